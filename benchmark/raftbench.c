@@ -0,0 +1,1003 @@
+/*
+ * Copyright Redis Ltd. 2023 - present
+ * Licensed under your choice of the Redis Source Available License 2.0 (RSALv2) or
+ * the Server Side Public License v1 (SSPLv1).
+ */
+
+/* raftbench
+ *
+ * Launches a local RedisRaft cluster on loopback and benchmarks it.
+ *
+ * Nodes run from a redis-server binary and the redisraft module, each in its
+ * own directory under a temporary working directory. Once the cluster is up,
+ * clients run in threads, each with its own connection. A client sends
+ * 'pipeline' operations at a time and waits for all their replies before
+ * sending the next ones. An operation is a GET or a SET of a random key, or a
+ * MULTI/EXEC transaction of 'multi' SETs.
+ *
+ * Results are printed as JSON, with latencies in microseconds, measured from
+ * sending an operation to receiving its last reply. With the same options and
+ * seed, clients send the same operations.
+ */
+
+#include "hiredis/hiredis.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef RAFTBENCH_MODULE
+#define RAFTBENCH_MODULE "redisraft.so"
+#endif
+
+#define MAX_NODES       9
+#define MAX_MODULE_ARGS 64
+
+/* Log-linear latency histogram, values within 1/HISTOGRAM_SUB_BUCKETS of
+ * the exact value. Same layout as LatencyHistogram, with more precision. */
+#define HISTOGRAM_SUB_BITS    6
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS     (HISTOGRAM_SUB_BUCKETS * (64 - HISTOGRAM_SUB_BITS + 1))
+
+typedef struct Histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+typedef enum Target {
+    TARGET_LEADER,
+    TARGET_FOLLOWERS,
+    TARGET_ALL
+} Target;
+
+static const char *targetStr[] = {"leader", "followers", "all"};
+
+typedef struct Options {
+    const char *name;
+    const char *redis;
+    const char *module;
+    const char *dir;
+    const char *output;
+    int nodes;
+    int port;
+    int clients;
+    int pipeline;
+    int duration;
+    long long requests;
+    int value_size;
+    int write_ratio;
+    int multi;
+    long long keys;
+    bool fsync;
+    bool quorum_reads;
+    bool follower_proxy;
+    Target target;
+    unsigned int seed;
+    bool keep;
+    const char *module_args[MAX_MODULE_ARGS];
+    int num_module_args;
+} Options;
+
+typedef struct Node {
+    int id;
+    int port;
+    pid_t pid;
+    char dir[PATH_MAX - 32];
+} Node;
+
+typedef struct Client {
+    pthread_t thread;
+    int index;
+    int port;
+    long long requests; /* Operations to send, 0 to run for 'duration' */
+    uint64_t seed;
+    uint64_t ops;
+    uint64_t errors;
+    char error[128]; /* First error reply */
+    Histogram reads;
+    Histogram writes;
+} Client;
+
+static Options opt = {
+    .name = "default",
+    .redis = "redis-server",
+    .module = RAFTBENCH_MODULE,
+    .nodes = 3,
+    .port = 25001,
+    .clients = 16,
+    .pipeline = 1,
+    .duration = 10,
+    .value_size = 64,
+    .write_ratio = 100,
+    .keys = 100000,
+    .fsync = true,
+    .target = TARGET_LEADER,
+    .seed = 1,
+};
+
+static Node nodes[MAX_NODES];
+static char workdir[PATH_MAX - 64];
+static uint64_t end_time;
+static char *value;
+
+static void panic(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+
+static void shutdownCluster(void);
+static void usage(void) __attribute__((noreturn));
+
+static void panic(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "raftbench: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+
+    shutdownCluster();
+    exit(1);
+}
+
+static uint64_t nowMicroseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/* ------------------------------------ Histogram ------------------------------------ */
+
+static int histogramBucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int) value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    int sub = (int) ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/* Largest value of a bucket */
+static uint64_t histogramBucketMax(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return (uint64_t) bucket;
+    }
+
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t) (bucket % HISTOGRAM_SUB_BUCKETS);
+
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+static void histogramAdd(Histogram *h, uint64_t value)
+{
+    if (h->count == 0 || value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+
+    h->buckets[histogramBucket(value)]++;
+    h->count++;
+    h->sum += value;
+}
+
+static void histogramMerge(Histogram *h, const Histogram *other)
+{
+    if (other->count == 0) {
+        return;
+    }
+
+    if (h->count == 0 || other->min < h->min) {
+        h->min = other->min;
+    }
+    if (other->max > h->max) {
+        h->max = other->max;
+    }
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        h->buckets[i] += other->buckets[i];
+    }
+    h->count += other->count;
+    h->sum += other->sum;
+}
+
+static uint64_t histogramPercentile(const Histogram *h, double percentile)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) ((percentile / 100.0) * (double) h->count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t max = histogramBucketMax(i);
+            return max < h->max ? max : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+/* ------------------------------------ Cluster ------------------------------------ */
+
+static redisContext *connectNode(int port, int timeout_ms)
+{
+    struct timeval tv = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+    redisContext *c = redisConnectWithTimeout("127.0.0.1", port, tv);
+
+    if (!c || c->err) {
+        if (c) {
+            redisFree(c);
+        }
+        return NULL;
+    }
+
+    return c;
+}
+
+static void startNode(Node *n)
+{
+    char port[16], addr[64], logfile[PATH_MAX];
+    const char *argv[32 + MAX_MODULE_ARGS];
+    int argc = 0;
+
+    snprintf(n->dir, sizeof(n->dir), "%s/node%d", workdir, n->id);
+    if (mkdir(n->dir, 0755) != 0 && errno != EEXIST) {
+        panic("failed to create %s: %s", n->dir, strerror(errno));
+    }
+
+    snprintf(port, sizeof(port), "%d", n->port);
+    snprintf(addr, sizeof(addr), "127.0.0.1:%d", n->port);
+    snprintf(logfile, sizeof(logfile), "%s/redis.log", n->dir);
+
+    argv[argc++] = opt.redis;
+    argv[argc++] = "--port";
+    argv[argc++] = port;
+    argv[argc++] = "--bind";
+    argv[argc++] = "127.0.0.1";
+    argv[argc++] = "--dir";
+    argv[argc++] = n->dir;
+    argv[argc++] = "--logfile";
+    argv[argc++] = logfile;
+    argv[argc++] = "--save";
+    argv[argc++] = "";
+    argv[argc++] = "--loadmodule";
+    argv[argc++] = opt.module;
+    argv[argc++] = "--raft.addr";
+    argv[argc++] = addr;
+    argv[argc++] = "--raft.log-fsync";
+    argv[argc++] = opt.fsync ? "yes" : "no";
+    argv[argc++] = "--raft.quorum-reads";
+    argv[argc++] = opt.quorum_reads ? "yes" : "no";
+    argv[argc++] = "--raft.follower-proxy";
+    argv[argc++] = opt.follower_proxy ? "yes" : "no";
+    for (int i = 0; i < opt.num_module_args; i++) {
+        argv[argc++] = opt.module_args[i];
+    }
+    argv[argc] = NULL;
+
+    n->pid = fork();
+    if (n->pid < 0) {
+        panic("fork failed: %s", strerror(errno));
+    }
+
+    if (n->pid == 0) {
+        int fd = open(logfile, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+
+        execvp(opt.redis, (char *const *) argv);
+        fprintf(stderr, "exec %s failed: %s\n", opt.redis, strerror(errno));
+        _exit(1);
+    }
+
+    /* Wait for the node to accept connections */
+    for (int i = 0; i < 100; i++) {
+        redisContext *c = connectNode(n->port, 100);
+        if (c) {
+            redisFree(c);
+            return;
+        }
+
+        if (waitpid(n->pid, NULL, WNOHANG) == n->pid) {
+            n->pid = 0;
+            panic("node %d exited, see %s", n->id, logfile);
+        }
+        usleep(100 * 1000);
+    }
+
+    panic("node %d is not accepting connections, see %s", n->id, logfile);
+}
+
+static redisReply *nodeCommand(Node *n, const char *fmt, ...)
+{
+    va_list ap;
+    redisContext *c = connectNode(n->port, 1000);
+
+    if (!c) {
+        return NULL;
+    }
+
+    va_start(ap, fmt);
+    redisReply *reply = redisvCommand(c, fmt, ap);
+    va_end(ap);
+
+    redisFree(c);
+    return reply;
+}
+
+/* Returns the value of an INFO raft field, in 'buf' */
+static const char *infoField(Node *n, const char *field, char *buf, size_t size)
+{
+    char key[64];
+    redisReply *reply = nodeCommand(n, "INFO raft");
+
+    buf[0] = '\0';
+    if (!reply || reply->type != REDIS_REPLY_STRING) {
+        goto exit;
+    }
+
+    snprintf(key, sizeof(key), "\r\n%s:", field);
+    const char *pos = strstr(reply->str, key);
+    if (!pos) {
+        goto exit;
+    }
+
+    pos += strlen(key);
+    size_t len = strcspn(pos, "\r\n");
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(buf, pos, len);
+    buf[len] = '\0';
+
+exit:
+    if (reply) {
+        freeReplyObject(reply);
+    }
+    return buf;
+}
+
+static bool nodeReady(Node *n)
+{
+    char buf[64];
+
+    return !strcmp(infoField(n, "raft_state", buf, sizeof(buf)), "up") &&
+           atoi(infoField(n, "raft_num_voting_nodes", buf, sizeof(buf))) == opt.nodes;
+}
+
+static Node *findLeader(void)
+{
+    char buf[64];
+
+    for (int i = 0; i < opt.nodes; i++) {
+        if (!strcmp(infoField(&nodes[i], "raft_role", buf, sizeof(buf)), "leader")) {
+            return &nodes[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void checkReply(redisReply *reply, const char *what)
+{
+    if (!reply) {
+        panic("%s: no reply", what);
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+        panic("%s: %s", what, reply->str);
+    }
+    freeReplyObject(reply);
+}
+
+static Node *startCluster(void)
+{
+    char tmpl[] = "/tmp/raftbench.XXXXXX";
+
+    if (opt.dir) {
+        if (strlen(opt.dir) >= sizeof(workdir)) {
+            panic("working directory path is too long");
+        }
+        snprintf(workdir, sizeof(workdir), "%s", opt.dir);
+        if (mkdir(workdir, 0755) != 0 && errno != EEXIST) {
+            panic("failed to create %s: %s", workdir, strerror(errno));
+        }
+    } else {
+        if (!mkdtemp(tmpl)) {
+            panic("failed to create a working directory: %s", strerror(errno));
+        }
+        snprintf(workdir, sizeof(workdir), "%s", tmpl);
+    }
+
+    for (int i = 0; i < opt.nodes; i++) {
+        nodes[i].id = i + 1;
+        nodes[i].port = opt.port + i;
+        startNode(&nodes[i]);
+    }
+
+    checkReply(nodeCommand(&nodes[0], "RAFT.CLUSTER INIT"), "RAFT.CLUSTER INIT");
+    for (int i = 1; i < opt.nodes; i++) {
+        checkReply(nodeCommand(&nodes[i], "RAFT.CLUSTER JOIN 127.0.0.1:%d", nodes[0].port),
+                   "RAFT.CLUSTER JOIN");
+    }
+
+    /* Wait for all nodes to be up, and for the leader to accept writes */
+    for (int i = 0; i < 300; i++) {
+        bool ready = true;
+
+        for (int j = 0; j < opt.nodes && ready; j++) {
+            ready = nodeReady(&nodes[j]);
+        }
+
+        Node *leader = ready ? findLeader() : NULL;
+        if (leader) {
+            redisReply *reply = nodeCommand(leader, "SET raftbench:ready 1");
+            bool ok = reply && reply->type == REDIS_REPLY_STATUS;
+
+            if (reply) {
+                freeReplyObject(reply);
+            }
+            if (ok) {
+                return leader;
+            }
+        }
+
+        usleep(100 * 1000);
+    }
+
+    panic("cluster did not come up, see logs in %s", workdir);
+}
+
+static void removeDir(const char *dir)
+{
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        execlp("rm", "rm", "-rf", dir, (char *) NULL);
+        _exit(1);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+}
+
+static void shutdownCluster(void)
+{
+    for (int i = 0; i < opt.nodes; i++) {
+        if (nodes[i].pid > 0) {
+            kill(nodes[i].pid, SIGKILL);
+            waitpid(nodes[i].pid, NULL, 0);
+            nodes[i].pid = 0;
+        }
+    }
+
+    if (workdir[0] && !opt.keep) {
+        removeDir(workdir);
+        workdir[0] = '\0';
+    }
+}
+
+/* ------------------------------------ Clients ------------------------------------ */
+
+static uint64_t nextRandom(uint64_t *state)
+{
+    /* xorshift64* */
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+typedef struct Op {
+    bool write;
+    int replies;
+} Op;
+
+/* Append an operation to the pipeline, returns it */
+static Op appendOp(Client *cl, redisContext *c)
+{
+    Op op = {.write = (int) (nextRandom(&cl->seed) % 100) < opt.write_ratio, .replies = 1};
+    char key[32];
+    size_t keylen = (size_t) snprintf(key, sizeof(key), "key:%llu",
+                                      (unsigned long long) (nextRandom(&cl->seed) % (uint64_t) opt.keys));
+
+    if (!op.write) {
+        const char *argv[] = {"GET", key};
+        size_t argvlen[] = {3, keylen};
+
+        redisAppendCommandArgv(c, 2, argv, argvlen);
+        return op;
+    }
+
+    const char *argv[] = {"SET", key, value};
+    size_t argvlen[] = {3, keylen, (size_t) opt.value_size};
+
+    if (opt.multi == 0) {
+        redisAppendCommandArgv(c, 3, argv, argvlen);
+        return op;
+    }
+
+    redisAppendCommand(c, "MULTI");
+    for (int i = 0; i < opt.multi; i++) {
+        argvlen[1] = (size_t) snprintf(key, sizeof(key), "key:%llu",
+                                       (unsigned long long) (nextRandom(&cl->seed) % (uint64_t) opt.keys));
+        redisAppendCommandArgv(c, 3, argv, argvlen);
+    }
+    redisAppendCommand(c, "EXEC");
+    op.replies = opt.multi + 2;
+
+    return op;
+}
+
+static void recordError(Client *cl, const char *err)
+{
+    if (cl->errors++ == 0) {
+        snprintf(cl->error, sizeof(cl->error), "%s", err);
+    }
+}
+
+static void *clientMain(void *arg)
+{
+    Client *cl = arg;
+    Op *ops = calloc((size_t) opt.pipeline, sizeof(Op));
+    redisContext *c = connectNode(cl->port, 5000);
+
+    if (!c) {
+        recordError(cl, "failed to connect");
+        free(ops);
+        return NULL;
+    }
+
+    while (cl->requests ? cl->ops < (uint64_t) cl->requests : nowMicroseconds() < end_time) {
+        int n = opt.pipeline;
+        if (cl->requests && (uint64_t) n > cl->requests - cl->ops) {
+            n = (int) (cl->requests - cl->ops);
+        }
+
+        for (int i = 0; i < n; i++) {
+            ops[i] = appendOp(cl, c);
+        }
+
+        uint64_t begin = nowMicroseconds();
+
+        for (int i = 0; i < n; i++) {
+            bool failed = false;
+
+            for (int j = 0; j < ops[i].replies; j++) {
+                redisReply *reply;
+
+                if (redisGetReply(c, (void **) &reply) != REDIS_OK) {
+                    recordError(cl, c->errstr);
+                    goto exit;
+                }
+
+                /* A failed EXEC replies with an error or a null */
+                bool last = j == ops[i].replies - 1;
+                if (reply->type == REDIS_REPLY_ERROR) {
+                    if (!failed) {
+                        recordError(cl, reply->str);
+                    }
+                    failed = true;
+                } else if (last && ops[i].replies > 1 && reply->type != REDIS_REPLY_ARRAY && !failed) {
+                    recordError(cl, "EXEC aborted");
+                    failed = true;
+                }
+                freeReplyObject(reply);
+            }
+
+            uint64_t took = nowMicroseconds() - begin;
+            histogramAdd(ops[i].write ? &cl->writes : &cl->reads, took);
+            cl->ops++;
+        }
+    }
+
+exit:
+    redisFree(c);
+    free(ops);
+    return NULL;
+}
+
+/* Port of the node a client connects to */
+static int clientPort(int index, Node *leader)
+{
+    if (opt.target == TARGET_LEADER || opt.nodes == 1) {
+        return leader->port;
+    }
+
+    int count = 0;
+    Node *candidates[MAX_NODES];
+
+    for (int i = 0; i < opt.nodes; i++) {
+        if (opt.target == TARGET_ALL || &nodes[i] != leader) {
+            candidates[count++] = &nodes[i];
+        }
+    }
+
+    return candidates[index % count]->port;
+}
+
+/* ------------------------------------ Report ------------------------------------ */
+
+static void printLatency(FILE *out, const char *name, const Histogram *h, bool last)
+{
+    fprintf(out,
+            "      \"%s\": {\"count\": %llu, \"avg\": %llu, \"min\": %llu, \"p50\": %llu, "
+            "\"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}%s\n",
+            name,
+            (unsigned long long) h->count,
+            (unsigned long long) (h->count ? h->sum / h->count : 0),
+            (unsigned long long) h->min,
+            (unsigned long long) histogramPercentile(h, 50),
+            (unsigned long long) histogramPercentile(h, 90),
+            (unsigned long long) histogramPercentile(h, 99),
+            (unsigned long long) histogramPercentile(h, 99.9),
+            (unsigned long long) h->max,
+            last ? "" : ",");
+}
+
+/* Print 's' as a JSON string */
+static void printString(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(out, "\\%c", *s);
+        } else if ((unsigned char) *s < 0x20) {
+            fprintf(out, "\\u%04x", *s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void printReport(FILE *out, Client *clients, uint64_t elapsed, const char *git_sha1)
+{
+    static Histogram all, reads, writes;
+    uint64_t ops = 0, errors = 0;
+    const char *error = "";
+
+    for (int i = 0; i < opt.clients; i++) {
+        histogramMerge(&reads, &clients[i].reads);
+        histogramMerge(&writes, &clients[i].writes);
+        ops += clients[i].ops;
+        errors += clients[i].errors;
+        if (!error[0] && clients[i].errors) {
+            error = clients[i].error;
+        }
+    }
+    histogramMerge(&all, &reads);
+    histogramMerge(&all, &writes);
+
+    double seconds = (double) elapsed / 1e6;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"name\": ");
+    printString(out, opt.name);
+    fprintf(out, ",\n  \"git_sha1\": ");
+    printString(out, git_sha1);
+    fprintf(out, ",\n");
+    fprintf(out, "  \"config\": {\n");
+    fprintf(out, "    \"nodes\": %d,\n", opt.nodes);
+    fprintf(out, "    \"clients\": %d,\n", opt.clients);
+    fprintf(out, "    \"pipeline\": %d,\n", opt.pipeline);
+    fprintf(out, "    \"duration\": %d,\n", opt.requests ? 0 : opt.duration);
+    fprintf(out, "    \"requests\": %lld,\n", opt.requests);
+    fprintf(out, "    \"value_size\": %d,\n", opt.value_size);
+    fprintf(out, "    \"write_ratio\": %d,\n", opt.write_ratio);
+    fprintf(out, "    \"multi\": %d,\n", opt.multi);
+    fprintf(out, "    \"keys\": %lld,\n", opt.keys);
+    fprintf(out, "    \"fsync\": %s,\n", opt.fsync ? "true" : "false");
+    fprintf(out, "    \"quorum_reads\": %s,\n", opt.quorum_reads ? "true" : "false");
+    fprintf(out, "    \"follower_proxy\": %s,\n", opt.follower_proxy ? "true" : "false");
+    fprintf(out, "    \"target\": \"%s\",\n", targetStr[opt.target]);
+    fprintf(out, "    \"seed\": %u,\n", opt.seed);
+    fprintf(out, "    \"module_args\": [");
+    for (int i = 0; i < opt.num_module_args; i++) {
+        fprintf(out, "%s", i ? ", " : "");
+        printString(out, opt.module_args[i]);
+    }
+    fprintf(out, "]\n");
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"results\": {\n");
+    fprintf(out, "    \"ops\": %llu,\n", (unsigned long long) ops);
+    fprintf(out, "    \"errors\": %llu,\n", (unsigned long long) errors);
+    fprintf(out, "    \"first_error\": ");
+    printString(out, error);
+    fprintf(out, ",\n");
+    fprintf(out, "    \"seconds\": %.3f,\n", seconds);
+    fprintf(out, "    \"ops_per_sec\": %.1f,\n", seconds > 0 ? (double) ops / seconds : 0);
+    fprintf(out, "    \"latency_usec\": {\n");
+    printLatency(out, "all", &all, false);
+    printLatency(out, "read", &reads, false);
+    printLatency(out, "write", &writes, true);
+    fprintf(out, "    }\n");
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+}
+
+/* ------------------------------------ Main ------------------------------------ */
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: raftbench [options]\n"
+            "\n"
+            "Cluster:\n"
+            "  --redis <path>            redis-server executable (default: redis-server)\n"
+            "  --module <path>           redisraft module (default: %s)\n"
+            "  --nodes <n>               Number of nodes, up to %d (default: 3)\n"
+            "  --port <port>             Port of the first node (default: 25001)\n"
+            "  --dir <path>              Working directory (default: a new /tmp directory)\n"
+            "  --keep                    Keep the working directory\n"
+            "  --fsync <yes|no>          raft.log-fsync (default: yes)\n"
+            "  --quorum-reads <yes|no>   raft.quorum-reads (default: no)\n"
+            "  --follower-proxy <yes|no> raft.follower-proxy (default: no)\n"
+            "  --module-arg <arg>        Additional module argument, repeatable,\n"
+            "                            e.g. --module-arg --raft.write-batch-max-count --module-arg 1\n"
+            "\n"
+            "Workload:\n"
+            "  --clients <n>             Connections, each in its own thread (default: 16)\n"
+            "  --pipeline <n>            Operations in flight per connection (default: 1)\n"
+            "  --duration <seconds>      Run time (default: 10)\n"
+            "  --requests <n>            Operations to send instead of running for --duration\n"
+            "  --value-size <bytes>      Size of SET values (default: 64)\n"
+            "  --write-ratio <percent>   Percentage of writes, the rest are GETs (default: 100)\n"
+            "  --multi <n>               Send writes as MULTI/EXEC of n SETs (default: 0, disabled)\n"
+            "  --keys <n>                Key space size (default: 100000)\n"
+            "  --target <t>              Nodes clients connect to: leader, followers or all\n"
+            "                            (default: leader)\n"
+            "  --seed <n>                Random seed (default: 1)\n"
+            "\n"
+            "Output:\n"
+            "  --name <name>             Name of the run, included in the report\n"
+            "  --output <path>           Write the JSON report to a file instead of stdout\n",
+            RAFTBENCH_MODULE, MAX_NODES);
+    exit(2);
+}
+
+static bool parseBool(const char *s)
+{
+    if (!strcmp(s, "yes")) {
+        return true;
+    }
+    if (!strcmp(s, "no")) {
+        return false;
+    }
+
+    fprintf(stderr, "raftbench: expected yes or no, got '%s'\n", s);
+    usage();
+}
+
+static long long parseNumber(const char *s, long long min, long long max)
+{
+    char *end;
+    long long n = strtoll(s, &end, 10);
+
+    if (*s == '\0' || *end != '\0' || n < min || n > max) {
+        fprintf(stderr, "raftbench: invalid number '%s', expected %lld to %lld\n", s, min, max);
+        usage();
+    }
+
+    return n;
+}
+
+static void parseOptions(int argc, char **argv)
+{
+    enum {
+        OPT_REDIS = 1000,
+        OPT_MODULE,
+        OPT_NODES,
+        OPT_PORT,
+        OPT_DIR,
+        OPT_KEEP,
+        OPT_FSYNC,
+        OPT_QUORUM_READS,
+        OPT_FOLLOWER_PROXY,
+        OPT_MODULE_ARG,
+        OPT_CLIENTS,
+        OPT_PIPELINE,
+        OPT_DURATION,
+        OPT_REQUESTS,
+        OPT_VALUE_SIZE,
+        OPT_WRITE_RATIO,
+        OPT_MULTI,
+        OPT_KEYS,
+        OPT_TARGET,
+        OPT_SEED,
+        OPT_NAME,
+        OPT_OUTPUT,
+        OPT_HELP,
+    };
+
+    static const struct option options[] = {
+        {"redis", required_argument, NULL, OPT_REDIS},
+        {"module", required_argument, NULL, OPT_MODULE},
+        {"nodes", required_argument, NULL, OPT_NODES},
+        {"port", required_argument, NULL, OPT_PORT},
+        {"dir", required_argument, NULL, OPT_DIR},
+        {"keep", no_argument, NULL, OPT_KEEP},
+        {"fsync", required_argument, NULL, OPT_FSYNC},
+        {"quorum-reads", required_argument, NULL, OPT_QUORUM_READS},
+        {"follower-proxy", required_argument, NULL, OPT_FOLLOWER_PROXY},
+        {"module-arg", required_argument, NULL, OPT_MODULE_ARG},
+        {"clients", required_argument, NULL, OPT_CLIENTS},
+        {"pipeline", required_argument, NULL, OPT_PIPELINE},
+        {"duration", required_argument, NULL, OPT_DURATION},
+        {"requests", required_argument, NULL, OPT_REQUESTS},
+        {"value-size", required_argument, NULL, OPT_VALUE_SIZE},
+        {"write-ratio", required_argument, NULL, OPT_WRITE_RATIO},
+        {"multi", required_argument, NULL, OPT_MULTI},
+        {"keys", required_argument, NULL, OPT_KEYS},
+        {"target", required_argument, NULL, OPT_TARGET},
+        {"seed", required_argument, NULL, OPT_SEED},
+        {"name", required_argument, NULL, OPT_NAME},
+        {"output", required_argument, NULL, OPT_OUTPUT},
+        {"help", no_argument, NULL, OPT_HELP},
+        {NULL, 0, NULL, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (c) {
+            case OPT_REDIS: opt.redis = optarg; break;
+            case OPT_MODULE: opt.module = optarg; break;
+            case OPT_NODES: opt.nodes = (int) parseNumber(optarg, 1, MAX_NODES); break;
+            case OPT_PORT: opt.port = (int) parseNumber(optarg, 1, 65535 - MAX_NODES); break;
+            case OPT_DIR: opt.dir = optarg; break;
+            case OPT_KEEP: opt.keep = true; break;
+            case OPT_FSYNC: opt.fsync = parseBool(optarg); break;
+            case OPT_QUORUM_READS: opt.quorum_reads = parseBool(optarg); break;
+            case OPT_FOLLOWER_PROXY: opt.follower_proxy = parseBool(optarg); break;
+            case OPT_MODULE_ARG:
+                if (opt.num_module_args == MAX_MODULE_ARGS) {
+                    fprintf(stderr, "raftbench: too many module arguments\n");
+                    usage();
+                }
+                opt.module_args[opt.num_module_args++] = optarg;
+                break;
+            case OPT_CLIENTS: opt.clients = (int) parseNumber(optarg, 1, 10000); break;
+            case OPT_PIPELINE: opt.pipeline = (int) parseNumber(optarg, 1, 10000); break;
+            case OPT_DURATION: opt.duration = (int) parseNumber(optarg, 1, 86400); break;
+            case OPT_REQUESTS: opt.requests = parseNumber(optarg, 1, LLONG_MAX); break;
+            case OPT_VALUE_SIZE: opt.value_size = (int) parseNumber(optarg, 0, 512 * 1024 * 1024); break;
+            case OPT_WRITE_RATIO: opt.write_ratio = (int) parseNumber(optarg, 0, 100); break;
+            case OPT_MULTI: opt.multi = (int) parseNumber(optarg, 0, 10000); break;
+            case OPT_KEYS: opt.keys = parseNumber(optarg, 1, LLONG_MAX); break;
+            case OPT_TARGET:
+                if (!strcmp(optarg, "leader")) {
+                    opt.target = TARGET_LEADER;
+                } else if (!strcmp(optarg, "followers")) {
+                    opt.target = TARGET_FOLLOWERS;
+                } else if (!strcmp(optarg, "all")) {
+                    opt.target = TARGET_ALL;
+                } else {
+                    fprintf(stderr, "raftbench: invalid target '%s'\n", optarg);
+                    usage();
+                }
+                break;
+            case OPT_SEED: opt.seed = (unsigned int) parseNumber(optarg, 0, UINT32_MAX); break;
+            case OPT_NAME: opt.name = optarg; break;
+            case OPT_OUTPUT: opt.output = optarg; break;
+            default: usage();
+        }
+    }
+
+    if (optind != argc) {
+        usage();
+    }
+}
+
+static void handleSignal(int sig)
+{
+    (void) sig;
+    shutdownCluster();
+    _exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    parseOptions(argc, argv);
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    value = malloc((size_t) opt.value_size + 1);
+    memset(value, 'x', (size_t) opt.value_size);
+    value[opt.value_size] = '\0';
+
+    Node *leader = startCluster();
+    fprintf(stderr, "raftbench: %d node cluster up in %s, leader is node %d\n",
+            opt.nodes, workdir, leader->id);
+
+    char git_sha1[64];
+    infoField(leader, "raft_git_sha1", git_sha1, sizeof(git_sha1));
+
+    Client *clients = calloc((size_t) opt.clients, sizeof(Client));
+    uint64_t begin = nowMicroseconds();
+    end_time = begin + (uint64_t) opt.duration * 1000000;
+
+    for (int i = 0; i < opt.clients; i++) {
+        Client *cl = &clients[i];
+
+        cl->index = i;
+        cl->port = clientPort(i, leader);
+        cl->seed = ((uint64_t) opt.seed << 32) + (uint64_t) i + 1;
+        if (opt.requests) {
+            cl->requests = opt.requests / opt.clients + (i < opt.requests % opt.clients);
+            if (cl->requests == 0) {
+                continue;
+            }
+        }
+
+        if (pthread_create(&cl->thread, NULL, clientMain, cl) != 0) {
+            panic("failed to create a client thread");
+        }
+    }
+
+    for (int i = 0; i < opt.clients; i++) {
+        if (!opt.requests || clients[i].requests) {
+            pthread_join(clients[i].thread, NULL);
+        }
+    }
+
+    uint64_t elapsed = nowMicroseconds() - begin;
+
+    FILE *out = stdout;
+    if (opt.output) {
+        out = fopen(opt.output, "w");
+        if (!out) {
+            panic("failed to open %s: %s", opt.output, strerror(errno));
+        }
+    }
+
+    printReport(out, clients, elapsed, git_sha1);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    shutdownCluster();
+    free(clients);
+    free(value);
+
+    return 0;
+}
@@ -655,6 +655,32 @@ typedef raft_time_t (
     void *user_data
     );
 
+/** Callback for being notified of a batch of entries about to be applied.
+ *
+ * Implementing this callback is optional
+ *
+ * Called when raft_apply_all() is about to apply all committed entries in the
+ * range [first_idx, last_idx]. applylog is still called for each entry, in
+ * order. The application may use this to set up state that can be shared
+ * by all the entries of the batch, e.g. to amortize per-entry lookups.
+ *
+ * The batch may end early, e.g. if the server runs out of its execution
+ * deadline. In that case, remaining entries will be part of the next batch.
+ *
+ * @param[in] raft The Raft server making this callback
+ * @param[in] user_data User data that is passed from Raft server
+ * @param[in] first_idx Index of the first entry to be applied
+ * @param[in] last_idx Index of the last entry to be applied
+ */
+typedef void (
+*raft_apply_batch_f
+)   (
+    raft_server_t *raft,
+    void *user_data,
+    raft_index_t first_idx,
+    raft_index_t last_idx
+    );
+
 typedef struct
 {
     /** Callback for sending request vote messages */
@@ -724,6 +750,10 @@ typedef struct
      * a raft_appendentries_req. */
     raft_get_entries_to_send_f get_entries_to_send;
 
+    /** (optional) Callback for being notified of a batch of committed entries
+     * before they are applied. */
+    raft_apply_batch_f notify_apply_batch;
+
 } raft_cbs_t;
 
 /** A callback used to notify when queued read requests can be processed.
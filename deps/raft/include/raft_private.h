@@ -243,6 +243,16 @@ int raft_apply_all(raft_server_t* me);
  * @param[in] commit_idx The new commit index. */
 void raft_set_commit_idx(raft_server_t *me, raft_index_t commit_idx);
 
+/** Select the highest value acknowledged by a majority.
+ * Returns the value at position num / 2 as if the array was sorted in
+ * descending order. The array is partially reordered in place.
+ * @param[in] indexes Match index of each voter
+ * @param[in] num Number of voters */
+raft_index_t raft_quorum_index(raft_index_t *indexes, int num);
+
+/** Same as raft_quorum_index() but for acknowledged msg_ids. */
+raft_msg_id_t raft_quorum_msg_id(raft_msg_id_t *msg_ids, int num);
+
 /** Vote for a server.
  * This should be used to reload persistent state, ie. the voted-for field.
  * @param[in] node The server to vote for
@@ -573,14 +573,6 @@ void raft_become_follower(raft_server_t* me)
     raft_log(me, "become follower, term:%ld", me->current_term);
 }
 
-static int msgid_cmp(const void *a, const void *b)
-{
-    raft_msg_id_t va = *((raft_msg_id_t*) a);
-    raft_msg_id_t vb = *((raft_msg_id_t*) b);
-
-    return va > vb ? -1 : 1;
-}
-
 static raft_msg_id_t quorum_msg_id(raft_server_t* me)
 {
     raft_msg_id_t msg_ids[me->num_nodes];
@@ -602,13 +594,11 @@ static raft_msg_id_t quorum_msg_id(raft_server_t* me)
     assert(num_voters == raft_get_num_voting_nodes(me));
 
     /**
-     *  Sort the acknowledged msg_ids in the descending order and return
-     *  the median value. Median value means it's the highest msg_id
-     *  acknowledged by the majority.
+     *  Return the median of the acknowledged msg_ids in descending order.
+     *  Median value means it's the highest msg_id acknowledged by the
+     *  majority.
      */
-    qsort(msg_ids, num_voters, sizeof(raft_msg_id_t), msgid_cmp);
-
-    return msg_ids[num_voters / 2];
+    return raft_quorum_msg_id(msg_ids, num_voters);
 }
 
 static raft_time_t raft_time_millis(raft_server_t *me)
@@ -1668,6 +1658,11 @@ int raft_apply_all(raft_server_t *me)
         return 0;
     }
 
+    if (me->cb.notify_apply_batch && me->commit_idx > me->last_applied_idx) {
+        me->cb.notify_apply_batch(me, me->udata, me->last_applied_idx + 1,
+                                  me->commit_idx);
+    }
+
     while (me->commit_idx > me->last_applied_idx) {
         if (raft_time_millis(me) > me->exec_deadline) {
             me->pending_operations = 1;
@@ -2121,12 +2116,47 @@ void raft_reset_transfer_leader(raft_server_t* me, int timed_out)
     me->sent_timeout_now = 0;
 }
 
-static int index_cmp(const void *a, const void *b)
-{
-    raft_index_t va = *((raft_index_t*) a);
-    raft_index_t vb = *((raft_index_t*) b);
-
-    return va > vb ? -1 : 1;
+/* Hoare style selection (nth_element) of the value at position n / 2 when
+ * the array is ordered in descending order, i.e. the highest value that is
+ * held by a majority. Runs in O(n) on average and reorders the array.
+ * Callers gather one value per voter, so there is no need to sort them all
+ * just to pick the median. */
+#define QUORUM_SELECT(type, vals, n)                        \
+    do {                                                    \
+        int k_ = (n) / 2, lo_ = 0, hi_ = (n) - 1;           \
+        while (lo_ < hi_) {                                 \
+            type pivot_ = (vals)[lo_ + (hi_ - lo_) / 2];    \
+            int i_ = lo_, j_ = hi_;                         \
+            while (i_ <= j_) {                              \
+                while ((vals)[i_] > pivot_) i_++;           \
+                while ((vals)[j_] < pivot_) j_--;           \
+                if (i_ <= j_) {                             \
+                    type tmp_ = (vals)[i_];                 \
+                    (vals)[i_++] = (vals)[j_];              \
+                    (vals)[j_--] = tmp_;                    \
+                }                                           \
+            }                                               \
+            if (k_ <= j_)                                   \
+                hi_ = j_;                                   \
+            else if (k_ >= i_)                              \
+                lo_ = i_;                                   \
+            else                                            \
+                break;                                      \
+        }                                                   \
+    } while (0)
+
+raft_index_t raft_quorum_index(raft_index_t *indexes, int num)
+{
+    assert(num > 0);
+    QUORUM_SELECT(raft_index_t, indexes, num);
+    return indexes[num / 2];
+}
+
+raft_msg_id_t raft_quorum_msg_id(raft_msg_id_t *msg_ids, int num)
+{
+    assert(num > 0);
+    QUORUM_SELECT(raft_msg_id_t, msg_ids, num);
+    return msg_ids[num / 2];
 }
 
 static void raft_update_commit_idx(raft_server_t* me)
@@ -2134,8 +2164,6 @@ static void raft_update_commit_idx(raft_server_t* me)
     raft_index_t indexes[me->num_nodes];
     int num_voters = 0;
 
-    memset(indexes, 0, sizeof(indexes));
-
     for (int i = 0; i < me->num_nodes; i++) {
         if (!raft_node_is_voting(me->nodes[i]))
             continue;
@@ -2143,8 +2171,7 @@ static void raft_update_commit_idx(raft_server_t* me)
         indexes[num_voters++] = raft_node_get_match_idx(me->nodes[i]);
     }
 
-    qsort(indexes, num_voters, sizeof(raft_index_t), index_cmp);
-    raft_index_t commit = indexes[num_voters / 2];
+    raft_index_t commit = raft_quorum_index(indexes, num_voters);
     if (commit > me->commit_idx) {
         /* Leader can only commit entries from the current term */
         raft_entry_t *ety = raft_get_entry_from_idx(me, commit);
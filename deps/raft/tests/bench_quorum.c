@@ -0,0 +1,81 @@
+/* Microbenchmark for the commit index / quorum msg_id selection.
+ *
+ * Compares the previous qsort based median against raft_quorum_index() for
+ * typical voter counts. Not part of the test suite, run manually:
+ *
+ *      ./bench_quorum [iterations]
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "raft.h"
+#include "raft_private.h"
+
+#define MAX_VOTERS 9
+#define NUM_SAMPLES 1024
+
+static int index_cmp(const void *a, const void *b)
+{
+    raft_index_t va = *((raft_index_t*) a);
+    raft_index_t vb = *((raft_index_t*) b);
+
+    return va > vb ? -1 : 1;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    static const int voters[] = {3, 5, 7, 9};
+    static raft_index_t samples[NUM_SAMPLES][MAX_VOTERS];
+    long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+    raft_index_t buf[MAX_VOTERS];
+    raft_index_t sink = 0;
+
+    srand(1);
+
+    /* Match indexes of a healthy cluster are close to each other, with the
+     * leader usually ahead. */
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        for (int j = 0; j < MAX_VOTERS; j++) {
+            samples[i][j] = 1000000 + rand() % 64;
+        }
+    }
+
+    printf("%-8s %14s %14s %8s\n", "voters", "qsort ns/op", "select ns/op", "speedup");
+
+    for (size_t v = 0; v < sizeof(voters) / sizeof(voters[0]); v++) {
+        int n = voters[v];
+        size_t sz = n * sizeof(raft_index_t);
+
+        double start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            memcpy(buf, samples[i % NUM_SAMPLES], sz);
+            qsort(buf, n, sizeof(raft_index_t), index_cmp);
+            sink += buf[n / 2];
+        }
+        double sorted = (now_ns() - start) / (double) iterations;
+
+        start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            memcpy(buf, samples[i % NUM_SAMPLES], sz);
+            sink += raft_quorum_index(buf, n);
+        }
+        double selected = (now_ns() - start) / (double) iterations;
+
+        printf("%-8d %14.1f %14.1f %7.2fx\n", n, sorted, selected, sorted / selected);
+    }
+
+    /* Keep the compiler from dropping the loops */
+    return sink == 42 ? 1 : 0;
+}
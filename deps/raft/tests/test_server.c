@@ -4918,6 +4918,58 @@ void TestRaft_apply_entry_timeout(CuTest *tc)
     CuAssertIntEquals(tc, 21, raft_get_last_applied_idx(r));
 }
 
+struct apply_batch_data {
+    int calls;
+    raft_index_t first;
+    raft_index_t last;
+};
+
+static void cb_apply_batch(raft_server_t *raft, void *udata,
+                           raft_index_t first_idx, raft_index_t last_idx)
+{
+    struct apply_batch_data *data = udata;
+
+    data->calls++;
+    data->first = first_idx;
+    data->last = last_idx;
+}
+
+void TestRaft_apply_all_notifies_batch(CuTest *tc)
+{
+    struct apply_batch_data data = {0};
+
+    raft_cbs_t funcs = {
+        .notify_apply_batch = cb_apply_batch
+    };
+
+    void *r = raft_new();
+    raft_add_node(r, NULL, 1, 1);
+    raft_set_callbacks(r, &funcs, &data);
+    raft_set_current_term(r, 1);
+
+    __RAFT_APPEND_ENTRIES_SEQ_ID(r, 5, 0, 1, "");
+    raft_set_commit_idx(r, 5);
+
+    raft_apply_all(r);
+    CuAssertIntEquals(tc, 1, data.calls);
+    CuAssertIntEquals(tc, 1, data.first);
+    CuAssertIntEquals(tc, 5, data.last);
+    CuAssertIntEquals(tc, 5, raft_get_last_applied_idx(r));
+
+    /* Nothing to apply, no notification */
+    raft_apply_all(r);
+    CuAssertIntEquals(tc, 1, data.calls);
+
+    __RAFT_APPEND_ENTRIES_SEQ_ID(r, 3, 5, 1, "");
+    raft_set_commit_idx(r, 8);
+
+    raft_apply_all(r);
+    CuAssertIntEquals(tc, 2, data.calls);
+    CuAssertIntEquals(tc, 6, data.first);
+    CuAssertIntEquals(tc, 8, data.last);
+    CuAssertIntEquals(tc, 8, raft_get_last_applied_idx(r));
+}
+
 void read_request(void *arg, int can_read)
 {
     int *count = arg;
@@ -5152,6 +5204,36 @@ void TestRaft_propagate_persist_metadata_failure(CuTest *tc)
     CuAssertIntEquals(tc, e, -1);
 }
 
+static int quorum_index_cmp(const void *a, const void *b)
+{
+    raft_index_t va = *((raft_index_t*) a);
+    raft_index_t vb = *((raft_index_t*) b);
+
+    return va > vb ? -1 : (va < vb ? 1 : 0);
+}
+
+void TestRaft_quorum_index_matches_sorted_median(CuTest *tc)
+{
+    raft_index_t vals[9], sorted[9];
+    raft_msg_id_t ids[9];
+
+    srand(1);
+
+    for (int n = 1; n <= 9; n++) {
+        for (int round = 0; round < 1000; round++) {
+            for (int i = 0; i < n; i++) {
+                /* Small range so duplicates are common */
+                vals[i] = sorted[i] = rand() % 8;
+                ids[i] = (raft_msg_id_t) vals[i];
+            }
+
+            qsort(sorted, n, sizeof(raft_index_t), quorum_index_cmp);
+            CuAssertIntEquals(tc, sorted[n / 2], raft_quorum_index(vals, n));
+            CuAssertIntEquals(tc, sorted[n / 2], raft_quorum_msg_id(ids, n));
+        }
+    }
+}
+
 int main(void)
 {
     CuString *output = CuStringNew();
@@ -5306,10 +5388,12 @@ int main(void)
     SUITE_ADD_TEST(suite, TestRaft_recv_appendentries_does_not_change_next_idx);
     SUITE_ADD_TEST(suite, TestRaft_apply_entry_timeout);
     SUITE_ADD_TEST(suite, TestRaft_apply_read_request_timeout);
+    SUITE_ADD_TEST(suite, TestRaft_apply_all_notifies_batch);
     SUITE_ADD_TEST(suite, TestRaft_test_metadata_on_restart);
     SUITE_ADD_TEST(suite, TestRaft_rebuild_config_after_restart);
     SUITE_ADD_TEST(suite, TestRaft_delete_configuration_change_entries);
     SUITE_ADD_TEST(suite, TestRaft_propagate_persist_metadata_failure);
+    SUITE_ADD_TEST(suite, TestRaft_quorum_index_matches_sorted_median);
     CuSuiteRun(suite);
     CuSuiteDetails(suite, output);
     printf("%s\n", output->buffer);
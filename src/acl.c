@@ -0,0 +1,572 @@
+/*
+ * Copyright Redis Ltd. 2023 - present
+ * Licensed under your choice of the Redis Source Available License 2.0 (RSALv2) or
+ * the Server Side Public License v1 (SSPLv1).
+ */
+
+#include "redisraft.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+/* ACL cache
+ *
+ * Scripts are executed with the ACL of the user who called them, so their
+ * entries carry the ACL string of that user and every node creates a module
+ * user with this ACL to execute them.
+ *
+ * ACL strings are cached by their 64-bit hash (the ACL id). Once an ACL is
+ * known to all nodes, entries carry a short reference ("#<16 hex digits>")
+ * instead of the full ACL string:
+ *
+ * - The leader appends a RAFT_LOGTYPE_ACL_DEFINE entry with the full ACL string
+ *   before the first entry that refers to it in a term. Log entries of a term
+ *   are never reordered, so any node that applies the reference has applied
+ *   the definition before.
+ * - Applied definitions are saved in snapshots.
+ * - Entries with a full ACL string (e.g. created by older versions) are still
+ *   accepted, and define the ACL as well.
+ *
+ * A reference only refers to a definition of its own term, so definitions of
+ * earlier terms are forgotten once an entry of a later term is applied. Within
+ * a term, once ACL_CACHE_MAX_DEFINED definitions were appended, the leader
+ * appends an empty RAFT_LOGTYPE_ACL_DEFINE entry (a reset) that makes all nodes
+ * forget their definitions, and defines ACLs again before referring to them.
+ * Password changes and user churn keep creating ACL strings, this bounds the
+ * definitions to about ACL_CACHE_MAX_DEFINED per node. Forgotten entries are
+ * freed before going to sleep, unless blocked commands still use them.
+ *
+ * Module users are created on demand and refcounted. On the leader, the ACL of
+ * each client is cached in its ClientState, valid for a version of the cache.
+ * ACL changes and authentication bump the version, ACL changes also free the
+ * module users no command is using.
+ *
+ * ACL commands are seen by the command filter before they run, so the cache is
+ * only marked stale then. ACLs of clients are not cached until it is
+ * invalidated, before going to sleep, when the ACL command is done.
+ *
+ * If two ACL strings have the same hash, the second one is not cached and its
+ * entries carry the full ACL string. Such entries get a detached ACLEntry that
+ * is freed once the command is done with it.
+ */
+
+#define ACL_REF_LEN 17 /* "#" + 16 hex digits */
+
+#define ACL_CACHE_MAX_DEFINED 1024
+
+static uint64_t aclHash(const char *s, size_t len)
+{
+    /* FNV-1a */
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) s[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static bool parseACLRef(const char *s, size_t len, uint64_t *id)
+{
+    if (len != ACL_REF_LEN || s[0] != '#') {
+        return false;
+    }
+
+    uint64_t val = 0;
+    for (size_t i = 1; i < len; i++) {
+        char c = s[i];
+        int digit;
+
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else {
+            return false;
+        }
+        val = (val << 4) | (uint64_t) digit;
+    }
+
+    *id = val;
+    return true;
+}
+
+/* Returns true if the ACL allows all keys and channels, and has no selectors
+ * or rules for subcommands or first arguments. The ACL check of a command
+ * does not depend on its arguments then. */
+static bool isUnrestrictedACL(const char *acl, size_t len)
+{
+    bool all_keys = false;
+    bool all_channels = false;
+    size_t i = 0;
+
+    while (i < len) {
+        while (i < len && acl[i] == ' ') {
+            i++;
+        }
+
+        const char *tok = &acl[i];
+        size_t tok_len = 0;
+        while (i < len && acl[i] != ' ') {
+            i++;
+            tok_len++;
+        }
+
+        if (!tok_len) {
+            break;
+        }
+
+        if (tok[0] == '(') {
+            return false;
+        }
+        if ((tok[0] == '+' || tok[0] == '-') && memchr(tok, '|', tok_len)) {
+            return false;
+        }
+        if (tok_len == 2 && !memcmp(tok, "~*", 2)) {
+            all_keys = true;
+        }
+        if (tok_len == 2 && !memcmp(tok, "&*", 2)) {
+            all_channels = true;
+        }
+    }
+
+    return all_keys && all_channels;
+}
+
+static ACLEntry *newEntry(uint64_t id, const char *acl, size_t len)
+{
+    ACLEntry *e = RedisModule_Calloc(1, sizeof(*e));
+
+    e->id = id;
+    e->acl = RedisModule_CreateString(NULL, acl, len);
+    e->unrestricted = isUnrestrictedACL(acl, len);
+    e->allowed = RedisModule_CreateDict(NULL);
+
+    return e;
+}
+
+static void freeEntry(ACLEntry *e)
+{
+    if (e->user) {
+        RedisModule_FreeModuleUser(e->user);
+    }
+    RedisModule_FreeString(NULL, e->acl);
+    RedisModule_FreeDict(NULL, e->allowed);
+    RedisModule_Free(e);
+}
+
+static ACLEntry *lookupEntry(ACLCache *cache, uint64_t id)
+{
+    return RedisModule_DictGetC(cache->entries, &id, sizeof(id), NULL);
+}
+
+/* Returns the entry of the ACL string, creating it if it does not exist. If
+ * the hash of the ACL string collides with another one, returns NULL. */
+static ACLEntry *getEntry(ACLCache *cache, const char *acl, size_t len)
+{
+    uint64_t id = aclHash(acl, len);
+    ACLEntry *e = lookupEntry(cache, id);
+
+    if (e) {
+        size_t e_len;
+        const char *e_acl = RedisModule_StringPtrLen(e->acl, &e_len);
+
+        if (e_len != len || memcmp(e_acl, acl, len) != 0) {
+            LOG_WARNING("ACL id %016" PRIx64 " collision", id);
+            return NULL;
+        }
+        return e;
+    }
+
+    e = newEntry(id, acl, len);
+    RedisModule_DictSetC(cache->entries, &id, sizeof(id), e);
+
+    return e;
+}
+
+static void freeEntryUser(ACLCache *cache, ACLEntry *e)
+{
+    if (e->user && e->refcount == 0) {
+        RedisModule_FreeModuleUser(e->user);
+        e->user = NULL;
+        cache->users_num--;
+    }
+}
+
+static void setDefined(ACLCache *cache, ACLEntry *e, raft_term_t term)
+{
+    if (!e->defined) {
+        e->defined = true;
+        cache->defined_num++;
+    }
+    e->defined_term = term;
+}
+
+/* Forget the definitions of terms before 'term', or all of them if it is past
+ * the term of the last applied entry. Entries are freed later, by
+ * ACLCacheCollect(). */
+static void forgetDefinitions(ACLCache *cache, raft_term_t term)
+{
+    ACLEntry *e;
+
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(cache->entries, "^", NULL, 0);
+    while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL) {
+        if (e->defined && e->defined_term < term) {
+            e->defined = false;
+            cache->defined_num--;
+            cache->collect = true;
+        }
+    }
+    RedisModule_DictIteratorStop(it);
+}
+
+void ACLCacheInit(ACLCache *cache)
+{
+    *cache = (ACLCache){
+        .entries = RedisModule_CreateDict(NULL),
+    };
+}
+
+void ACLCacheFree(ACLCache *cache)
+{
+    ACLEntry *e;
+
+    if (!cache->entries) {
+        return;
+    }
+
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(cache->entries, "^", NULL, 0);
+    while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL) {
+        freeEntry(e);
+    }
+    RedisModule_DictIteratorStop(it);
+
+    RedisModule_FreeDict(NULL, cache->entries);
+    *cache = (ACLCache){0};
+}
+
+/* Called by the command filter when an ACL command is about to run. */
+void ACLCacheSetStale(ACLCache *cache)
+{
+    cache->stale = true;
+}
+
+/* Called by the command filter when a client is about to authenticate. The
+ * filter does not know the client, so the ACLs of all clients are dropped. */
+void ACLCacheClientsChanged(ACLCache *cache)
+{
+    cache->version++;
+}
+
+/* Called when ACLs may have changed: forget the ACL of clients and free
+ * module users that are not in use. */
+void ACLCacheInvalidate(ACLCache *cache)
+{
+    ACLEntry *e;
+
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(cache->entries, "^", NULL, 0);
+    while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL) {
+        freeEntryUser(cache, e);
+    }
+    RedisModule_DictIteratorStop(it);
+
+    /* Entries of users that changed are not needed anymore */
+    cache->collect = true;
+    cache->stale = false;
+    cache->version++;
+    cache->invalidations++;
+}
+
+/* Free the entries that are not defined and not used by any command. Called
+ * before going to sleep, as ACLs of clients may be used during a command. */
+void ACLCacheCollect(ACLCache *cache)
+{
+    uint64_t *ids = RedisModule_Alloc((RedisModule_DictSize(cache->entries) + 1) * sizeof(uint64_t));
+    size_t num = 0;
+    ACLEntry *e;
+
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(cache->entries, "^", NULL, 0);
+    while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL) {
+        if (!e->defined && e->refcount == 0) {
+            ids[num++] = e->id;
+        }
+    }
+    RedisModule_DictIteratorStop(it);
+
+    for (size_t i = 0; i < num; i++) {
+        RedisModule_DictDelC(cache->entries, &ids[i], sizeof(ids[i]), &e);
+        if (e->user) {
+            cache->users_num--;
+        }
+        freeEntry(e);
+    }
+    RedisModule_Free(ids);
+
+    cache->collect = false;
+    cache->version++;
+}
+
+/* Called before applying an entry of 'term'. References of a term only refer
+ * to definitions of the same term. */
+void ACLCacheApplied(ACLCache *cache, raft_term_t term)
+{
+    if (term > cache->term) {
+        forgetDefinitions(cache, term);
+        cache->term = term;
+    }
+}
+
+/* Apply a RAFT_LOGTYPE_ACL_DEFINE entry of 'term' or a definition loaded from
+ * a snapshot. An empty definition is a reset, all definitions are forgotten. */
+void ACLCacheDefine(ACLCache *cache, const char *acl, size_t len, raft_term_t term)
+{
+    if (len == 0) {
+        forgetDefinitions(cache, cache->term + 1);
+        return;
+    }
+
+    ACLEntry *e = getEntry(cache, acl, len);
+    if (e) {
+        setDefined(cache, e, term);
+    }
+}
+
+/* Returns the cached ACL of the user of the current client, or NULL if it
+ * cannot be cached. */
+ACLEntry *ACLCacheGetCurrentUser(RedisRaftCtx *rr, RedisModuleCtx *ctx)
+{
+    ACLCache *cache = &rr->acl_cache;
+    ClientState *cs = cache->stale ? NULL : ClientStateGet(rr, ctx);
+
+    if (cs && cs->acl && cs->acl_version == cache->version) {
+        cache->hits++;
+        return cs->acl;
+    }
+
+    cache->misses++;
+
+    RedisModuleString *user_name = RedisModule_GetCurrentUserName(ctx);
+    RedisModuleUser *user = RedisModule_GetModuleUserFromUserName(user_name);
+    RedisModuleString *acl = RedisModule_GetModuleUserACLString(user);
+    RedisModule_FreeModuleUser(user);
+    RedisModule_FreeString(ctx, user_name);
+
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(acl, &len);
+
+    ACLEntry *e = getEntry(cache, str, len);
+    if (cs) {
+        cs->acl = e;
+        cs->acl_version = cache->version;
+    }
+
+    RedisModule_FreeString(NULL, acl);
+
+    return e;
+}
+
+static int appendDefinition(RedisRaftCtx *rr, const char *acl, size_t len)
+{
+    raft_entry_t *entry = raft_entry_new(len);
+    entry->type = RAFT_LOGTYPE_ACL_DEFINE;
+    memcpy(entry->data, acl, len);
+
+    int ret = raft_recv_entry(rr->raft, entry, NULL);
+    raft_entry_release(entry);
+
+    return ret;
+}
+
+/* Set the ACL of the user calling a script on the command array. 'e' is the
+ * user's cached ACL returned by ACLCacheGetCurrentUser(). On the leader, this
+ * is done before appending the entry, and the ACL definition is appended first
+ * if needed.
+ */
+RRStatus ACLCacheSetCommandACL(RedisRaftCtx *rr, RedisModuleCtx *ctx, ACLEntry *e, RaftRedisCommandArray *cmds)
+{
+    if (!e) {
+        /* Hash collision, fall back to the full ACL string */
+        RedisModuleString *user_name = RedisModule_GetCurrentUserName(ctx);
+        RedisModuleUser *user = RedisModule_GetModuleUserFromUserName(user_name);
+        cmds->acl = RedisModule_GetModuleUserACLString(user);
+        RedisModule_FreeModuleUser(user);
+        RedisModule_FreeString(ctx, user_name);
+        return RR_OK;
+    }
+
+    ACLCache *cache = &rr->acl_cache;
+    raft_term_t term = raft_get_current_term(rr->raft);
+
+    if (cache->epoch_term != term) {
+        cache->epoch_term = term;
+        cache->epoch_defines = 0;
+    }
+
+    if (e->appended_term != term || e->appended_epoch != cache->epoch) {
+        int ret;
+
+        /* Make all nodes forget the definitions appended so far */
+        if (cache->epoch_defines >= ACL_CACHE_MAX_DEFINED) {
+            if ((ret = appendDefinition(rr, "", 0)) != 0) {
+                replyRaftError(ctx, NULL, ret);
+                return RR_ERROR;
+            }
+            cache->epoch++;
+            cache->epoch_defines = 0;
+        }
+
+        size_t len;
+        const char *str = RedisModule_StringPtrLen(e->acl, &len);
+
+        if ((ret = appendDefinition(rr, str, len)) != 0) {
+            replyRaftError(ctx, NULL, ret);
+            return RR_ERROR;
+        }
+
+        e->appended_term = term;
+        e->appended_epoch = cache->epoch;
+        cache->epoch_defines++;
+    }
+
+    char ref[ACL_REF_LEN + 1];
+    snprintf(ref, sizeof(ref), "#%016" PRIx64, e->id);
+    cmds->acl = RedisModule_CreateString(NULL, ref, ACL_REF_LEN);
+
+    return RR_OK;
+}
+
+/* Returns true if the command is known to pass the ACL check of this ACL
+ * regardless of its arguments. Only tracked for unrestricted ACLs. */
+bool ACLEntryCommandAllowed(ACLEntry *e, const CommandSpec *cs, unsigned long version)
+{
+    if (!e->unrestricted || e->allowed_version != version) {
+        return false;
+    }
+
+    return RedisModule_DictGetC(e->allowed, &cs, sizeof(cs), NULL) != NULL;
+}
+
+void ACLEntrySetCommandAllowed(ACLEntry *e, const CommandSpec *cs, unsigned long version)
+{
+    if (!e->unrestricted) {
+        return;
+    }
+
+    /* CommandSpec pointers are only valid for a version of the table */
+    if (e->allowed_version != version) {
+        RedisModule_FreeDict(NULL, e->allowed);
+        e->allowed = RedisModule_CreateDict(NULL);
+        e->allowed_version = version;
+    }
+
+    RedisModule_DictSetC(e->allowed, &cs, sizeof(cs), (void *) cs);
+}
+
+/* Returns the cached ACL for an ACL string or reference found in an entry, and
+ * holds its module user until ACLCacheRelease() is called. Returns NULL if the
+ * ACL is unknown. A reference to a forgotten definition is unknown, even if its
+ * entry is not freed yet, so all nodes agree on it.
+ */
+ACLEntry *ACLCacheAcquire(ACLCache *cache, RedisModuleString *acl)
+{
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(acl, &len);
+    uint64_t id;
+    ACLEntry *e;
+
+    if (parseACLRef(str, len, &id)) {
+        e = lookupEntry(cache, id);
+        if (!e || !e->defined) {
+            return NULL;
+        }
+    } else {
+        e = getEntry(cache, str, len);
+        if (e) {
+            setDefined(cache, e, cache->term);
+        } else {
+            /* Hash collision, the ACL string is not cached */
+            e = newEntry(aclHash(str, len), str, len);
+            e->detached = true;
+        }
+    }
+
+    if (!e->user) {
+        char user_name[64];
+        snprintf(user_name, sizeof(user_name), "redis_raft%016" PRIx64 "%s",
+                 e->id, e->detached ? "_detached" : "");
+
+        e->user = RedisModule_CreateModuleUser(user_name);
+        RedisModule_Assert(e->user != NULL);
+
+        const char *acl_str = RedisModule_StringPtrLen(e->acl, NULL);
+        int ret = RedisModule_SetModuleUserACLString(NULL, e->user, acl_str, NULL);
+        RedisModule_Assert(ret == REDISMODULE_OK);
+
+        if (!e->detached) {
+            cache->users_num++;
+        }
+    }
+
+    e->refcount++;
+    return e;
+}
+
+/* Entries of forgotten definitions released here are freed by the next
+ * ACLCacheCollect(). */
+void ACLCacheRelease(ACLEntry *e)
+{
+    if (e) {
+        RedisModule_Assert(e->refcount > 0);
+        e->refcount--;
+
+        if (e->detached && e->refcount == 0) {
+            freeEntry(e);
+        }
+    }
+}
+
+void ACLCacheRDBSave(RedisModuleIO *rdb, ACLCache *cache)
+{
+    ACLEntry *e;
+    size_t count = 0;
+
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(cache->entries, "^", NULL, 0);
+    while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL) {
+        if (e->defined) {
+            count++;
+        }
+    }
+    RedisModule_DictIteratorStop(it);
+
+    RedisModule_SaveUnsigned(rdb, count);
+
+    it = RedisModule_DictIteratorStartC(cache->entries, "^", NULL, 0);
+    while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL) {
+        if (e->defined) {
+            RedisModule_SaveString(rdb, e->acl);
+        }
+    }
+    RedisModule_DictIteratorStop(it);
+}
+
+/* Replaces the definitions with the ones of a snapshot whose last applied
+ * entry is of 'term'. */
+void ACLCacheRDBLoad(RedisModuleIO *rdb, ACLCache *cache, raft_term_t term)
+{
+    size_t count = RedisModule_LoadUnsigned(rdb);
+
+    forgetDefinitions(cache, cache->term + 1);
+    cache->term = term;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t len;
+        char *acl = RedisModule_LoadStringBuffer(rdb, &len);
+
+        if (len > 0) {
+            ACLCacheDefine(cache, acl, len, term);
+        }
+        RedisModule_Free(acl);
+    }
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright Redis Ltd. 2023 - present
+ * Licensed under your choice of the Redis Source Available License 2.0 (RSALv2) or
+ * the Server Side Public License v1 (SSPLv1).
+ */
+
+#include "redisraft.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/* Apply pipeline
+ *
+ * Entries that are not attached to a local client (e.g. all entries on a
+ * follower) must be deserialized before they can be executed. To take this
+ * off the apply path, we hand upcoming entries to the thread pool as soon as
+ * they show up in the log, so by the time an entry is committed and applied,
+ * its command arrays are usually ready.
+ *
+ * Execution itself (RedisModule_Call(), sharding checks, ACL lookups) must stay
+ * on the main thread and in log order, so workers only deserialize.
+ *
+ * Prefetched entries may be beyond the commit index and the log may be
+ * truncated in the meantime. We hold a reference to the entry we prefetched
+ * and only use the result if the entry being applied is the very same object.
+ * Otherwise, the result is dropped and the entry is deserialized inline.
+ *
+ * The main thread never waits for a worker: the thread pool also runs slow
+ * jobs (e.g. getaddrinfo()), so an entry whose prefetch is not done yet is
+ * deserialized inline. Prefetches dropped while in flight are kept until the
+ * worker is done with them and freed later.
+ *
+ * Entry reference counts are not thread-safe, so all holds and releases are
+ * done on the main thread. Workers only read entry->data.
+ */
+
+typedef struct ApplyPrefetch {
+    raft_index_t idx;
+    raft_entry_t *entry;        /* Held until consumed or discarded */
+    RaftRedisCommandBatch cmds; /* Filled in by the worker thread */
+    RRStatus status;            /* Deserialization result */
+    bool done;                  /* Worker is done, protected by pipeline mutex */
+    uint64_t time;              /* Microseconds the worker spent on this entry */
+    ApplyPipeline *pipeline;
+    struct sc_list entries;
+} ApplyPrefetch;
+
+/* Thread pool callback */
+static void prefetchEntry(void *arg)
+{
+    ApplyPrefetch *pf = arg;
+    ApplyPipeline *p = pf->pipeline;
+
+    uint64_t begin = RedisModule_MonotonicMicroseconds();
+    RRStatus status = RaftRedisCommandBatchDeserialize(&pf->cmds,
+                                                       pf->entry->data,
+                                                       pf->entry->data_len,
+                                                       pf->entry->session);
+    uint64_t took = RedisModule_MonotonicMicroseconds() - begin;
+
+    pthread_mutex_lock(&p->mtx);
+    pf->status = status;
+    pf->time = took;
+    pf->done = true;
+    pthread_mutex_unlock(&p->mtx);
+}
+
+/* Returns true if the worker is done with the prefetch task, and accounts its
+ * time. The task's fields must not be touched from the main thread before. */
+static bool prefetchDone(ApplyPipeline *p, ApplyPrefetch *pf)
+{
+    pthread_mutex_lock(&p->mtx);
+    bool done = pf->done;
+    pthread_mutex_unlock(&p->mtx);
+
+    if (done) {
+        p->deserialize_time += pf->time;
+        p->prefetched++;
+    }
+
+    return done;
+}
+
+static void freePrefetch(ApplyPrefetch *pf)
+{
+    RaftRedisCommandBatchFree(&pf->cmds);
+    raft_entry_release(pf->entry);
+    RedisModule_Free(pf);
+}
+
+/* Free a prefetch task removed from the queue, or keep it on the dropped list
+ * if the worker is still running it. */
+static void dropPrefetch(ApplyPipeline *p, ApplyPrefetch *pf)
+{
+    if (prefetchDone(p, pf)) {
+        freePrefetch(pf);
+        return;
+    }
+
+    sc_list_add_tail(&p->dropped, &pf->entries);
+    p->prefetch_dropped++;
+}
+
+/* Free dropped prefetch tasks the workers are done with. */
+static void reapDropped(ApplyPipeline *p)
+{
+    struct sc_list *it, *tmp;
+
+    sc_list_foreach_safe (&p->dropped, tmp, it) {
+        ApplyPrefetch *pf = sc_list_entry(it, ApplyPrefetch, entries);
+
+        if (prefetchDone(p, pf)) {
+            sc_list_del(&p->dropped, &pf->entries);
+            freePrefetch(pf);
+        }
+    }
+}
+
+void ApplyPipelineInit(ApplyPipeline *p)
+{
+    *p = (ApplyPipeline){
+        .mtx = (pthread_mutex_t) PTHREAD_MUTEX_INITIALIZER,
+    };
+
+    sc_list_init(&p->queue);
+    sc_list_init(&p->dropped);
+}
+
+/* Drop all prefetched entries, e.g. when the log is reset. In-flight ones are
+ * freed once their worker is done. */
+void ApplyPipelineReset(ApplyPipeline *p)
+{
+    struct sc_list *elem;
+
+    while ((elem = sc_list_pop_head(&p->queue)) != NULL) {
+        dropPrefetch(p, sc_list_entry(elem, ApplyPrefetch, entries));
+    }
+
+    reapDropped(p);
+    p->scheduled_idx = 0;
+}
+
+/* Hand entries after the last applied index to the thread pool, up to
+ * `apply-prefetch` entries ahead. Called from the main thread before entries
+ * are applied. */
+void ApplyPipelineSchedule(RedisRaftCtx *rr)
+{
+    ApplyPipeline *p = &rr->apply_pipeline;
+
+    reapDropped(p);
+
+    if (!rr->config.apply_prefetch) {
+        return;
+    }
+
+    raft_index_t applied = raft_get_last_applied_idx(rr->raft);
+    raft_index_t last = raft_get_current_idx(rr->raft);
+
+    if (last > applied + rr->config.apply_prefetch) {
+        last = applied + rr->config.apply_prefetch;
+    }
+
+    /* Either we are behind the applied index (entries applied with prefetch
+     * disabled, snapshot loaded), or the log was truncated. */
+    if (p->scheduled_idx < applied) {
+        p->scheduled_idx = applied;
+    } else if (p->scheduled_idx > raft_get_current_idx(rr->raft)) {
+        p->scheduled_idx = raft_get_current_idx(rr->raft);
+    }
+
+    for (raft_index_t idx = p->scheduled_idx + 1; idx <= last; idx++) {
+        raft_entry_t *entry = raft_get_entry_from_idx(rr->raft, idx);
+        if (!entry) {
+            break;
+        }
+
+        p->scheduled_idx = idx;
+
+        /* Entries of local clients are already deserialized */
+        if (entry->type != RAFT_LOGTYPE_NORMAL || entry->user_data) {
+            raft_entry_release(entry);
+            continue;
+        }
+
+        ApplyPrefetch *pf = RedisModule_Calloc(1, sizeof(*pf));
+        pf->idx = idx;
+        pf->entry = entry;
+        pf->pipeline = p;
+        sc_list_init(&pf->entries);
+
+        sc_list_add_tail(&p->queue, &pf->entries);
+        threadPoolAdd(&rr->thread_pool, pf, prefetchEntry);
+    }
+}
+
+/* Fetch the prefetched command arrays of the entry about to be applied into
+ * target. Returns RR_ERROR if it's not available or not ready yet, the caller
+ * is expected to deserialize the entry itself in that case.
+ */
+RRStatus ApplyPipelineTake(ApplyPipeline *p, raft_index_t idx, raft_entry_t *entry,
+                           RaftRedisCommandBatch *target)
+{
+    struct sc_list *elem;
+
+    while ((elem = sc_list_head(&p->queue)) != NULL) {
+        ApplyPrefetch *pf = sc_list_entry(elem, ApplyPrefetch, entries);
+        if (pf->idx > idx) {
+            break;
+        }
+
+        sc_list_del(&p->queue, elem);
+
+        if (!prefetchDone(p, pf)) {
+            sc_list_add_tail(&p->dropped, &pf->entries);
+            p->prefetch_dropped++;
+            continue;
+        }
+
+        if (pf->idx == idx && pf->entry == entry && pf->status == RR_OK) {
+            *target = pf->cmds;
+            pf->cmds = (RaftRedisCommandBatch){0};
+            freePrefetch(pf);
+
+            p->prefetch_hits++;
+            return RR_OK;
+        }
+
+        freePrefetch(pf);
+    }
+
+    p->prefetch_misses++;
+    return RR_ERROR;
+}
+
+/* Apply batches
+ *
+ * The Raft library notifies us before applying a range of committed entries.
+ * Consecutive entries usually touch the same slot range, so we keep the result
+ * of the last slot validation and reuse it for the following entries.
+ *
+ * Slot validation depends on sharding info, which can be changed by any entry
+ * that is not a RAFT_LOGTYPE_NORMAL one, so the cached slot range is dropped
+ * on those and at the beginning of each batch.
+ */
+
+void ApplyBatchBegin(ApplyBatch *b, raft_index_t first_idx, raft_index_t last_idx)
+{
+    b->first_idx = first_idx;
+    b->last_idx = last_idx;
+    b->batches++;
+
+    ApplyBatchInvalidate(b);
+}
+
+void ApplyBatchInvalidate(ApplyBatch *b)
+{
+    b->slot_start = -1;
+    b->slot_end = -1;
+}
+
+bool ApplyBatchSlotValidated(ApplyBatch *b, int slot)
+{
+    return b->slot_start <= slot && slot <= b->slot_end;
+}
+
+/* Remember the slot range of a slot that has just been validated, if the
+ * slot is a stable one served locally. Validation of such slots doesn't
+ * depend on the command itself. */
+void ApplyBatchSetValidatedSlot(RedisRaftCtx *rr, int slot)
+{
+    ShardGroup *sg = rr->sharding_info->stable_slots_map[slot];
+
+    if (!sg || !sg->local) {
+        return;
+    }
+
+    for (size_t i = 0; i < sg->slot_ranges_num; i++) {
+        ShardGroupSlotRange *r = &sg->slot_ranges[i];
+
+        if (r->start_slot <= (unsigned int) slot && (unsigned int) slot <= r->end_slot) {
+            if (r->type == SLOTRANGE_TYPE_STABLE) {
+                rr->apply_batch.slot_start = (int) r->start_slot;
+                rr->apply_batch.slot_end = (int) r->end_slot;
+            }
+            return;
+        }
+    }
+}
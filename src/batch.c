@@ -0,0 +1,244 @@
+/*
+ * Copyright Redis Ltd. 2023 - present
+ * Licensed under your choice of the Redis Source Available License 2.0 (RSALv2) or
+ * the Server Side Public License v1 (SSPLv1).
+ */
+
+#include "redisraft.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Write batching
+ *
+ * Each log entry comes with a fixed cost: a log header, a CRC, an index
+ * write, a cache slot, its share of an AppendEntries message and an apply
+ * dispatch. With many clients issuing small writes, this overhead dominates.
+ *
+ * Instead of appending writes one by one, independent single-command writes
+ * received in the same event loop iteration are queued and appended as a
+ * single entry before going to sleep (see handleBeforeSleep()). Every command
+ * keeps its own RaftReq and client id, so when the entry is applied, each
+ * client receives its own reply.
+ *
+ * Commands are serialized as they are queued, into a buffer which is reused
+ * by the following batches.
+ *
+ * Blocking commands and MULTI/EXEC transactions are not batched. Any write that
+ * is not batched flushes the pending batch first, so writes are appended in the
+ * order they are received.
+ *
+ * A batch of a single command is appended as a regular entry.
+ *
+ * Followers in follower-proxy mode batch the same writes and send them to the
+ * leader with a single RAFT.ENTRIES command (see proxy.c). The leader appends
+ * them as a single entry as well.
+ */
+
+static void replyRaftErrorAll(RaftReq *req, int err)
+{
+    if (req->type != RR_REDISCOMMAND_BATCH) {
+        replyRaftError(req->ctx, NULL, err);
+        return;
+    }
+
+    for (int i = 0; i < req->r.batch.len; i++) {
+        replyRaftError(req->r.batch.reqs[i]->ctx, NULL, err);
+    }
+}
+
+/* Reply with an error to all requests of a batch. */
+void WriteBatchReplyWithError(RaftReq *batch, const char *msg)
+{
+    RedisModule_Assert(batch->type == RR_REDISCOMMAND_BATCH);
+
+    for (int i = 0; i < batch->r.batch.len; i++) {
+        RedisModule_ReplyWithError(batch->r.batch.reqs[i]->ctx, msg);
+    }
+}
+
+/* Queue a RR_REDISCOMMAND request to be appended with the current batch.
+ *
+ * Returns false if batching is disabled, in which case the caller should
+ * append the request itself.
+ */
+bool WriteBatchAdd(RedisRaftCtx *rr, RaftReq *req)
+{
+    WriteBatch *b = &rr->write_batch;
+    long long max_count = rr->config.write_batch_max_count;
+    long long max_size = rr->config.write_batch_max_size;
+
+    if (max_count <= 1) {
+        return false;
+    }
+
+    if (!b->req) {
+        b->req = RaftReqInit(NULL, RR_REDISCOMMAND_BATCH);
+    }
+
+    RaftReq *batch = b->req;
+    if (batch->r.batch.len == batch->r.batch.size) {
+        batch->r.batch.size = batch->r.batch.size ? batch->r.batch.size * 2 : 16;
+        batch->r.batch.reqs = RedisModule_Realloc(batch->r.batch.reqs,
+                                                  batch->r.batch.size * sizeof(RaftReq *));
+    }
+
+    batch->r.batch.reqs[batch->r.batch.len++] = req;
+    RaftRedisCommandBufferAppend(&b->buf, &req->r.redis.cmds);
+
+    if (batch->r.batch.len >= max_count || b->buf.len >= (size_t) max_size) {
+        WriteBatchFlush(rr);
+    }
+
+    return true;
+}
+
+/* Append a batch entry to the log. 'req' is the batch request, or its only
+ * request. */
+static void appendBatchEntry(RedisRaftCtx *rr, RaftReq *req, raft_entry_t *entry, int commands)
+{
+    WriteBatch *b = &rr->write_batch;
+
+    entry->id = rand();
+    entry->type = RAFT_LOGTYPE_NORMAL;
+
+    int e = RedisRaftRecvEntry(rr, entry, req);
+    if (e != 0) {
+        replyRaftErrorAll(req, e);
+        RaftReqFree(req);
+        return;
+    }
+
+    req->raft_idx = raft_get_current_idx(rr->raft);
+    req->times.appended = RedisModule_MonotonicMicroseconds();
+
+    if (req->type == RR_REDISCOMMAND_BATCH) {
+        for (int i = 0; i < req->r.batch.len; i++) {
+            req->r.batch.reqs[i]->raft_idx = req->raft_idx;
+            req->r.batch.reqs[i]->times.appended = req->times.appended;
+        }
+
+        b->entries++;
+        b->commands += commands;
+    }
+}
+
+/* Append the pending batch to the log, if there is one. */
+void WriteBatchFlush(RedisRaftCtx *rr)
+{
+    WriteBatch *b = &rr->write_batch;
+    RaftReq *batch = b->req;
+    raft_entry_t *entry;
+    RaftReq *req;
+
+    if (!batch) {
+        return;
+    }
+
+    b->req = NULL;
+
+    int len = batch->r.batch.len;
+    entry = RaftRedisCommandBufferToEntry(&b->buf);
+
+    if (len == 1) {
+        req = batch->r.batch.reqs[0];
+        batch->r.batch.len = 0;
+        RaftReqFree(batch);
+
+        entry->session = req->r.redis.cmds.client_id;
+    } else {
+        req = batch;
+    }
+
+    appendBatchEntry(rr, req, entry, len);
+}
+
+/* Only independent single-command writes are proxied in batches, which are
+ * also the writes the leader batches locally. */
+bool WriteBatchCanProxy(RaftRedisCommandArray *cmds, unsigned int cmd_flags)
+{
+    return cmds->len == 1 && !cmds->asking && (cmd_flags & CMD_SPEC_WRITE) &&
+           !(cmd_flags & (CMD_SPEC_UNSUPPORTED | CMD_SPEC_BLOCKING |
+                          CMD_SPEC_MULTI | CMD_SPEC_SCRIPTS));
+}
+
+/* Returns the error a proxied command is rejected with, or NULL if it can be
+ * appended. */
+static RedisModuleString *checkProxiedCommand(RedisRaftCtx *rr, RedisModuleCtx *ctx,
+                                              ACLEntry *acl, RaftRedisCommandArray *cmds)
+{
+    const char *err = "ERR command can't be proxied in a batch";
+    size_t len = strlen(err);
+
+    cmds->cmd_flags = CommandSpecTableGetAggregateFlags(rr->commands_spec_table,
+                                                        rr->subcommand_spec_tables,
+                                                        cmds, CMD_SPEC_WRITE);
+    if (!WriteBatchCanProxy(cmds, cmds->cmd_flags)) {
+        return RedisModule_CreateString(NULL, err, len);
+    }
+
+    RedisModuleCallReply *reply = CommandDryRunGetError(rr, ctx, acl, cmds->commands[0], true);
+    if (!reply) {
+        return NULL;
+    }
+
+    const char *str = RedisModule_CallReplyStringPtr(reply, &len);
+    RedisModuleString *ret = RedisModule_CreateString(NULL, str ? str : err, str ? len : strlen(err));
+    RedisModule_FreeCallReply(reply);
+
+    return ret;
+}
+
+/* Append the writes of a RAFT.ENTRIES batch, proxied by a follower, as a
+ * single entry.
+ *
+ * The client is blocked once and receives an array with a reply per command,
+ * in order. All requests of the batch reply to the context of the batch.
+ * Commands rejected before being appended take their place in the array when
+ * the entry is applied.
+ */
+void WriteBatchAppendProxied(RedisRaftCtx *rr, RedisModuleCtx *ctx, RaftRedisCommandBatch *cmds)
+{
+    static RaftRedisCommandBuffer buf;
+    ACLEntry *acl = ACLCacheGetCurrentUser(rr, ctx);
+    unsigned long long client_id = RedisModule_GetClientId(ctx);
+    uint64_t received = RedisModule_MonotonicMicroseconds();
+
+    /* Writes queued earlier must be appended first */
+    WriteBatchFlush(rr);
+
+    RaftReq *batch = RaftReqInit(ctx, RR_REDISCOMMAND_BATCH);
+    batch->r.batch.size = cmds->len;
+    batch->r.batch.reqs = RedisModule_Alloc(cmds->len * sizeof(RaftReq *));
+
+    RedisModule_ReplyWithArray(batch->ctx, cmds->len);
+
+    for (int i = 0; i < cmds->len; i++) {
+        RaftReq *req = RaftReqInit(NULL, RR_REDISCOMMAND);
+        req->ctx = batch->ctx;
+
+        RaftRedisCommandArrayMove(&req->r.redis.cmds, &cmds->arrays[i]);
+        req->r.redis.cmds.client_id = client_id;
+        req->r.redis.error = checkProxiedCommand(rr, ctx, acl, &req->r.redis.cmds);
+        if (!req->r.redis.error) {
+            RaftRedisCommandBufferAppend(&buf, &req->r.redis.cmds);
+        }
+
+        req->times.received = received;
+        req->times.validated = RedisModule_MonotonicMicroseconds();
+
+        batch->r.batch.reqs[batch->r.batch.len++] = req;
+    }
+
+    int commands = buf.num;
+    if (commands == 0) {
+        for (int i = 0; i < batch->r.batch.len; i++) {
+            RaftReq *req = batch->r.batch.reqs[i];
+            RedisModule_ReplyWithError(req->ctx, RedisModule_StringPtrLen(req->r.redis.error, NULL));
+        }
+        RaftReqFree(batch);
+        return;
+    }
+
+    appendBatchEntry(rr, batch, RaftRedisCommandBufferToEntry(&buf), commands);
+}
@@ -10,7 +10,59 @@
 #include <string.h>
 #include <strings.h>
 
-/* A list of all current blocked commands */
+/* Blocked commands
+ *
+ * Commands that block when applied are kept in a list, in order of blocking,
+ * and in a hash index by the index of their entry, used to time them out or
+ * unblock them.
+ *
+ * The timeouts of blocked client requests are kept in a timer wheel, expired
+ * by a single timer. Requests that expire in the same tick are timed out with
+ * a single RAFT_LOGTYPE_TIMEOUT_BLOCKED entry.
+ *
+ * Snapshots store blocked commands with the keys they are blocked on. When a
+ * snapshot is loaded, they are registered as dormant, without executing them.
+ * A dormant command is executed (armed) to block again only when its keys may
+ * get data: before applying a write to one of its keys, or once the snapshot
+ * is loaded if its keys already have data. Writes that are not applied
+ * entries, e.g. a BLMOVE that completes when it is unblocked or armed, are
+ * caught by their keyspace notification and arm the commands right after.
+ */
+
+/* Resolution of blocked command timeouts, in milliseconds */
+#define BLOCKED_TIMEOUT_RESOLUTION 10
+
+#define BLOCKED_INDEX_INITIAL_SIZE 16
+
+void blockedCommandsInit(void)
+{
+    BlockedCommands *b = &redis_raft.blocked_commands;
+
+    sc_list_init(&b->list);
+    TimerWheelInit(&b->timeouts, BLOCKED_TIMEOUT_RESOLUTION, monotonicMilliseconds());
+    b->dormant_keys = RedisModule_CreateDict(NULL);
+}
+
+void blockedCommandsTerm(void)
+{
+    BlockedCommands *b = &redis_raft.blocked_commands;
+    struct sc_list *elem;
+
+    while ((elem = sc_list_pop_head(&b->list)) != NULL) {
+        RedisModule_Free(sc_list_entry(elem, BlockedCommand, blocked_list));
+    }
+
+    RedisModule_Free(b->buckets);
+    b->buckets = NULL;
+    b->size = 0;
+    b->count = 0;
+
+    if (b->dormant_keys) {
+        RedisModule_FreeDict(NULL, b->dormant_keys);
+        b->dormant_keys = NULL;
+    }
+    b->dormant = 0;
+}
 
 BlockedCommand *allocBlockedCommand(const char *cmd_name, raft_index_t idx, raft_session_t session, const char *data, size_t data_len, RaftReq *req, RedisModuleCallReply *reply)
 {
@@ -29,22 +81,116 @@ BlockedCommand *allocBlockedCommand(const char *cmd_name, raft_index_t idx, raft
     return bc;
 }
 
+static BlockedCommand **indexBucket(BlockedCommands *b, raft_index_t idx)
+{
+    /* Indexes are sequential, so they are spread evenly as they are */
+    return &b->buckets[(unsigned long) idx & (b->size - 1)];
+}
+
+static void indexResize(BlockedCommands *b, unsigned long size)
+{
+    BlockedCommand **old = b->buckets;
+    unsigned long old_size = b->size;
+
+    b->buckets = RedisModule_Calloc(size, sizeof(BlockedCommand *));
+    b->size = size;
+
+    for (unsigned long i = 0; i < old_size; i++) {
+        BlockedCommand *bc = old[i];
+        while (bc) {
+            BlockedCommand *next = bc->index_next;
+            BlockedCommand **bucket = indexBucket(b, bc->idx);
+
+            bc->index_next = *bucket;
+            *bucket = bc;
+            bc = next;
+        }
+    }
+
+    RedisModule_Free(old);
+}
+
+/* Keep the keys of the command as it was blocked, to save them in snapshots */
+void blockedCommandSetKeys(BlockedCommand *bc, RaftRedisCommand *cmd)
+{
+    int num_keys = 0;
+    int *pos = RedisModule_GetCommandKeys(redis_raft.ctx, cmd->argv, cmd->argc, &num_keys);
+
+    if (!pos) {
+        return;
+    }
+
+    bc->keys = RedisModule_Alloc(num_keys * sizeof(RedisModuleString *));
+    bc->num_keys = num_keys;
+    for (int i = 0; i < num_keys; i++) {
+        bc->keys[i] = RedisModule_HoldString(NULL, cmd->argv[pos[i]]);
+    }
+
+    RedisModule_Free(pos);
+}
+
+static void setDormant(BlockedCommands *b, BlockedCommand *bc, bool dormant)
+{
+    if (bc->dormant == dormant) {
+        return;
+    }
+
+    for (int i = 0; i < bc->num_keys; i++) {
+        uintptr_t count = (uintptr_t) RedisModule_DictGet(b->dormant_keys, bc->keys[i], NULL);
+
+        count = dormant ? count + 1 : count - 1;
+        if (count) {
+            RedisModule_DictReplace(b->dormant_keys, bc->keys[i], (void *) count);
+        } else {
+            RedisModule_DictDel(b->dormant_keys, bc->keys[i], NULL);
+        }
+    }
+
+    bc->dormant = dormant;
+    b->dormant = dormant ? b->dormant + 1 : b->dormant - 1;
+}
+
 void addBlockedCommand(BlockedCommand *bc)
 {
-    sc_list_add_tail(&redis_raft.blocked_command_list, &bc->blocked_list);
-    RedisModule_DictSetC(redis_raft.blocked_command_dict, &bc->idx, sizeof(bc->idx), bc);
+    BlockedCommands *b = &redis_raft.blocked_commands;
+
+    if (b->count >= b->size) {
+        indexResize(b, b->size ? b->size * 2 : BLOCKED_INDEX_INITIAL_SIZE);
+    }
+
+    BlockedCommand **bucket = indexBucket(b, bc->idx);
+    bc->index_next = *bucket;
+    *bucket = bc;
+    b->count++;
+
+    sc_list_add_tail(&b->list, &bc->blocked_list);
 }
 
 void deleteBlockedCommand(raft_index_t idx)
 {
-    BlockedCommand *blocked = NULL;
+    BlockedCommands *b = &redis_raft.blocked_commands;
 
-    RedisModule_DictDelC(redis_raft.blocked_command_dict, &idx, sizeof(idx), &blocked);
+    if (!b->size) {
+        return;
+    }
+
+    BlockedCommand **it = indexBucket(b, idx);
+    while (*it && (*it)->idx != idx) {
+        it = &(*it)->index_next;
+    }
+
+    BlockedCommand *blocked = *it;
     if (blocked == NULL) {
         return;
     }
 
-    sc_list_del(&redis_raft.blocked_command_list, &blocked->blocked_list);
+    *it = blocked->index_next;
+    blocked->index_next = NULL;
+    b->count--;
+
+    setDormant(b, blocked, false);
+
+    sc_list_del(&b->list, &blocked->blocked_list);
 }
 
 void freeBlockedCommand(BlockedCommand *bc)
@@ -53,6 +199,12 @@ void freeBlockedCommand(BlockedCommand *bc)
         RedisModule_FreeCallReply(bc->reply);
     }
 
+    for (int i = 0; i < bc->num_keys; i++) {
+        RedisModule_FreeString(NULL, bc->keys[i]);
+    }
+    RedisModule_Free(bc->keys);
+
+    ACLCacheRelease(bc->acl);
     RedisModule_Free(bc->command);
     RedisModule_Free(bc->data);
     RedisModule_Free(bc);
@@ -60,91 +212,439 @@ void freeBlockedCommand(BlockedCommand *bc)
 
 BlockedCommand *getBlockedCommand(raft_index_t idx)
 {
-    return RedisModule_DictGetC(redis_raft.blocked_command_dict, &idx, sizeof(idx), NULL);
+    BlockedCommands *b = &redis_raft.blocked_commands;
+
+    if (!b->size) {
+        return NULL;
+    }
+
+    BlockedCommand *bc = *indexBucket(b, idx);
+    while (bc && bc->idx != idx) {
+        bc = bc->index_next;
+    }
+
+    return bc;
 }
 
 void clearAllBlockCommands()
 {
+    BlockedCommands *b = &redis_raft.blocked_commands;
     struct sc_list *elem;
 
-    while ((elem = sc_list_pop_head(&redis_raft.blocked_command_list)) != NULL) {
+    if (b->size) {
+        memset(b->buckets, 0, b->size * sizeof(BlockedCommand *));
+    }
+    b->count = 0;
+
+    RedisModule_FreeDict(NULL, b->dormant_keys);
+    b->dormant_keys = RedisModule_CreateDict(NULL);
+    b->dormant = 0;
+
+    while ((elem = sc_list_pop_head(&b->list)) != NULL) {
         BlockedCommand *bc = sc_list_entry(elem, BlockedCommand, blocked_list);
-        if (RedisModule_CallReplyPromiseAbort(bc->reply, NULL) != REDISMODULE_OK) {
+        if (bc->reply && RedisModule_CallReplyPromiseAbort(bc->reply, NULL) != REDISMODULE_OK) {
             /* shouldn't happen with normal redis commands */
             LOG_WARNING("timeoutBlockedCommand: failed to abort %lu", bc->idx);
             return;
         }
         freeBlockedCommand(bc);
     }
-    if (redis_raft.blocked_command_dict != NULL) {
-        RedisModule_FreeDict(redis_raft.ctx, redis_raft.blocked_command_dict);
-    }
-    redis_raft.blocked_command_dict = RedisModule_CreateDict(redis_raft.ctx);
 }
 
 void blockedCommandsSave(RedisModuleIO *rdb)
 {
+    BlockedCommands *b = &redis_raft.blocked_commands;
     RaftSnapshotInfo *info = &redis_raft.snapshot_info;
+    unsigned long count = b->count;
     struct sc_list *it;
-    int count = 0;
 
-    sc_list_foreach (&redis_raft.blocked_command_list, it) {
+    /* The list is in index order, skip commands blocked after the snapshot's
+     * last applied entry, if any, from the tail */
+    sc_list_foreach_r (&b->list, it) {
         BlockedCommand *bc = sc_list_entry(it, BlockedCommand, blocked_list);
         if (bc->idx <= info->last_applied_idx) {
-            count++;
-        } else {
             break;
         }
+        count--;
     }
 
     RedisModule_SaveUnsigned(rdb, count);
-    sc_list_foreach (&redis_raft.blocked_command_list, it) {
-        BlockedCommand *bc = sc_list_entry(it, BlockedCommand, blocked_list);
-        if (bc->idx <= info->last_applied_idx) {
-            RedisModule_SaveUnsigned(rdb, bc->idx);
-            RedisModule_SaveUnsigned(rdb, bc->session);
-            RedisModule_SaveStringBuffer(rdb, bc->data, bc->data_len);
-        } else {
+    sc_list_foreach (&b->list, it) {
+        if (count-- == 0) {
             break;
         }
+
+        BlockedCommand *bc = sc_list_entry(it, BlockedCommand, blocked_list);
+        RedisModule_SaveUnsigned(rdb, bc->idx);
+        RedisModule_SaveUnsigned(rdb, bc->session);
+        RedisModule_SaveStringBuffer(rdb, bc->command, strlen(bc->command) + 1);
+
+        size_t acl_len = 0;
+        const char *acl = bc->acl ? RedisModule_StringPtrLen(bc->acl->acl, &acl_len) : "";
+        RedisModule_SaveStringBuffer(rdb, acl, acl_len);
+
+        RedisModule_SaveUnsigned(rdb, bc->num_keys);
+        for (int i = 0; i < bc->num_keys; i++) {
+            RedisModule_SaveString(rdb, bc->keys[i]);
+        }
+
+        RedisModule_SaveStringBuffer(rdb, bc->data, bc->data_len);
+    }
+}
+
+/* Snapshots before REDIS_RAFT_DATATYPE_ENCVER 3 only have the entry of each
+ * blocked command, which is parsed to get its keys. */
+static BlockedCommand *loadLegacyBlockedCommand(RedisModuleIO *rdb)
+{
+    RedisRaftCtx *rr = &redis_raft;
+
+    raft_index_t idx = RedisModule_LoadUnsigned(rdb);
+    raft_session_t session = RedisModule_LoadUnsigned(rdb);
+    size_t data_len;
+    char *data = RedisModule_LoadStringBuffer(rdb, &data_len);
+
+    RaftRedisCommandArray tmp = {
+        .client_id = session,
+    };
+    if (RaftRedisCommandArrayDeserialize(&tmp, data, data_len) != RR_OK) {
+        PANIC("Invalid Raft entry");
     }
+
+    const char *cmdstr = RedisModule_StringPtrLen(tmp.commands[0]->argv[0], NULL);
+    BlockedCommand *bc = allocBlockedCommand(cmdstr, idx, session, data, data_len, NULL, NULL);
+    blockedCommandSetKeys(bc, tmp.commands[0]);
+    if (tmp.acl) {
+        bc->acl = ACLCacheAcquire(&rr->acl_cache, tmp.acl);
+    }
+
+    RedisModule_Free(data);
+    RaftRedisCommandArrayFree(&tmp);
+
+    return bc;
 }
 
-void blockedCommandsLoad(RedisModuleIO *rdb)
+static BlockedCommand *loadBlockedCommand(RedisModuleIO *rdb)
 {
     RedisRaftCtx *rr = &redis_raft;
+    size_t len;
+
+    raft_index_t idx = RedisModule_LoadUnsigned(rdb);
+    raft_session_t session = RedisModule_LoadUnsigned(rdb);
+
+    char *cmdstr = RedisModule_LoadStringBuffer(rdb, &len);
+    if (len == 0 || cmdstr[len - 1] != '\0') {
+        PANIC("Invalid blocked command in snapshot");
+    }
+
+    char *acl = RedisModule_LoadStringBuffer(rdb, &len);
+    ACLEntry *entry = NULL;
+    if (len > 0) {
+        RedisModuleString *acl_str = RedisModule_CreateString(NULL, acl, len);
+        entry = ACLCacheAcquire(&rr->acl_cache, acl_str);
+        RedisModule_FreeString(NULL, acl_str);
+    }
+    RedisModule_Free(acl);
+
+    int num_keys = (int) RedisModule_LoadUnsigned(rdb);
+    RedisModuleString **keys = RedisModule_Alloc(num_keys * sizeof(RedisModuleString *));
+    for (int i = 0; i < num_keys; i++) {
+        keys[i] = RedisModule_LoadString(rdb);
+    }
+
+    size_t data_len;
+    char *data = RedisModule_LoadStringBuffer(rdb, &data_len);
+
+    BlockedCommand *bc = allocBlockedCommand(cmdstr, idx, session, data, data_len, NULL, NULL);
+    bc->acl = entry;
+    bc->keys = keys;
+    bc->num_keys = num_keys;
+
+    RedisModule_Free(cmdstr);
+    RedisModule_Free(data);
+
+    return bc;
+}
+
+void blockedCommandsLoad(RedisModuleIO *rdb, int encver)
+{
+    BlockedCommands *b = &redis_raft.blocked_commands;
+    uint64_t begin = RedisModule_MonotonicMicroseconds();
 
     clearAllBlockCommands();
 
     size_t command_count = RedisModule_LoadUnsigned(rdb);
     for (size_t i = 0; i < command_count; i++) {
-        raft_index_t idx = RedisModule_LoadUnsigned(rdb);
-        raft_session_t session = RedisModule_LoadUnsigned(rdb);
-        size_t data_len;
-        char *data = RedisModule_LoadStringBuffer(rdb, &data_len);
-
-        /* execute blocking command again */
-        RaftRedisCommandArray tmp = {
-            .client_id = session,
-        };
-        if (RaftRedisCommandArrayDeserialize(&tmp, data, data_len) != RR_OK) {
-            PANIC("Invalid Raft entry");
-        }
-        RedisModuleCallReply *reply = RaftExecuteCommandArray(rr, NULL, &tmp);
-        RedisModule_Assert(reply != NULL);
-        RedisModule_Assert(RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_PROMISE);
-
-        /* save blocked command info */
-        size_t cmdstr_len;
-        const char *cmdstr = RedisModule_StringPtrLen(tmp.commands[0]->argv[0], &cmdstr_len);
-        BlockedCommand *bc = allocBlockedCommand(cmdstr, idx, session, data, data_len, NULL, reply);
+        BlockedCommand *bc;
+
+        if (encver < 3) {
+            bc = loadLegacyBlockedCommand(rdb);
+        } else {
+            bc = loadBlockedCommand(rdb);
+        }
+
         addBlockedCommand(bc);
+        setDormant(b, bc, true);
+    }
+
+    b->rebuild_time = RedisModule_MonotonicMicroseconds() - begin;
+}
+
+/* Execute a dormant command, so it blocks again. If its keys have data, it
+ * completes right away. */
+static void armBlockedCommand(RedisRaftCtx *rr, BlockedCommand *bc)
+{
+    BlockedCommands *b = &rr->blocked_commands;
 
-        /* setup handler */
-        RedisModule_CallReplyPromiseSetUnblockHandler(reply, handleUnblock, bc);
-        RedisModule_Free(data);
-        RaftRedisCommandArrayFree(&tmp);
+    RaftRedisCommandArray tmp = {
+        .client_id = bc->session,
+    };
+    if (RaftRedisCommandArrayDeserialize(&tmp, bc->data, bc->data_len) != RR_OK) {
+        PANIC("Invalid Raft entry");
     }
+
+    setDormant(b, bc, false);
+
+    /* Arming may nest, see blockedCommandsKeyspaceEvent() */
+    bool arming = b->arming;
+    b->arming = true;
+    RedisModuleCallReply *reply = RaftExecuteCommandArray(rr, NULL, &tmp);
+    b->arming = arming;
+
+    RaftRedisCommandArrayFree(&tmp);
+
+    if (!reply) {
+        deleteBlockedCommand(bc->idx);
+        freeBlockedCommand(bc);
+        return;
+    }
+
+    RedisModule_Assert(RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_PROMISE);
+    bc->reply = reply;
+    RedisModule_CallReplyPromiseSetUnblockHandler(reply, handleUnblock, bc);
+}
+
+static bool hasAnyKey(BlockedCommand *bc, RedisModuleString **keys, size_t num_keys)
+{
+    for (int i = 0; i < bc->num_keys; i++) {
+        size_t len;
+        const char *key = RedisModule_StringPtrLen(bc->keys[i], &len);
+
+        for (size_t j = 0; j < num_keys; j++) {
+            size_t other_len;
+            const char *other = RedisModule_StringPtrLen(keys[j], &other_len);
+
+            if (len == other_len && memcmp(key, other, len) == 0) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool keysExist(RedisRaftCtx *rr, BlockedCommand *bc)
+{
+    for (int i = 0; i < bc->num_keys; i++) {
+        if (RedisModule_KeyExists(rr->ctx, bc->keys[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Arm dormant commands in blocking order. If 'keys' is not NULL, only the
+ * commands blocked on one of them are armed. If 'ready' is true, only the
+ * commands whose keys have data are armed. */
+static void armBlockedCommands(RedisRaftCtx *rr, RedisModuleString **keys, size_t num_keys, bool ready)
+{
+    BlockedCommands *b = &rr->blocked_commands;
+    raft_index_t *idxs = NULL;
+    int len = 0;
+    struct sc_list *it;
+
+    /* Commands are armed after they are collected, as arming may unblock
+     * other commands */
+    sc_list_foreach (&b->list, it) {
+        BlockedCommand *bc = sc_list_entry(it, BlockedCommand, blocked_list);
+
+        if (!bc->dormant ||
+            (keys && !hasAnyKey(bc, keys, num_keys)) ||
+            (ready && !keysExist(rr, bc))) {
+            continue;
+        }
+
+        if (!idxs) {
+            idxs = RedisModule_Alloc(b->dormant * sizeof(raft_index_t));
+        }
+        idxs[len++] = bc->idx;
+    }
+
+    for (int i = 0; i < len; i++) {
+        BlockedCommand *bc = getBlockedCommand(idxs[i]);
+        if (bc && bc->dormant) {
+            armBlockedCommand(rr, bc);
+        }
+    }
+
+    RedisModule_Free(idxs);
+}
+
+/* Arm the dormant commands whose keys have data, once a snapshot is loaded */
+void blockedCommandsArmReady(void)
+{
+    RedisRaftCtx *rr = &redis_raft;
+    BlockedCommands *b = &rr->blocked_commands;
+
+    if (!b->dormant) {
+        return;
+    }
+
+    uint64_t begin = RedisModule_MonotonicMicroseconds();
+    armBlockedCommands(rr, NULL, 0, true);
+    b->rebuild_time += RedisModule_MonotonicMicroseconds() - begin;
+
+    LOG_VERBOSE("Blocked commands rebuilt in %lu microseconds, %lu dormant",
+                b->rebuild_time, b->dormant);
+}
+
+/* Arm the dormant commands blocked on any of 'keys', before they are written */
+void blockedCommandsArmKeys(RedisModuleString **keys, size_t num_keys)
+{
+    RedisRaftCtx *rr = &redis_raft;
+    BlockedCommands *b = &rr->blocked_commands;
+
+    if (!b->dormant || b->arming) {
+        return;
+    }
+
+    for (size_t i = 0; i < num_keys; i++) {
+        if (RedisModule_DictGet(b->dormant_keys, keys[i], NULL)) {
+            armBlockedCommands(rr, keys, num_keys, false);
+            return;
+        }
+    }
+}
+
+/* Arm the dormant commands that the commands about to be executed may
+ * unblock. */
+void blockedCommandsArmForCommands(RaftRedisCommandArray *cmds)
+{
+    RedisRaftCtx *rr = &redis_raft;
+    BlockedCommands *b = &rr->blocked_commands;
+
+    if (!b->dormant || b->arming) {
+        return;
+    }
+
+    for (int i = 0; i < cmds->len && b->dormant; i++) {
+        RaftRedisCommand *c = cmds->commands[i];
+        const CommandSpec *cs = CommandSpecTableGetCommandSpec(rr->commands_spec_table,
+                                                               rr->subcommand_spec_tables, c);
+        size_t len;
+        const char *cmd = RedisModule_StringPtrLen(c->argv[0], &len);
+
+        /* Scripts may write any key, SWAPDB replaces all of them */
+        if ((cs && (cs->flags & CMD_SPEC_SCRIPTS)) ||
+            (len == 6 && strncasecmp(cmd, "SWAPDB", 6) == 0)) {
+            armBlockedCommands(rr, NULL, 0, false);
+            return;
+        }
+
+        if (cs && (cs->flags & CMD_SPEC_READONLY)) {
+            continue;
+        }
+
+        int num_keys = 0;
+        int *pos = RedisModule_GetCommandKeys(rr->ctx, c->argv, c->argc, &num_keys);
+        if (!pos) {
+            continue;
+        }
+
+        RedisModuleString *keys[num_keys];
+        for (int j = 0; j < num_keys; j++) {
+            keys[j] = c->argv[pos[j]];
+        }
+        RedisModule_Free(pos);
+
+        blockedCommandsArmKeys(keys, num_keys);
+    }
+}
+
+/* Indexes of the entries of requests that expired in a tick */
+typedef struct ExpiredRequests {
+    raft_index_t *idxs;
+    int len;
+    int size;
+} ExpiredRequests;
+
+static void blockedTimeoutExpired(TimerWheelEntry *e, void *privdata)
+{
+    RaftReq *req = sc_list_entry(e, RaftReq, timeout);
+    ExpiredRequests *expired = privdata;
+
+    /* Not appended yet */
+    if (!req->raft_idx) {
+        return;
+    }
+
+    if (expired->len == expired->size) {
+        expired->size = expired->size ? expired->size * 2 : 16;
+        expired->idxs = RedisModule_Realloc(expired->idxs, expired->size * sizeof(raft_index_t));
+    }
+    expired->idxs[expired->len++] = req->raft_idx;
+}
+
+static void handleBlockedTimeouts(RedisModuleCtx *ctx, void *data)
+{
+    RedisRaftCtx *rr = data;
+    BlockedCommands *b = &rr->blocked_commands;
+    ExpiredRequests expired = {0};
+
+    b->timer = 0;
+    TimerWheelExpire(&b->timeouts, monotonicMilliseconds(), blockedTimeoutExpired, &expired);
+
+    if (expired.len) {
+        /* don't need to attach a req to this entry, as the reqs are part of
+         * the BlockedClient objects */
+        raft_entry_t *entry = RaftRedisSerializeTimeout(expired.idxs, expired.len, false);
+
+        int e = raft_recv_entry(rr->raft, entry, NULL);
+        if (e == 0) {
+            b->timeout_entries++;
+            b->timeouts_expired += expired.len;
+        }
+        /* Otherwise, we lost leadership. When the new leader applies a NO_OP,
+         * blocked commands are timed out on all nodes, so there is nothing to
+         * do here. */
+
+        raft_entry_release(entry);
+        RedisModule_Free(expired.idxs);
+    }
+
+    if (b->timeouts.count > 0) {
+        b->timer = RedisModule_CreateTimer(rr->ctx, BLOCKED_TIMEOUT_RESOLUTION,
+                                           handleBlockedTimeouts, rr);
+    }
+}
+
+/* Time out a blocked client request after 'timeout' milliseconds */
+void blockedTimeoutAdd(RaftReq *req, long long timeout)
+{
+    RedisRaftCtx *rr = &redis_raft;
+    BlockedCommands *b = &rr->blocked_commands;
+
+    TimerWheelAdd(&b->timeouts, &req->timeout, monotonicMilliseconds() + timeout);
+
+    if (!b->timer) {
+        b->timer = RedisModule_CreateTimer(rr->ctx, BLOCKED_TIMEOUT_RESOLUTION,
+                                           handleBlockedTimeouts, rr);
+    }
+}
+
+void blockedTimeoutDel(RaftReq *req)
+{
+    TimerWheelDel(&redis_raft.blocked_commands.timeouts, &req->timeout);
 }
 
 static int findTimeoutIndex(RaftRedisCommand *cmd)
@@ -229,3 +729,32 @@ void replaceBlockingTimeout(RaftRedisCommandArray *cmds)
     RedisModule_FreeString(NULL, cmd->argv[index]);
     cmd->argv[index] = RedisModule_HoldString(NULL, zero);
 }
+
+static void armKeyJob(RedisModuleCtx *ctx, void *pd)
+{
+    RedisModuleString *key = pd;
+
+    if (redis_raft.blocked_commands.dormant) {
+        armBlockedCommands(&redis_raft, &key, 1, false);
+    }
+}
+
+static void freeKeyJob(void *pd)
+{
+    RedisModule_FreeString(NULL, pd);
+}
+
+/* Keyspace notification callback, arms the dormant commands blocked on a key
+ * once the write that notified it completes, as writes are not allowed in the
+ * callback itself. */
+int blockedCommandsKeyspaceEvent(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key)
+{
+    BlockedCommands *b = &redis_raft.blocked_commands;
+
+    if (!b->dormant || !RedisModule_DictGet(b->dormant_keys, key, NULL)) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_AddPostNotificationJob(ctx, armKeyJob, RedisModule_HoldString(NULL, key), freeKeyJob);
+    return REDISMODULE_OK;
+}
@@ -0,0 +1 @@
+#define REDISRAFT_GIT_SHA1 "792e6af9"
@@ -16,49 +16,188 @@
  * -------------------------------------------------------------------------- */
 
 /* ShardGroup serialization and deserialization is used in Raft log entries
- * of type RAFT_LOGTYPE_ADD_SHARDGROUP.
+ * of type RAFT_LOGTYPE_ADD_SHARDGROUP, RAFT_LOGTYPE_UPDATE_SHARDGROUP and
+ * RAFT_LOGTYPE_REPLACE_SHARDGROUPS, and in snapshots.
  *
- * The format is as follows:
- *      <id>:<start-slot>:<end-slot>:<number-of-nodes>\n
- *      <node-uid>:<node host>:<node port>\n
+ * The format is as follows, with varint numbers and varint length prefixed
+ * strings:
+ *      <RAFT_REDIS_ENCODING_V2> <id> <number-of-slot-ranges> <number-of-nodes>
+ *      <start-slot-delta> <end-slot - start-slot> <type> <migration-session-key>
+ *      ...
+ *      <node-uid> <node host> <node port>
+ *      ...
+ *
+ * The start slot of a range is encoded as the zigzag encoded difference with
+ * the start slot of the previous range, so sorted ranges take one or two
+ * bytes each.
+ *
+ * Older versions used a text format, which is still read:
+ *      <id>\n<number-of-slot-ranges>\n<number-of-nodes>\n
+ *      <start-slot>\n<end-slot>\n<type>\n<migration-session-key>\n
+ *      ...
+ *      <node-uid>\n<node host>:<node port>\n
  *      ...
  */
 
-/* Serialize a ShardGroup. Returns a newly allocated null terminated buffer
- * that contains the serialized form.
+static uint64_t zigzagEncode(int64_t val)
+{
+    return ((uint64_t) val << 1) ^ (uint64_t) (val >> 63);
+}
+
+static int64_t zigzagDecode(uint64_t val)
+{
+    return (int64_t) (val >> 1) ^ -(int64_t) (val & 1);
+}
+
+static char *putBytes(char *p, const char *bytes, size_t len)
+{
+    p += encodeVarint(p, len);
+    memcpy(p, bytes, len);
+    return p + len;
+}
+
+/* Serialize a ShardGroup. Returns a newly allocated buffer that contains the
+ * serialized form, and its length in 'len'.
  */
-char *ShardGroupSerialize(ShardGroup *sg)
+char *ShardGroupSerialize(ShardGroup *sg, size_t *len)
 {
-    size_t buf_size = SHARDGROUP_MAXLEN +
-                      (SHARDGROUPNODE_MAXLEN * sg->nodes_num) + 1 +
-                      (SLOT_RANGE_MAXLEN * sg->slot_ranges_num) + 1;
-    char *buf = RedisModule_Calloc(1, buf_size);
+    size_t size = 1 + VARINT_MAX_LEN + strlen(sg->id) + 2 * VARINT_MAX_LEN +
+                  sg->slot_ranges_num * 4 * VARINT_MAX_LEN;
+
+    for (unsigned int i = 0; i < sg->nodes_num; i++) {
+        size += 3 * VARINT_MAX_LEN + strlen(sg->nodes[i].node_id) +
+                strlen(sg->nodes[i].addr.host);
+    }
 
-    /* shard group id */
-    buf = catsnprintf(buf, &buf_size, "%s\n", sg->id);
+    char *buf = RedisModule_Alloc(size);
+    char *p = buf;
 
-    /* number of slot ranges and nodes */
-    buf = catsnprintf(buf, &buf_size, "%u\n%u\n", sg->slot_ranges_num, sg->nodes_num);
+    *p++ = RAFT_REDIS_ENCODING_V2;
+    p = putBytes(p, sg->id, strlen(sg->id));
+    p += encodeVarint(p, sg->slot_ranges_num);
+    p += encodeVarint(p, sg->nodes_num);
 
+    int64_t prev = 0;
     for (unsigned int i = 0; i < sg->slot_ranges_num; i++) {
-        /* individual slot ranges */
         ShardGroupSlotRange *sr = &sg->slot_ranges[i];
-        buf = catsnprintf(buf, &buf_size, "%u\n%u\n%u\n%llu\n", sr->start_slot, sr->end_slot, sr->type, sr->migration_session_key);
+
+        p += encodeVarint(p, zigzagEncode((int64_t) sr->start_slot - prev));
+        p += encodeVarint(p, zigzagEncode((int64_t) sr->end_slot - sr->start_slot));
+        p += encodeVarint(p, sr->type);
+        p += encodeVarint(p, sr->migration_session_key);
+        prev = sr->start_slot;
     }
 
     for (unsigned int i = 0; i < sg->nodes_num; i++) {
-        /* individual nodes */
-        NodeAddr *addr = &sg->nodes[i].addr;
-        buf = catsnprintf(buf, &buf_size, "%s\n%s:%d\n", sg->nodes[i].node_id, addr->host, addr->port);
+        ShardGroupNode *n = &sg->nodes[i];
+
+        p = putBytes(p, n->node_id, strlen(n->node_id));
+        p = putBytes(p, n->addr.host, strlen(n->addr.host));
+        p += encodeVarint(p, n->addr.port);
     }
 
+    RedisModule_Assert((size_t) (p - buf) <= size);
+    *len = p - buf;
+
     return buf;
 }
 
-/* Deserialize a ShardGroup from the specified buffer. The target ShardGroup is assumed
- * to be uninitialized, and the nodes array will be allocated on demand.
- */
-ShardGroup *ShardGroupDeserialize(const char *buf, size_t buf_len)
+static bool getVarint(const char **p, const char *end, uint64_t *val)
+{
+    int n = decodeVarint(*p, end - *p, val);
+    if (n < 0) {
+        return false;
+    }
+
+    *p += n;
+    return true;
+}
+
+/* Reads a string of up to 'max' bytes into 'dst', null terminated */
+static bool getString(const char **p, const char *end, char *dst, size_t max)
+{
+    uint64_t len;
+
+    if (!getVarint(p, end, &len) || len > max || len > (uint64_t) (end - *p)) {
+        return false;
+    }
+
+    memcpy(dst, *p, len);
+    dst[len] = '\0';
+    *p += len;
+    return true;
+}
+
+static ShardGroup *deserializeShardGroupV2(const char *buf, size_t buf_len)
+{
+    ShardGroup *sg = ShardGroupCreate();
+    const char *p = buf + 1;
+    const char *end = buf + buf_len;
+    uint64_t ranges_num, nodes_num;
+
+    if (!getString(&p, end, sg->id, RAFT_DBID_LEN) ||
+        !getVarint(&p, end, &ranges_num) ||
+        !getVarint(&p, end, &nodes_num) ||
+        ranges_num > (uint64_t) (end - p) ||
+        nodes_num > (uint64_t) (end - p)) {
+        goto error;
+    }
+
+    sg->slot_ranges_num = (unsigned int) ranges_num;
+    sg->slot_ranges = RedisModule_Calloc(sg->slot_ranges_num, sizeof(ShardGroupSlotRange));
+
+    int64_t prev = 0;
+    for (unsigned int i = 0; i < sg->slot_ranges_num; i++) {
+        ShardGroupSlotRange *r = &sg->slot_ranges[i];
+        uint64_t start, span, type, key;
+
+        if (!getVarint(&p, end, &start) ||
+            !getVarint(&p, end, &span) ||
+            !getVarint(&p, end, &type) ||
+            !getVarint(&p, end, &key)) {
+            goto error;
+        }
+
+        int64_t start_slot = prev + zigzagDecode(start);
+        int64_t end_slot = start_slot + zigzagDecode(span);
+        if (start_slot < 0 || end_slot < 0 || end_slot > UINT32_MAX) {
+            goto error;
+        }
+
+        r->start_slot = (unsigned int) start_slot;
+        r->end_slot = (unsigned int) end_slot;
+        r->type = (SlotRangeType) type;
+        r->migration_session_key = key;
+        prev = start_slot;
+    }
+
+    sg->nodes_num = (unsigned int) nodes_num;
+    sg->nodes = RedisModule_Calloc(sg->nodes_num, sizeof(ShardGroupNode));
+    for (unsigned int i = 0; i < sg->nodes_num; i++) {
+        ShardGroupNode *n = &sg->nodes[i];
+        uint64_t port;
+
+        if (!getString(&p, end, n->node_id, RAFT_SHARDGROUP_NODEID_LEN) ||
+            !getString(&p, end, n->addr.host, sizeof(n->addr.host) - 1) ||
+            !getVarint(&p, end, &port) || port > UINT16_MAX) {
+            goto error;
+        }
+        n->addr.port = (uint16_t) port;
+    }
+
+    if (p != end) {
+        goto error;
+    }
+
+    return sg;
+
+error:
+    ShardGroupFree(sg);
+    return NULL;
+}
+
+/* Deserialize a ShardGroup in the legacy text format */
+static ShardGroup *deserializeShardGroupLegacy(const char *buf, size_t buf_len)
 {
     ShardGroup *sg = ShardGroupCreate();
 
@@ -179,6 +318,18 @@ error:
     return NULL;
 }
 
+/* Deserialize a ShardGroup from the specified buffer, in the binary or the
+ * legacy text format. Returns NULL if the buffer is invalid.
+ */
+ShardGroup *ShardGroupDeserialize(const char *buf, size_t buf_len)
+{
+    if (buf_len > 0 && *buf == RAFT_REDIS_ENCODING_V2) {
+        return deserializeShardGroupV2(buf, buf_len);
+    }
+
+    return deserializeShardGroupLegacy(buf, buf_len);
+}
+
 /* Initialize a (previously allocated) shardgroup structure.
  * Basically just zero-initializing everything, but a place holder
  * for the future.
@@ -272,14 +423,21 @@ RRStatus parseShardGroupReply(redisReply *reply, ShardGroup *sg)
         return RR_ERROR;
     }
 
-    /* check if it has 2 elements and both are arrays */
-    if (reply->elements != 3 ||
+    /* check if it has 3 elements, and a version if requested with IF-NEWER */
+    if (reply->elements < 3 || reply->elements > 4 ||
         reply->element[0]->type != REDIS_REPLY_STRING || /* shardgroup_id */
         reply->element[1]->type != REDIS_REPLY_ARRAY ||  /* slots array */
         reply->element[2]->type != REDIS_REPLY_ARRAY) {  /* nodes array */
         return RR_ERROR;
     }
 
+    if (reply->elements == 4) {
+        if (reply->element[3]->type != REDIS_REPLY_INTEGER) { /* version */
+            return RR_ERROR;
+        }
+        sg->config_version = reply->element[3]->integer;
+    }
+
     strncpy(sg->id, reply->element[0]->str, RAFT_DBID_LEN);
     sg->id[RAFT_DBID_LEN] = '\0';
     sg->slot_ranges_num = reply->element[1]->elements;
@@ -362,16 +520,14 @@ RRStatus ShardGroupAppendLogEntry(RedisRaftCtx *rr, ShardGroup *sg, int type, vo
     }
 
     /* Serialize */
-    char *payload = ShardGroupSerialize(sg);
-    if (!payload) {
-        return RR_ERROR;
-    }
+    size_t payload_len;
+    char *payload = ShardGroupSerialize(sg, &payload_len);
 
-    raft_entry_t *entry = raft_entry_new(strlen(payload));
+    raft_entry_t *entry = raft_entry_new(payload_len);
     entry->type = type;
     entry->id = rand();
     entry->user_data = user_data;
-    memcpy(entry->data, payload, strlen(payload));
+    memcpy(entry->data, payload, payload_len);
     RedisModule_Free(payload);
 
     /* Submit */
@@ -386,28 +542,143 @@ RRStatus ShardGroupAppendLogEntry(RedisRaftCtx *rr, ShardGroup *sg, int type, vo
     return RR_OK;
 }
 
-RRStatus ShardGroupsAppendLogEntry(RedisRaftCtx *rr, int num_sg, ShardGroup **sg, int type, void *user_data)
+/* Serialize multiple ShardGroups, for RAFT_LOGTYPE_REPLACE_SHARDGROUPS entries.
+ *
+ * Format:
+ *      <RAFT_REDIS_ENCODING_V2> <num shard groups> (<payload len> <payload>)...
+ *
+ * Older versions used a text format, which is still read:
+ *      <num shard groups>\n(<payload len>\n<payload>\n)...
+ */
+static raft_entry_t *serializeShardGroups(int num_sg, ShardGroup **sg)
 {
-    /* Serialize */
-    /* We reuse the existing shard group serialization
-     * Format:
-     * <num shard groups>:strlen(sg #1 payload):sg #1 payload|...:strlen(sg #n payload):sg #n payload|
-     */
-    size_t buflen = 4096;
-    char *buf = RedisModule_Calloc(1, buflen);
-    buf = catsnprintf(buf, &buflen, "%d\n", num_sg);
+    char **payloads = RedisModule_Alloc(num_sg * sizeof(*payloads));
+    size_t *lens = RedisModule_Alloc(num_sg * sizeof(*lens));
+    size_t size = 1 + VARINT_MAX_LEN;
+
     for (int i = 0; i < num_sg; i++) {
-        char *payload = ShardGroupSerialize(sg[i]);
-        buf = catsnprintf(buf, &buflen, "%lu\n%s\n", strlen(payload), payload);
-        RedisModule_Free(payload);
+        payloads[i] = ShardGroupSerialize(sg[i], &lens[i]);
+        size += VARINT_MAX_LEN + lens[i];
     }
-    size_t payload_len = strlen(buf);
-    raft_entry_t *entry = raft_entry_new(payload_len);
+
+    raft_entry_t *entry = raft_entry_new(size);
+    char *p = entry->data;
+
+    *p++ = RAFT_REDIS_ENCODING_V2;
+    p += encodeVarint(p, num_sg);
+    for (int i = 0; i < num_sg; i++) {
+        p = putBytes(p, payloads[i], lens[i]);
+        RedisModule_Free(payloads[i]);
+    }
+    entry->data_len = p - entry->data;
+
+    RedisModule_Free(payloads);
+    RedisModule_Free(lens);
+
+    return entry;
+}
+
+static ShardGroup **deserializeShardGroupsLegacy(const char *buf, size_t buf_len, int *num_sg)
+{
+    const char *end = buf + buf_len;
+    const char *nl = memchr(buf, '\n', buf_len);
+    char *endptr;
+
+    if (!nl) {
+        return NULL;
+    }
+
+    long num = strtol(buf, &endptr, 10);
+    if (endptr != nl || num < 0 || num > (long) buf_len) {
+        return NULL;
+    }
+
+    ShardGroup **sgs = RedisModule_Calloc(num ? num : 1, sizeof(*sgs));
+    const char *p = nl + 1;
+
+    for (long i = 0; i < num; i++) {
+        nl = memchr(p, '\n', end - p);
+        if (!nl) {
+            goto error;
+        }
+
+        unsigned long len = strtoul(p, &endptr, 10);
+        if (endptr != nl || len >= (unsigned long) (end - nl)) {
+            goto error;
+        }
+        p = nl + 1;
+
+        if ((sgs[i] = ShardGroupDeserialize(p, len)) == NULL) {
+            goto error;
+        }
+        p += len + 1;
+    }
+
+    *num_sg = (int) num;
+    return sgs;
+
+error:
+    for (long i = 0; i < num; i++) {
+        if (sgs[i]) {
+            ShardGroupFree(sgs[i]);
+        }
+    }
+    RedisModule_Free(sgs);
+    return NULL;
+}
+
+/* Deserialize the ShardGroups of a RAFT_LOGTYPE_REPLACE_SHARDGROUPS entry.
+ * Returns a newly allocated array of 'num_sg' ShardGroups, or NULL if the
+ * buffer is invalid.
+ */
+ShardGroup **ShardGroupsDeserialize(const char *buf, size_t buf_len, int *num_sg)
+{
+    if (buf_len == 0 || *buf != RAFT_REDIS_ENCODING_V2) {
+        return deserializeShardGroupsLegacy(buf, buf_len, num_sg);
+    }
+
+    const char *p = buf + 1;
+    const char *end = buf + buf_len;
+    uint64_t num;
+
+    if (!getVarint(&p, end, &num) || num > (uint64_t) (end - p)) {
+        return NULL;
+    }
+
+    ShardGroup **sgs = RedisModule_Calloc(num ? num : 1, sizeof(*sgs));
+
+    for (uint64_t i = 0; i < num; i++) {
+        uint64_t len;
+
+        if (!getVarint(&p, end, &len) || len > (uint64_t) (end - p) ||
+            (sgs[i] = ShardGroupDeserialize(p, len)) == NULL) {
+            for (uint64_t j = 0; j < i; j++) {
+                ShardGroupFree(sgs[j]);
+            }
+            RedisModule_Free(sgs);
+            return NULL;
+        }
+        p += len;
+    }
+
+    if (p != end) {
+        for (uint64_t i = 0; i < num; i++) {
+            ShardGroupFree(sgs[i]);
+        }
+        RedisModule_Free(sgs);
+        return NULL;
+    }
+
+    *num_sg = (int) num;
+    return sgs;
+}
+
+RRStatus ShardGroupsAppendLogEntry(RedisRaftCtx *rr, int num_sg, ShardGroup **sg, int type, void *user_data)
+{
+    raft_entry_t *entry = serializeShardGroups(num_sg, sg);
     entry->type = type;
     entry->id = rand();
     entry->user_data = user_data;
-    memcpy(entry->data, buf, payload_len);
-    RedisModule_Free(buf);
 
     /* Submit */
     int e = raft_recv_entry(rr->raft, entry, NULL);
@@ -422,7 +693,8 @@ RRStatus ShardGroupsAppendLogEntry(RedisRaftCtx *rr, int num_sg, ShardGroup **sg
 }
 
 /* A hiredis callback that handles the Redis reply after sending a
- * RAFT.SHARDGROUP GET command.
+ * RAFT.SHARDGROUP GET IF-NEWER command. A nil reply means the configuration
+ * has not changed since the version we already have.
  *
  * FIXME: Some error handling paths may not be accurate and may require
  *        some cleanup here.
@@ -451,6 +723,12 @@ static void handleShardGroupResponse(redisAsyncContext *c, void *r, void *privda
         } else {
             LOG_WARNING("RAFT.SHARDGROUP GET failed: %s", reply->str);
         }
+    } else if (reply->type == REDIS_REPLY_NIL) {
+        LOG_DEBUG("Shardgroup %s is unchanged.", sg->id);
+        sg->use_conn_addr = true;
+        sg->last_updated = RedisModule_Milliseconds();
+        sg->update_in_progress = false;
+        return;
     } else {
         ShardGroup recv_sg;
         ShardGroupInit(&recv_sg);
@@ -466,9 +744,12 @@ static void handleShardGroupResponse(redisAsyncContext *c, void *r, void *privda
             /* Issue update */
             memcpy(recv_sg.id, sg->id, RAFT_DBID_LEN); /* Copy ID to allow correlation */
             recv_sg.id[RAFT_DBID_LEN] = '\0';
-            if (compareShardGroups(sg, &recv_sg) != 0) {
+            /* An appended entry is lost only if this node loses leadership,
+             * see ShardingInfoResetConfigVersions() */
+            if (compareShardGroups(sg, &recv_sg) == 0 ||
                 ShardGroupAppendLogEntry(ConnGetRedisRaftCtx(conn), &recv_sg,
-                                         RAFT_LOGTYPE_UPDATE_SHARDGROUP, NULL);
+                                         RAFT_LOGTYPE_UPDATE_SHARDGROUP, NULL) == RR_OK) {
+                sg->config_version = recv_sg.config_version;
             }
             ShardGroupTerm(&recv_sg);
 
@@ -484,9 +765,14 @@ static void handleShardGroupResponse(redisAsyncContext *c, void *r, void *privda
 
 /* Issue a RAFT.SHARDGROUP GET command on an active connection and register
  * a callback to process the reply.
+ *
+ * The configuration is requested only if it is newer than the one we have,
+ * so an unchanged shardgroup costs a nil reply.
  */
 static void sendShardGroupRequest(Connection *conn)
 {
+    ShardGroup *sg = ConnGetPrivateData(conn);
+
     /* Failed to connect? Advance node_idx to attempt another node. */
     if (!ConnIsConnected(conn)) {
         return;
@@ -495,7 +781,7 @@ static void sendShardGroupRequest(Connection *conn)
     /* Request configuration */
     redisAsyncContext *rc = ConnGetRedisCtx(conn);
     if (redisAsyncCommand(rc, handleShardGroupResponse, conn,
-                          "RAFT.SHARDGROUP %s", "GET") != REDIS_OK) {
+                          "RAFT.SHARDGROUP GET IF-NEWER %llu", sg->config_version) != REDIS_OK) {
 
         redisAsyncDisconnect(rc);
         ConnMarkDisconnected(conn);
@@ -581,6 +867,27 @@ void ShardingPeriodicCall(RedisRaftCtx *rr)
     }
 }
 
+/* Forget the configuration versions received from other shardgroups. Called
+ * when this node becomes leader: a version is recorded once its
+ * UPDATE_SHARDGROUP entry is appended, and the entry may have been lost with
+ * an earlier term. The next refresh of each shardgroup gets a full reply. */
+void ShardingInfoResetConfigVersions(RedisRaftCtx *rr)
+{
+    ShardingInfo *si = rr->sharding_info;
+
+    if (si->shard_group_map != NULL) {
+        size_t key_len;
+        ShardGroup *sg;
+
+        RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(si->shard_group_map, "^", NULL, 0);
+        while (RedisModule_DictNextC(iter, &key_len, (void **) &sg) != NULL) {
+            sg->config_version = 0;
+        }
+
+        RedisModule_DictIteratorStop(iter);
+    }
+}
+
 /* -----------------------------------------------------------------------------
  * ShardingInfo Handling
  * -------------------------------------------------------------------------- */
@@ -610,8 +917,9 @@ void ShardingInfoRDBSave(RedisModuleIO *rdb)
         ShardGroup *sg;
 
         while (RedisModule_DictNextC(iter, &key_len, (void **) &sg) != NULL) {
-            char *buf = ShardGroupSerialize(sg);
-            RedisModule_SaveStringBuffer(rdb, buf, strlen(buf));
+            size_t len;
+            char *buf = ShardGroupSerialize(sg, &len);
+            RedisModule_SaveStringBuffer(rdb, buf, len);
             RedisModule_Free(buf);
         }
         RedisModule_DictIteratorStop(iter);
@@ -727,6 +1035,72 @@ ShardGroup *GetShardGroupById(RedisRaftCtx *rr, const char *id)
     return RedisModule_DictGetC(si->shard_group_map, (void *) id, strlen(id), NULL);
 }
 
+/* Returns the type of the first slot range of 'sg' that includes 'slot' */
+static SlotRangeType getSlotRangeType(ShardGroup *sg, unsigned int slot)
+{
+    if (!sg) {
+        return SLOTRANGE_TYPE_UNDEF;
+    }
+
+    for (size_t i = 0; i < sg->slot_ranges_num; i++) {
+        if (sg->slot_ranges[i].start_slot <= slot && slot <= sg->slot_ranges[i].end_slot) {
+            return sg->slot_ranges[i].type;
+        }
+    }
+
+    return SLOTRANGE_TYPE_UNDEF;
+}
+
+/* Resolve the owner of every slot.
+ *
+ * The owner is either
+ *
+ * 1) a shardgroup that owns the slot as a stable slot
+ * 2) a shardgroup that owns the slot as a migrating slot. By definition if
+ *    this shardgroup is local, then it can't also be importing (a single
+ *    RedisRaft cluster cannot be both importing and migrating the same slot)
+ * 3) for ASKING commands, a shardgroup marked as local (i.e. corresponding to
+ *    this cluster) that owns the slot as an importing slot
+ */
+static void buildRoutes(RedisRaftCtx *rr)
+{
+    ShardingInfo *si = rr->sharding_info;
+
+    for (unsigned int slot = 0; slot < REDIS_RAFT_HASH_SLOTS; slot++) {
+        SlotRoute *route = &si->routes[slot];
+        ShardGroup *ssg = si->stable_slots_map[slot];
+        ShardGroup *msg = si->migrating_slots_map[slot];
+        ShardGroup *isg = si->importing_slots_map[slot];
+
+        route->sg = ssg ? ssg : msg;
+        route->asking_sg = route->sg;
+        if (!ssg && !(msg && msg->local) && isg && isg->local) {
+            route->asking_sg = isg;
+        }
+
+        route->importing_sg = isg;
+        route->type = (uint8_t) getSlotRangeType(route->sg, slot);
+        route->asking_type = (uint8_t) getSlotRangeType(route->asking_sg, slot);
+    }
+
+    si->routes_epoch = rr->topology_cache.epoch;
+}
+
+/* Returns the routing of a slot, the routing table is rebuilt first if the
+ * topology changed since it was built. */
+const SlotRoute *ShardingInfoGetRoute(RedisRaftCtx *rr, unsigned int slot)
+{
+    ShardingInfo *si = rr->sharding_info;
+
+    RedisModule_Assert(slot < REDIS_RAFT_HASH_SLOTS);
+
+    if (si->routes_epoch != rr->topology_cache.epoch) {
+        buildRoutes(rr);
+    }
+
+    return &si->routes[slot];
+}
+
 /* Update an existing ShardGroup in the active ShardingInfo.
  *
  * FIXME: We currently only handle updating nodes but don't support remapping
@@ -748,6 +1122,7 @@ RRStatus ShardingInfoUpdateShardGroup(RedisRaftCtx *rr, ShardGroup *new_sg)
         sg->nodes_num = new_sg->nodes_num;
         sg->nodes = RedisModule_Realloc(sg->nodes, sizeof(ShardGroupNode) * sg->nodes_num);
         memcpy(sg->nodes, new_sg->nodes, sizeof(ShardGroupNode) * sg->nodes_num);
+        ShardingTopologyChanged(rr);
     }
 
     ret = RR_OK;
@@ -779,6 +1154,8 @@ RRStatus ShardingInfoAddShardGroup(RedisRaftCtx *rr, ShardGroup *sg)
     }
 
     si->shard_groups_num++;
+    ShardingTopologyChanged(rr);
+
     sg->next_redir = 0;
     sg->use_conn_addr = false;
     sg->node_conn_idx = 0;
@@ -1133,10 +1510,32 @@ void ShardingInfoReset(RedisModuleCtx *ctx, ShardingInfo *si)
     }
 
     si->is_sharding = false;
+
+    /* Slot ranges validated while applying entries are no longer valid */
+    ApplyBatchInvalidate(&redis_raft.apply_batch);
+    ShardingTopologyChanged(&redis_raft);
+}
+
+/* Merge the hash slot of a key into 'slot', returns false on a cross-slot
+ * violation. */
+static bool mergeKeyHashSlot(RedisModuleString *key, int *slot)
+{
+    int thisslot = (int) keyHashSlotRedisString(key);
+
+    if (*slot == -1) {
+        /* First key */
+        *slot = thisslot;
+    }
+
+    return *slot == thisslot;
 }
 
 /* Compute the hash slot for a RaftRedisCommandArray list of commands and update
  * the entry or reply with an error or if it can't be done
+ *
+ * Keys are located with the key positions of the cached command spec. Only
+ * commands with keys at variable positions or with subcommands need
+ * RedisModule_GetCommandKeys().
  */
 RRStatus HashSlotCompute(RedisRaftCtx *rr,
                          RaftRedisCommandArray *cmds,
@@ -1145,23 +1544,32 @@ RRStatus HashSlotCompute(RedisRaftCtx *rr,
     *slot = -1;
     for (int i = 0; i < cmds->len; i++) {
         RaftRedisCommand *cmd = cmds->commands[i];
+        const CommandSpec *cs = CommandSpecTableGetCommandSpec(rr->commands_spec_table,
+                                                               rr->subcommand_spec_tables, cmd);
+
+        if (cs && cs->fixed_keys) {
+            if (cs->first_key == 0) {
+                continue;
+            }
+
+            int last = cs->last_key < 0 ? cmd->argc + cs->last_key : cs->last_key;
+            if (last >= cmd->argc) {
+                last = cmd->argc - 1;
+            }
+
+            if (!keyHashSlotArgv(cmd->argv, cs->first_key, last, cs->key_step, slot)) {
+                return RR_ERROR;
+            }
+            continue;
+        }
 
         /* Iterate command keys */
         int num_keys = 0;
         int *keyindex = RedisModule_GetCommandKeys(rr->ctx, cmd->argv, cmd->argc, &num_keys);
         for (int j = 0; j < num_keys; j++) {
-            RedisModuleString *key = cmd->argv[keyindex[j]];
-
-            int thisslot = (int) keyHashSlotRedisString(key);
-
-            if (*slot == -1) {
-                /* First key */
-                *slot = thisslot;
-            } else {
-                if (*slot != thisslot) {
-                    RedisModule_Free(keyindex);
-                    return RR_ERROR;
-                }
+            if (!mergeKeyHashSlot(cmd->argv[keyindex[j]], slot)) {
+                RedisModule_Free(keyindex);
+                return RR_ERROR;
             }
         }
 
@@ -1171,9 +1579,163 @@ RRStatus HashSlotCompute(RedisRaftCtx *rr,
     return RR_OK;
 }
 
+/* -----------------------------------------------------------------------------
+ * Topology replies
+ *
+ * CLUSTER SLOTS, NODES and SHARDS replies only change when shardgroups, the
+ * cluster membership, the leader or the term change. Each of them is rendered
+ * once per topology epoch and served from the cache until then, so clients
+ * refreshing the topology after every MOVED don't rebuild it on each call.
+ *
+ * Modules can't reply with raw RESP, so SLOTS and SHARDS are cached as the
+ * list of their reply elements and replayed. NODES is a single bulk string.
+ * -------------------------------------------------------------------------- */
+
+enum {
+    TOPOLOGY_REPLY_ARRAY,
+    TOPOLOGY_REPLY_NULL_ARRAY,
+    TOPOLOGY_REPLY_MAP,
+    TOPOLOGY_REPLY_INTEGER,
+    TOPOLOGY_REPLY_STRING,
+};
+
+typedef struct TopologyReplyElem {
+    int type;
+    long long value; /* Integer, number of elements or length of a string */
+    size_t offset;   /* Offset of a string in the buffer */
+} TopologyReplyElem;
+
+typedef struct TopologyReply {
+    TopologyReplyElem *elems;
+    size_t len;
+    size_t size;
+    char *buf; /* Strings of the reply */
+    size_t buf_len;
+    size_t buf_size;
+} TopologyReply;
+
+static TopologyReply *topologyReplyCreate(void)
+{
+    return RedisModule_Calloc(1, sizeof(TopologyReply));
+}
+
+static void topologyReplyFree(TopologyReply *r)
+{
+    if (!r) {
+        return;
+    }
+
+    RedisModule_Free(r->elems);
+    RedisModule_Free(r->buf);
+    RedisModule_Free(r);
+}
+
+/* Appends an element and returns its index, to set the length of arrays and
+ * maps once their elements are known. */
+static size_t topologyReplyAdd(TopologyReply *r, int type, long long value)
+{
+    if (r->len == r->size) {
+        r->size = r->size ? r->size * 2 : 64;
+        r->elems = RedisModule_Realloc(r->elems, r->size * sizeof(*r->elems));
+    }
+
+    r->elems[r->len] = (TopologyReplyElem){.type = type, .value = value};
+    return r->len++;
+}
+
+static void topologyReplyString(TopologyReply *r, const char *str)
+{
+    size_t len = strlen(str);
+    size_t idx = topologyReplyAdd(r, TOPOLOGY_REPLY_STRING, (long long) len);
+
+    if (r->buf_len + len > r->buf_size) {
+        r->buf_size = (r->buf_len + len) * 2;
+        r->buf = RedisModule_Realloc(r->buf, r->buf_size);
+    }
+
+    memcpy(r->buf + r->buf_len, str, len);
+    r->elems[idx].offset = r->buf_len;
+    r->buf_len += len;
+}
+
+static void topologyReplySend(RedisModuleCtx *ctx, TopologyReply *r)
+{
+    for (size_t i = 0; i < r->len; i++) {
+        TopologyReplyElem *e = &r->elems[i];
+
+        switch (e->type) {
+            case TOPOLOGY_REPLY_ARRAY:
+                RedisModule_ReplyWithArray(ctx, e->value);
+                break;
+            case TOPOLOGY_REPLY_NULL_ARRAY:
+                RedisModule_ReplyWithNullArray(ctx);
+                break;
+            case TOPOLOGY_REPLY_MAP:
+                RedisModule_ReplyWithMap(ctx, e->value);
+                break;
+            case TOPOLOGY_REPLY_INTEGER:
+                RedisModule_ReplyWithLongLong(ctx, e->value);
+                break;
+            case TOPOLOGY_REPLY_STRING:
+                RedisModule_ReplyWithStringBuffer(ctx, r->buf + e->offset, e->value);
+                break;
+            default:
+                PANIC("Unknown topology reply element type %d", e->type);
+        }
+    }
+}
+
+void TopologyCacheInit(TopologyCache *tc)
+{
+    *tc = (TopologyCache){.epoch = 1};
+}
+
+static void dropTopologyReplies(TopologyCache *tc)
+{
+    if (tc->nodes) {
+        RedisModule_FreeString(NULL, tc->nodes);
+        tc->nodes = NULL;
+    }
+
+    topologyReplyFree(tc->slots);
+    tc->slots = NULL;
+
+    topologyReplyFree(tc->shards);
+    tc->shards = NULL;
+}
+
+void TopologyCacheFree(TopologyCache *tc)
+{
+    dropTopologyReplies(tc);
+}
+
+/* Called when shardgroups, the membership or node addresses change, cached
+ * replies are rendered again on the next CLUSTER command. */
+void ShardingTopologyChanged(RedisRaftCtx *rr)
+{
+    rr->topology_cache.epoch++;
+}
+
+/* Drops cached replies rendered with another epoch, leader or term */
+static void validateTopologyCache(RedisRaftCtx *rr)
+{
+    TopologyCache *tc = &rr->topology_cache;
+    raft_node_id_t leader_id = raft_get_leader_id(rr->raft);
+    raft_term_t term = raft_get_current_term(rr->raft);
+
+    if (tc->cached_epoch == tc->epoch && tc->leader_id == leader_id && tc->term == term) {
+        return;
+    }
+
+    dropTopologyReplies(tc);
+    tc->cached_epoch = tc->epoch;
+    tc->leader_id = leader_id;
+    tc->term = term;
+}
+
 /* Produces a CLUSTER SLOTS compatible reply entry for the specified local cluster node.
  */
-static int addClusterSlotNodeReply(RedisRaftCtx *rr, RedisModuleCtx *ctx, raft_node_t *raft_node)
+static int addClusterSlotNodeReply(RedisRaftCtx *rr, TopologyReply *r, raft_node_t *raft_node)
 {
     Node *node = raft_node_get_udata(raft_node);
     NodeAddr *addr;
@@ -1196,19 +1758,19 @@ static int addClusterSlotNodeReply(RedisRaftCtx *rr, RedisModuleCtx *ctx, raft_n
      * 3) Node ID
      */
 
-    RedisModule_ReplyWithArray(ctx, 3);
-    RedisModule_ReplyWithCString(ctx, addr->host);
-    RedisModule_ReplyWithLongLong(ctx, addr->port);
+    topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, 3);
+    topologyReplyString(r, addr->host);
+    topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, addr->port);
 
     raftNodeToString(node_id, rr->meta.dbid, raft_node);
-    RedisModule_ReplyWithCString(ctx, node_id);
+    topologyReplyString(r, node_id);
 
     return 1;
 }
 
 /* Produce a CLUSTER SLOTS compatible reply entry for the specified shardgroup node.
  */
-static int addClusterSlotShardGroupNodeReply(RedisRaftCtx *rr, RedisModuleCtx *ctx, ShardGroupNode *sgn)
+static int addClusterSlotShardGroupNodeReply(RedisRaftCtx *rr, TopologyReply *r, ShardGroupNode *sgn)
 {
     UNUSED(rr);
 
@@ -1218,10 +1780,10 @@ static int addClusterSlotShardGroupNodeReply(RedisRaftCtx *rr, RedisModuleCtx *c
      * 3) Node ID
      */
 
-    RedisModule_ReplyWithArray(ctx, 3);
-    RedisModule_ReplyWithCString(ctx, sgn->addr.host);
-    RedisModule_ReplyWithLongLong(ctx, sgn->addr.port);
-    RedisModule_ReplyWithCString(ctx, sgn->node_id);
+    topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, 3);
+    topologyReplyString(r, sgn->addr.host);
+    topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, sgn->addr.port);
+    topologyReplyString(r, sgn->node_id);
 
     return 1;
 }
@@ -1406,11 +1968,11 @@ static void addClusterNodeReplyFromNode(RedisRaftCtx *rr,
  * 2. All configured shardgroups with their slot ranges and nodes.
  */
 
-static void addClusterNodesReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
+static RedisModuleString *renderClusterNodes(RedisRaftCtx *rr)
 {
     ShardingInfo *si = rr->sharding_info;
 
-    RedisModuleString *ret = RedisModule_CreateString(ctx, "", 0);
+    RedisModuleString *ret = RedisModule_CreateString(NULL, "", 0);
 
     if (si->shard_group_map != NULL) {
         size_t key_len;
@@ -1418,7 +1980,7 @@ static void addClusterNodesReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
 
         RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(si->shard_group_map, "^", NULL, 0);
         while (RedisModule_DictNextC(iter, &key_len, (void **) &sg) != NULL) {
-            RedisModuleString *slots = generateSlots(ctx, sg);
+            RedisModuleString *slots = generateSlots(NULL, sg);
 
             if (sg->local) {
                 for (int j = 0; j < raft_get_num_nodes(rr->raft); j++) {
@@ -1444,14 +2006,13 @@ static void addClusterNodesReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
                     RedisModule_StringAppendBuffer(NULL, ret, "\n", 1);
                 }
             }
-            RedisModule_FreeString(ctx, slots);
+            RedisModule_FreeString(NULL, slots);
         }
 
         RedisModule_DictIteratorStop(iter);
     }
 
-    RedisModule_ReplyWithString(ctx, ret);
-    RedisModule_FreeString(ctx, ret);
+    return ret;
 }
 
 /* Produce a CLUSTER SLOTS compatible reply, including:
@@ -1460,14 +2021,15 @@ static void addClusterNodesReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
  * 2. All configured shardgroups with their slot ranges and nodes.
  */
 
-static void addClusterSlotsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
+static TopologyReply *renderClusterSlots(RedisRaftCtx *rr)
 {
     raft_node_t *leader = raft_get_leader_node(rr->raft);
     ShardingInfo *si = rr->sharding_info;
+    TopologyReply *r = topologyReplyCreate();
 
     if (!si->shard_group_map) {
-        RedisModule_ReplyWithArray(ctx, 0);
-        return;
+        topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, 0);
+        return r;
     }
 
     /* Count slots and initiate array reply */
@@ -1475,7 +2037,7 @@ static void addClusterSlotsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
     size_t key_len;
     ShardGroup *sg;
 
-    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+    size_t slots_idx = topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, 0);
 
     /* Return array elements */
     RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(si->shard_group_map, "^", NULL, 0);
@@ -1486,12 +2048,12 @@ static void addClusterSlotsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
             }
             num_slots += 1;
 
-            RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+            size_t slot_idx = topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, 0);
 
             int slot_len = 0;
 
-            RedisModule_ReplyWithLongLong(ctx, sg->slot_ranges[i].start_slot); /* Start slot */
-            RedisModule_ReplyWithLongLong(ctx, sg->slot_ranges[i].end_slot);   /* End slot */
+            topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, sg->slot_ranges[i].start_slot); /* Start slot */
+            topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, sg->slot_ranges[i].end_slot);   /* End slot */
             slot_len += 2;
 
             /* Dump Raft nodes now. Leader (master) first, followed by others */
@@ -1501,7 +2063,7 @@ static void addClusterSlotsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
                  * come from the ShardGroup.
                  */
 
-                slot_len += addClusterSlotNodeReply(rr, ctx, leader);
+                slot_len += addClusterSlotNodeReply(rr, r, leader);
                 for (int j = 0; j < raft_get_num_nodes(rr->raft); j++) {
                     raft_node_t *raft_node = raft_get_node_from_idx(rr->raft, j);
                     if (raft_node_get_id(raft_node) == raft_get_leader_id(rr->raft) ||
@@ -1509,7 +2071,7 @@ static void addClusterSlotsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
                         continue;
                     }
 
-                    slot_len += addClusterSlotNodeReply(rr, ctx, raft_node);
+                    slot_len += addClusterSlotNodeReply(rr, r, raft_node);
                 }
             } else {
                 /* Remote cluster: we simply dump what the ShardGroup configuration
@@ -1517,43 +2079,45 @@ static void addClusterSlotsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
                  */
 
                 for (unsigned int j = 0; j < sg->nodes_num; j++) {
-                    slot_len += addClusterSlotShardGroupNodeReply(rr, ctx, &sg->nodes[j]);
+                    slot_len += addClusterSlotShardGroupNodeReply(rr, r, &sg->nodes[j]);
                 }
             }
 
-            RedisModule_ReplySetArrayLength(ctx, slot_len);
+            r->elems[slot_idx].value = slot_len;
         }
     }
 
     RedisModule_DictIteratorStop(iter);
-    RedisModule_ReplySetArrayLength(ctx, num_slots);
+    r->elems[slots_idx].value = num_slots;
+
+    return r;
 }
 
-static void addClusterShardsNodeReply(RedisRaftCtx *rr, RedisModuleCtx *ctx, char *id, uint16_t port, char *host, char *role)
+static void addClusterShardsNodeReply(RedisRaftCtx *rr, TopologyReply *r, char *id, uint16_t port, char *host, char *role)
 {
-    RedisModule_ReplyWithMap(ctx, 7);
-    RedisModule_ReplyWithCString(ctx, "id");
-    RedisModule_ReplyWithCString(ctx, id);
+    topologyReplyAdd(r, TOPOLOGY_REPLY_MAP, 7);
+    topologyReplyString(r, "id");
+    topologyReplyString(r, id);
     if (!rr->config.tls_enabled) {
-        RedisModule_ReplyWithCString(ctx, "port");
-        RedisModule_ReplyWithLongLong(ctx, port);
+        topologyReplyString(r, "port");
+        topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, port);
     } else {
-        RedisModule_ReplyWithCString(ctx, "tls-port");
-        RedisModule_ReplyWithLongLong(ctx, port);
-    }
-    RedisModule_ReplyWithCString(ctx, "ip");
-    RedisModule_ReplyWithCString(ctx, host);
-    RedisModule_ReplyWithCString(ctx, "endpoint");
-    RedisModule_ReplyWithCString(ctx, host);
-    RedisModule_ReplyWithCString(ctx, "role");
-    RedisModule_ReplyWithCString(ctx, role);
-    RedisModule_ReplyWithCString(ctx, "replication-offset");
-    RedisModule_ReplyWithLongLong(ctx, 0);
-    RedisModule_ReplyWithCString(ctx, "health");
-    RedisModule_ReplyWithCString(ctx, "online");
+        topologyReplyString(r, "tls-port");
+        topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, port);
+    }
+    topologyReplyString(r, "ip");
+    topologyReplyString(r, host);
+    topologyReplyString(r, "endpoint");
+    topologyReplyString(r, host);
+    topologyReplyString(r, "role");
+    topologyReplyString(r, role);
+    topologyReplyString(r, "replication-offset");
+    topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, 0);
+    topologyReplyString(r, "health");
+    topologyReplyString(r, "online");
 }
 
-static int addClusterShardsLocalNodeReply(RedisRaftCtx *rr, RedisModuleCtx *ctx, raft_node_t *raft_node, raft_node_t *leader)
+static int addClusterShardsLocalNodeReply(RedisRaftCtx *rr, TopologyReply *r, raft_node_t *raft_node, raft_node_t *leader)
 {
     Node *node = raft_node_get_udata(raft_node);
     NodeAddr *addr;
@@ -1575,35 +2139,36 @@ static int addClusterShardsLocalNodeReply(RedisRaftCtx *rr, RedisModuleCtx *ctx,
     char node_id[RAFT_SHARDGROUP_NODEID_LEN + 1];
     raftNodeToString(node_id, rr->meta.dbid, raft_node);
 
-    addClusterShardsNodeReply(rr, ctx, node_id, addr->port, addr->host, role);
+    addClusterShardsNodeReply(rr, r, node_id, addr->port, addr->host, role);
 
     return 1;
 }
 
-static void addClusterShardsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
+static TopologyReply *renderClusterShards(RedisRaftCtx *rr)
 {
     raft_node_t *leader = raft_get_leader_node(rr->raft);
     ShardingInfo *si = rr->sharding_info;
+    TopologyReply *r = topologyReplyCreate();
 
     if (!si->shard_group_map) {
-        RedisModule_ReplyWithNullArray(ctx);
-        return;
+        topologyReplyAdd(r, TOPOLOGY_REPLY_NULL_ARRAY, 0);
+        return r;
     }
 
     int shard_count = 0;
     size_t key_len;
     ShardGroup *sg;
 
-    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_LEN);
+    size_t shards_idx = topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, 0);
     RedisModuleDictIter *iter = RedisModule_DictIteratorStartC(si->shard_group_map, "^", NULL, 0);
     while (RedisModule_DictNextC(iter, &key_len, (void **) &sg) != NULL) {
         shard_count++;
 
-        RedisModule_ReplyWithMap(ctx, 2);
-        RedisModule_ReplyWithCString(ctx, "slots");
+        topologyReplyAdd(r, TOPOLOGY_REPLY_MAP, 2);
+        topologyReplyString(r, "slots");
 
         int slot_count = 0;
-        RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_LEN);
+        size_t slots_idx = topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, 0);
         for (unsigned int i = 0; i < sg->slot_ranges_num; i++) {
             /* we only include slot ranges for a shard that are stable / migration */
             SlotRangeType type = sg->slot_ranges[i].type;
@@ -1611,39 +2176,41 @@ static void addClusterShardsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
                 continue;
             }
             slot_count += 1;
-            RedisModule_ReplyWithLongLong(ctx, sg->slot_ranges[i].start_slot);
-            RedisModule_ReplyWithLongLong(ctx, sg->slot_ranges[i].end_slot);
+            topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, sg->slot_ranges[i].start_slot);
+            topologyReplyAdd(r, TOPOLOGY_REPLY_INTEGER, sg->slot_ranges[i].end_slot);
         }
-        RedisModule_ReplySetArrayLength(ctx, slot_count * 2);
+        r->elems[slots_idx].value = slot_count * 2;
 
-        RedisModule_ReplyWithCString(ctx, "nodes");
+        topologyReplyString(r, "nodes");
         if (sg->local) {
             int node_count = 0;
-            RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_LEN);
+            size_t nodes_idx = topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, 0);
 
             for (int j = 0; j < raft_get_num_nodes(rr->raft); j++) {
                 raft_node_t *raft_node = raft_get_node_from_idx(rr->raft, j);
                 if (!raft_node_is_active(raft_node)) {
                     continue;
                 }
-                node_count += addClusterShardsLocalNodeReply(rr, ctx, raft_node, leader);
+                node_count += addClusterShardsLocalNodeReply(rr, r, raft_node, leader);
             }
-            RedisModule_ReplySetArrayLength(ctx, node_count);
+            r->elems[nodes_idx].value = node_count;
         } else {
-            RedisModule_ReplyWithArray(ctx, sg->nodes_num);
+            topologyReplyAdd(r, TOPOLOGY_REPLY_ARRAY, sg->nodes_num);
             for (unsigned int j = 0; j < sg->nodes_num; j++) {
                 char *node_id = sg->nodes[j].node_id;
                 uint16_t port = sg->nodes[j].addr.port;
                 char *host = sg->nodes[j].addr.host;
                 char *role = (j == 0) ? "master" : "replica";
 
-                addClusterShardsNodeReply(rr, ctx, node_id, port, host, role);
+                addClusterShardsNodeReply(rr, r, node_id, port, host, role);
             }
         }
     }
 
     RedisModule_DictIteratorStop(iter);
-    RedisModule_ReplySetArrayLength(ctx, shard_count);
+    r->elems[shards_idx].value = shard_count;
+
+    return r;
 }
 
 /* Process CLUSTER commands, as intercepted earlier by the Raft module.
@@ -1652,6 +2219,9 @@ static void addClusterShardsReply(RedisRaftCtx *rr, RedisModuleCtx *ctx)
  *   - SLOTS.
  *   - NODES.
  *   - SHARDS,
+ *
+ * Replies are served from the topology cache, and rendered only if the
+ * topology changed since they were last rendered.
  */
 void ShardingHandleClusterCommand(RedisRaftCtx *rr, RedisModuleCtx *ctx,
                                   RaftRedisCommand *cmd)
@@ -1666,15 +2236,36 @@ void ShardingHandleClusterCommand(RedisRaftCtx *rr, RedisModuleCtx *ctx,
         return;
     }
 
+    TopologyCache *tc = &rr->topology_cache;
     size_t cmd_len;
     const char *cmd_str = RedisModule_StringPtrLen(cmd->argv[1], &cmd_len);
 
+    validateTopologyCache(rr);
+
     if (cmd_len == 5 && !strncasecmp(cmd_str, "SLOTS", 5)) {
-        addClusterSlotsReply(rr, ctx);
+        if (!tc->slots) {
+            tc->slots = renderClusterSlots(rr);
+            tc->renders++;
+        } else {
+            tc->hits++;
+        }
+        topologyReplySend(ctx, tc->slots);
     } else if (cmd_len == 5 && !strncasecmp(cmd_str, "NODES", 5)) {
-        addClusterNodesReply(rr, ctx);
+        if (!tc->nodes) {
+            tc->nodes = renderClusterNodes(rr);
+            tc->renders++;
+        } else {
+            tc->hits++;
+        }
+        RedisModule_ReplyWithString(ctx, tc->nodes);
     } else if (cmd_len == 6 && !strncasecmp(cmd_str, "SHARDS", 6)) {
-        addClusterShardsReply(rr, ctx);
+        if (!tc->shards) {
+            tc->shards = renderClusterShards(rr);
+            tc->renders++;
+        } else {
+            tc->hits++;
+        }
+        topologyReplySend(ctx, tc->shards);
     } else {
         RedisModule_ReplyWithError(ctx, "ERR Unknown subcommand.");
     }
@@ -1804,15 +2395,54 @@ void ShardGroupLink(RedisRaftCtx *rr,
                           rr->config.cluster_user, rr->config.cluster_password);
 }
 
-void ShardGroupGet(RedisRaftCtx *rr, RedisModuleCtx *ctx)
+/* Version of the local shardgroup configuration, as returned by
+ * RAFT.SHARDGROUP GET IF-NEWER.
+ *
+ * The topology epoch changes whenever shardgroups or membership change, but
+ * it is local to this process. A term has a single leader, so the term and
+ * the leader's epoch together make a version that only grows, even if the
+ * leader changes. A leader change makes the version newer even if the
+ * configuration is unchanged, which only costs one full reply.
+ */
+static unsigned long long shardGroupConfigVersion(RedisRaftCtx *rr)
+{
+    return ((unsigned long long) raft_get_current_term(rr->raft) << 32) |
+           (rr->topology_cache.epoch & 0xffffffff);
+}
+
+void ShardGroupGet(RedisRaftCtx *rr, RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
     ShardGroup *sg = GetShardGroupById(rr, rr->meta.dbid);
+    unsigned long long version = shardGroupConfigVersion(rr);
+    bool if_newer = false;
+
+    if (argc == 4) {
+        long long known;
+
+        if (strcasecmp(RedisModule_StringPtrLen(argv[2], NULL), "IF-NEWER") != 0) {
+            RedisModule_ReplyWithError(ctx, "ERR syntax error");
+            return;
+        }
+
+        if (RedisModule_StringToLongLong(argv[3], &known) != REDISMODULE_OK || known < 0) {
+            RedisModule_ReplyWithError(ctx, "ERR invalid version");
+            return;
+        }
+
+        if (version <= (unsigned long long) known) {
+            RedisModule_ReplyWithNull(ctx);
+            return;
+        }
+
+        if_newer = true;
+    }
 
     /* 2 arrays
      * 1. slot ranges -> each element is a 3 element array start/end/type
      * 2. nodes -> each element is a 2 element array id/address
+     * and the version, if requested with IF-NEWER.
      */
-    RedisModule_ReplyWithArray(ctx, 3);
+    RedisModule_ReplyWithArray(ctx, if_newer ? 4 : 3);
     RedisModule_ReplyWithCString(ctx, redis_raft.snapshot_info.dbid);
     RedisModule_ReplyWithArray(ctx, sg->slot_ranges_num);
 
@@ -1858,6 +2488,10 @@ void ShardGroupGet(RedisRaftCtx *rr, RedisModuleCtx *ctx)
     }
 
     RedisModule_ReplySetArrayLength(ctx, node_count);
+
+    if (if_newer) {
+        RedisModule_ReplyWithLongLong(ctx, (long long) version);
+    }
 }
 
 void ShardGroupAdd(RedisRaftCtx *rr,
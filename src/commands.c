@@ -10,12 +10,18 @@
 #include <string.h>
 #include <strings.h>
 
-static const CommandSpec clientCommands[] = {
+/* Static part of a CommandSpec */
+typedef struct {
+    char *name;
+    unsigned int flags;
+} CommandSpecDef;
+
+static const CommandSpecDef clientCommands[] = {
     {"unblock", 0},
     {NULL,      0},
 };
 
-static const CommandSpec commands[] = {
+static const CommandSpecDef commands[] = {
   /* Core Redis Commands */
     {"time",                        CMD_SPEC_DONT_INTERCEPT | CMD_SPEC_RANDOM    },
     {"sync",                        CMD_SPEC_UNSUPPORTED                         },
@@ -88,6 +94,7 @@ static const CommandSpec commands[] = {
  /* RedisRaft Commands */
     {"raft",                        CMD_SPEC_DONT_INTERCEPT                      },
     {"raft.entry",                  CMD_SPEC_DONT_INTERCEPT                      },
+    {"raft.entries",                CMD_SPEC_DONT_INTERCEPT                      },
     {"raft.cluster",                CMD_SPEC_DONT_INTERCEPT                      },
     {"raft.shardgroup",             CMD_SPEC_DONT_INTERCEPT                      },
     {"raft.node",                   CMD_SPEC_DONT_INTERCEPT                      },
@@ -102,10 +109,193 @@ static const CommandSpec commands[] = {
     {"raft._reject_random_command", CMD_SPEC_DONT_INTERCEPT                      },
     {"raft.import",                 CMD_SPEC_DONT_INTERCEPT                      },
     {"raft.scan",                   CMD_SPEC_READONLY                            },
+    {"raft.migrate",                CMD_SPEC_DONT_INTERCEPT                      },
+    {"raft.stats",                  CMD_SPEC_DONT_INTERCEPT                      },
+    {"raft.log",                    CMD_SPEC_DONT_INTERCEPT                      },
     {"client",                      CMD_SPEC_SUBCOMMAND | CMD_SPEC_DONT_INTERCEPT},
     {NULL,                          0                                            }
 };
 
+/* Command spec index
+ *
+ * Commands are looked up for every client request, so once a table is built,
+ * it is indexed with a perfect hash (hash and displace): names are hashed into
+ * buckets, and each bucket gets its own hash seed that maps all of its names
+ * to free slots. A lookup hashes the name twice and compares it with a single
+ * CommandSpec, without any allocation. Names are hashed case-insensitively.
+ *
+ * If no seed is found for a bucket, the table grows. If that fails too, the
+ * table is left without an index and lookups use the dict.
+ */
+
+#define SPEC_INDEX_MAX_SEED    1024
+#define SPEC_INDEX_MAX_RETRIES 4
+
+static unsigned long spec_table_version;
+
+static uint32_t specHash(const char *s, size_t len, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) tolower((unsigned char) s[i]);
+        h *= 16777619u;
+    }
+
+    /* murmur3 finalizer */
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static void freeIndex(CommandSpecTable *cmd_spec_table)
+{
+    RedisModule_Free(cmd_spec_table->index);
+    RedisModule_Free(cmd_spec_table->displacements);
+    cmd_spec_table->index = NULL;
+    cmd_spec_table->displacements = NULL;
+    cmd_spec_table->index_mask = 0;
+    cmd_spec_table->buckets_mask = 0;
+}
+
+static bool tryBuildIndex(CommandSpecTable *t, CommandSpec **specs, uint32_t n,
+                          uint32_t slots_num, uint32_t buckets_num)
+{
+    uint32_t *counts = RedisModule_Calloc(buckets_num + 1, sizeof(uint32_t));
+    uint32_t *members = RedisModule_Alloc(n * sizeof(uint32_t));
+    uint32_t *bucket_of = RedisModule_Alloc(n * sizeof(uint32_t));
+    uint32_t *placed = RedisModule_Alloc(n * sizeof(uint32_t));
+    uint32_t max_count = 0;
+    bool ok = true;
+
+    t->index = RedisModule_Calloc(slots_num, sizeof(CommandSpec *));
+    t->index_mask = slots_num - 1;
+    t->displacements = RedisModule_Calloc(buckets_num, sizeof(uint32_t));
+    t->buckets_mask = buckets_num - 1;
+
+    /* Group names by bucket, counts[b + 1] is the start of bucket b + 1 */
+    for (uint32_t i = 0; i < n; i++) {
+        bucket_of[i] = specHash(specs[i]->name, strlen(specs[i]->name), 0) & t->buckets_mask;
+        counts[bucket_of[i] + 1]++;
+    }
+    for (uint32_t b = 0; b < buckets_num; b++) {
+        if (counts[b + 1] > max_count) {
+            max_count = counts[b + 1];
+        }
+        counts[b + 1] += counts[b];
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        members[counts[bucket_of[i]]++] = i;
+    }
+    for (uint32_t b = buckets_num; b > 0; b--) {
+        counts[b] = counts[b - 1];
+    }
+    counts[0] = 0;
+
+    /* Place the largest buckets first, while there's more room */
+    for (uint32_t size = max_count; size > 0 && ok; size--) {
+        for (uint32_t b = 0; b < buckets_num && ok; b++) {
+            uint32_t *m = &members[counts[b]];
+            if (counts[b + 1] - counts[b] != size) {
+                continue;
+            }
+
+            uint32_t seed;
+            for (seed = 1; seed <= SPEC_INDEX_MAX_SEED; seed++) {
+                uint32_t j;
+                for (j = 0; j < size; j++) {
+                    CommandSpec *cs = specs[m[j]];
+                    placed[j] = specHash(cs->name, strlen(cs->name), seed) & t->index_mask;
+                    if (t->index[placed[j]]) {
+                        break;
+                    }
+                    t->index[placed[j]] = cs;
+                }
+
+                if (j == size) {
+                    break;
+                }
+
+                /* Roll back */
+                while (j > 0) {
+                    t->index[placed[--j]] = NULL;
+                }
+            }
+
+            if (seed > SPEC_INDEX_MAX_SEED) {
+                ok = false;
+            } else {
+                t->displacements[b] = seed;
+            }
+        }
+    }
+
+    RedisModule_Free(counts);
+    RedisModule_Free(members);
+    RedisModule_Free(bucket_of);
+    RedisModule_Free(placed);
+
+    if (!ok) {
+        freeIndex(t);
+    }
+    return ok;
+}
+
+static void buildIndex(CommandSpecTable *cmd_spec_table)
+{
+    uint32_t n = (uint32_t) RedisModule_DictSize(cmd_spec_table->table);
+    CommandSpec **specs = RedisModule_Alloc((n + 1) * sizeof(CommandSpec *));
+    CommandSpec *cs;
+    uint32_t i = 0;
+
+    freeIndex(cmd_spec_table);
+
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(cmd_spec_table->table, "^", NULL, 0);
+    while (RedisModule_DictNextC(it, NULL, (void **) &cs) != NULL) {
+        specs[i++] = cs;
+    }
+    RedisModule_DictIteratorStop(it);
+
+    uint32_t slots_num = 8;
+    while (slots_num < 2 * n) {
+        slots_num <<= 1;
+    }
+
+    uint32_t buckets_num = 1;
+    while (buckets_num < n / 2) {
+        buckets_num <<= 1;
+    }
+
+    for (int retry = 0; retry < SPEC_INDEX_MAX_RETRIES; retry++) {
+        if (tryBuildIndex(cmd_spec_table, specs, n, slots_num, buckets_num)) {
+            break;
+        }
+        slots_num <<= 1;
+    }
+
+    if (!cmd_spec_table->index) {
+        LOG_WARNING("Failed to build command spec index, using slow lookups");
+    }
+
+    RedisModule_Free(specs);
+}
+
+static CommandSpec *indexLookup(CommandSpecTable *cmd_spec_table, const char *name, size_t len)
+{
+    uint32_t b = specHash(name, len, 0) & cmd_spec_table->buckets_mask;
+    uint32_t seed = cmd_spec_table->displacements[b];
+    CommandSpec *cs = cmd_spec_table->index[specHash(name, len, seed) & cmd_spec_table->index_mask];
+
+    if (cs && strlen(cs->name) == len && strncasecmp(cs->name, name, len) == 0) {
+        return cs;
+    }
+    return NULL;
+}
+
 /* Look up the specified command in the command spec table and return the
  * CommandSpec associated with it. If create is true, a new entry will
  * be created if one does not exist. Otherwise, NULL is returned.
@@ -114,6 +304,11 @@ static CommandSpec *getOrCreateCommandSpec(CommandSpecTable *cmd_spec_table, con
 {
     size_t cmd_len;
     const char *cmd_str = RedisModule_StringPtrLen(cmd, &cmd_len);
+
+    if (!create && cmd_spec_table->index) {
+        return indexLookup(cmd_spec_table, cmd_str, cmd_len);
+    }
+
     char buf[64];
     char *lcmd = buf;
 
@@ -128,9 +323,8 @@ static CommandSpec *getOrCreateCommandSpec(CommandSpecTable *cmd_spec_table, con
 
     CommandSpec *cs = CommandSpecTableGetC(cmd_spec_table, lcmd, cmd_len, NULL);
     if (!cs && create) {
-        cs = RedisModule_Alloc(sizeof(CommandSpec));
+        cs = RedisModule_Calloc(1, sizeof(CommandSpec));
         cs->name = RedisModule_Strdup(lcmd);
-        cs->flags = 0;
 
         int ret = CommandSpecTableSetC(cmd_spec_table, lcmd, cmd_len, cs);
         RedisModule_Assert(ret == REDISMODULE_OK);
@@ -163,6 +357,8 @@ static void populateCommandSpecFromRedis(RedisModuleCtx *ctx, CommandSpecTable *
          * "readonly" => CMD_SPEC_READONLY
          */
         const char *readonly_flag = "readonly";
+        const char *movablekeys_flag = "movablekeys";
+        bool movablekeys = false;
 
         RedisModuleCallReply *flags = RedisModule_CallReplyArrayElement(cmd, 2);
         RedisModule_Assert(flags != NULL);
@@ -178,6 +374,8 @@ static void populateCommandSpecFromRedis(RedisModuleCtx *ctx, CommandSpecTable *
 
             if (strncmp(str, readonly_flag, len) == 0) {
                 cmdspec_flags |= CMD_SPEC_READONLY;
+            } else if (strncmp(str, movablekeys_flag, len) == 0) {
+                movablekeys = true;
             }
         }
 
@@ -207,10 +405,17 @@ static void populateCommandSpecFromRedis(RedisModuleCtx *ctx, CommandSpecTable *
             }
         }
 
-        /* Ignore commands with non-default flags */
-        if (!cmdspec_flags) {
-            continue;
-        }
+        /* Arity (element #2) is used to validate commands without a dry-run.
+         * Commands with subcommands (element #10) have their own arity per
+         * subcommand, so we don't keep theirs. */
+        RedisModuleCallReply *arity = RedisModule_CallReplyArrayElement(cmd, 1);
+        RedisModule_Assert(arity != NULL);
+        RedisModule_Assert(RedisModule_CallReplyType(arity) == REDISMODULE_REPLY_INTEGER);
+
+        RedisModuleCallReply *subcommands = RedisModule_CallReplyArrayElement(cmd, 9);
+        bool has_subcommands = subcommands != NULL &&
+                               RedisModule_CallReplyType(subcommands) == REDISMODULE_REPLY_ARRAY &&
+                               RedisModule_CallReplyLength(subcommands) > 0;
 
         RedisModuleCallReply *name = RedisModule_CallReplyArrayElement(cmd, 0);
         RedisModule_Assert(name != NULL);
@@ -222,6 +427,16 @@ static void populateCommandSpecFromRedis(RedisModuleCtx *ctx, CommandSpecTable *
         RedisModule_FreeString(NULL, name_str);
 
         cs->flags |= cmdspec_flags;
+        cs->arity = has_subcommands ? 0 : (int) RedisModule_CallReplyInteger(arity);
+
+        /* First key, last key and step (elements #4 to #6) locate the keys,
+         * unless the command has subcommands or keys at variable positions
+         * ("movablekeys"). Keys are then found with RM_GetCommandKeys(). */
+        cs->first_key = (int) RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(cmd, 3));
+        cs->last_key = (int) RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(cmd, 4));
+        cs->key_step = (int) RedisModule_CallReplyInteger(RedisModule_CallReplyArrayElement(cmd, 5));
+        cs->fixed_keys = !has_subcommands && !movablekeys &&
+                         (cs->first_key == 0 || cs->key_step > 0);
     }
 
     RedisModule_FreeCallReply(reply);
@@ -236,6 +451,11 @@ static void updateIgnoredCommands(CommandSpecTable *cmd_spec_table, const char *
         int nokey = 0;
         CommandSpec *cs;
 
+        /* Command names are stored in lowercase */
+        for (char *p = tok; *p; p++) {
+            *p = (char) tolower((unsigned char) *p);
+        }
+
         cs = CommandSpecTableGetC(cmd_spec_table, tok, strlen(tok), &nokey);
         if (!nokey) {
             cs->flags |= CMD_SPEC_DONT_INTERCEPT;
@@ -252,12 +472,12 @@ static void updateIgnoredCommands(CommandSpecTable *cmd_spec_table, const char *
     RedisModule_Free(tmp);
 }
 
-static void buildCommandSpecTable(RedisModuleCtx *ctx, CommandSpecTable *cmd_spec_table, const CommandSpec *command_list, const char *ignored_commands, bool from_redis)
+static void buildCommandSpecTable(RedisModuleCtx *ctx, CommandSpecTable *cmd_spec_table, const CommandSpecDef *command_list, const char *ignored_commands, bool from_redis)
 {
     RedisModule_Assert(CommandSpecTableSize(cmd_spec_table) == 0);
 
     for (int i = 0; command_list[i].name != NULL; i++) {
-        CommandSpec *cs = RedisModule_Alloc(sizeof(*cs));
+        CommandSpec *cs = RedisModule_Calloc(1, sizeof(*cs));
         cs->name = RedisModule_Strdup(command_list[i].name);
         cs->flags = command_list[i].flags;
 
@@ -275,6 +495,9 @@ static void buildCommandSpecTable(RedisModuleCtx *ctx, CommandSpecTable *cmd_spe
     if (from_redis) {
         populateCommandSpecFromRedis(ctx, cmd_spec_table);
     }
+
+    buildIndex(cmd_spec_table);
+    cmd_spec_table->version = ++spec_table_version;
 }
 
 static void initCommandSpecTableInternals(CommandSpecTable *cmd_spec_table)
@@ -343,6 +566,8 @@ void CommandSpecTableClear(CommandSpecTable *cmd_spec_table)
 
     RedisModule_FreeDict(NULL, cmd_spec_table->table);
     cmd_spec_table->table = NULL;
+
+    freeIndex(cmd_spec_table);
 }
 
 /* Return the command spec table size */
@@ -368,58 +593,90 @@ CommandSpec *CommandSpecTableGetC(CommandSpecTable *cmd_spec_table, void *key, s
  * exists the function returns RR_ERROR. */
 RRStatus CommandSpecTableSetC(CommandSpecTable *cmd_spec_table, void *key, size_t keylen, CommandSpec *cs)
 {
+    /* The index only covers the table as it was built */
+    freeIndex(cmd_spec_table);
+
     int ret = RedisModule_DictSetC(cmd_spec_table->table, key, keylen, cs);
     return ret == REDISMODULE_OK ? RR_OK : RR_ERROR;
 }
 
 /* Look up the specified command in the command spec table and return the
- * CommandSpec associated with it, or NULL.
+ * CommandSpec associated with it, or NULL. For commands with subcommand specs,
+ * the subcommand's CommandSpec is returned if it has one.
  */
-int CommandSpecTableGetFlags(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, const RedisModuleString *cmd, const RedisModuleString *subcmd)
+const CommandSpec *CommandSpecTableLookup(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, const RedisModuleString *cmd, const RedisModuleString *subcmd)
 {
     CommandSpec *cs = getOrCreateCommandSpec(cmd_spec_table, cmd, false);
 
-    if (!cs) {
-        return -1;
-    }
-
-    int flags = cs->flags;
-
-    if (!(cs->flags & CMD_SPEC_SUBCOMMAND) || subcmd == NULL) {
-        return flags;
+    if (!cs || !(cs->flags & CMD_SPEC_SUBCOMMAND) || subcmd == NULL) {
+        return cs;
     }
 
-    /* flags are now for subcommand, so mask it out of flags */
-    flags &= ~CMD_SPEC_SUBCOMMAND; /* flags is now the default set of flags for all subcommands */
-
     CommandSpecTable *sub_cmd_spec_table = RedisModule_DictGetC(sub_command_tables, cs->name, strlen(cs->name), NULL);
     if (sub_cmd_spec_table == NULL) {
-        return flags; /* no table, return default set of flags for subcommand */
+        return cs; /* no table, use default set of flags for subcommand */
     }
 
     CommandSpec *sub_cs = getOrCreateCommandSpec(sub_cmd_spec_table, subcmd, false);
     if (sub_cs == NULL) {
-        return flags; /* command not specified in table, return default set of flags */
+        return cs; /* command not specified in table, use default set of flags */
+    }
+
+    return sub_cs;
+}
+
+/* Return the flags of a CommandSpec returned by CommandSpecTableLookup(),
+ * or -1 if it's NULL. */
+int CommandSpecGetFlags(const CommandSpec *cs, bool has_subcmd)
+{
+    if (!cs) {
+        return -1;
+    }
+
+    /* The default set of flags for all subcommands */
+    if ((cs->flags & CMD_SPEC_SUBCOMMAND) && has_subcmd) {
+        return (int) (cs->flags & ~CMD_SPEC_SUBCOMMAND);
+    }
+
+    return (int) cs->flags;
+}
+
+/* Look up the specified command in the command spec table and return its
+ * flags, or -1 if it is not found.
+ */
+int CommandSpecTableGetFlags(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, const RedisModuleString *cmd, const RedisModuleString *subcmd)
+{
+    const CommandSpec *cs = CommandSpecTableLookup(cmd_spec_table, sub_command_tables, cmd, subcmd);
+    return CommandSpecGetFlags(cs, subcmd != NULL);
+}
+
+/* Return the CommandSpec of a RaftRedisCommand. The result is cached on the
+ * command until the command spec table is rebuilt.
+ */
+const CommandSpec *CommandSpecTableGetCommandSpec(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, RaftRedisCommand *cmd)
+{
+    if (cmd->spec_version != cmd_spec_table->version) {
+        RedisModuleString *subcmd = cmd->argc > 1 ? cmd->argv[1] : NULL;
+
+        cmd->spec = CommandSpecTableLookup(cmd_spec_table, sub_command_tables, cmd->argv[0], subcmd);
+        cmd->spec_version = cmd_spec_table->version;
     }
 
-    return sub_cs->flags; /* command is in table, return its flags */
+    return cmd->spec;
 }
 
 /* For a given RaftRedisCommandArray, return a flags value that represents
  * the aggregate flags of all commands. If a command is not listed in the
- * command spec table, use default_flags.
+ * command spec table or has no flags, use default_flags.
  */
 unsigned int CommandSpecTableGetAggregateFlags(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, RaftRedisCommandArray *array, unsigned int default_flags)
 {
     unsigned int flags = 0;
     for (int i = 0; i < array->len; i++) {
-        RedisModuleString *cmd = array->commands[i]->argv[0];
-        RedisModuleString *subcmd = NULL;
-        if (array->commands[i]->argc > 1) {
-            subcmd = array->commands[i]->argv[1];
-        }
-        int flag = CommandSpecTableGetFlags(cmd_spec_table, sub_command_tables, cmd, subcmd);
-        if (flag != -1) {
+        RaftRedisCommand *cmd = array->commands[i];
+        const CommandSpec *cs = CommandSpecTableGetCommandSpec(cmd_spec_table, sub_command_tables, cmd);
+        int flag = CommandSpecGetFlags(cs, cmd->argc > 1);
+        if (flag > 0) {
             flags |= flag;
         } else {
             flags |= default_flags;
@@ -428,3 +685,68 @@ unsigned int CommandSpecTableGetAggregateFlags(CommandSpecTable *cmd_spec_table,
 
     return flags;
 }
+
+/* Dry-runs are skipped only while memory usage is below this ratio of
+ * maxmemory, so the OOM check of the dry-run could not fail. */
+#define DRY_RUN_OOM_RATIO 0.9
+
+static bool checkArity(const CommandSpec *cs, int argc)
+{
+    if (cs->arity > 0) {
+        return argc == cs->arity;
+    }
+    return cs->arity < 0 && argc >= -cs->arity;
+}
+
+/* Check if a command would be rejected because of ACL, arity or OOM before
+ * it is appended to the log. If so, the error reply is returned, otherwise
+ * NULL. The caller must free the reply.
+ *
+ * The check is a dry-run of the command through RedisModule_Call(). It's
+ * skipped if the command passed the dry-run with the same ACL before, the ACL
+ * check does not depend on the arguments, the arguments match the arity, and
+ * memory usage is not close to maxmemory. 'acl' is the cached ACL of the
+ * current user, or NULL.
+ */
+RedisModuleCallReply *CommandDryRunGetError(RedisRaftCtx *rr, RedisModuleCtx *ctx, ACLEntry *acl, RaftRedisCommand *cmd, bool check_oom)
+{
+    CommandSpecTable *table = rr->commands_spec_table;
+    const CommandSpec *cs = CommandSpecTableGetCommandSpec(table, rr->subcommand_spec_tables, cmd);
+    bool cacheable = acl && cs && checkArity(cs, cmd->argc);
+
+    if (cacheable && ACLEntryCommandAllowed(acl, cs, table->version) &&
+        (!check_oom || RedisModule_GetUsedMemoryRatio() < DRY_RUN_OOM_RATIO)) {
+        rr->dry_runs_skipped++;
+        return NULL;
+    }
+
+    rr->dry_runs++;
+
+    const char *cmdstr = RedisModule_StringPtrLen(cmd->argv[0], NULL);
+
+    enterRedisModuleCall();
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, cmdstr, check_oom ? "DCEMv" : "DCEv",
+                                                   cmd->argv + 1, cmd->argc - 1);
+    exitRedisModuleCall();
+
+    if (reply == NULL && cacheable) {
+        ACLEntrySetCommandAllowed(acl, cs, table->version);
+    }
+
+    return reply;
+}
+
+/* Same as CommandDryRunGetError(), but the error is replied and RR_ERROR is
+ * returned if the command would be rejected. */
+RRStatus CommandDryRun(RedisRaftCtx *rr, RedisModuleCtx *ctx, ACLEntry *acl, RaftRedisCommand *cmd, bool check_oom)
+{
+    RedisModuleCallReply *reply = CommandDryRunGetError(rr, ctx, acl, cmd, check_oom);
+
+    if (reply != NULL) {
+        RedisModule_ReplyWithCallReply(ctx, reply);
+        RedisModule_FreeCallReply(reply);
+        return RR_ERROR;
+    }
+
+    return RR_OK;
+}
@@ -70,13 +70,16 @@ static const char *conf_connection_timeout = "connection-timeout";
 static const char *conf_join_timeout = "join-timeout";
 static const char *conf_response_timeout = "response-timeout";
 static const char *conf_proxy_response_timeout = "proxy-response-timeout";
+static const char *conf_proxy_connections = "proxy-connections";
 static const char *conf_reconnect_interval = "reconnect-interval";
+static const char *conf_dns_cache_ttl = "dns-cache-ttl";
 static const char *conf_log_filename = "log-filename";
 static const char *conf_log_max_cache_size = "log-max-cache-size";
 static const char *conf_log_max_file_size = "log-max-file-size";
 static const char *conf_log_fsync = "log-fsync";
 static const char *conf_follower_proxy = "follower-proxy";
 static const char *conf_quorum_reads = "quorum-reads";
+static const char *conf_slot_index = "slot-index";
 static const char *conf_loglevel = "loglevel";
 static const char *conf_trace = "trace";
 static const char *conf_sharding = "sharding";
@@ -89,6 +92,10 @@ static const char *conf_append_req_max_size = "append-req-max-size";
 static const char *conf_snapshot_req_max_count = "snapshot-req-max-count";
 static const char *conf_snapshot_req_max_size = "snapshot-req-max-size";
 static const char *conf_scan_size = "scan-size";
+static const char *conf_apply_prefetch = "apply-prefetch";
+static const char *conf_write_batch_max_count = "write-batch-max-count";
+static const char *conf_write_batch_max_size = "write-batch-max-size";
+static const char *conf_slow_write_threshold = "slow-write-threshold";
 static const char *conf_tls_enabled = "tls-enabled";
 static const char *conf_cluster_user = "cluster-user";
 static const char *conf_cluster_password = "cluster-password";
@@ -397,6 +404,7 @@ static int setString(const char *name,
             *err = RedisModule_CreateStringPrintf(NULL, "Address is invalid. It must be in the form of 10.0.0.3:8000");
             return REDISMODULE_ERR;
         }
+        ShardingTopologyChanged(rr);
     } else if (strcasecmp(name, conf_slot_config) == 0) {
         if (!validSlotConfig(value)) {
             *err = RedisModule_CreateStringPrintf(NULL, "Not a valid slot config");
@@ -491,6 +499,8 @@ static int getBool(const char *name, void *privdata)
         return c->follower_proxy;
     } else if (strcasecmp(name, conf_quorum_reads) == 0) {
         return c->quorum_reads;
+    } else if (strcasecmp(name, conf_slot_index) == 0) {
+        return c->slot_index;
     } else if (strcasecmp(name, conf_sharding) == 0) {
         return c->sharding;
     } else if (strcasecmp(name, conf_external_sharding) == 0) {
@@ -557,10 +567,14 @@ static int setBool(const char *name, int val, void *pr, RedisModuleString **err)
         c->follower_proxy = val;
     } else if (strcasecmp(name, conf_quorum_reads) == 0) {
         c->quorum_reads = val;
+    } else if (strcasecmp(name, conf_slot_index) == 0) {
+        c->slot_index = val;
     } else if (strcasecmp(name, conf_sharding) == 0) {
         c->sharding = val;
+        ShardingTopologyChanged(rr);
     } else if (strcasecmp(name, conf_external_sharding) == 0) {
         c->external_sharding = val;
+        ShardingTopologyChanged(rr);
     } else if (strcasecmp(name, conf_tls_enabled) == 0) {
         const char *errmsg = handleTlsEnabled(c, val);
         if (errmsg) {
@@ -568,6 +582,7 @@ static int setBool(const char *name, int val, void *pr, RedisModuleString **err)
             return REDISMODULE_ERR;
         }
         c->tls_enabled = val;
+        ShardingTopologyChanged(rr);
     } else if (strcasecmp(name, conf_log_disable_apply) == 0) {
         if (rr->state == REDIS_RAFT_UP) {
             if (raft_config(rr->raft, 1, RAFT_CONFIG_DISABLE_APPLY, val) != 0) {
@@ -611,8 +626,12 @@ static long long getNumeric(const char *name, void *privdata)
         return c->response_timeout;
     } else if (strcasecmp(name, conf_proxy_response_timeout) == 0) {
         return c->proxy_response_timeout;
+    } else if (strcasecmp(name, conf_proxy_connections) == 0) {
+        return c->proxy_connections;
     } else if (strcasecmp(name, conf_reconnect_interval) == 0) {
         return c->reconnect_interval;
+    } else if (strcasecmp(name, conf_dns_cache_ttl) == 0) {
+        return c->dns_cache_ttl;
     } else if (strcasecmp(name, conf_log_max_file_size) == 0) {
         return (long long) c->log_max_file_size;
     } else if (strcasecmp(name, conf_log_max_cache_size) == 0) {
@@ -629,6 +648,14 @@ static long long getNumeric(const char *name, void *privdata)
         return c->snapshot_req_max_size;
     } else if (strcasecmp(name, conf_scan_size) == 0) {
         return c->scan_size;
+    } else if (strcasecmp(name, conf_apply_prefetch) == 0) {
+        return c->apply_prefetch;
+    } else if (strcasecmp(name, conf_write_batch_max_count) == 0) {
+        return c->write_batch_max_count;
+    } else if (strcasecmp(name, conf_write_batch_max_size) == 0) {
+        return c->write_batch_max_size;
+    } else if (strcasecmp(name, conf_slow_write_threshold) == 0) {
+        return c->slow_write_threshold;
     } else if (strcasecmp(name, conf_log_delay_apply) == 0) {
         return c->log_delay_apply;
     } else if (strcasecmp(name, conf_snapshot_delay) == 0) {
@@ -687,8 +714,12 @@ static int setNumeric(const char *name, long long val, void *priv,
         c->response_timeout = (int) val;
     } else if (strcasecmp(name, conf_proxy_response_timeout) == 0) {
         c->proxy_response_timeout = (int) val;
+    } else if (strcasecmp(name, conf_proxy_connections) == 0) {
+        c->proxy_connections = (int) val;
     } else if (strcasecmp(name, conf_reconnect_interval) == 0) {
         c->reconnect_interval = (int) val;
+    } else if (strcasecmp(name, conf_dns_cache_ttl) == 0) {
+        c->dns_cache_ttl = (int) val;
     } else if (strcasecmp(name, conf_log_max_cache_size) == 0) {
         c->log_max_cache_size = val;
     } else if (strcasecmp(name, conf_log_max_file_size) == 0) {
@@ -705,6 +736,14 @@ static int setNumeric(const char *name, long long val, void *priv,
         c->snapshot_req_max_size = val;
     } else if (strcasecmp(name, conf_scan_size) == 0) {
         c->scan_size = val;
+    } else if (strcasecmp(name, conf_apply_prefetch) == 0) {
+        c->apply_prefetch = val;
+    } else if (strcasecmp(name, conf_write_batch_max_count) == 0) {
+        c->write_batch_max_count = val;
+    } else if (strcasecmp(name, conf_write_batch_max_size) == 0) {
+        c->write_batch_max_size = val;
+    } else if (strcasecmp(name, conf_slow_write_threshold) == 0) {
+        c->slow_write_threshold = val;
     } else if (strcasecmp(name, conf_log_delay_apply) == 0) {
         c->log_delay_apply = val;
     } else if (strcasecmp(name, conf_snapshot_delay) == 0) {
@@ -816,7 +855,9 @@ RRStatus ConfigInit(RedisModuleCtx *ctx, RedisRaftConfig *c)
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_join_timeout,               120000,           REDISMODULE_CONFIG_DEFAULT,   1, INT_MAX,   getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_response_timeout,           1000,             REDISMODULE_CONFIG_DEFAULT,   1, INT_MAX,   getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_proxy_response_timeout,     10000,            REDISMODULE_CONFIG_DEFAULT,   1, INT_MAX,   getNumeric, setNumeric, NULL, c);
+    ret |= RedisModule_RegisterNumericConfig(ctx, conf_proxy_connections,          2,                REDISMODULE_CONFIG_DEFAULT,   1, 64,        getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_reconnect_interval,         100,              REDISMODULE_CONFIG_DEFAULT,   1, INT_MAX,   getNumeric, setNumeric, NULL, c);
+    ret |= RedisModule_RegisterNumericConfig(ctx, conf_dns_cache_ttl,              30000,            REDISMODULE_CONFIG_DEFAULT,   0, INT_MAX,   getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_shardgroup_update_interval, 5000,             REDISMODULE_CONFIG_DEFAULT,   1, INT_MAX,   getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_append_req_max_count,       2,                REDISMODULE_CONFIG_DEFAULT,   1, INT_MAX,   getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_append_req_max_size,        2097152,          REDISMODULE_CONFIG_MEMORY,    1, INT_MAX,   getNumeric, setNumeric, NULL, c);
@@ -825,6 +866,10 @@ RRStatus ConfigInit(RedisModuleCtx *ctx, RedisRaftConfig *c)
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_log_max_cache_size,         64000000,         REDISMODULE_CONFIG_MEMORY,    0, LLONG_MAX, getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_log_max_file_size,          128000000,        REDISMODULE_CONFIG_MEMORY,    0, LLONG_MAX, getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_scan_size,                  1000,             REDISMODULE_CONFIG_DEFAULT,   1, LLONG_MAX, getNumeric, setNumeric, NULL, c);
+    ret |= RedisModule_RegisterNumericConfig(ctx, conf_apply_prefetch,             256,              REDISMODULE_CONFIG_DEFAULT,   0, INT_MAX,   getNumeric, setNumeric, NULL, c);
+    ret |= RedisModule_RegisterNumericConfig(ctx, conf_write_batch_max_count,      64,               REDISMODULE_CONFIG_DEFAULT,   1, INT_MAX,   getNumeric, setNumeric, NULL, c);
+    ret |= RedisModule_RegisterNumericConfig(ctx, conf_write_batch_max_size,       65536,            REDISMODULE_CONFIG_MEMORY,    1, INT_MAX,   getNumeric, setNumeric, NULL, c);
+    ret |= RedisModule_RegisterNumericConfig(ctx, conf_slow_write_threshold,       0,                REDISMODULE_CONFIG_DEFAULT,   0, LLONG_MAX, getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_log_delay_apply,            0,                REDISMODULE_CONFIG_HIDDEN,    0, LLONG_MAX, getNumeric, setNumeric, NULL, c);
     ret |= RedisModule_RegisterNumericConfig(ctx, conf_snapshot_delay,             0,                REDISMODULE_CONFIG_HIDDEN,    0, LLONG_MAX, getNumeric, setNumeric, NULL, c);
 
@@ -832,6 +877,7 @@ RRStatus ConfigInit(RedisModuleCtx *ctx, RedisRaftConfig *c)
     ret |= RedisModule_RegisterBoolConfig(ctx,    conf_log_fsync,                  true,             REDISMODULE_CONFIG_DEFAULT,                 getBool,    setBool,    NULL, c);
     ret |= RedisModule_RegisterBoolConfig(ctx,    conf_follower_proxy,             false,            REDISMODULE_CONFIG_DEFAULT,                 getBool,    setBool,    NULL, c);
     ret |= RedisModule_RegisterBoolConfig(ctx,    conf_quorum_reads,               true,             REDISMODULE_CONFIG_DEFAULT,                 getBool,    setBool,    NULL, c);
+    ret |= RedisModule_RegisterBoolConfig(ctx,    conf_slot_index,                 false,            REDISMODULE_CONFIG_DEFAULT,                 getBool,    setBool,    NULL, c);
     ret |= RedisModule_RegisterBoolConfig(ctx,    conf_sharding,                   false,            REDISMODULE_CONFIG_DEFAULT,                 getBool,    setBool,    NULL, c);
     ret |= RedisModule_RegisterBoolConfig(ctx,    conf_external_sharding,          false,            REDISMODULE_CONFIG_DEFAULT,                 getBool,    setBool,    NULL, c);
     ret |= RedisModule_RegisterBoolConfig(ctx,    conf_tls_enabled,                false,            REDISMODULE_CONFIG_DEFAULT,                 getBool,    setBool,    NULL, c);
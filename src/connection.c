@@ -275,36 +275,29 @@ static void handleDisconnected(const redisAsyncContext *c, int status)
     }
 }
 
-/* Callback for ConnGetAddrinfo(). This will be called from Redis thread. */
-static void handleResolved(void *arg)
+/* Called once the host of the connection is resolved, from the Redis thread.
+ * 'rc' is the getaddrinfo() result and 'ipaddr' the address to connect to.
+ */
+static void handleResolved(Connection *conn, int rc, const char *ipaddr)
 {
-    Connection *conn = arg;
-
     CONN_TRACE(conn, "handleResolved: flags=%d, state=%s, rc=%p",
                conn->flags,
                ConnStateStr[conn->state],
                conn->rc);
 
-    struct AddrinfoResult *res = &conn->addrinfo_result;
-
     /* If flagged for terminated in the meanwhile, drop now. */
     if (conn->flags & CONN_TERMINATING) {
         conn->state = CONN_DISCONNECTED;
-        if (res->addr) {
-            freeaddrinfo(res->addr);
-        }
         return;
     }
 
-    if (res->rc != 0) {
+    if (rc != 0) {
         CONN_LOG_WARNING(conn, "Failed to resolve '%s': %s", conn->addr.host,
-                         gai_strerror(res->rc));
+                         gai_strerror(rc));
         goto fail;
     }
 
-    void *addr = &((struct sockaddr_in *) res->addr->ai_addr)->sin_addr;
-    inet_ntop(AF_INET, addr, conn->ipaddr, INET_ADDRSTRLEN);
-    freeaddrinfo(res->addr);
+    strcpy(conn->ipaddr, ipaddr);
 
     /* Initiate connection */
     if (conn->rc != NULL) {
@@ -359,27 +352,169 @@ fail:
     }
 }
 
-/* getaddrinfo() is quite slow, especially when it fails to resolve the address.
- * This function will be called in the threadpool not to stop Redis main thread.
- */
-void ConnGetAddrinfo(void *arg)
+/* -----------------------------------------------------------------------------
+ * Resolver cache
+ *
+ * getaddrinfo() is slow, so it runs in the thread pool. Results are cached
+ * per host for 'dns-cache-ttl' milliseconds, and failures for up to
+ * RESOLVER_NEGATIVE_TTL, so reconnects after a partition heals don't resolve
+ * every peer again. Connections to a host that is being resolved wait for
+ * the running lookup instead of starting another one.
+ *
+ * Entries are only accessed from the Redis thread, except for 'result' and
+ * 'result_rc', which the thread pool writes while 'resolving' is set.
+ * -------------------------------------------------------------------------- */
+
+#define RESOLVER_NEGATIVE_TTL 1000
+
+typedef struct ResolverEntry {
+    char host[256];
+    char ipaddr[INET6_ADDRSTRLEN + 1]; /* Address to connect to */
+    int rc;                            /* getaddrinfo() error, 0 if resolved */
+    long long expires;                 /* Monotonic time in ms the result expires */
+    bool resolving;                    /* getaddrinfo() is running */
+    int result_rc;                     /* getaddrinfo() result, from the thread pool */
+    struct addrinfo *result;           /* getaddrinfo() addresses, from the thread pool */
+    Connection **waiting;              /* Connections waiting for the lookup */
+    int waiting_num;
+} ResolverEntry;
+
+void ResolverCacheInit(ResolverCache *cache)
 {
-    Connection *conn = arg;
+    *cache = (ResolverCache){
+        .entries = RedisModule_CreateDict(NULL),
+    };
+}
+
+void ResolverCacheFree(ResolverCache *cache)
+{
+    if (!cache->entries) {
+        return;
+    }
+
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(cache->entries, "^", NULL, 0);
+    ResolverEntry *e;
+
+    while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL) {
+        /* The thread pool still owns entries being resolved */
+        if (!e->resolving) {
+            RedisModule_Free(e->waiting);
+            RedisModule_Free(e);
+        }
+    }
+    RedisModule_DictIteratorStop(it);
+
+    RedisModule_FreeDict(NULL, cache->entries);
+    cache->entries = NULL;
+}
+
+/* Pick the address to connect to. IPv4 is preferred, as a host may resolve to
+ * both and a node listening on 0.0.0.0 is not reachable over IPv6. */
+static int pickAddress(struct addrinfo *result, char *ipaddr)
+{
+    struct addrinfo *ai6 = NULL;
+
+    for (struct addrinfo *ai = result; ai != NULL; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            inet_ntop(AF_INET, &((struct sockaddr_in *) ai->ai_addr)->sin_addr,
+                      ipaddr, INET6_ADDRSTRLEN);
+            return 0;
+        }
+        if (ai->ai_family == AF_INET6 && !ai6) {
+            ai6 = ai;
+        }
+    }
+
+    if (!ai6) {
+        return EAI_FAMILY;
+    }
+
+    inet_ntop(AF_INET6, &((struct sockaddr_in6 *) ai6->ai_addr)->sin6_addr,
+              ipaddr, INET6_ADDRSTRLEN);
+    return 0;
+}
+
+/* Completes a lookup, called from the Redis thread. */
+static void resolverHandleResult(void *arg)
+{
+    ResolverEntry *e = arg;
+    RedisRaftCtx *rr = &redis_raft;
+
+    e->rc = e->result_rc;
+    if (e->rc == 0) {
+        e->rc = pickAddress(e->result, e->ipaddr);
+    }
+    if (e->result) {
+        freeaddrinfo(e->result);
+        e->result = NULL;
+    }
+
+    long long ttl = e->rc == 0 ? rr->config.dns_cache_ttl :
+                                 MIN(rr->config.dns_cache_ttl, RESOLVER_NEGATIVE_TTL);
+    e->expires = monotonicMilliseconds() + ttl;
+    e->resolving = false;
+
+    /* Callbacks may start new lookups, so detach the waiting list first */
+    Connection **waiting = e->waiting;
+    int waiting_num = e->waiting_num;
+
+    e->waiting = NULL;
+    e->waiting_num = 0;
+
+    for (int i = 0; i < waiting_num; i++) {
+        handleResolved(waiting[i], e->rc, e->ipaddr);
+    }
+    RedisModule_Free(waiting);
+}
+
+/* Runs getaddrinfo() in the thread pool, not to block the Redis thread. */
+static void resolverGetAddrinfo(void *arg)
+{
+    ResolverEntry *e = arg;
 
     struct addrinfo hints = {
-        .ai_family = PF_INET,
+        .ai_family = AF_UNSPEC,
         .ai_socktype = SOCK_STREAM,
         .ai_protocol = IPPROTO_TCP,
         .ai_flags = 0,
     };
 
-    struct addrinfo *addr = NULL;
-    int rc = getaddrinfo(conn->addr.host, NULL, &hints, &addr);
+    e->result = NULL;
+    e->result_rc = getaddrinfo(e->host, NULL, &hints, &e->result);
+
+    RedisModule_EventLoopAddOneShot(resolverHandleResult, e);
+}
+
+static void resolve(Connection *conn)
+{
+    ResolverCache *cache = &conn->rr->resolver_cache;
+    const char *host = conn->addr.host;
+    size_t len = strlen(host);
+
+    ResolverEntry *e = RedisModule_DictGetC(cache->entries, (void *) host, len, NULL);
+    if (!e) {
+        e = RedisModule_Calloc(1, sizeof(*e));
+        memcpy(e->host, host, len + 1);
+        RedisModule_DictSetC(cache->entries, (void *) host, len, e);
+    }
 
-    conn->addrinfo_result.rc = rc;
-    conn->addrinfo_result.addr = addr;
+    if (!e->resolving && monotonicMilliseconds() < e->expires) {
+        cache->hits++;
+        handleResolved(conn, e->rc, e->ipaddr);
+        return;
+    }
+
+    e->waiting = RedisModule_Realloc(e->waiting, (e->waiting_num + 1) * sizeof(*e->waiting));
+    e->waiting[e->waiting_num++] = conn;
+
+    if (e->resolving) {
+        cache->coalesced++;
+        return;
+    }
 
-    RedisModule_EventLoopAddOneShot(handleResolved, conn);
+    cache->misses++;
+    e->resolving = true;
+    threadPoolAdd(&conn->rr->thread_pool, e, resolverGetAddrinfo);
 }
 
 RRStatus ConnConnect(Connection *conn, const NodeAddr *addr, ConnectionCallbackFunc connect_callback)
@@ -392,8 +527,7 @@ RRStatus ConnConnect(Connection *conn, const NodeAddr *addr, ConnectionCallbackF
     conn->state = CONN_RESOLVING;
     conn->connect_callback = connect_callback;
 
-    /* Call slow getaddrinfo() in another thread asynchronously */
-    threadPoolAdd(&redis_raft.thread_pool, conn, ConnGetAddrinfo);
+    resolve(conn);
 
     return RR_OK;
 }
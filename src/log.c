@@ -199,36 +199,46 @@ error:
     return RR_ERROR;
 }
 
-static raft_entry_t *pageReadEntry(LogPage *p, long *read_crc)
+/* Read the header of the entry at the current read offset, up to the data. */
+static int pageReadEntryHeader(LogPage *p, LogEntryInfo *info)
 {
     char str[64] = {0};
     int num_elements;
 
     if (!multibulkReadLen(&p->file, '*', &num_elements) ||
         !multibulkReadStr(&p->file, str, sizeof(str))) {
-        return NULL;
+        return RR_ERROR;
     }
 
     if (num_elements != ENTRY_ELEM_COUNT ||
         strncmp(ENTRY_STR, str, strlen(ENTRY_STR)) != 0) {
-        return NULL;
+        return RR_ERROR;
     }
 
-    raft_term_t term;
-    raft_entry_id_t id;
-    raft_session_t session_id;
-    int type, length;
+    int length;
 
-    /* header */
-    if (!multibulkReadLong(&p->file, &term) ||
-        !multibulkReadInt(&p->file, &id) ||
-        !multibulkReadUInt64(&p->file, &session_id) ||
-        !multibulkReadInt(&p->file, &type) ||
+    if (!multibulkReadLong(&p->file, &info->term) ||
+        !multibulkReadInt(&p->file, &info->id) ||
+        !multibulkReadUInt64(&p->file, &info->session) ||
+        !multibulkReadInt(&p->file, &info->type) ||
         !multibulkReadLen(&p->file, '$', &length)) {
+        return RR_ERROR;
+    }
+
+    info->data_len = length;
+    return RR_OK;
+}
+
+static raft_entry_t *pageReadEntry(LogPage *p, long *read_crc)
+{
+    LogEntryInfo info;
+
+    if (pageReadEntryHeader(p, &info) != RR_OK) {
         return NULL;
     }
 
     char crlf[2];
+    int length = (int) info.data_len;
     raft_entry_t *e = raft_entry_new(length);
 
     /* data */
@@ -247,10 +257,10 @@ static raft_entry_t *pageReadEntry(LogPage *p, long *read_crc)
         *read_crc = crc;
     }
 
-    e->term = term;
-    e->id = id;
-    e->session = session_id;
-    e->type = type;
+    e->term = info.term;
+    e->id = info.id;
+    e->session = info.session;
+    e->type = info.type;
 
     return e;
 
@@ -511,6 +521,18 @@ static raft_entry_t *pageGet(LogPage *p, raft_index_t idx)
     return ety;
 }
 
+static int pageGetEntryInfo(LogPage *p, raft_index_t idx, LogEntryInfo *info)
+{
+    if (pageSeekEntry(p, idx) <= 0) {
+        return RR_ERROR;
+    }
+
+    int ret = pageReadEntryHeader(p, info);
+    RedisModule_Assert(ret == RR_OK);
+
+    return RR_OK;
+}
+
 static int pageDelete(LogPage *p, raft_index_t from_idx)
 {
     if (from_idx <= p->prev_log_idx || from_idx > p->index) {
@@ -768,6 +790,16 @@ raft_entry_t *LogGet(Log *log, raft_index_t idx)
     return ety;
 }
 
+/* Read the metadata of an entry, without reading its data. */
+int LogGetEntryInfo(Log *log, raft_index_t idx, LogEntryInfo *info)
+{
+    if (log->pages[1] && pageGetEntryInfo(log->pages[1], idx, info) == RR_OK) {
+        return RR_OK;
+    }
+
+    return pageGetEntryInfo(log->pages[0], idx, info);
+}
+
 int LogDelete(Log *log, raft_index_t from_idx)
 {
     LogPage *p0 = log->pages[0];
@@ -933,6 +965,9 @@ static void logImplReset(void *arg, raft_index_t index, raft_term_t term)
 
     RAFTLOG_TRACE("Reset(index=%lu,term=%lu)", index, term);
 
+    /* Prefetched entries are gone with the log */
+    ApplyPipelineReset(&rr->apply_pipeline);
+
     EntryCacheFree(rr->logcache);
     rr->logcache = EntryCacheNew(ENTRY_CACHE_INIT_SIZE);
 }
@@ -31,6 +31,15 @@ typedef struct LogPage {
     long current_crc;           /* Current running crc value for the log file */
 } LogPage;
 
+/* Metadata of a log entry */
+typedef struct LogEntryInfo {
+    raft_term_t term;
+    raft_entry_id_t id;
+    raft_session_t session;
+    int type;
+    size_t data_len;
+} LogEntryInfo;
+
 typedef struct Log {
     char dbid[64];            /* DB unique ID, TODO: size should be RAFT_DBID_LEN + 1, will be fixed with RR-148 */
     raft_node_id_t node_id;   /* Node ID */
@@ -58,6 +67,7 @@ int LogSync(Log *log, bool sync);
 int LogFlush(Log *log);
 int LogCurrentFd(Log *log);
 raft_entry_t *LogGet(Log *log, raft_index_t idx);
+int LogGetEntryInfo(Log *log, raft_index_t idx, LogEntryInfo *info);
 int LogDelete(Log *log, raft_index_t from_idx);
 int LogReset(Log *log, raft_index_t index, raft_term_t term);
 raft_term_t LogPrevLogTerm(Log *log);
@@ -93,6 +93,8 @@ void importKeys(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
     RedisModuleString *zero = RedisModule_CreateString(rr->ctx, "0", strlen("0"));                /* ttl of zero */
     RedisModuleString *replace = RedisModule_CreateString(rr->ctx, "REPLACE", strlen("REPLACE")); /* overwrite on import */
 
+    blockedCommandsArmKeys(import_keys.key_names, import_keys.num_keys);
+
     for (size_t i = 0; i < import_keys.num_keys; i++) {
         RedisModuleString *temp[4];
         temp[0] = import_keys.key_names[i];
@@ -268,47 +270,41 @@ static void transferKeys(Connection *conn)
         return;
     }
 
-    /* raft.import term migration_session_key <key1_name> <key1_serialized> ... <keyn_name> <keyn_serialized> */
+    /* raft.import term migration_session_key <key1_name> <key1_serialized> ... <keyn_name> <keyn_serialized>
+     *
+     * Arguments point to the strings of the request, hiredis copies them once
+     * into its output buffer. */
     int argc = 3 + (req->r.migrate_keys.num_serialized_keys * 2);
-    char **argv = RedisModule_Calloc(argc, sizeof(char *));
+    const char **argv = RedisModule_Calloc(argc, sizeof(char *));
     size_t *argv_len = RedisModule_Calloc(argc, sizeof(size_t));
+    char term[32], session_key[32];
 
-    argv[0] = RedisModule_Strdup("RAFT.IMPORT");
+    argv[0] = "RAFT.IMPORT";
     argv_len[0] = strlen("RAFT.IMPORT");
-    argv[1] = RedisModule_Alloc(32);
-    int n = snprintf(argv[1], 32, "%ld", req->r.migrate_keys.migrate_term);
-    argv_len[1] = n;
-    argv[2] = RedisModule_Alloc(32);
-    n = snprintf(argv[2], 32, "%llu", req->r.migrate_keys.migration_session_key);
-    argv_len[2] = n;
+    argv[1] = term;
+    argv_len[1] = snprintf(term, sizeof(term), "%ld", req->r.migrate_keys.migrate_term);
+    argv[2] = session_key;
+    argv_len[2] = snprintf(session_key, sizeof(session_key), "%llu", req->r.migrate_keys.migration_session_key);
 
+    int n = 3;
     for (size_t i = 0; i < req->r.migrate_keys.num_keys; i++) {
         if (req->r.migrate_keys.keys_serialized[i] == NULL) {
             continue;
         }
 
-        size_t key_len;
-        const char *key = RedisModule_StringPtrLen(req->r.migrate_keys.keys[i], &key_len);
-        argv[3 + (i * 2)] = RedisModule_Strdup(key);
-        argv_len[3 + (i * 2)] = key_len;
-
-        size_t str_len;
-        const char *str = RedisModule_StringPtrLen(req->r.migrate_keys.keys_serialized[i], &str_len);
-        argv[3 + (i * 2) + 1] = RedisModule_Alloc(str_len);
-        memcpy(argv[3 + (i * 2) + 1], str, str_len);
-        argv_len[3 + (i * 2) + 1] = str_len;
+        argv[n] = RedisModule_StringPtrLen(req->r.migrate_keys.keys[i], &argv_len[n]);
+        n++;
+        argv[n] = RedisModule_StringPtrLen(req->r.migrate_keys.keys_serialized[i], &argv_len[n]);
+        n++;
     }
 
-    if (redisAsyncCommandArgv(ConnGetRedisCtx(conn), transferKeysResponse, conn, argc, (const char **) argv, argv_len) != REDIS_OK) {
+    if (redisAsyncCommandArgv(ConnGetRedisCtx(conn), transferKeysResponse, conn, argc, argv, argv_len) != REDIS_OK) {
         RedisModule_ReplyWithError(req->ctx, "ERR failed to submit RAFT.IMPORT command, try again");
         redisAsyncDisconnect(ConnGetRedisCtx(conn));
         ConnMarkDisconnected(conn);
         RaftReqFree(req);
     }
 
-    for (int i = 0; i < argc; i++) {
-        RedisModule_Free(argv[i]);
-    }
     RedisModule_Free(argv);
     RedisModule_Free(argv_len);
 }
@@ -397,3 +393,400 @@ void MigrateKeys(RedisRaftCtx *rr, RaftReq *req)
 exit:
     RaftReqFree(req);
 }
+
+/* Slot migration
+ *
+ * RAFT.MIGRATE moves all keys of a migrating slot to the importing cluster:
+ *
+ * 1. A RAFT_LOGTYPE_LOCK_SLOT entry locks the slot. Existing keys of a locked
+ *    slot can't be modified, commands get TRYAGAIN. Commands on keys that
+ *    don't exist are redirected to the importing cluster, as usual.
+ * 2. Once the entry is applied, the leader streams the keys of the slot to the
+ *    importing cluster on a single connection. Keys are sent with RAFT.IMPORT
+ *    in batches bounded by MIGRATION_BATCH_MAX_KEYS and
+ *    MIGRATION_BATCH_MAX_SIZE, and up to MIGRATION_MAX_INFLIGHT batches are
+ *    pipelined. DUMP payloads are passed to hiredis straight from the replies.
+ * 3. RAFT_LOGTYPE_DELETE_UNLOCK_SLOT entries delete the keys of the slot, and
+ *    the last one unlocks it. The entries carry the keys collected in step 2,
+ *    so nodes don't look them up again when applying them. Like RAFT.IMPORT
+ *    batches, each entry is bounded by MIGRATION_BATCH_MAX_KEYS and
+ *    MIGRATION_BATCH_MAX_SIZE. The keys of a locked slot can't change, other
+ *    than by expiring.
+ *
+ * If the transfer fails, the slot stays locked. Running RAFT.MIGRATE again
+ * restarts it, keys already imported are replaced.
+ */
+
+#define MIGRATION_BATCH_MAX_KEYS 1000
+#define MIGRATION_BATCH_MAX_SIZE (1024 * 1024)
+#define MIGRATION_MAX_INFLIGHT   4
+
+void SlotMigrationInit(SlotMigration *m)
+{
+    *m = (SlotMigration){
+        .slot = -1,
+    };
+}
+
+/* Releases the state of the current migration, keeping its progress */
+void SlotMigrationReset(SlotMigration *m)
+{
+    for (size_t i = 0; i < m->num_keys; i++) {
+        RedisModule_FreeString(NULL, m->keys[i]);
+    }
+    RedisModule_Free(m->keys);
+
+    m->keys = NULL;
+    m->num_keys = 0;
+    m->pos = 0;
+    m->inflight = 0;
+    m->conn = NULL;
+    m->req = NULL;
+
+    if (m->start_time && !m->end_time) {
+        m->end_time = monotonicMilliseconds();
+    }
+}
+
+static void failSlotMigration(SlotMigration *m, const char *err)
+{
+    if (m->conn) {
+        ConnAsyncTerminate(m->conn);
+    }
+
+    RedisModule_ReplyWithError(m->req->ctx, err);
+    RaftReqFree(m->req);
+}
+
+/* Returns the number of keys from 'pos' to delete in a single entry */
+static size_t deleteBatchKeys(SlotMigration *m, size_t pos)
+{
+    size_t num = 0, size = 0;
+
+    while (pos + num < m->num_keys && num < MIGRATION_BATCH_MAX_KEYS) {
+        size_t len;
+        RedisModule_StringPtrLen(m->keys[pos + num], &len);
+
+        if (num > 0 && size + len > MIGRATION_BATCH_MAX_SIZE) {
+            break;
+        }
+        size += len;
+        num++;
+    }
+
+    return num;
+}
+
+/* Deletes the migrated keys in bounded entries, the last one unlocks the slot
+ * and replies to the request. */
+static void appendDeleteUnlockSlot(RedisRaftCtx *rr, RaftReq *req)
+{
+    if (rr->config.migration_debug == DEBUG_MIGRATION_EMULATE_UNLOCK_FAILED) {
+        RedisModule_ReplyWithError(req->ctx, "ERR Unable to unlock/delete migrated keys, try again");
+        RaftReqFree(req);
+        return;
+    }
+
+    SlotMigration *m = &rr->slot_migration;
+    size_t pos = 0;
+
+    do {
+        size_t num = deleteBatchKeys(m, pos);
+        bool unlock = pos + num == m->num_keys;
+
+        raft_entry_t *entry = RaftRedisSerializeDeleteUnlockSlot(req->r.migrate_slot.slot, unlock,
+                                                                 num ? &m->keys[pos] : NULL, num);
+        entry->id = rand();
+
+        int e = RedisRaftRecvEntry(rr, entry, unlock ? req : NULL);
+        if (e != 0) {
+            replyRaftError(req->ctx, "Unable to unlock/delete migrated keys, try again", e);
+            RaftReqFree(req);
+            return;
+        }
+
+        pos += num;
+    } while (pos < m->num_keys);
+}
+
+static void sendImportBatches(Connection *conn);
+
+static void importBatchResponse(redisAsyncContext *c, void *r, void *privdata)
+{
+    Connection *conn = privdata;
+    RedisRaftCtx *rr = ConnGetRedisRaftCtx(conn);
+    SlotMigration *m = &rr->slot_migration;
+    redisReply *reply = r;
+
+    /* Migration failed on a previous batch */
+    if (!m->req || m->conn != conn) {
+        return;
+    }
+
+    m->inflight--;
+
+    if (!reply) {
+        ConnMarkDisconnected(conn);
+        failSlotMigration(m, "ERR connection dropped importing keys into remote cluster, try again");
+        return;
+    }
+
+    if (reply->type == REDIS_REPLY_ERROR) {
+        char err[256];
+        snprintf(err, sizeof(err), "ERR RAFT.IMPORT failed: %.*s", (int) reply->len, reply->str);
+        failSlotMigration(m, err);
+        redisAsyncDisconnect(c);
+        return;
+    }
+
+    if (reply->type != REDIS_REPLY_STATUS || reply->len != 2 || strncmp(reply->str, "OK", 2) != 0) {
+        failSlotMigration(m, "ERR received unexpected response from remote cluster");
+        redisAsyncDisconnect(c);
+        return;
+    }
+
+    if (m->pos < m->num_keys) {
+        sendImportBatches(conn);
+        return;
+    }
+
+    if (m->inflight == 0) {
+        ConnAsyncTerminate(conn);
+        redisAsyncDisconnect(c);
+        m->conn = NULL;
+        appendDeleteUnlockSlot(rr, m->req);
+    }
+}
+
+/* Send the next RAFT.IMPORT batch. Returns false if the migration failed. */
+static bool sendImportBatch(RedisRaftCtx *rr, Connection *conn, SlotMigration *m)
+{
+    RaftReq *req = m->req;
+    RedisModuleCallReply *replies[MIGRATION_BATCH_MAX_KEYS];
+    const char *argv[3 + MIGRATION_BATCH_MAX_KEYS * 2];
+    size_t argv_len[3 + MIGRATION_BATCH_MAX_KEYS * 2];
+    char term[32], session_key[32];
+    size_t size = 0;
+    int num = 0;
+
+    argv[0] = "RAFT.IMPORT";
+    argv_len[0] = strlen("RAFT.IMPORT");
+    argv[1] = term;
+    argv_len[1] = snprintf(term, sizeof(term), "%ld", req->r.migrate_slot.migrate_term);
+    argv[2] = session_key;
+    argv_len[2] = snprintf(session_key, sizeof(session_key), "%llu", req->r.migrate_slot.migration_session_key);
+
+    while (m->pos < m->num_keys && num < MIGRATION_BATCH_MAX_KEYS && size < MIGRATION_BATCH_MAX_SIZE) {
+        RedisModuleString *key = m->keys[m->pos++];
+
+        enterRedisModuleCall();
+        RedisModuleCallReply *reply = RedisModule_Call(rr->ctx, "DUMP", "s", key);
+        exitRedisModuleCall();
+
+        if (!reply) {
+            break;
+        }
+
+        /* Expired since the slot was locked */
+        if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_NULL) {
+            RedisModule_FreeCallReply(reply);
+            continue;
+        }
+
+        if (RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_STRING) {
+            LOG_WARNING("unexpected response type = %d", RedisModule_CallReplyType(reply));
+            RedisModule_FreeCallReply(reply);
+            break;
+        }
+
+        int i = 3 + num * 2;
+        argv[i] = RedisModule_StringPtrLen(key, &argv_len[i]);
+        argv[i + 1] = RedisModule_CallReplyStringPtr(reply, &argv_len[i + 1]);
+        size += argv_len[i] + argv_len[i + 1];
+        replies[num++] = reply;
+    }
+
+    bool ok = m->pos == m->num_keys || num == MIGRATION_BATCH_MAX_KEYS || size >= MIGRATION_BATCH_MAX_SIZE;
+    if (!ok) {
+        failSlotMigration(m, "ERR serializing keys for migration failed");
+    } else if (num > 0) {
+        if (redisAsyncCommandArgv(ConnGetRedisCtx(conn), importBatchResponse, conn,
+                                  3 + num * 2, argv, argv_len) != REDIS_OK) {
+            failSlotMigration(m, "ERR failed to submit RAFT.IMPORT command, try again");
+            ok = false;
+        } else {
+            m->inflight++;
+            m->batches++;
+            m->keys_sent += num;
+            m->bytes_sent += size;
+        }
+    }
+
+    for (int i = 0; i < num; i++) {
+        RedisModule_FreeCallReply(replies[i]);
+    }
+
+    return ok;
+}
+
+static void sendImportBatches(Connection *conn)
+{
+    RedisRaftCtx *rr = ConnGetRedisRaftCtx(conn);
+    SlotMigration *m = &rr->slot_migration;
+
+    while (m->inflight < MIGRATION_MAX_INFLIGHT && m->pos < m->num_keys) {
+        if (!sendImportBatch(rr, conn, m)) {
+            return;
+        }
+    }
+
+    /* All remaining keys expired */
+    if (m->inflight == 0) {
+        ConnAsyncTerminate(conn);
+        m->conn = NULL;
+        appendDeleteUnlockSlot(rr, m->req);
+    }
+}
+
+static void streamSlot(Connection *conn)
+{
+    RedisRaftCtx *rr = ConnGetRedisRaftCtx(conn);
+    SlotMigration *m = &rr->slot_migration;
+
+    if (!ConnIsConnected(conn) || !m->req) {
+        return;
+    }
+
+    m->conn = conn;
+
+    if (rr->config.migration_debug == DEBUG_MIGRATION_EMULATE_IMPORT_FAILED) {
+        failSlotMigration(m, "ERR failed to submit RAFT.IMPORT command, try again");
+        return;
+    }
+
+    sendImportBatches(conn);
+}
+
+/* Called on the leader once the slot is locked */
+void MigrateSlot(RedisRaftCtx *rr, RaftReq *req)
+{
+    SlotMigration *m = &rr->slot_migration;
+    unsigned int slot = req->r.migrate_slot.slot;
+
+    SlotMigrationReset(m);
+    m->req = req;
+    m->slot = (int) slot;
+    m->keys_sent = 0;
+    m->bytes_sent = 0;
+    m->batches = 0;
+    m->start_time = monotonicMilliseconds();
+    m->end_time = 0;
+
+    if (rr->config.migration_debug == DEBUG_MIGRATION_EMULATE_CONNECT_FAILED) {
+        failSlotMigration(m, "ERR failed to connect to import cluster, try again");
+        return;
+    }
+
+    ShardGroup *sg = GetShardGroupById(rr, req->r.migrate_slot.shard_group_id);
+    if (sg == NULL) {
+        failSlotMigration(m, "ERR couldn't resolve shardgroup id");
+        return;
+    }
+
+    ShardGroup *local = rr->sharding_info->migrating_slots_map[slot];
+    for (unsigned int i = 0; i < local->slot_ranges_num; i++) {
+        ShardGroupSlotRange *sr = &local->slot_ranges[i];
+        if (sr->start_slot <= slot && sr->end_slot >= slot) {
+            req->r.migrate_slot.migration_session_key = sr->migration_session_key;
+            break;
+        }
+    }
+    req->r.migrate_slot.migrate_term = raft_get_current_term(rr->raft);
+
+    m->num_keys = SlotIndexGetKeys(rr, rr->ctx, slot, &m->keys);
+    if (m->num_keys == 0) {
+        appendDeleteUnlockSlot(rr, req);
+        return;
+    }
+
+    JoinLinkState *state = RedisModule_Calloc(1, sizeof(*state));
+    for (unsigned int i = 0; i < sg->nodes_num; i++) {
+        NodeAddrListAddElement(&state->addr, &sg->nodes[i].addr);
+    }
+
+    state->type = "migrate";
+    state->connect_callback = streamSlot;
+    state->start = time(NULL);
+    state->req = req;
+
+    char *username = req->r.migrate_slot.auth_username;
+    char *password = req->r.migrate_slot.auth_password;
+    state->conn = ConnCreate(rr, state, joinLinkIdleCallback, joinLinkFreeCallback, username, password);
+}
+
+/* RAFT.MIGRATE <slot> [AUTH2 <username> <password>]
+ *   Moves all keys of a migrating slot to the importing cluster.
+ * Reply:
+ *   +OK once the keys are imported and deleted locally
+ */
+int cmdRaftMigrate(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RedisRaftCtx *rr = &redis_raft;
+    long long slot;
+
+    if (argc != 2 && argc != 5) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    if (checkRaftState(rr, ctx) == RR_ERROR ||
+        checkLeader(rr, ctx, NULL) == RR_ERROR) {
+        return REDISMODULE_OK;
+    }
+
+    if (RedisModule_StringToLongLong(argv[1], &slot) != REDISMODULE_OK ||
+        !HashSlotValid((long) slot)) {
+        RedisModule_ReplyWithError(ctx, "ERR invalid slot");
+        return REDISMODULE_OK;
+    }
+
+    const char *username = "";
+    const char *password = "";
+    size_t username_len = 0, password_len = 0;
+
+    if (argc == 5) {
+        if (strcasecmp(RedisModule_StringPtrLen(argv[2], NULL), "AUTH2") != 0) {
+            RedisModule_ReplyWithError(ctx, "ERR syntax error");
+            return REDISMODULE_OK;
+        }
+
+        username = RedisModule_StringPtrLen(argv[3], &username_len);
+        password = RedisModule_StringPtrLen(argv[4], &password_len);
+        if (username_len > MAX_AUTH_STRING_ARG_LENGTH || password_len > MAX_AUTH_STRING_ARG_LENGTH) {
+            RedisModule_ReplyWithError(ctx, "ERR username or password is too long");
+            return REDISMODULE_OK;
+        }
+    }
+
+    if (rr->migrate_req != NULL) {
+        RedisModule_ReplyWithError(ctx, "ERR RedisRaft only supports one concurrent migration currently");
+        return REDISMODULE_OK;
+    }
+
+    RaftReq *req = RaftReqInit(ctx, RR_MIGRATE_SLOT);
+    req->r.migrate_slot.slot = (unsigned int) slot;
+    memcpy(req->r.migrate_slot.auth_username, username, username_len);
+    memcpy(req->r.migrate_slot.auth_password, password, password_len);
+
+    raft_entry_t *entry = RaftRedisSerializeSlot(RAFT_LOGTYPE_LOCK_SLOT, (unsigned int) slot);
+    entry->id = rand();
+    entryAttachRaftReq(rr, entry, req);
+
+    int e = RedisRaftRecvEntry(rr, entry, req);
+    if (e != 0) {
+        replyRaftError(req->ctx, NULL, e);
+        RaftReqFree(req);
+    }
+
+    return REDISMODULE_OK;
+}
@@ -134,13 +134,8 @@ bool MultiHandleCommand(RedisRaftCtx *rr,
         }
 
         /* "Multi Dry Run" - only check for ACL, not for OOM, as OOM is checked above */
-        enterRedisModuleCall();
-        RedisModuleCallReply *reply = RedisModule_Call(ctx, cmd_str, "DCEv", cmd->argv + 1, cmd->argc - 1);
-        exitRedisModuleCall();
-        if (reply != NULL) {
-            RedisModule_ReplyWithCallReply(ctx, reply);
-            RedisModule_FreeCallReply(reply);
-
+        ACLEntry *acl = ACLCacheGetCurrentUser(rr, ctx);
+        if (CommandDryRun(rr, ctx, acl, cmd, false) != RR_OK) {
             multiState->error = true;
             return true;
         }
@@ -23,7 +23,6 @@
 static void clearPendingResponses(Node *node)
 {
     node->pending_raft_response_num = 0;
-    node->pending_proxy_response_num = 0;
 
     struct sc_list *tmp, *it;
 
@@ -109,45 +108,46 @@ Node *NodeCreate(RedisRaftCtx *rr, int id, const NodeAddr *addr)
 /* Track a new pending response for a request that was sent to the node.
  * This is used to track connection liveness and decide when it should be
  * dropped.
+ *
+ * The caller may describe the request in the returned PendingResponse, to
+ * get it back on NodeDismissPendingResponse().
  */
-void NodeAddPendingResponse(Node *node, bool proxy)
+PendingResponse *NodeAddPendingResponse(Node *node)
 {
     static int response_id = 0;
 
     PendingResponse *resp = RedisModule_Calloc(1, sizeof(PendingResponse));
-    resp->proxy = proxy;
     resp->request_time = RedisModule_Milliseconds();
+    resp->send_time = (long long) RedisModule_MonotonicMicroseconds();
     resp->id = ++response_id;
     sc_list_init(&resp->entries);
 
-    if (proxy) {
-        node->pending_proxy_response_num++;
-    } else {
-        node->pending_raft_response_num++;
-    }
+    node->pending_raft_response_num++;
     sc_list_add_tail(&node->pending_responses, &resp->entries);
 
-    NODE_TRACE(node, "NodeAddPendingResponse: id=%d, type=%s, request_time=%lld",
-               resp->id, proxy ? "proxy" : "raft", resp->request_time);
+    NODE_TRACE(node, "NodeAddPendingResponse: id=%d, request_time=%lld",
+               resp->id, resp->request_time);
+
+    return resp;
 }
 
 /* Acknowledge a response that has been received and remove it from the
- * node's list of pending responses.
+ * node's list of pending responses. If 'out' is not NULL, the pending
+ * response is copied to it.
  */
-void NodeDismissPendingResponse(Node *node)
+void NodeDismissPendingResponse(Node *node, PendingResponse *out)
 {
     struct sc_list *elem = sc_list_pop_head(&node->pending_responses);
     PendingResponse *resp = sc_list_entry(elem, PendingResponse, entries);
 
-    if (resp->proxy) {
-        node->pending_proxy_response_num--;
-    } else {
-        node->pending_raft_response_num--;
-    }
+    node->pending_raft_response_num--;
 
-    NODE_TRACE(node, "NodeDismissPendingResponse: id=%d, type=%s, latency=%lld",
-               resp->id, resp->proxy ? "proxy" : "raft",
-               RedisModule_Milliseconds() - resp->request_time);
+    NODE_TRACE(node, "NodeDismissPendingResponse: id=%d, latency=%lld",
+               resp->id, RedisModule_Milliseconds() - resp->request_time);
+
+    if (out) {
+        *out = *resp;
+    }
 
     RedisModule_Free(resp);
 }
@@ -169,17 +169,10 @@ void HandleNodeStates(RedisRaftCtx *rr)
 
         if (ConnIsConnected(node->conn) && head != NULL) {
             PendingResponse *resp = sc_list_entry(head, PendingResponse, entries);
-            long timeout;
-
-            if (raft_is_leader(rr->raft)) {
-                timeout = rr->config.response_timeout;
-            } else {
-                timeout = resp->proxy ? rr->config.proxy_response_timeout : rr->config.response_timeout;
-            }
+            long timeout = rr->config.response_timeout;
 
             if (timeout && resp->request_time + timeout < RedisModule_Milliseconds()) {
-                NODE_TRACE(node, "Pending %s response timeout expired, reconnecting.",
-                           resp->proxy ? "proxy" : "raft");
+                NODE_TRACE(node, "Pending response timeout expired, reconnecting.");
                 ConnMarkDisconnected(node->conn);
             }
         }
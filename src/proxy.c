@@ -4,8 +4,49 @@
  * the Server Side Public License v1 (SSPLv1).
  */
 
+/* Follower proxy
+ *
+ * In follower-proxy mode, followers forward commands to the leader. The leader
+ * receives them serialized, the same way they're encoded in log entries.
+ *
+ * Proxied commands are sent over a pool of connections to the leader
+ * (proxy-connections), separate from the connection used for Raft traffic, so
+ * slow replies of one kind don't delay the other. Each command goes to the
+ * connection with the fewest outstanding requests. Until a pool connection is
+ * established, commands are sent over the leader's node connection.
+ *
+ * Commands are sent with redisAsyncFormattedCommand(), framed directly around
+ * the serialized commands, so hiredis does not need to format them again.
+ *
+ * The deadline of each request is tracked in a timer wheel. Replies of a
+ * connection arrive in order, so once a request times out, the requests sent
+ * after it on the same connection are stuck as well: a pool connection is
+ * dropped, which fails all of them. The leader's node connection is never
+ * dropped for proxied requests, a request sent over it fails on its own.
+ *
+ * Writes that can be batched (see WriteBatchCanProxy()) and are received in the
+ * same event loop iteration are sent as a single RAFT.ENTRIES command before
+ * going to sleep. The leader appends them as a single entry and replies with an
+ * array of replies, which are passed on to the clients. Other commands are
+ * sent with RAFT.ENTRY, after any pending batch.
+ */
+
 #include "redisraft.h"
 
+#include <stdio.h>
+#include <string.h>
+
+#define PROXY_TIMER_RESOLUTION 10 /* Milliseconds */
+
+/* A command sent to the leader, waiting for a reply */
+typedef struct ProxyRequest {
+    RaftReq *req;             /* RR_GENERIC request, or a batch of them */
+    Connection *conn;         /* Connection the command was sent over */
+    ProxyConn *pc;            /* Pool connection, NULL if sent over the node connection */
+    long long start;          /* Send time, in microseconds */
+    TimerWheelEntry deadline; /* Entry in ProxyPool->deadlines */
+} ProxyRequest;
+
 static RRStatus hiredisReplyToModule(redisReply *reply, RedisModuleCtx *ctx)
 {
     switch (reply->type) {
@@ -39,65 +80,401 @@ static RRStatus hiredisReplyToModule(redisReply *reply, RedisModuleCtx *ctx)
     return RR_OK;
 }
 
-static void handleProxiedCommandResponse(redisAsyncContext *c, void *r, void *privdata)
+static void replyFromLeader(RaftReq *req, redisReply *reply)
+{
+    if (RedisModule_BlockedClientDisconnected(req->ctx)) {
+        return;
+    }
+
+    if (hiredisReplyToModule(reply, req->ctx) != RR_OK) {
+        RedisModule_ReplyWithError(req->ctx, "ERR bad reply from leader");
+    }
+}
+
+/* ------------------------------------ Connection pool ------------------------------------ */
+
+void ProxyPoolInit(ProxyPool *pool)
+{
+    *pool = (ProxyPool){
+        .leader_id = RAFT_NODE_ID_NONE,
+    };
+    TimerWheelInit(&pool->deadlines, PROXY_TIMER_RESOLUTION, monotonicMilliseconds());
+}
+
+static void proxyPoolRemove(ProxyPool *pool, int i)
 {
-    RaftReq *req = privdata;
+    ProxyConn *pc = pool->conns[i];
+
+    pc->pool = NULL;
+    ConnAsyncTerminate(pc->conn);
+    pool->conns[i] = pool->conns[--pool->num];
+}
+
+/* Terminate all connections of the pool. Requests still waiting for a reply
+ * fail once the connections are closed. */
+void ProxyPoolReset(ProxyPool *pool)
+{
+    while (pool->num > 0) {
+        proxyPoolRemove(pool, pool->num - 1);
+    }
+    pool->leader_id = RAFT_NODE_ID_NONE;
+}
+
+void ProxyPoolFree(ProxyPool *pool)
+{
+    ProxyPoolReset(pool);
+    RedisModule_Free(pool->conns);
+    pool->conns = NULL;
+}
+
+/* Idle callback: (re)connect as long as the connection belongs to the pool of
+ * the current leader. */
+static void proxyConnIdleCallback(Connection *conn)
+{
+    ProxyConn *pc = ConnGetPrivateData(conn);
+    RedisRaftCtx *rr = ConnGetRedisRaftCtx(conn);
+    ProxyPool *pool = pc->pool;
+
+    if (!pool) {
+        return;
+    }
+
+    if (!rr->raft || raft_get_leader_id(rr->raft) != pool->leader_id) {
+        ProxyPoolReset(pool);
+        return;
+    }
+
+    ConnConnect(conn, &pool->addr, NULL);
+}
+
+static void proxyConnFreeCallback(void *privdata)
+{
+    RedisModule_Free(privdata);
+}
+
+/* Returns the connected pool connection to the leader with the fewest
+ * outstanding requests, or NULL if none is connected. The pool is created or
+ * resized as needed. */
+static ProxyConn *proxyPoolGet(RedisRaftCtx *rr, Node *leader)
+{
+    ProxyPool *pool = &rr->proxy_pool;
+    int size = rr->config.proxy_connections;
+    ProxyConn *best = NULL;
+
+    if (pool->leader_id != leader->id ||
+        pool->addr.port != leader->addr.port ||
+        strcmp(pool->addr.host, leader->addr.host) != 0) {
+        ProxyPoolReset(pool);
+        pool->leader_id = leader->id;
+        pool->addr = leader->addr;
+    }
+
+    while (pool->num > size) {
+        proxyPoolRemove(pool, pool->num - 1);
+    }
+
+    if (pool->num < size) {
+        pool->conns = RedisModule_Realloc(pool->conns, size * sizeof(ProxyConn *));
+
+        while (pool->num < size) {
+            ProxyConn *pc = RedisModule_Calloc(1, sizeof(ProxyConn));
+            pc->pool = pool;
+            pc->conn = ConnCreate(rr, pc, proxyConnIdleCallback, proxyConnFreeCallback,
+                                  rr->config.cluster_user, rr->config.cluster_password);
+            pool->conns[pool->num++] = pc;
+        }
+    }
+
+    for (int i = 0; i < pool->num; i++) {
+        ProxyConn *pc = pool->conns[i];
+
+        if (ConnIsConnected(pc->conn) &&
+            (!best || pc->outstanding < best->outstanding)) {
+            best = pc;
+        }
+    }
+
+    return best;
+}
+
+/* ------------------------------------ Requests ------------------------------------ */
+
+/* Reply with a timeout error to the clients of 'pr' and release its request.
+ * The state of the commands on the leader is unknown at this point and this
+ * must be reflected to the user. */
+static void proxyRequestFail(RedisRaftCtx *rr, ProxyRequest *pr)
+{
+    RaftReq *req = pr->req;
+    bool batch = req->type == RR_REDISCOMMAND_BATCH;
+    int len = batch ? req->r.batch.len : 1;
+
+    TimerWheelDel(&rr->proxy_pool.deadlines, &pr->deadline);
+    if (pr->pc) {
+        pr->pc->outstanding--;
+    }
+    rr->proxy_outstanding_reqs -= len;
+    rr->proxy_failed_responses += len;
+
+    if (batch) {
+        WriteBatchReplyWithError(req, "TIMEOUT no reply from leader");
+    } else {
+        RedisModule_ReplyWithError(req->ctx, "TIMEOUT no reply from leader");
+    }
+
+    RaftReqFree(req);
+    pr->req = NULL;
+}
+
+static void handleProxiedResponse(redisAsyncContext *c, void *r, void *privdata)
+{
+    RedisRaftCtx *rr = &redis_raft;
+    ProxyRequest *pr = privdata;
+    RaftReq *req = pr->req;
     redisReply *reply = r;
 
-    redis_raft.proxy_outstanding_reqs--;
-    NodeDismissPendingResponse(req->r.redis.proxy_node);
+    /* Already failed by proxyRequestExpired(), the reply is dropped */
+    if (!req) {
+        RedisModule_Free(pr);
+        return;
+    }
 
     if (!reply) {
-        /* Connection have dropped.  The state of the request is unknown at this point
-         * and this must be reflected to the user.
-         *
-         * Ideally the connection should be dropped but Module API does not provide for that.
-         */
-        ConnMarkDisconnected(req->r.redis.proxy_node->conn);
-        RedisModule_ReplyWithError(req->ctx, "TIMEOUT no reply from leader");
-        redis_raft.proxy_failed_responses++;
+        /* Connection have dropped. A pool connection is marked disconnected
+         * so it's reconnected, the node connection is left to Raft. */
+        if (pr->pc) {
+            ConnMarkDisconnected(pr->conn);
+        }
+        proxyRequestFail(rr, pr);
+        RedisModule_Free(pr);
+        return;
+    }
+
+    bool batch = req->type == RR_REDISCOMMAND_BATCH;
+    int len = batch ? req->r.batch.len : 1;
+
+    TimerWheelDel(&rr->proxy_pool.deadlines, &pr->deadline);
+    if (pr->pc) {
+        pr->pc->outstanding--;
+    }
+    rr->proxy_outstanding_reqs -= len;
+
+    LatencyHistogramAdd(&rr->proxy_pool.latency,
+                        RedisModule_MonotonicMicroseconds() - pr->start);
+
+    if (!batch) {
+        replyFromLeader(req, reply);
         goto exit;
     }
 
-    if (RedisModule_BlockedClientDisconnected(req->ctx)) {
+    /* The leader replies with an array of replies, in order. Any other reply
+     * is an error for the entire batch, e.g. -MOVED. */
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements != (size_t) len) {
+        WriteBatchReplyWithError(req, "ERR bad reply from leader");
         goto exit;
     }
 
-    if (hiredisReplyToModule(reply, req->ctx) != RR_OK) {
-        RedisModule_ReplyWithError(req->ctx, "ERR bad reply from leader");
+    for (int i = 0; i < len; i++) {
+        redisReply *elem = reply->type == REDIS_REPLY_ARRAY ? reply->element[i] : reply;
+        replyFromLeader(req->r.batch.reqs[i], elem);
     }
 
 exit:
     RaftReqFree(req);
+    RedisModule_Free(pr);
 }
 
-RRStatus ProxyCommand(RedisRaftCtx *rr, RedisModuleCtx *ctx,
-                      RaftRedisCommandArray *cmds, Node *leader)
+/* Send "<cmd> <serialized commands>" to the leader. The command is framed in
+ * a buffer reused by the following calls, hiredis copies the frame into its
+ * output buffer. */
+static int sendCommands(redisAsyncContext *rc, redisCallbackFn *fn, void *privdata,
+                        const char *cmd, RaftRedisCommandBuffer *cmds)
 {
+    static char *frame = NULL;
+    static size_t frame_size = 0;
+    char hdr[VARINT_MAX_LEN + 1];
+    size_t cmdlen = strlen(cmd);
+
+    /* Same header RaftRedisCommandBufferToEntry() writes */
+    hdr[0] = RAFT_REDIS_ENCODING_V2;
+    size_t hdrlen = 1 + encodeVarint(hdr + 1, cmds->num);
+    size_t datalen = hdrlen + cmds->len;
+
+    size_t needed = cmdlen + datalen + 64;
+    if (frame_size < needed) {
+        frame_size = needed * 2;
+        frame = RedisModule_Realloc(frame, frame_size);
+    }
+
+    size_t len = snprintf(frame, frame_size, "*2\r\n$%zu\r\n%s\r\n$%zu\r\n",
+                          cmdlen, cmd, datalen);
+    memcpy(frame + len, hdr, hdrlen);
+    len += hdrlen;
+    memcpy(frame + len, cmds->data, cmds->len);
+    len += cmds->len;
+    memcpy(frame + len, "\r\n", 2);
+    len += 2;
+
+    RaftRedisCommandBufferClear(cmds);
+
+    int ret = redisAsyncFormattedCommand(rc, fn, privdata, frame, len);
+
+    /* Don't keep the memory of a large frame */
+    if (frame_size > COMMAND_BUFFER_KEEP_SIZE) {
+        RedisModule_Free(frame);
+        frame = NULL;
+        frame_size = 0;
+    }
+
+    return ret;
+}
+
+/* Send the serialized commands of 'req' to the leader. */
+static RRStatus proxySend(RedisRaftCtx *rr, Node *leader, RaftReq *req,
+                          const char *cmd, RaftRedisCommandBuffer *cmds)
+{
+    ProxyConn *pc = proxyPoolGet(rr, leader);
+    Connection *conn = pc ? pc->conn : leader->conn;
+    int len = req->type == RR_REDISCOMMAND_BATCH ? req->r.batch.len : 1;
     redisAsyncContext *rc;
 
-    if (!ConnIsConnected(leader->conn) || !(rc = ConnGetRedisCtx(leader->conn))) {
-        rr->proxy_failed_reqs++;
+    if (!ConnIsConnected(conn) || !(rc = ConnGetRedisCtx(conn))) {
+        RaftRedisCommandBufferClear(cmds);
         return RR_ERROR;
     }
 
+    ProxyRequest *pr = RedisModule_Calloc(1, sizeof(ProxyRequest));
+    pr->req = req;
+    pr->conn = conn;
+    pr->pc = pc;
+    pr->start = RedisModule_MonotonicMicroseconds();
+    TimerWheelEntryInit(&pr->deadline);
+
+    if (sendCommands(rc, handleProxiedResponse, pr, cmd, cmds) != REDIS_OK) {
+        RedisModule_Free(pr);
+        return RR_ERROR;
+    }
+
+    TimerWheelAdd(&rr->proxy_pool.deadlines, &pr->deadline,
+                  monotonicMilliseconds() + rr->config.proxy_response_timeout);
+    if (pc) {
+        pc->outstanding++;
+    }
+    rr->proxy_reqs += len;
+    rr->proxy_outstanding_reqs += len;
+
+    return RR_OK;
+}
+
+static void proxyRequestExpired(TimerWheelEntry *e, void *privdata)
+{
+    RedisRaftCtx *rr = &redis_raft;
+    ProxyRequest *pr = sc_list_entry(e, ProxyRequest, deadline);
+
+    /* Fails all requests waiting on this connection, including this one */
+    if (pr->pc) {
+        ConnMarkDisconnected(pr->conn);
+        return;
+    }
+
+    /* Sent over the leader's node connection, which carries Raft traffic and
+     * must not be dropped. Only this request fails, its reply is dropped if it
+     * arrives later. */
+    proxyRequestFail(rr, pr);
+}
+
+/* Gets called periodically to fail proxied requests that timed out. */
+void ProxyHandleTimeouts(RedisRaftCtx *rr)
+{
+    TimerWheelExpire(&rr->proxy_pool.deadlines, monotonicMilliseconds(),
+                     proxyRequestExpired, NULL);
+}
+
+/* Send the pending batch of proxied writes to the leader, if there is one. */
+void ProxyBatchFlush(RedisRaftCtx *rr)
+{
+    ProxyBatch *b = &rr->proxy_batch;
+    RaftReq *batch = b->req;
+
+    if (!batch) {
+        return;
+    }
+
+    b->req = NULL;
+
+    int len = batch->r.batch.len;
+    Node *leader = batch->r.batch.reqs[0]->r.redis.proxy_node;
+
+    if (proxySend(rr, leader, batch, "RAFT.ENTRIES", &b->buf) != RR_OK) {
+        WriteBatchReplyWithError(batch, "NOTLEADER Failed to proxy command");
+        RaftReqFree(batch);
+        rr->proxy_failed_reqs += len;
+        return;
+    }
+
+    rr->proxy_batches++;
+}
+
+/* Queue a proxied write to be sent with the current batch. Returns false if
+ * batching is disabled. */
+static bool proxyBatchAdd(RedisRaftCtx *rr, RaftReq *req, RaftRedisCommandArray *cmds)
+{
+    ProxyBatch *b = &rr->proxy_batch;
+
+    if (rr->config.write_batch_max_count <= 1) {
+        return false;
+    }
+
+    /* Leader has changed */
+    if (b->req && b->req->r.batch.reqs[0]->r.redis.proxy_node != req->r.redis.proxy_node) {
+        ProxyBatchFlush(rr);
+    }
+
+    if (!b->req) {
+        b->req = RaftReqInit(NULL, RR_REDISCOMMAND_BATCH);
+    }
+
+    RaftReq *batch = b->req;
+    if (batch->r.batch.len == batch->r.batch.size) {
+        batch->r.batch.size = batch->r.batch.size ? batch->r.batch.size * 2 : 16;
+        batch->r.batch.reqs = RedisModule_Realloc(batch->r.batch.reqs,
+                                                  batch->r.batch.size * sizeof(RaftReq *));
+    }
+
+    batch->r.batch.reqs[batch->r.batch.len++] = req;
+    RaftRedisCommandBufferAppend(&b->buf, cmds);
+
+    if (batch->r.batch.len >= rr->config.write_batch_max_count ||
+        b->buf.len >= (size_t) rr->config.write_batch_max_size) {
+        ProxyBatchFlush(rr);
+    }
+
+    return true;
+}
+
+RRStatus ProxyCommand(RedisRaftCtx *rr, RedisModuleCtx *ctx,
+                      RaftRedisCommandArray *cmds, Node *leader)
+{
+    static RaftRedisCommandBuffer buf;
+
     RaftReq *req = RaftReqInit(ctx, RR_GENERIC);
     req->r.redis.proxy_node = leader;
 
-    raft_entry_t *entry = RaftRedisCommandArraySerialize(cmds);
-    int ret = redisAsyncCommand(rc, handleProxiedCommandResponse, req,
-                                "RAFT.ENTRY %b", entry->data, entry->data_len);
-    raft_entry_release(entry);
+    unsigned int cmd_flags = CommandSpecTableGetAggregateFlags(rr->commands_spec_table,
+                                                               rr->subcommand_spec_tables,
+                                                               cmds, CMD_SPEC_WRITE);
+    if (WriteBatchCanProxy(cmds, cmd_flags) && proxyBatchAdd(rr, req, cmds)) {
+        return RR_OK;
+    }
+
+    /* Writes queued earlier must be sent first */
+    ProxyBatchFlush(rr);
 
-    if (ret != REDIS_OK) {
+    RaftRedisCommandBufferAppend(&buf, cmds);
+    if (proxySend(rr, leader, req, "RAFT.ENTRY", &buf) != RR_OK) {
         RaftReqFree(req);
         rr->proxy_failed_reqs++;
         return RR_ERROR;
     }
 
-    NodeAddPendingResponse(leader, true);
-    rr->proxy_reqs++;
-    rr->proxy_outstanding_reqs++;
-
     return RR_OK;
 }
@@ -30,8 +30,10 @@ const char *RaftReqTypeStr[] = {
     [RR_IMPORT_KEYS] = "RR_IMPORT_KEYS",
     [RR_MIGRATE_KEYS] = "RR_MIGRATE_KEYS",
     [RR_DELETE_UNLOCK_KEYS] = "RR_DELETE_UNLOCK_KEYS",
+    [RR_MIGRATE_SLOT] = "RR_MIGRATE_SLOT",
     [RR_END_SESSION] = "RR_END_SESSION",
     [RR_CLIENT_UNBLOCK] = "RR_CLIENT_UNBLOCK",
+    [RR_REDISCOMMAND_BATCH] = "RR_REDISCOMMAND_BATCH",
 };
 
 /* Forward declarations */
@@ -78,7 +80,11 @@ void entryFreeAttachedRaftReq(raft_entry_t *ety)
     RaftReq *req = entryDetachRaftReq(&redis_raft, ety);
 
     if (req) {
-        RedisModule_ReplyWithError(req->ctx, "TIMEOUT not committed yet");
+        if (req->type == RR_REDISCOMMAND_BATCH) {
+            WriteBatchReplyWithError(req, "TIMEOUT not committed yet");
+        } else {
+            RedisModule_ReplyWithError(req->ctx, "TIMEOUT not committed yet");
+        }
         RaftReqFree(req);
     }
 
@@ -131,10 +137,11 @@ static KeysStatus validateKeyExistence(RedisRaftCtx *rr, RaftRedisCommandArray *
             if (RedisModule_KeyExists(rr->ctx, cmd->argv[keyindex[j]])) {
                 found++;
 
-                /* test if locked */
+                /* test if locked, by key or by slot */
                 int nokey;
                 RedisModule_DictGet(rr->locked_keys, cmd->argv[keyindex[j]], &nokey);
-                if (!nokey) {
+                if (!nokey || (rr->sharding_info->locked_slots_num &&
+                               rr->sharding_info->locked_slots[keyHashSlotRedisString(cmd->argv[keyindex[j]])])) {
                     locked++;
                 }
             }
@@ -153,45 +160,14 @@ static KeysStatus validateKeyExistence(RedisRaftCtx *rr, RaftRedisCommandArray *
     return ALL_EXIST;
 }
 
-/* figure out the "owner shardgroup"
- *
- * the owner shardgroup is either
- *
- * 1) a shardgroup that owns the slot as a stable slot
- * 2) a shardgroup that owns the slot as a migrating slot.  by definition is this shardgroup is local, then it
- *    can't also be importing (a single RedisRaft cluster cannot be both importing and migrating the same slot
- * 3) a shardgroup marked as local (i.e. corresponding to this cluster) that owns the slot as an importing slot and
- *    has a RaftRedisCommandArray marked as asking
- */
-static ShardGroup *getSlotShardGroup(RedisRaftCtx *rr, unsigned int slot, bool asking)
-{
-    ShardGroup *sg = rr->sharding_info->stable_slots_map[slot];
-    if (sg != NULL) {
-        return sg;
-    }
-
-    sg = rr->sharding_info->migrating_slots_map[slot];
-    if (sg && sg->local) {
-        return sg;
-    }
-
-    if (asking) {
-        ShardGroup *isg = rr->sharding_info->importing_slots_map[slot];
-        if (isg && isg->local) {
-            return isg;
-        }
-    }
-
-    return sg;
-}
-
 static RRStatus validateRaftRedisCommandArray(RedisRaftCtx *rr, RedisModuleCtx *reply_ctx,
                                               RaftRedisCommandArray *cmds, unsigned int slot)
 {
     RedisModule_Assert(slot <= REDIS_RAFT_HASH_MAX_SLOT);
 
     /* Make sure hash slot is mapped and handled locally. */
-    ShardGroup *sg = getSlotShardGroup(rr, slot, cmds->asking);
+    const SlotRoute *route = ShardingInfoGetRoute(rr, slot);
+    ShardGroup *sg = cmds->asking ? route->asking_sg : route->sg;
     if (!sg) {
         if (reply_ctx) {
             RedisModule_ReplyWithError(reply_ctx, "CLUSTERDOWN Hash slot is not served");
@@ -199,14 +175,7 @@ static RRStatus validateRaftRedisCommandArray(RedisRaftCtx *rr, RedisModuleCtx *
         return RR_ERROR;
     }
 
-    SlotRangeType slot_type = SLOTRANGE_TYPE_UNDEF;
-    for (size_t i = 0; i < sg->slot_ranges_num; i++) {
-        if (sg->slot_ranges[i].start_slot <= slot && slot <= sg->slot_ranges[i].end_slot) {
-            slot_type = sg->slot_ranges[i].type;
-            break;
-        }
-    }
-
+    SlotRangeType slot_type = cmds->asking ? route->asking_type : route->type;
     if (slot_type == SLOTRANGE_TYPE_UNDEF) {
         if (reply_ctx) {
             RedisModule_ReplyWithError(reply_ctx, "ERR internal error, couldn't associate a shardgroup slot to this request");
@@ -234,9 +203,7 @@ static RRStatus validateRaftRedisCommandArray(RedisRaftCtx *rr, RedisModuleCtx *
                 return RR_ERROR;
             case NONE_EXIST:
                 if (reply_ctx) {
-                    ShardGroup *isg;
-
-                    isg = rr->sharding_info->importing_slots_map[slot];
+                    ShardGroup *isg = route->importing_sg;
                     if (isg) {
                         replyAsk(reply_ctx, slot, &isg->nodes[0].addr);
                     } else {
@@ -293,7 +260,17 @@ static RRStatus handleSharding(RedisRaftCtx *rr, RedisModuleCtx *ctx, RaftRedisC
         return RR_OK;
     }
 
-    return validateRaftRedisCommandArray(rr, ctx, cmds, slot);
+    /* Consecutive entries usually target the same slot range */
+    if (ApplyBatchSlotValidated(&rr->apply_batch, slot)) {
+        return RR_OK;
+    }
+
+    if (validateRaftRedisCommandArray(rr, ctx, cmds, slot) != RR_OK) {
+        return RR_ERROR;
+    }
+
+    ApplyBatchSetValidatedSlot(rr, slot);
+    return RR_OK;
 }
 
 /* returns the client session object for this CommandArray if applicable
@@ -322,29 +299,6 @@ static void *getClientSession(RedisRaftCtx *rr, RaftRedisCommandArray *cmds, boo
     return client_session;
 }
 
-RedisModuleUser *RaftGetACLUser(RedisModuleCtx *ctx, RedisRaftCtx *rr, RaftRedisCommandArray *cmds)
-{
-    int nokey;
-    RedisModuleUser *user = RedisModule_DictGet(rr->acl_dict, cmds->acl, &nokey);
-    if (nokey) {
-        char user_name[64];
-        /* Note: This assumes we don't delete "acl users" */
-        uint64_t count = RedisModule_DictSize(rr->acl_dict);
-        count++;
-        snprintf(user_name, 64, "redis_raft%lu", (unsigned long) count);
-        user = RedisModule_CreateModuleUser(user_name);
-        RedisModule_Assert(user != NULL);
-
-        const char *acl_str = RedisModule_StringPtrLen(cmds->acl, NULL);
-        int ret = RedisModule_SetModuleUserACLString(ctx, user, acl_str, NULL);
-        RedisModule_Assert(ret == REDISMODULE_OK);
-
-        RedisModule_DictSet(rr->acl_dict, cmds->acl, user);
-    }
-
-    return user;
-}
-
 void handleUnblock(RedisModuleCtx *ctx, RedisModuleCallReply *reply, void *private_data)
 {
     UNUSED(ctx);
@@ -376,12 +330,9 @@ RedisModuleCallReply *RaftExecuteCommandArray(RedisRaftCtx *rr,
 {
     RedisModuleCallReply *reply = NULL;
     RedisModuleUser *user = NULL;
+    ACLEntry *acl = NULL;
     RedisModuleCtx *ctx = req ? req->ctx : rr->ctx;
 
-    if (cmds->acl) {
-        user = RaftGetACLUser(rr->ctx, rr, cmds);
-    }
-
     if (rr->config.log_delay_apply) {
         usleep(rr->config.log_delay_apply);
     }
@@ -399,6 +350,22 @@ RedisModuleCallReply *RaftExecuteCommandArray(RedisRaftCtx *rr,
         replaceBlockingTimeout(cmds);
     }
 
+    /* Commands blocked before the last snapshot was loaded must block again
+     * before the keys they wait for are written */
+    blockedCommandsArmForCommands(cmds);
+
+    if (cmds->acl) {
+        acl = ACLCacheAcquire(&rr->acl_cache, cmds->acl);
+        if (!acl) {
+            LOG_WARNING("Unknown ACL in entry: %s", RedisModule_StringPtrLen(cmds->acl, NULL));
+            if (req) {
+                RedisModule_ReplyWithError(req->ctx, "ERR unknown ACL");
+            }
+            return NULL;
+        }
+        user = acl->user;
+    }
+
     for (int i = 0; i < cmds->len; i++) {
         RaftRedisCommand *c = cmds->commands[i];
 
@@ -422,12 +389,9 @@ RedisModuleCallReply *RaftExecuteCommandArray(RedisRaftCtx *rr,
 
         int old_entered_eval = rr->entered_eval;
 
-        if ((cmdlen == 4 && !strncasecmp(cmd, "eval", 4)) ||
-            (cmdlen == 7 && !strncasecmp(cmd, "eval_ro", 7)) ||
-            (cmdlen == 7 && !strncasecmp(cmd, "evalsha", 7)) ||
-            (cmdlen == 10 && !strncasecmp(cmd, "evalsha_ro", 10)) ||
-            (cmdlen == 5 && !strncasecmp(cmd, "fcall", 5)) ||
-            (cmdlen == 8 && !strncasecmp(cmd, "fcall_ro", 8))) {
+        const CommandSpec *cs = CommandSpecTableGetCommandSpec(rr->commands_spec_table,
+                                                               rr->subcommand_spec_tables, c);
+        if (cs && (cs->flags & CMD_SPEC_SCRIPTS)) {
             rr->entered_eval = 1;
         }
 
@@ -466,10 +430,36 @@ RedisModuleCallReply *RaftExecuteCommandArray(RedisRaftCtx *rr,
         }
     }
 
+    ACLCacheRelease(acl);
+
     /* if blocking (this won't be NULL), return it to the caller, to setup callback / saving state */
     return reply;
 }
 
+/* Checks the slot is migrated from this cluster to another one, replies with
+ * an error to 'req' if not. */
+static bool validateMigratingSlot(RedisRaftCtx *rr, unsigned int slot, RaftReq *req)
+{
+    ShardingInfo *si = rr->sharding_info;
+    const char *err = NULL;
+
+    if (!si->migrating_slots_map[slot]) {
+        err = "ERR keys are not migratable";
+    } else if (!si->migrating_slots_map[slot]->local) {
+        err = "ERR This RedisRaft cluster doesn't own these keys";
+    } else if (!si->importing_slots_map[slot]) {
+        err = "ERR no RedisRaft cluster to import keys into";
+    } else if (si->importing_slots_map[slot]->local) {
+        err = "ERR trying to import keys into self RedisCluster";
+    }
+
+    if (err && req) {
+        RedisModule_ReplyWithError(req->ctx, err);
+    }
+
+    return err == NULL;
+}
+
 static void lockKeys(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
 {
     RedisModule_Assert(entry->type == RAFT_LOGTYPE_LOCK_KEYS);
@@ -480,20 +470,11 @@ static void lockKeys(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
 
     /* sanity check keys all belong to same slot */
     int slot = -1;
-    for (size_t i = 0; i < num_keys; i++) {
-        RedisModuleString *key = keys[i];
-
-        unsigned int thisslot = keyHashSlotRedisString(key);
-        if (slot == -1) {
-            slot = (int) thisslot;
-        } else {
-            if (slot != (int) thisslot) {
-                if (req) {
-                    replyCrossSlot(req->ctx);
-                }
-                goto error;
-            }
+    if (!keyHashSlotArgv(keys, 0, (int) num_keys - 1, 1, &slot)) {
+        if (req) {
+            replyCrossSlot(req->ctx);
         }
+        goto error;
     }
 
     if (slot == -1) { /* should be impossible, as keys should be listed up front */
@@ -504,31 +485,7 @@ static void lockKeys(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
     }
 
     ShardingInfo *si = rr->sharding_info;
-    if (!si->migrating_slots_map[slot]) {
-        if (req) {
-            RedisModule_ReplyWithError(req->ctx, "ERR keys are not migratable");
-        }
-        goto error;
-    }
-
-    if (!si->migrating_slots_map[slot]->local) {
-        if (req) {
-            RedisModule_ReplyWithError(req->ctx, "ERR This RedisRaft cluster doesn't own these keys");
-        }
-        goto error;
-    }
-
-    if (!si->importing_slots_map[slot]) {
-        if (req) {
-            RedisModule_ReplyWithError(req->ctx, "ERR no RedisRaft cluster to import keys into");
-        }
-        goto error;
-    }
-
-    if (si->importing_slots_map[slot]->local) {
-        if (req) {
-            RedisModule_ReplyWithError(req->ctx, "ERR trying to import keys into self RedisCluster");
-        }
+    if (!validateMigratingSlot(rr, (unsigned int) slot, req)) {
         goto error;
     }
 
@@ -592,6 +549,82 @@ static void unlockDeleteKeys(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req
     }
 }
 
+static void lockSlot(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
+{
+    ShardingInfo *si = rr->sharding_info;
+    unsigned int slot;
+
+    RedisModule_Assert(entry->type == RAFT_LOGTYPE_LOCK_SLOT);
+
+    if (RaftRedisDeserializeSlot(entry->data, entry->data_len, &slot) != RR_OK) {
+        PANIC("Invalid lock slot entry");
+    }
+
+    if (!validateMigratingSlot(rr, slot, req)) {
+        if (req) {
+            RaftReqFree(req);
+        }
+        return;
+    }
+
+    MIGRATION_TRACE("Locking slot: %u", slot);
+
+    if (!si->locked_slots[slot]) {
+        si->locked_slots[slot] = true;
+        si->locked_slots_num++;
+    }
+
+    if (req) {
+        memcpy(req->r.migrate_slot.shard_group_id, si->importing_slots_map[slot]->id, RAFT_DBID_LEN);
+        MigrateSlot(rr, req);
+    }
+}
+
+static void unlockDeleteSlot(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
+{
+    ShardingInfo *si = rr->sharding_info;
+    RedisModuleString **keys;
+    unsigned int slot;
+    bool unlock;
+
+    RedisModule_Assert(entry->type == RAFT_LOGTYPE_DELETE_UNLOCK_SLOT);
+
+    size_t num_keys;
+    if (RaftRedisDeserializeDeleteUnlockSlot(entry->data, entry->data_len, &slot, &unlock, &keys, &num_keys) != RR_OK) {
+        PANIC("Invalid unlock slot entry");
+    }
+
+    if (num_keys) {
+        enterRedisModuleCall();
+        RedisModuleCallReply *reply = RedisModule_Call(rr->ctx, "del", "v", keys, num_keys);
+        exitRedisModuleCall();
+        RedisModule_Assert(reply != NULL);
+        RedisModule_FreeCallReply(reply);
+    }
+
+    for (size_t i = 0; i < num_keys; i++) {
+        RedisModule_FreeString(NULL, keys[i]);
+    }
+    RedisModule_Free(keys);
+
+    if (!unlock) {
+        MIGRATION_TRACE("Deleted %zu keys of slot: %u", num_keys, slot);
+        return;
+    }
+
+    MIGRATION_TRACE("Unlocking slot: %u, deleted %zu keys", slot, num_keys);
+
+    if (si->locked_slots[slot]) {
+        si->locked_slots[slot] = false;
+        si->locked_slots_num--;
+    }
+
+    if (req) {
+        RedisModule_ReplyWithSimpleString(req->ctx, "OK");
+        RaftReqFree(req);
+    }
+}
+
 static void freeClientSession(void *client_session)
 {
     RedisModule_Free(client_session);
@@ -634,59 +667,112 @@ void clearClientSessions(RedisRaftCtx *rr)
     rr->client_session_dict = RedisModule_CreateDict(rr->ctx);
 }
 
-static void timeoutBlockedCommand(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
+/* Time out, or unblock with an error, the command blocked by the entry at
+ * 'idx'. Returns true if the command was still blocked. */
+static bool timeoutBlockedCommand(raft_index_t idx, bool error)
 {
-    raft_index_t idx;
-    bool error;
-
-    int ret = RaftRedisDeserializeTimeout(entry->data, entry->data_len, &idx, &error);
-    RedisModule_Assert(ret == RR_OK);
-
     BlockedCommand *bc = getBlockedCommand(idx);
     if (!bc) {
         /* unblock handler called before timeout was applied */
-        if (req) {
-            RedisModule_ReplyWithLongLong(req->ctx, 0);
-            RaftReqFree(req);
-        }
-        return;
+        return false;
     }
 
-    /* In future might have to handle abort failing, but for plain redis commands this is a panic condition */
-    ret = RedisModule_CallReplyPromiseAbort(bc->reply, NULL);
+    /* In future might have to handle abort failing, but for plain redis commands this is a panic condition.
+     * Dormant commands loaded from a snapshot were never executed. */
+    if (bc->reply && RedisModule_CallReplyPromiseAbort(bc->reply, NULL) != REDISMODULE_OK) {
+        return false;
+    }
 
-    if (ret == REDISMODULE_OK) {
-        if (bc->req) {
-            /* responding to blocked command */
-            if (error) {
-                RedisModule_ReplyWithError(bc->req->ctx, "UNBLOCKED client unblocked via CLIENT UNBLOCK");
+    if (bc->req) {
+        /* responding to blocked command */
+        if (error) {
+            RedisModule_ReplyWithError(bc->req->ctx, "UNBLOCKED client unblocked via CLIENT UNBLOCK");
+        } else {
+            if ((strncasecmp(bc->command, "bzpopmin", 8) == 0) ||
+                (strncasecmp(bc->command, "bzpopmax", 8) == 0) ||
+                (strncasecmp(bc->command, "bzmpop", 6) == 0)) {
+                RedisModule_ReplyWithNullArray(bc->req->ctx);
             } else {
-                if ((strncasecmp(bc->command, "bzpopmin", 8) == 0) ||
-                    (strncasecmp(bc->command, "bzpopmax", 8) == 0) ||
-                    (strncasecmp(bc->command, "bzmpop", 6) == 0)) {
-                    RedisModule_ReplyWithNullArray(bc->req->ctx);
-                } else {
-                    RedisModule_ReplyWithNull(bc->req->ctx);
-                }
+                RedisModule_ReplyWithNull(bc->req->ctx);
             }
-
-            RaftReqFree(bc->req);
         }
 
-        deleteBlockedCommand(bc->idx);
-        freeBlockedCommand(bc);
+        RaftReqFree(bc->req);
+    }
+
+    deleteBlockedCommand(bc->idx);
+    freeBlockedCommand(bc);
+
+    return true;
+}
+
+static void timeoutBlockedCommands(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
+{
+    raft_index_t *idxs;
+    int count;
+    bool error;
+
+    int ret = RaftRedisDeserializeTimeout(entry->data, entry->data_len, &idxs, &count, &error);
+    RedisModule_Assert(ret == RR_OK);
+
+    long long unblocked = 0;
+    for (int i = 0; i < count; i++) {
+        if (timeoutBlockedCommand(idxs[i], error)) {
+            unblocked++;
+        }
     }
+    RedisModule_Free(idxs);
 
     if (req) {
         /* respond to initiator of the timeout, i.e. CLIENT UNBLOCK */
-        if (ret == REDISMODULE_OK) {
-            RedisModule_ReplyWithLongLong(req->ctx, 1);
-        } else {
-            RedisModule_ReplyWithLongLong(req->ctx, 0);
+        RedisModule_ReplyWithLongLong(req->ctx, unblocked);
+        RaftReqFree(req);
+    }
+}
+
+/* Execute a command array of a log entry. If req is non-NULL, it receives the
+ * reply and is freed once the command is done.
+ *
+ * Commands of batched entries never block, the entry index only identifies a
+ * single blocked command. */
+static void executeCommandArray(RedisRaftCtx *rr, raft_entry_t *entry, raft_index_t entry_idx,
+                                RaftReq *req, RaftRedisCommandArray *cmds, bool batched)
+{
+    uint64_t begin = RedisModule_MonotonicMicroseconds();
+    RedisModuleCallReply *reply = RaftExecuteCommandArray(rr, req, cmds);
+    uint64_t end = RedisModule_MonotonicMicroseconds();
+    rr->apply_pipeline.exec_time += end - begin;
+
+    if (req) {
+        WriteTraceExecuted(rr, req, end);
+    }
+
+    if (reply == NULL) {
+        if (req) {
+            RaftReqFree(req);
         }
+        return;
+    }
 
-        RaftReqFree(req);
+    if (batched) {
+        RedisModule_CallReplyPromiseAbort(reply, NULL);
+        RedisModule_FreeCallReply(reply);
+        if (req) {
+            RedisModule_ReplyWithError(req->ctx, "ERR command blocked in a batched entry");
+            RaftReqFree(req);
+        }
+        return;
     }
+
+    size_t cmdstr_len;
+    const char *cmdstr = RedisModule_StringPtrLen(cmds->commands[0]->argv[0], &cmdstr_len);
+    BlockedCommand *bc = allocBlockedCommand(cmdstr, entry_idx, entry->session, entry->data, entry->data_len, req, reply);
+    if (cmds->acl) {
+        bc->acl = ACLCacheAcquire(&rr->acl_cache, cmds->acl);
+    }
+    blockedCommandSetKeys(bc, cmds->commands[0]);
+    addBlockedCommand(bc);
+    RedisModule_CallReplyPromiseSetUnblockHandler(reply, handleUnblock, bc);
 }
 
 /*
@@ -695,50 +781,54 @@ static void timeoutBlockedCommand(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq
  * There are two variants:
  * 1) Execution of a raft entry received from another node.
  * 2) Execution of a locally initiated command.
+ *
+ * Entries created by write batching carry the commands of multiple clients,
+ * which are executed one by one.
  */
 static void executeLogEntry(RedisRaftCtx *rr, raft_entry_t *entry, raft_index_t entry_idx, RaftReq *req)
 {
     RedisModule_Assert(entry->type == RAFT_LOGTYPE_NORMAL);
 
-    RaftRedisCommandArray tmp = {0};
-    RaftRedisCommandArray *cmds;
+    if (req && req->type == RR_REDISCOMMAND_BATCH) {
+        for (int i = 0; i < req->r.batch.len; i++) {
+            RaftReq *r = req->r.batch.reqs[i];
 
-    /* setup for req/non req nodes needs to mirror teardown below */
-    if (req) {
-        cmds = &req->r.redis.cmds;
+            /* Rejected requests of a proxied batch are not part of the entry,
+             * they are replied in order with the others. */
+            if (r->r.redis.error) {
+                RedisModule_ReplyWithError(r->ctx, RedisModule_StringPtrLen(r->r.redis.error, NULL));
+                RaftReqFree(r);
+                continue;
+            }
+
+            executeCommandArray(rr, entry, entry_idx, r, &r->r.redis.cmds, true);
+        }
+
+        /* Requests are freed once executed */
+        req->r.batch.len = 0;
+        RaftReqFree(req);
+    } else if (req) {
+        executeCommandArray(rr, entry, entry_idx, req, &req->r.redis.cmds, false);
     } else {
-        if (RaftRedisCommandArrayDeserialize(&tmp,
+        RaftRedisCommandBatch batch = {0};
+
+        /* Use the command arrays prepared by the apply pipeline if available */
+        if (ApplyPipelineTake(&rr->apply_pipeline, entry_idx, entry, &batch) != RR_OK &&
+            RaftRedisCommandBatchDeserialize(&batch,
                                              entry->data,
-                                             entry->data_len) != RR_OK) {
+                                             entry->data_len,
+                                             entry->session) != RR_OK) {
             PANIC("Invalid Raft entry");
         }
-        tmp.client_id = entry->session;
-        cmds = &tmp;
-    }
 
-    RedisModuleCallReply *reply = RaftExecuteCommandArray(rr, req, cmds);
-
-    if (reply == NULL) {
-        /* setup for req/non req nodes needs to mirror teardown below */
-        if (req) { /*  node instance where client issued command */
-            RaftReqFree(req);
-        } else {
-            RaftRedisCommandArrayFree(cmds);
-        }
-    } else {
-        size_t cmdstr_len;
-        const char *cmdstr = RedisModule_StringPtrLen(cmds->commands[0]->argv[0], &cmdstr_len);
-        BlockedCommand *bc = allocBlockedCommand(cmdstr, entry_idx, entry->session, entry->data, entry->data_len, req, reply);
-        addBlockedCommand(bc);
-        RedisModule_CallReplyPromiseSetUnblockHandler(reply, handleUnblock, bc);
-        if (req) {
-            /* nothing really happens here for now, but for symmetry, keeping it in place */
-            ;
-        } else {
-            RaftRedisCommandArrayFree(cmds);
+        for (int i = 0; i < batch.len; i++) {
+            executeCommandArray(rr, entry, entry_idx, NULL, &batch.arrays[i], batch.len > 1);
         }
+        RaftRedisCommandBatchFree(&batch);
     }
 
+    rr->apply_pipeline.applied++;
+
     /* Update snapshot info in Redis dataset. This must be done now so it's
      * always consistent with what we applied and we never end up applying
      * an entry onto a snapshot where it was applied already.
@@ -779,7 +869,7 @@ static void handleRequestVoteResponse(redisAsyncContext *c, void *r, void *privd
 
     redisReply *reply = r;
 
-    NodeDismissPendingResponse(node);
+    NodeDismissPendingResponse(node, NULL);
     if (!reply) {
         NODE_LOG_DEBUG(node, "RAFT.REQUESTVOTE failed: connection dropped.");
         ConnMarkDisconnected(node->conn);
@@ -849,7 +939,7 @@ static int raftSendRequestVote(raft_server_t *raft, void *user_data,
                           msg->last_log_term) != REDIS_OK) {
         NODE_TRACE(node, "failed requestvote");
     } else {
-        NodeAddPendingResponse(node, false);
+        NodeAddPendingResponse(node);
     }
 
     return 0;
@@ -861,8 +951,9 @@ static void handleAppendEntriesResponse(redisAsyncContext *c, void *r, void *pri
 {
     Node *node = privdata;
     RedisRaftCtx *rr = node->rr;
+    PendingResponse resp;
 
-    NodeDismissPendingResponse(node);
+    NodeDismissPendingResponse(node, &resp);
 
     redisReply *reply = r;
     if (!reply) {
@@ -885,6 +976,10 @@ static void handleAppendEntriesResponse(redisAsyncContext *c, void *r, void *pri
         return;
     }
 
+    /* Only replies complete a round trip, dropped connections don't */
+    LatencyHistogramAdd(&node->stats.ae_rtt,
+                        (long long) RedisModule_MonotonicMicroseconds() - resp.send_time);
+
     raft_appendentries_resp_t response = {
         .term = reply->element[0]->integer,
         .success = reply->element[1]->integer,
@@ -892,12 +987,29 @@ static void handleAppendEntriesResponse(redisAsyncContext *c, void *r, void *pri
         .msg_id = reply->element[3]->integer,
     };
 
+    if (response.success) {
+        node->stats.ae_acked++;
+        node->stats.ae_entries_acked += resp.num_entries;
+        node->stats.ae_bytes_acked += resp.bytes;
+        node->stats.match_idx = response.current_idx;
+    } else {
+        node->stats.ae_rejected++;
+    }
+
     raft_node_t *raft_node = raft_get_node(rr->raft, node->id);
 
     int ret = raft_recv_appendentries_response(rr->raft, raft_node, &response);
     if (ret != 0) {
         NODE_TRACE(node, "raft_recv_appendentries_response failed, error %d", ret);
     }
+
+    if (response.success && raft_is_leader(rr->raft)) {
+        raft_index_t lag = raft_get_current_idx(rr->raft) - response.current_idx;
+
+        LatencyHistogramAdd(&node->stats.lag, lag > 0 ? lag : 0);
+
+        WriteTraceCommitted(rr);
+    }
 }
 
 static int raftSendAppendEntries(raft_server_t *raft, void *user_data,
@@ -962,7 +1074,16 @@ static int raftSendAppendEntries(raft_server_t *raft, void *user_data,
                               node, argc, (const char **) argv, argvlen) != REDIS_OK) {
         NODE_TRACE(node, "failed appendentries");
     } else {
-        NodeAddPendingResponse(node, false);
+        PendingResponse *resp = NodeAddPendingResponse(node);
+
+        resp->num_entries = msg->n_entries;
+        for (i = 0; i < argc; i++) {
+            resp->bytes += argvlen[i];
+        }
+
+        node->stats.ae_sent++;
+        node->stats.ae_entries_sent += resp->num_entries;
+        node->stats.ae_bytes_sent += resp->bytes;
     }
 
     for (i = 0; i < msg->n_entries; i++) {
@@ -981,7 +1102,7 @@ static void handleTimeoutNowResponse(redisAsyncContext *c, void *r, void *privda
 {
     Node *node = privdata;
 
-    NodeDismissPendingResponse(node);
+    NodeDismissPendingResponse(node, NULL);
 
     redisReply *reply = r;
     if (!reply) {
@@ -1013,7 +1134,7 @@ static int raftSendTimeoutNow(raft_server_t *raft, void *udata, raft_node_t *raf
                           node, "RAFT.TIMEOUT_NOW") != REDIS_OK) {
         NODE_TRACE(node, "failed timeout now");
     } else {
-        NodeAddPendingResponse(node, false);
+        NodeAddPendingResponse(node);
     }
 
     return 0;
@@ -1040,6 +1161,19 @@ static int raftApplyLog(raft_server_t *raft, void *user_data, raft_entry_t *entr
     RedisRaftCtx *rr = user_data;
     RaftReq *req = entryDetachRaftReq(rr, entry);
 
+    /* The commit index may have moved in raft_flush(), before applying */
+    if (req) {
+        WriteTraceCommitted(rr);
+    }
+
+    /* Anything other than a user command may change sharding info */
+    if (entry->type != RAFT_LOGTYPE_NORMAL) {
+        ApplyBatchInvalidate(&rr->apply_batch);
+    }
+
+    /* ACL definitions of earlier terms are not referred to anymore */
+    ACLCacheApplied(&rr->acl_cache, entry->term);
+
     switch (entry->type) {
         case RAFT_LOGTYPE_ADD_NONVOTING_NODE: {
             RaftCfgChange *cfg = (RaftCfgChange *) entry->data;
@@ -1089,6 +1223,12 @@ static int raftApplyLog(raft_server_t *raft, void *user_data, raft_entry_t *entr
         case RAFT_LOGTYPE_DELETE_UNLOCK_KEYS:
             unlockDeleteKeys(rr, entry, req);
             break;
+        case RAFT_LOGTYPE_LOCK_SLOT:
+            lockSlot(rr, entry, req);
+            break;
+        case RAFT_LOGTYPE_DELETE_UNLOCK_SLOT:
+            unlockDeleteSlot(rr, entry, req);
+            break;
         case RAFT_LOGTYPE_END_SESSION:
             handleEndClientSession(rr, entry, req);
             break;
@@ -1097,7 +1237,10 @@ static int raftApplyLog(raft_server_t *raft, void *user_data, raft_entry_t *entr
             clearAllBlockCommands();
             break;
         case RAFT_LOGTYPE_TIMEOUT_BLOCKED:
-            timeoutBlockedCommand(rr, entry, req);
+            timeoutBlockedCommands(rr, entry, req);
+            break;
+        case RAFT_LOGTYPE_ACL_DEFINE:
+            ACLCacheDefine(&rr->acl_cache, entry->data, entry->data_len, entry->term);
             break;
         default:
             break;
@@ -1111,6 +1254,13 @@ static int raftApplyLog(raft_server_t *raft, void *user_data, raft_entry_t *entr
 
 /* ------------------------------------ Utility Callbacks ------------------------------------ */
 
+static void raftNotifyApplyBatch(raft_server_t *raft, void *user_data,
+                                 raft_index_t first_idx, raft_index_t last_idx)
+{
+    RedisRaftCtx *rr = user_data;
+    ApplyBatchBegin(&rr->apply_batch, first_idx, last_idx);
+}
+
 static void raftLog(raft_server_t *raft, void *user_data, const char *buf)
 {
     (void) raft;
@@ -1275,6 +1425,7 @@ void raftNotifyMembershipEvent(raft_server_t *raft, void *user_data,
             RedisModule_Assert(0);
     }
 
+    ShardingTopologyChanged(rr);
     testSendMemberShipEvent(raft, user_data, type, raft_node_get_id(raft_node));
 
     char *s = raftMembershipInfoString(raft);
@@ -1350,6 +1501,9 @@ static void raftNotifyStateEvent(raft_server_t *raft, void *user_data, raft_stat
                        raft_get_current_term(raft));
 
             rr = (RedisRaftCtx*) user_data;
+            WriteTraceReset(&rr->write_trace);
+            ShardingInfoResetConfigVersions(rr);
+
             event_key = "BecomeLeader";
             event_key_s = RedisModule_CreateString(NULL, event_key, strlen(event_key));
             
@@ -1405,6 +1559,7 @@ static int raftBackpressure(raft_server_t *raft, void *user_data, raft_node_t *r
     Node *node = raft_node_get_udata(raft_node);
     if (node->pending_raft_response_num >= rr->config.append_req_max_count) {
         /* Don't send append req to this node */
+        node->stats.backpressure++;
         return 1;
     }
 
@@ -1468,6 +1623,7 @@ raft_cbs_t redis_raft_callbacks = {
     .backpressure = raftBackpressure,
     .timestamp = raftTimestamp,
     .get_entries_to_send = raftGetEntriesToSend,
+    .notify_apply_batch = raftNotifyApplyBatch,
 };
 
 static RRStatus loadRaftLog(RedisRaftCtx *rr)
@@ -1586,6 +1742,7 @@ static void handleLoadingState(RedisRaftCtx *rr)
         if (rr->snapshot_info.loaded) {
             createOutgoingSnapshotMmap(rr);
             configureFromSnapshot(rr);
+            blockedCommandsArmReady();
         }
 
         if (loadRaftLog(rr) != RR_OK) {
@@ -1701,6 +1858,7 @@ void callHandleNodeStates(RedisModuleCtx *ctx, void *arg)
                             callHandleNodeStates, rr);
     HandleIdleConnections(rr);
     HandleNodeStates(rr);
+    ProxyHandleTimeouts(rr);
 }
 
 raft_node_id_t makeRandomNodeId(RedisRaftCtx *rr)
@@ -1865,10 +2023,7 @@ void RaftReqFree(RaftReq *req)
     TRACE("RaftReqFree: req=%p, req->ctx=%p, req->client=%p",
           req, req->ctx, req->client);
 
-    if (req->timeout_timer) {
-        RedisModule_StopTimer(req->ctx, req->timeout_timer, NULL);
-        req->timeout_timer = 0;
-    }
+    blockedTimeoutDel(req);
 
     if (req->client_id) {
         BlockedReqResetById(&redis_raft, req->client_id);
@@ -1878,6 +2033,9 @@ void RaftReqFree(RaftReq *req)
         if (req->r.redis.cmds.size) {
             RaftRedisCommandArrayFree(&req->r.redis.cmds);
         }
+        if (req->r.redis.error) {
+            RedisModule_FreeString(NULL, req->r.redis.error);
+        }
     } else if (req->type == RR_IMPORT_KEYS) {
         if (req->r.import_keys.key_names) {
             for (size_t i = 0; i < req->r.import_keys.num_keys; i++) {
@@ -1911,9 +2069,19 @@ void RaftReqFree(RaftReq *req)
             req->r.migrate_keys.keys_serialized = NULL;
         }
         redis_raft.migrate_req = NULL;
+    } else if (req->type == RR_MIGRATE_SLOT) {
+        SlotMigrationReset(&redis_raft.slot_migration);
+        redis_raft.migrate_req = NULL;
+    } else if (req->type == RR_REDISCOMMAND_BATCH) {
+        for (int i = 0; i < req->r.batch.len; i++) {
+            RaftReqFree(req->r.batch.reqs[i]);
+        }
+        RedisModule_Free(req->r.batch.reqs);
+        req->r.batch.reqs = NULL;
     }
 
-    if (req->ctx) {
+    /* Requests of a proxied batch share the context of the batch */
+    if (req->client) {
         RedisModule_FreeThreadSafeContext(req->ctx);
         RedisModule_UnblockClient(req->client, NULL);
     }
@@ -1921,25 +2089,6 @@ void RaftReqFree(RaftReq *req)
     RedisModule_Free(req);
 }
 
-void blockedTimedOut(RedisModuleCtx *ctx, void *data)
-{
-    RedisRaftCtx *rr = &redis_raft;
-    RaftReq *req = data;
-
-    /* don't need to attach the req to this entry, as the req is part of the BlockedClient object */
-    raft_entry_t *entry = RaftRedisSerializeTimeout(req->raft_idx, false);
-
-    int e = raft_recv_entry(rr->raft, entry, NULL);
-    if (e != 0) {
-        /* if we timed out, but we couldn't apply the timeout entry, it means we lost leadership.
-         * Therefore, when we apply a new NO_OP, it will automatically be timed out on all nodes.
-         * Therefore, don't have to do anything here
-         */
-    }
-
-    raft_entry_release(entry);
-}
-
 static RaftReq *RaftReqInitCore(RedisModuleCtx *ctx, enum RaftReqType type)
 {
     RaftReq *req = RedisModule_Calloc(1, sizeof(RaftReq));
@@ -1948,6 +2097,7 @@ static RaftReq *RaftReqInitCore(RedisModuleCtx *ctx, enum RaftReqType type)
         req->ctx = RedisModule_GetThreadSafeContext(req->client);
     }
     req->type = type;
+    TimerWheelEntryInit(&req->timeout);
 
     return req;
 }
@@ -1956,7 +2106,7 @@ RaftReq *RaftReqInit(RedisModuleCtx *ctx, enum RaftReqType type)
 {
     RaftReq *req = RaftReqInitCore(ctx, type);
 
-    if (type == RR_MIGRATE_KEYS) {
+    if (type == RR_MIGRATE_KEYS || type == RR_MIGRATE_SLOT) {
         redis_raft.migrate_req = req;
     }
 
@@ -1973,7 +2123,7 @@ RaftReq *RaftReqInitBlocking(RedisModuleCtx *ctx, enum RaftReqType type, long lo
     RaftReq *req = RaftReqInitCore(ctx, type);
 
     if (timeout > 0) {
-        req->timeout_timer = RedisModule_CreateTimer(req->ctx, timeout, blockedTimedOut, req);
+        blockedTimeoutAdd(req, timeout);
     }
 
     req->client_id = RedisModule_GetClientId(ctx);
@@ -2038,8 +2188,7 @@ void applyShardGroupChange(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
     ShardGroup *sg;
 
     if ((sg = ShardGroupDeserialize(entry->data, entry->data_len)) == NULL) {
-        LOG_WARNING("Failed to deserialize ADD_SHARDGROUP payload: [%.*s]",
-                    entry->data_len, entry->data);
+        LOG_WARNING("Failed to deserialize ADD_SHARDGROUP payload");
         return;
     }
 
@@ -2087,6 +2236,7 @@ void replaceShardGroups(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
 
     si->shard_group_map = RedisModule_CreateDict(rr->ctx);
     si->shard_groups_num = 0;
+    ShardingTopologyChanged(rr);
 
     for (int i = 0; i <= REDIS_RAFT_HASH_MAX_SLOT; i++) {
         si->stable_slots_map[i] = NULL;
@@ -2094,37 +2244,24 @@ void replaceShardGroups(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req)
         si->migrating_slots_map[i] = NULL;
     }
 
-    /* 2. iterate over payloads
-     * payload structure
-     * "# shard groups:payload1 len:payload1:....:payload n len:payload n:"
-     */
-    char *payload = entry->data;
-
-    char *nl = strchr(payload, '\n');
-    char *endptr;
-    int num_payloads = (int) strtoul(payload, &endptr, 10);
-    RedisModule_Assert(endptr == nl);
-    payload = nl + 1;
-
-    for (int i = 0; i < num_payloads; i++) {
-        nl = strchr(payload, '\n');
-        size_t payload_len = strtoul(payload, &endptr, 10);
-        RedisModule_Assert(endptr == nl);
-        payload = nl + 1;
-
-        ShardGroup *sg;
-        if ((sg = ShardGroupDeserialize(payload, payload_len)) == NULL) {
-            LOG_WARNING("Failed to deserialize shardgroup payload: [%.*s]", (int) payload_len, payload);
-            return;
-        }
+    /* 2. add the shardgroups of the entry */
+    int num_sg;
+    ShardGroup **sgs = ShardGroupsDeserialize(entry->data, entry->data_len, &num_sg);
+    if (!sgs) {
+        LOG_WARNING("Failed to deserialize REPLACE_SHARDGROUPS payload");
+        return;
+    }
+
+    for (int i = 0; i < num_sg; i++) {
+        ShardGroup *sg = sgs[i];
 
         if (!strncmp(sg->id, rr->meta.dbid, RAFT_DBID_LEN)) {
             sg->local = true;
         }
 
         RedisModule_Assert(ShardingInfoAddShardGroup(rr, sg) == RR_OK);
-        payload += payload_len + 1;
     }
+    RedisModule_Free(sgs);
 
     /* If we have an attached client, handle the reply */
     if (req) {
@@ -2144,6 +2281,7 @@ void handleFsyncCompleted(void *result)
     rr->log.fsync_index = rs->fsync_index;
     rr->log.fsync_total += rs->time;
     rr->log.fsync_max = MAX(rs->time, rr->log.fsync_max);
+    WriteTraceMark(&rr->write_trace.fsynced, rs->fsync_index, RedisModule_MonotonicMicroseconds());
 
     RedisModule_Free(rs);
 }
@@ -2163,20 +2301,31 @@ void handleBeforeSleep(RedisRaftCtx *rr)
         return;
     }
 
+    /* Append writes received in this iteration, or send them to the leader */
+    WriteBatchFlush(rr);
+    ProxyBatchFlush(rr);
+
     raft_index_t flushed = rr->log.fsync_index;
     raft_index_t next = raft_get_index_to_sync(rr->raft);
     if (next > 0) {
         LogFlush(&rr->log);
 
+        uint64_t now = RedisModule_MonotonicMicroseconds();
+        WriteTraceMark(&rr->write_trace.written, next, now);
+
         if (rr->config.log_fsync) {
             /* Trigger async fsync() for the current index */
             fsyncThreadAddTask(&rr->fsyncThread, LogCurrentFd(&rr->log), next);
         } else {
             /* Skipping fsync(), we can just update the sync'd index. */
             flushed = next;
+            WriteTraceMark(&rr->write_trace.fsynced, next, now);
         }
     }
 
+    /* Deserialize upcoming entries in the thread pool while we apply */
+    ApplyPipelineSchedule(rr);
+
     int e = raft_flush(rr->raft, flushed);
     if (e == RAFT_ERR_SHUTDOWN) {
         shutdownAfterRemoval(rr);
@@ -38,6 +38,36 @@ int redisraft_loglevel_enums[] = {
 
 RedisRaftCtx redis_raft = {0};
 
+/* State shared by the command filter and cmdRaft(), so intercepting a command
+ * does not allocate. See interceptRedisCommands().
+ */
+static struct {
+    /* Prefixes inserted by the command filter. Created once and retained for
+     * every insert, Redis releases them with the command's arguments. */
+    RedisModuleString *raft;
+    RedisModuleString *sort_reply;
+    RedisModuleString *reject_random;
+    RedisModuleString *reject_subscribe;
+
+    /* The last intercepted command and its spec, so cmdRaft() does not look
+     * it up again. */
+    const RedisModuleString *cmd;
+    const CommandSpec *spec;
+    unsigned long spec_version;
+
+    /* Commands are processed one at a time, so cmdRaft() builds every command
+     * in the same array. 'spare' is the command it holds, kept with its argv
+     * array of 'argv_size' elements unless it's moved to a request. */
+    RaftRedisCommandArray cmds;
+    RaftRedisCommand *spare;
+    int argv_size;
+
+    /* When the last command was intercepted, and when the command in 'cmds'
+     * was, 0 if it was not intercepted. */
+    uint64_t time;
+    uint64_t received;
+} intercept;
+
 /* This is needed for newer pthread versions to properly link and work */
 #ifdef LINUX
 void *__dso_handle;
@@ -568,7 +598,7 @@ static void handleClientUnblock(RedisRaftCtx *rr, RedisModuleCtx *ctx, RaftRedis
         return;
     }
 
-    raft_entry_t *entry = RaftRedisSerializeTimeout(cs->blocked_req->raft_idx, error);
+    raft_entry_t *entry = RaftRedisSerializeTimeout(&cs->blocked_req->raft_idx, 1, error);
     RaftReq *req = RaftReqInit(ctx, RR_CLIENT_UNBLOCK);
 
     int e = RedisRaftRecvEntry(rr, entry, req);
@@ -661,7 +691,7 @@ static bool handleInterceptedCommands(RedisRaftCtx *rr,
 /* NOTE: see comment in rediraft.h on ClientState->watched */
 static void handleWatch(RedisRaftCtx *rr, RedisModuleCtx *ctx, RaftRedisCommandArray *cmds)
 {
-    if (cmds->size == 1) {
+    if (cmds->len == 1) {
         size_t cmd_len;
         const char *cmd = RedisModule_StringPtrLen(cmds->commands[0]->argv[0], &cmd_len);
         if (cmd_len == 5 && strncasecmp("WATCH", cmd, 5) == 0) {
@@ -736,6 +766,8 @@ static void handleRedisCommandAppend(RedisRaftCtx *rr,
         return;
     }
 
+    ACLEntry *acl = ACLCacheGetCurrentUser(rr, ctx);
+
     /* dry run */
     for (int i = 0; i < cmds->len; i++) {
         RaftRedisCommand *cmd = cmds->commands[i];
@@ -746,12 +778,7 @@ static void handleRedisCommandAppend(RedisRaftCtx *rr,
             continue;
         }
 
-        enterRedisModuleCall();
-        RedisModuleCallReply *reply = RedisModule_Call(ctx, cmdstr, "DCEMv", cmd->argv + 1, cmd->argc - 1);
-        exitRedisModuleCall();
-        if (reply != NULL) {
-            RedisModule_ReplyWithCallReply(ctx, reply);
-            RedisModule_FreeCallReply(reply);
+        if (CommandDryRun(rr, ctx, acl, cmd, true) != RR_OK) {
             return;
         }
     }
@@ -763,11 +790,9 @@ static void handleRedisCommandAppend(RedisRaftCtx *rr,
     }
 
     if (cmd_flags & CMD_SPEC_SCRIPTS) {
-        RedisModuleString *user_name = RedisModule_GetCurrentUserName(ctx);
-        RedisModuleUser *user = RedisModule_GetModuleUserFromUserName(user_name);
-        cmds->acl = RedisModule_GetModuleUserACLString(user);
-        RedisModule_FreeModuleUser(user);
-        RedisModule_FreeString(ctx, user_name);
+        if (ACLCacheSetCommandACL(rr, ctx, acl, cmds) != RR_OK) {
+            return;
+        }
     }
 
     /* Handle the special case of read-only commands here: if quorum reads
@@ -801,11 +826,30 @@ static void handleRedisCommandAppend(RedisRaftCtx *rr,
     } else {
         req = RaftReqInit(ctx, RR_REDISCOMMAND);
     }
+
+    /* Commands that didn't go through the command filter, e.g. MULTI/EXEC
+     * transactions, are timed from here */
+    req->times.validated = RedisModule_MonotonicMicroseconds();
+    req->times.received = req->times.validated;
+    if (cmds == &intercept.cmds && intercept.received) {
+        req->times.received = intercept.received;
+    }
+
     RaftRedisCommandArrayMove(&req->r.redis.cmds, cmds);
+    req->r.redis.cmds.client_id = RedisModule_GetClientId(ctx);
+
+    /* Independent writes are appended together, before going to sleep */
+    if (!(cmd_flags & (CMD_SPEC_BLOCKING | CMD_SPEC_MULTI)) &&
+        WriteBatchAdd(rr, req)) {
+        return;
+    }
+
+    /* Writes queued earlier must be appended first */
+    WriteBatchFlush(rr);
 
     raft_entry_t *entry = RaftRedisCommandArraySerialize(&req->r.redis.cmds);
     entry->id = rand();
-    entry->session = RedisModule_GetClientId(ctx);
+    entry->session = req->r.redis.cmds.client_id;
     entry->type = RAFT_LOGTYPE_NORMAL;
 
     int e = RedisRaftRecvEntry(rr, entry, req);
@@ -815,6 +859,7 @@ static void handleRedisCommandAppend(RedisRaftCtx *rr,
         return;
     }
     req->raft_idx = raft_get_current_idx(rr->raft);
+    req->times.appended = RedisModule_MonotonicMicroseconds();
 }
 
 static void handleRedisCommand(RedisRaftCtx *rr,
@@ -840,6 +885,75 @@ static void handleRedisCommand(RedisRaftCtx *rr,
     handleRedisCommandAppend(rr, ctx, cmds);
 }
 
+/* Return the command array of a RAFT command, built in the array shared by
+ * all commands. The command's spec is taken from the command filter, if it
+ * intercepted the command.
+ */
+static RaftRedisCommandArray *getCommandArray(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RaftRedisCommandArray *cmds = &intercept.cmds;
+
+    if (!intercept.spare) {
+        intercept.spare = RaftRedisCommandArrayExtend(cmds);
+        intercept.argv_size = 0;
+    }
+
+    RaftRedisCommand *cmd = intercept.spare;
+    if (argc - 1 > intercept.argv_size) {
+        intercept.argv_size = argc - 1;
+        cmd->argv = RedisModule_Realloc(cmd->argv, intercept.argv_size * sizeof(RedisModuleString *));
+    }
+
+    /* Arguments are retained, as the command may outlive this call */
+    cmd->argc = argc - 1;
+    for (int i = 0; i < argc - 1; i++) {
+        cmd->argv[i] = argv[i + 1];
+        RedisModule_RetainString(ctx, cmd->argv[i]);
+    }
+
+    if (intercept.cmd == argv[1]) {
+        cmd->spec = intercept.spec;
+        cmd->spec_version = intercept.spec_version;
+        intercept.received = intercept.time;
+    }
+    intercept.cmd = NULL;
+
+    cmds->client_id = RedisModule_GetClientId(ctx);
+    return cmds;
+}
+
+/* Release the command array returned by getCommandArray(), keeping its
+ * command for the next one unless it was moved to a request or replaced by a
+ * MULTI/EXEC transaction.
+ */
+static void releaseCommandArray(RaftRedisCommandArray *cmds)
+{
+    if (cmds->len == 1 && cmds->commands[0] == intercept.spare) {
+        RaftRedisCommand *cmd = intercept.spare;
+
+        for (int i = 0; i < cmd->argc; i++) {
+            RedisModule_FreeString(NULL, cmd->argv[i]);
+        }
+        cmd->argc = 0;
+        cmd->spec = NULL;
+        cmd->spec_version = 0;
+    } else {
+        if (cmds->len > 0) {
+            RaftRedisCommandArrayFree(cmds);
+        }
+        intercept.spare = NULL;
+    }
+
+    if (cmds->acl) {
+        RedisModule_FreeString(NULL, cmds->acl);
+        cmds->acl = NULL;
+    }
+    cmds->asking = false;
+    cmds->cmd_flags = 0;
+    cmds->client_id = 0;
+    intercept.received = 0;
+}
+
 /* RAFT [Redis command to execute]
  *   Submit a Redis command to be appended to the Raft log and applied.
  *   The command blocks until it has been committed to the log by the majority
@@ -860,20 +974,9 @@ static int cmdRaft(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         return REDISMODULE_OK;
     }
 
-    RaftRedisCommandArray cmds = {0};
-    RaftRedisCommand *cmd = RaftRedisCommandArrayExtend(&cmds);
-    cmds.client_id = RedisModule_GetClientId(ctx);
-
-    cmd->argc = argc - 1;
-    cmd->argv = RedisModule_Alloc((argc - 1) * sizeof(RedisModuleString *));
-
-    int i;
-    for (i = 0; i < argc - 1; i++) {
-        cmd->argv[i] = argv[i + 1];
-        RedisModule_RetainString(ctx, cmd->argv[i]);
-    }
-    handleRedisCommand(rr, ctx, &cmds);
-    RaftRedisCommandArrayFree(&cmds);
+    RaftRedisCommandArray *cmds = getCommandArray(ctx, argv, argc);
+    handleRedisCommand(rr, ctx, cmds);
+    releaseCommandArray(cmds);
 
     return REDISMODULE_OK;
 }
@@ -908,6 +1011,53 @@ static int cmdRaftEntry(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     return REDISMODULE_OK;
 }
 
+/* RAFT.ENTRIES [Serialized Entry]
+ *   Receive a serialized batch of independent Redis commands, proxied by a
+ *   follower, and append them as a single entry.
+ * Reply:
+ *   -NOCLUSTER ||
+ *   -LOADING ||
+ *   -MOVED <addr> ||
+ *   -CLUSTERDOWN ||
+ *   *<n>
+ *   A standard Redis reply per command, in order
+ */
+static int cmdRaftEntries(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RedisRaftCtx *rr = &redis_raft;
+
+    if (argc != 2) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    size_t data_len;
+    const char *data = RedisModule_StringPtrLen(argv[1], &data_len);
+
+    RaftRedisCommandBatch batch = {0};
+    if (RaftRedisCommandBatchDeserialize(&batch, data, data_len, 0) != RR_OK) {
+        RedisModule_ReplyWithError(ctx, "ERR invalid argument");
+        return REDISMODULE_OK;
+    }
+
+    if (checkRaftState(rr, ctx) != RR_OK ||
+        checkLeader(rr, ctx, NULL) != RR_OK) {
+        goto exit;
+    }
+
+    /* See handleRedisCommandAppend() */
+    if (raft_get_current_term(rr->raft) != rr->snapshot_info.last_applied_term) {
+        replyClusterDown(ctx);
+        goto exit;
+    }
+
+    WriteBatchAppendProxied(rr, ctx, &batch);
+
+exit:
+    RaftRedisCommandBatchFree(&batch);
+    return REDISMODULE_OK;
+}
+
 /* RAFT.AE [target_node_id] [src_node_id]
  *         [leader_id]:[term]:[prev_log_idx]:[prev_log_term]:[leader_commit]:[msg_id]
  *         [n_entries] [<term>:<id>:<session>:<type> <entry>]...
@@ -1217,7 +1367,7 @@ static int cmdRaftCluster(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
         clusterInit(cluster_id);
 
         char reply[RAFT_DBID_LEN + 260];
-        snprintf(reply, sizeof(reply) - 1, "OK %s", rr->snapshot_info.dbid);
+        snprintf(reply, sizeof(reply) - 1, "OK %.*s", RAFT_DBID_LEN, rr->snapshot_info.dbid);
 
         RedisModule_ReplyWithSimpleString(ctx, reply);
     } else if (!strncasecmp(cmd, "JOIN", cmd_len)) {
@@ -1249,11 +1399,15 @@ static int cmdRaftCluster(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
     return REDISMODULE_OK;
 }
 
-/* RAFT.SHARDGROUP GET
+/* RAFT.SHARDGROUP GET [IF-NEWER <version>]
  *   Returns the current cluster's local shard group configuration, in a format
  *   that is compatible with RAFT.SHARDGROUP ADD.
+ *   With IF-NEWER, the configuration is returned only if its version is newer
+ *   than <version>, and the version is appended to the reply.
  * Reply:
  *   [start-slot] [end-slot] [node-id node-addr] [node-id node-addr...]
+ *   [shardgroup-id] [slot ranges] [nodes] [version], with IF-NEWER
+ *   (nil), with IF-NEWER if the configuration is unchanged
  *
  * RAFT.SHARDGROUP ADD [shardgroup id] [num_slots] [num_nodes] ([start slot] [end slot] [slot type])* ([node-uid node-addr:node-port])*
  *   Adds a new shard group configuration.
@@ -1294,7 +1448,12 @@ static int cmdRaftShardGroup(RedisModuleCtx *ctx, RedisModuleString **argv, int
     const char *cmd = RedisModule_StringPtrLen(argv[1], &cmd_len);
 
     if (!strncasecmp(cmd, "GET", cmd_len)) {
-        ShardGroupGet(rr, ctx);
+        if (argc != 2 && argc != 4) {
+            RedisModule_WrongArity(ctx);
+            return REDISMODULE_OK;
+        }
+
+        ShardGroupGet(rr, ctx, argv, argc);
         return REDISMODULE_OK;
     } else if (!strncasecmp(cmd, "ADD", cmd_len)) {
         if (argc < 4) {
@@ -1430,8 +1589,10 @@ static int cmdRaftDebug(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
                 raft_node_set_voting_committed(node, 0);
             } else if (!strcasecmp(tok, "+active")) {
                 raft_node_set_active(node, 1);
+                ShardingTopologyChanged(rr);
             } else if (!strcasecmp(tok, "-active")) {
                 raft_node_set_active(node, 0);
+                ShardingTopologyChanged(rr);
             } else {
                 RedisModule_ReplyWithError(ctx, "ERR invalid nodecfg option");
                 RedisModule_Free(cfg);
@@ -1573,6 +1734,245 @@ static int cmdRaftRejectSubscribe(RedisModuleCtx *ctx, RedisModuleString **argv,
     return REDISMODULE_OK;
 }
 
+static void replyStat(RedisModuleCtx *ctx, const char *name, long long value)
+{
+    RedisModule_ReplyWithCString(ctx, name);
+    RedisModule_ReplyWithLongLong(ctx, value);
+}
+
+#define NODE_STATS_FIELDS 28
+
+static void replyNodeStats(RedisRaftCtx *rr, RedisModuleCtx *ctx, raft_node_t *rn, Node *n)
+{
+    NodeStats *s = &n->stats;
+    bool leader = raft_is_leader(rr->raft);
+    long long lag = 0;
+    long long lag_msec = 0;
+
+    if (leader) {
+        lag = MAX(raft_get_current_idx(rr->raft) - s->match_idx, 0);
+
+        /* Age of the oldest entry the peer hasn't acked */
+        uint64_t written = lag ? WriteTraceWrittenTime(&rr->write_trace, s->match_idx + 1) : 0;
+        if (written) {
+            lag_msec = (long long) (RedisModule_MonotonicMicroseconds() - written) / 1000;
+        }
+    }
+
+    char addr[NODEADDR_MAXLEN];
+    snprintf(addr, sizeof(addr), "%s:%u", n->addr.host, n->addr.port);
+
+    RedisModule_ReplyWithMap(ctx, NODE_STATS_FIELDS);
+    replyStat(ctx, "id", n->id);
+    RedisModule_ReplyWithCString(ctx, "addr");
+    RedisModule_ReplyWithCString(ctx, addr);
+    RedisModule_ReplyWithCString(ctx, "state");
+    RedisModule_ReplyWithCString(ctx, ConnGetStateStr(n->conn));
+    replyStat(ctx, "voting", raft_node_is_voting(rn));
+    replyStat(ctx, "match_idx", s->match_idx);
+    replyStat(ctx, "lag_entries", lag);
+    replyStat(ctx, "lag_msec", lag_msec);
+    replyStat(ctx, "lag_entries_p50", (long long) LatencyHistogramPercentile(&s->lag, 50));
+    replyStat(ctx, "lag_entries_p99", (long long) LatencyHistogramPercentile(&s->lag, 99));
+    replyStat(ctx, "lag_entries_p999", (long long) LatencyHistogramPercentile(&s->lag, 99.9));
+    replyStat(ctx, "ae_sent", (long long) s->ae_sent);
+    replyStat(ctx, "ae_entries_sent", (long long) s->ae_entries_sent);
+    replyStat(ctx, "ae_bytes_sent", (long long) s->ae_bytes_sent);
+    replyStat(ctx, "ae_acked", (long long) s->ae_acked);
+    replyStat(ctx, "ae_entries_acked", (long long) s->ae_entries_acked);
+    replyStat(ctx, "ae_bytes_acked", (long long) s->ae_bytes_acked);
+    replyStat(ctx, "ae_rejected", (long long) s->ae_rejected);
+    replyStat(ctx, "ae_pending", n->pending_raft_response_num);
+    replyStat(ctx, "ae_rtt_count", (long long) s->ae_rtt.count);
+    replyStat(ctx, "ae_rtt_avg_usec", s->ae_rtt.count ? (long long) (s->ae_rtt.sum / s->ae_rtt.count) : 0);
+    replyStat(ctx, "ae_rtt_p50_usec", (long long) LatencyHistogramPercentile(&s->ae_rtt, 50));
+    replyStat(ctx, "ae_rtt_p99_usec", (long long) LatencyHistogramPercentile(&s->ae_rtt, 99));
+    replyStat(ctx, "ae_rtt_p999_usec", (long long) LatencyHistogramPercentile(&s->ae_rtt, 99.9));
+    replyStat(ctx, "backpressure", (long long) s->backpressure);
+    replyStat(ctx, "snapshot_chunks_sent", (long long) s->snapshot_chunks_sent);
+    replyStat(ctx, "snapshot_bytes_sent", (long long) s->snapshot_bytes_sent);
+    replyStat(ctx, "conn_errors", (long long) n->conn->connect_errors);
+    replyStat(ctx, "conn_oks", (long long) n->conn->connect_oks);
+}
+
+/* RAFT.STATS
+ *   Returns write latency and replication metrics of the node and of each of
+ *   its peers, as maps (flat arrays with RESP2). Lag metrics are only tracked
+ *   by the leader.
+ * Reply:
+ *   node_id, role, term, commit_idx, current_idx
+ *   slow_writes: writes slower than slow-write-threshold
+ *   write_latency: a map per write stage (validate, append, write, fsync,
+ *     commit, apply and total) with count, avg_usec, p50_usec, p99_usec and
+ *     p999_usec
+ *   peers: an array with a map per peer:
+ *     id, addr, state, voting
+ *     match_idx, lag_entries, lag_msec: last index acked by the peer, how many
+ *       entries it is behind and how long ago the first of them was written,
+ *       in milliseconds
+ *     lag_entries_p50/p99/p999: distribution of lag_entries, sampled on
+ *       RAFT.AE responses
+ *     ae_sent, ae_entries_sent, ae_bytes_sent: RAFT.AE messages sent
+ *     ae_acked, ae_entries_acked, ae_bytes_acked: RAFT.AE messages acked
+ *     ae_rejected: RAFT.AE responses with a log mismatch
+ *     ae_pending: RAFT.AE and other messages waiting for a response
+ *     ae_rtt_count, ae_rtt_avg_usec, ae_rtt_p50/p99/p999_usec: RAFT.AE round
+ *       trip time
+ *     backpressure: times a RAFT.AE was held back by append-req-max-count
+ *     snapshot_chunks_sent, snapshot_bytes_sent: RAFT.SNAPSHOT messages sent
+ *     conn_errors, conn_oks: connection attempts
+ */
+static int cmdRaftStats(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RedisRaftCtx *rr = &redis_raft;
+
+    if (argc != 1) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    if (checkRaftState(rr, ctx) != RR_OK) {
+        return REDISMODULE_OK;
+    }
+
+    RedisModule_ReplyWithMap(ctx, 8);
+    replyStat(ctx, "node_id", raft_get_nodeid(rr->raft));
+    RedisModule_ReplyWithCString(ctx, "role");
+    RedisModule_ReplyWithCString(ctx, raft_get_state_str(rr->raft));
+    replyStat(ctx, "term", raft_get_current_term(rr->raft));
+    replyStat(ctx, "commit_idx", raft_get_commit_idx(rr->raft));
+    replyStat(ctx, "current_idx", raft_get_current_idx(rr->raft));
+    replyStat(ctx, "slow_writes", (long long) rr->write_trace.slow);
+
+    RedisModule_ReplyWithCString(ctx, "write_latency");
+    RedisModule_ReplyWithMap(ctx, WRITE_STAGE_NUM);
+    for (int i = 0; i < WRITE_STAGE_NUM; i++) {
+        LatencyHistogram *h = &rr->write_trace.stages[i];
+
+        RedisModule_ReplyWithCString(ctx, WriteStageStr[i]);
+        RedisModule_ReplyWithMap(ctx, 5);
+        replyStat(ctx, "count", (long long) h->count);
+        replyStat(ctx, "avg_usec", h->count ? (long long) (h->sum / h->count) : 0);
+        replyStat(ctx, "p50_usec", (long long) LatencyHistogramPercentile(h, 50));
+        replyStat(ctx, "p99_usec", (long long) LatencyHistogramPercentile(h, 99));
+        replyStat(ctx, "p999_usec", (long long) LatencyHistogramPercentile(h, 99.9));
+    }
+
+    RedisModule_ReplyWithCString(ctx, "peers");
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_LEN);
+
+    long len = 0;
+    for (int i = 0; i < raft_get_num_nodes(rr->raft); i++) {
+        raft_node_t *rn = raft_get_node_from_idx(rr->raft, i);
+        Node *n = raft_node_get_udata(rn);
+
+        if (!n) {
+            continue;
+        }
+
+        replyNodeStats(rr, ctx, rn, n);
+        len++;
+    }
+    RedisModule_ReplySetArrayLength(ctx, len);
+
+    return REDISMODULE_OK;
+}
+
+#define LOG_RANGE_MAX_COUNT 1000
+
+static void replyLogEntryInfo(RedisModuleCtx *ctx, raft_index_t idx, LogEntryInfo *info)
+{
+    RedisModule_ReplyWithMap(ctx, 6);
+    replyStat(ctx, "index", idx);
+    replyStat(ctx, "term", info->term);
+    replyStat(ctx, "id", info->id);
+    replyStat(ctx, "session", (long long) info->session);
+    replyStat(ctx, "type", info->type);
+    replyStat(ctx, "data_len", (long long) info->data_len);
+}
+
+/* RAFT.LOG RANGE <from> <count>
+ *   Returns the metadata of up to <count> log entries, starting at index
+ *   <from>. Entries are read from the log cache or from the headers in the
+ *   log file, their data is not read. Compacted entries are skipped, and
+ *   <count> is capped at 1000.
+ * Reply:
+ *   An array of two elements:
+ *     - The index to continue from, or 0 if there are no more entries.
+ *     - An array with a map per entry: index, term, id, session, type and
+ *       data_len.
+ */
+static int cmdRaftLog(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
+{
+    RedisRaftCtx *rr = &redis_raft;
+
+    if (argc < 2) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    if (checkRaftState(rr, ctx) != RR_OK) {
+        return REDISMODULE_OK;
+    }
+
+    size_t cmd_len;
+    const char *cmd = RedisModule_StringPtrLen(argv[1], &cmd_len);
+
+    if (strncasecmp(cmd, "RANGE", cmd_len) != 0) {
+        RedisModule_ReplyWithError(ctx, "RAFT.LOG supports RANGE only");
+        return REDISMODULE_OK;
+    }
+
+    if (argc != 4) {
+        RedisModule_WrongArity(ctx);
+        return REDISMODULE_OK;
+    }
+
+    long long from, count;
+
+    if (RedisModule_StringToLongLong(argv[2], &from) != REDISMODULE_OK || from < 0) {
+        RedisModule_ReplyWithError(ctx, "ERR invalid index");
+        return REDISMODULE_OK;
+    }
+
+    if (RedisModule_StringToLongLong(argv[3], &count) != REDISMODULE_OK || count <= 0) {
+        RedisModule_ReplyWithError(ctx, "ERR invalid count");
+        return REDISMODULE_OK;
+    }
+
+    raft_index_t idx = MAX(from, LogFirstIdx(&rr->log));
+    raft_index_t end = MIN(idx + MIN(count, LOG_RANGE_MAX_COUNT), raft_get_current_idx(rr->raft) + 1);
+
+    RedisModule_ReplyWithArray(ctx, 2);
+    RedisModule_ReplyWithLongLong(ctx, end <= raft_get_current_idx(rr->raft) ? end : 0);
+    RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_LEN);
+
+    long len = 0;
+    for (; idx < end; idx++) {
+        LogEntryInfo info;
+        raft_entry_t *e = EntryCacheGet(rr->logcache, idx);
+
+        if (e) {
+            info = (LogEntryInfo){
+                .term = e->term,
+                .id = e->id,
+                .session = e->session,
+                .type = e->type,
+                .data_len = e->data_len,
+            };
+            raft_entry_release(e);
+        } else if (LogGetEntryInfo(&rr->log, idx, &info) != RR_OK) {
+            continue;
+        }
+
+        replyLogEntryInfo(ctx, idx, &info);
+        len++;
+    }
+    RedisModule_ReplySetArrayLength(ctx, len);
+
+    return REDISMODULE_OK;
+}
+
 static int cmdRaftScan(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 {
     RedisRaftCtx *rr = &redis_raft;
@@ -1602,6 +2002,18 @@ static int cmdRaftScan(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
         return REDISMODULE_OK;
     }
 
+    /* The slot index covers db 0, its cursors are not SCAN cursors */
+    if (rr->config.slot_index && RedisModule_GetSelectedDb(ctx) == 0) {
+        long long index_cursor;
+        if (RedisModule_StringToLongLong(argv[1], &index_cursor) != REDISMODULE_OK) {
+            RedisModule_ReplyWithError(ctx, "ERR invalid cursor");
+            return REDISMODULE_OK;
+        }
+
+        SlotIndexScan(rr, ctx, (unsigned long long) index_cursor, slots, rr->config.scan_size);
+        return REDISMODULE_OK;
+    }
+
     RedisModuleCallReply *reply;
     if (!(reply = RedisModule_Call(ctx, "scan", "ccl", cursor, "count", rr->config.scan_size))) {
         RedisModule_ReplyWithError(ctx, "ERR scan failed");
@@ -1684,7 +2096,7 @@ void handleClientEvent(RedisModuleCtx *ctx, RedisModuleEvent eid,
                         appendEndClientSession(rr, NULL, ci->id, "disconnect");
                     }
                     if (cs->blocked_req) {
-                        raft_entry_t *entry = RaftRedisSerializeTimeout(cs->blocked_req->raft_idx, false);
+                        raft_entry_t *entry = RaftRedisSerializeTimeout(&cs->blocked_req->raft_idx, 1, false);
                         raft_recv_entry(rr->raft, entry, NULL);
                         raft_entry_release(entry);
                     }
@@ -1699,15 +2111,25 @@ void handleClientEvent(RedisModuleCtx *ctx, RedisModuleEvent eid,
     }
 }
 
+/* Insert one of the shared prefixes of the command filter. Redis releases it
+ * with the command's arguments, so it is retained for every insert. */
+static void insertCommandPrefix(RedisModuleCommandFilterCtx *filter, RedisModuleString *prefix)
+{
+    RedisModule_RetainString(NULL, prefix);
+    RedisModule_CommandFilterArgInsert(filter, 0, prefix);
+}
+
 /* Command filter callback that intercepts normal Redis commands and prefixes them
  * with a RAFT command prefix in order to divert them to execute inside RedisRaft.
  */
 static void interceptRedisCommands(RedisModuleCommandFilterCtx *filter)
 {
     RedisRaftCtx *rr = &redis_raft;
-    RedisModuleString *s, *subcmd = NULL;
+    RedisModuleString *subcmd = NULL;
     RedisModuleString *cmd = RedisModule_CommandFilterArgGet(filter, 0);
 
+    intercept.cmd = NULL;
+
     if (RedisModule_CommandFilterArgsCount(filter) > 1) {
         subcmd = RedisModule_CommandFilterArgGet(filter, 1);
     }
@@ -1718,11 +2140,9 @@ static void interceptRedisCommands(RedisModuleCommandFilterCtx *filter)
             int flags;
             if ((flags = CommandSpecTableGetFlags(rr->commands_spec_table, rr->subcommand_spec_tables, cmd, subcmd)) != -1) {
                 if (flags & CMD_SPEC_SORT_REPLY) {
-                    s = RedisModule_CreateString(NULL, "RAFT._SORT_REPLY", 16);
-                    RedisModule_CommandFilterArgInsert(filter, 0, s);
+                    insertCommandPrefix(filter, intercept.sort_reply);
                 } else if (flags & CMD_SPEC_RANDOM) {
-                    s = RedisModule_CreateString(NULL, "RAFT._REJECT_RANDOM_COMMAND", 27);
-                    RedisModule_CommandFilterArgInsert(filter, 0, s);
+                    insertCommandPrefix(filter, intercept.reject_random);
                 }
             }
         }
@@ -1730,27 +2150,49 @@ static void interceptRedisCommands(RedisModuleCommandFilterCtx *filter)
         return;
     }
 
-    int flags = CommandSpecTableGetFlags(rr->commands_spec_table, rr->subcommand_spec_tables, cmd, subcmd);
-    if (flags != -1 && (flags & CMD_SPEC_DONT_INTERCEPT))
-        return;
-
     size_t len;
     const char *str = RedisModule_StringPtrLen(cmd, &len);
 
+    /* Cached ACLs of user names may change */
+    if (len == 3 && strncasecmp(str, "ACL", len) == 0 && subcmd) {
+        size_t sublen;
+        const char *substr = RedisModule_StringPtrLen(subcmd, &sublen);
+
+        if ((sublen == 7 && strncasecmp(substr, "SETUSER", sublen) == 0) ||
+            (sublen == 7 && strncasecmp(substr, "DELUSER", sublen) == 0) ||
+            (sublen == 4 && strncasecmp(substr, "LOAD", sublen) == 0)) {
+            ACLCacheSetStale(&rr->acl_cache);
+        }
+    }
+
+    /* The user of a client may change */
+    if ((len == 4 && strncasecmp(str, "AUTH", len) == 0) ||
+        (len == 5 && strncasecmp(str, "HELLO", len) == 0)) {
+        ACLCacheClientsChanged(&rr->acl_cache);
+    }
+
+    const CommandSpec *cs = CommandSpecTableLookup(rr->commands_spec_table, rr->subcommand_spec_tables, cmd, subcmd);
+    int flags = CommandSpecGetFlags(cs, subcmd != NULL);
+    if (flags != -1 && (flags & CMD_SPEC_DONT_INTERCEPT))
+        return;
+
     if ((len == 9 && strncasecmp(str, "SUBSCRIBE", len) == 0) ||
         (len == 10 && strncasecmp(str, "SSUBSCRIBE", len) == 0) ||
         (len == 10 && strncasecmp(str, "PSUBSCRIBE", len) == 0)) {
 
         if (!allowSubscribe(rr)) {
-            s = RedisModule_CreateString(NULL, "RAFT._REJECT_SUBSCRIBE", 22);
-            RedisModule_CommandFilterArgInsert(filter, 0, s);
+            insertCommandPrefix(filter, intercept.reject_subscribe);
         }
         return;
     }
 
-    /* Prepend RAFT to the original command */
-    RedisModuleString *raft_str = RedisModule_CreateString(NULL, "RAFT", 4);
-    RedisModule_CommandFilterArgInsert(filter, 0, raft_str);
+    /* Prepend RAFT to the original command, cmdRaft() picks up its spec */
+    insertCommandPrefix(filter, intercept.raft);
+
+    intercept.cmd = cmd;
+    intercept.spec = cs;
+    intercept.spec_version = rr->commands_spec_table->version;
+    intercept.time = RedisModule_MonotonicMicroseconds();
 }
 
 /* Callback from Redis event loop */
@@ -1758,6 +2200,14 @@ static void beforeSleep(RedisModuleCtx *ctx, RedisModuleEvent eid,
                         uint64_t subevent, void *data)
 {
     if (subevent == REDISMODULE_SUBEVENT_EVENTLOOP_BEFORE_SLEEP) {
+        /* ACL commands seen by the command filter have run by now */
+        if (redis_raft.acl_cache.stale) {
+            ACLCacheInvalidate(&redis_raft.acl_cache);
+        }
+        if (redis_raft.acl_cache.collect) {
+            ACLCacheCollect(&redis_raft.acl_cache);
+        }
+
         handleBeforeSleep(&redis_raft);
     }
 }
@@ -1830,21 +2280,6 @@ static void handleInfo(RedisModuleInfoCtx *ctx, int for_crash_report)
     RedisModule_InfoAddFieldULongLong(ctx, "client_attached_entries", rr->client_attached_entries);
     RedisModule_InfoAddFieldULongLong(ctx, "fsync_count", rr->log.fsync_count);
     RedisModule_InfoAddFieldULongLong(ctx, "fsync_max_microseconds", rr->log.fsync_max);
-    int num_entries = rr->raft ? raft_get_log_count(rr->raft) : 0;
-    for (int i = 0; i < num_entries; i++ ) {
-        raft_entry_t *entry = LogGet(&rr->log, i);
-        if (entry == NULL) {
-            continue;
-        }
-        char name[32];
-        snprintf(name, sizeof(name), "entry%d", i);
-
-        RedisModule_InfoBeginDictField(ctx, name);
-        RedisModule_InfoAddFieldLongLong(ctx, "term", entry->term);
-        RedisModule_InfoAddFieldLongLong(ctx, "id", (long) entry->id);
-        RedisModule_InfoAddFieldLongLong(ctx, "data_len", entry->data_len);
-        RedisModule_InfoEndDictField(ctx);
-    }
 
     uint64_t avg = 0;
     if (rr->log.fsync_count) {
@@ -1875,6 +2310,11 @@ static void handleInfo(RedisModuleInfoCtx *ctx, int for_crash_report)
     RedisModule_InfoAddFieldULongLong(ctx, "proxy_failed_reqs", rr->proxy_failed_reqs);
     RedisModule_InfoAddFieldULongLong(ctx, "proxy_failed_responses", rr->proxy_failed_responses);
     RedisModule_InfoAddFieldULongLong(ctx, "proxy_outstanding_reqs", rr->proxy_outstanding_reqs);
+    RedisModule_InfoAddFieldULongLong(ctx, "proxy_batches", rr->proxy_batches);
+    RedisModule_InfoAddFieldLongLong(ctx, "proxy_connections", rr->proxy_pool.num);
+    RedisModule_InfoAddFieldULongLong(ctx, "proxy_latency_p50_microseconds", LatencyHistogramPercentile(&rr->proxy_pool.latency, 50));
+    RedisModule_InfoAddFieldULongLong(ctx, "proxy_latency_p99_microseconds", LatencyHistogramPercentile(&rr->proxy_pool.latency, 99));
+    RedisModule_InfoAddFieldULongLong(ctx, "proxy_latency_p999_microseconds", LatencyHistogramPercentile(&rr->proxy_pool.latency, 99.9));
 
     RedisModule_InfoAddSection(ctx, "stats");
     RedisModule_InfoAddFieldULongLong(ctx, "appendreq_received", rr->appendreq_received);
@@ -1882,6 +2322,68 @@ static void handleInfo(RedisModuleInfoCtx *ctx, int for_crash_report)
     RedisModule_InfoAddFieldULongLong(ctx, "snapshotreq_received", rr->snapshotreq_received);
     RedisModule_InfoAddFieldULongLong(ctx, "exec_throttled", rr->exec_throttled);
     RedisModule_InfoAddFieldULongLong(ctx, "num_sessions", RedisModule_DictSize(rr->client_session_dict));
+
+    ApplyPipeline *ap = &rr->apply_pipeline;
+    raft_index_t lag = rr->raft ? raft_get_commit_idx(rr->raft) - raft_get_last_applied_idx(rr->raft) : 0;
+    RedisModule_InfoAddFieldULongLong(ctx, "apply_lag", lag);
+    RedisModule_InfoAddFieldULongLong(ctx, "apply_entries", ap->applied);
+    RedisModule_InfoAddFieldULongLong(ctx, "apply_batches", rr->apply_batch.batches);
+    RedisModule_InfoAddFieldULongLong(ctx, "apply_prefetch_hits", ap->prefetch_hits);
+    RedisModule_InfoAddFieldULongLong(ctx, "apply_prefetch_misses", ap->prefetch_misses);
+    RedisModule_InfoAddFieldULongLong(ctx, "apply_prefetch_dropped", ap->prefetch_dropped);
+    RedisModule_InfoAddFieldULongLong(ctx, "apply_deserialize_avg_microseconds", ap->prefetched ? ap->deserialize_time / ap->prefetched : 0);
+    RedisModule_InfoAddFieldULongLong(ctx, "apply_exec_avg_microseconds", ap->applied ? ap->exec_time / ap->applied : 0);
+    RedisModule_InfoAddFieldULongLong(ctx, "acl_cache_definitions", rr->acl_cache.defined_num);
+    RedisModule_InfoAddFieldULongLong(ctx, "acl_cache_users", rr->acl_cache.users_num);
+    RedisModule_InfoAddFieldULongLong(ctx, "acl_cache_hits", rr->acl_cache.hits);
+    RedisModule_InfoAddFieldULongLong(ctx, "acl_cache_misses", rr->acl_cache.misses);
+    RedisModule_InfoAddFieldULongLong(ctx, "acl_cache_invalidations", rr->acl_cache.invalidations);
+    RedisModule_InfoAddFieldULongLong(ctx, "dry_runs", rr->dry_runs);
+    RedisModule_InfoAddFieldULongLong(ctx, "dry_runs_skipped", rr->dry_runs_skipped);
+    RedisModule_InfoAddFieldULongLong(ctx, "write_batch_entries", rr->write_batch.entries);
+    RedisModule_InfoAddFieldULongLong(ctx, "write_batch_commands", rr->write_batch.commands);
+    RedisModule_InfoAddFieldULongLong(ctx, "blocked_commands", rr->blocked_commands.count);
+    RedisModule_InfoAddFieldULongLong(ctx, "blocked_timeout_entries", rr->blocked_commands.timeout_entries);
+    RedisModule_InfoAddFieldULongLong(ctx, "blocked_timeouts_expired", rr->blocked_commands.timeouts_expired);
+    RedisModule_InfoAddFieldULongLong(ctx, "blocked_commands_dormant", rr->blocked_commands.dormant);
+    RedisModule_InfoAddFieldULongLong(ctx, "blocked_rebuild_microseconds", rr->blocked_commands.rebuild_time);
+    RedisModule_InfoAddFieldULongLong(ctx, "slot_index_keys", rr->slot_index.num_keys);
+    RedisModule_InfoAddFieldULongLong(ctx, "slot_index_rebuilds", rr->slot_index.rebuilds);
+    RedisModule_InfoAddFieldULongLong(ctx, "topology_epoch", rr->topology_cache.epoch);
+    RedisModule_InfoAddFieldULongLong(ctx, "topology_cache_hits", rr->topology_cache.hits);
+    RedisModule_InfoAddFieldULongLong(ctx, "topology_cache_renders", rr->topology_cache.renders);
+    RedisModule_InfoAddFieldULongLong(ctx, "dns_cache_entries", rr->resolver_cache.entries ? RedisModule_DictSize(rr->resolver_cache.entries) : 0);
+    RedisModule_InfoAddFieldULongLong(ctx, "dns_cache_hits", rr->resolver_cache.hits);
+    RedisModule_InfoAddFieldULongLong(ctx, "dns_cache_misses", rr->resolver_cache.misses);
+    RedisModule_InfoAddFieldULongLong(ctx, "dns_cache_coalesced", rr->resolver_cache.coalesced);
+
+    SlotMigration *m = &rr->slot_migration;
+    long long elapsed = (m->end_time ? m->end_time : monotonicMilliseconds()) - m->start_time;
+    RedisModule_InfoAddFieldLongLong(ctx, "migration_slot", m->slot);
+    RedisModule_InfoAddFieldCString(ctx, "migration_state", m->req ? "migrating" : "idle");
+    RedisModule_InfoAddFieldULongLong(ctx, "migration_keys_total", m->num_keys);
+    RedisModule_InfoAddFieldULongLong(ctx, "migration_keys_sent", m->keys_sent);
+    RedisModule_InfoAddFieldULongLong(ctx, "migration_bytes_sent", m->bytes_sent);
+    RedisModule_InfoAddFieldULongLong(ctx, "migration_batches", m->batches);
+    RedisModule_InfoAddFieldLongLong(ctx, "migration_elapsed_msec", m->start_time ? elapsed : 0);
+    RedisModule_InfoAddFieldULongLong(ctx, "migration_bytes_per_sec",
+                                      elapsed > 0 ? m->bytes_sent * 1000 / elapsed : 0);
+
+    RedisModule_InfoAddSection(ctx, "latency");
+    RedisModule_InfoAddFieldULongLong(ctx, "slow_writes", rr->write_trace.slow);
+    for (int i = 0; i < WRITE_STAGE_NUM; i++) {
+        LatencyHistogram *h = &rr->write_trace.stages[i];
+        char name[64];
+
+        snprintf(name, sizeof(name), "write_%s", WriteStageStr[i]);
+        RedisModule_InfoBeginDictField(ctx, name);
+        RedisModule_InfoAddFieldULongLong(ctx, "count", h->count);
+        RedisModule_InfoAddFieldULongLong(ctx, "avg_usec", h->count ? h->sum / h->count : 0);
+        RedisModule_InfoAddFieldULongLong(ctx, "p50_usec", LatencyHistogramPercentile(h, 50));
+        RedisModule_InfoAddFieldULongLong(ctx, "p99_usec", LatencyHistogramPercentile(h, 99));
+        RedisModule_InfoAddFieldULongLong(ctx, "p999_usec", LatencyHistogramPercentile(h, 99.9));
+        RedisModule_InfoEndDictField(ctx);
+    }
 }
 
 static int registerRaftCommands(RedisModuleCtx *ctx)
@@ -1902,6 +2404,11 @@ static int registerRaftCommands(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
+    if (RedisModule_CreateCommand(ctx, "raft.entries", cmdRaftEntries,
+                                  "write", 0, 0, 0) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
     if (RedisModule_CreateCommand(ctx, "raft.cluster", cmdRaftCluster,
                                   "admin", 0, 0, 0) == REDISMODULE_ERR) {
         return REDISMODULE_ERR;
@@ -1980,6 +2487,21 @@ static int registerRaftCommands(RedisModuleCtx *ctx)
         return REDISMODULE_ERR;
     }
 
+    if (RedisModule_CreateCommand(ctx, "raft.migrate", cmdRaftMigrate,
+                                  "admin", 0, 0, 0) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "raft.stats", cmdRaftStats,
+                                  "admin", 0, 0, 0) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
+    if (RedisModule_CreateCommand(ctx, "raft.log", cmdRaftLog,
+                                  "admin", 0, 0, 0) == REDISMODULE_ERR) {
+        return REDISMODULE_ERR;
+    }
+
     RedisRaftType = RedisModule_CreateDataType(ctx, REDIS_RAFT_DATATYPE_NAME,
                                                REDIS_RAFT_DATATYPE_ENCVER,
                                                &RedisRaftTypeMethods);
@@ -2008,6 +2530,7 @@ RRStatus RedisRaftCtxInit(RedisRaftCtx *rr, RedisModuleCtx *ctx)
     sc_crc32_init();
     sc_list_init(&rr->nodes);
     sc_list_init(&rr->connections);
+    ApplyPipelineInit(&rr->apply_pipeline);
 
     CommandSpecTableInit(rr->ctx, &rr->commands_spec_table);
     SubCommandsSpecTableInit(rr->ctx, &rr->subcommand_spec_tables);
@@ -2022,15 +2545,18 @@ RRStatus RedisRaftCtxInit(RedisRaftCtx *rr, RedisModuleCtx *ctx)
     rr->locked_keys = RedisModule_CreateDict(rr->ctx);
 
     /* setup blocked command state */
-    rr->blocked_command_dict = RedisModule_CreateDict(rr->ctx);
-    sc_list_init(&rr->blocked_command_list);
+    blockedCommandsInit();
 
-    /* acl -> user dictionary */
-    rr->acl_dict = RedisModule_CreateDict(rr->ctx);
+    SlotIndexInit(&rr->slot_index);
+    SlotMigrationInit(&rr->slot_migration);
+
+    /* ACLs of script entries */
+    ACLCacheInit(&rr->acl_cache);
 
     rr->client_session_dict = RedisModule_CreateDict(rr->ctx);
 
     /* Cluster configuration */
+    TopologyCacheInit(&rr->topology_cache);
     ShardingInfoInit(rr->ctx, &rr->sharding_info);
 
     /* Snapshot state initialization */
@@ -2069,6 +2595,9 @@ RRStatus RedisRaftCtxInit(RedisRaftCtx *rr, RedisModuleCtx *ctx)
     RedisModule_CreateTimer(rr->ctx, rr->config.periodic_interval, callRaftPeriodic, rr);
     RedisModule_CreateTimer(rr->ctx, rr->config.reconnect_interval, callHandleNodeStates, rr);
     threadPoolInit(&rr->thread_pool, 5);
+    ResolverCacheInit(&rr->resolver_cache);
+    ProxyPoolInit(&rr->proxy_pool);
+    ApplyBatchInvalidate(&rr->apply_batch);
     fsyncThreadStart(&rr->fsyncThread, handleFsyncCompleted);
 
     return RR_OK;
@@ -2081,6 +2610,8 @@ error:
 
 void RedisRaftCtxClear(RedisRaftCtx *rr)
 {
+    ApplyPipelineReset(&rr->apply_pipeline);
+
     if (rr->raft) {
         raft_destroy(rr->raft);
         rr->raft = NULL;
@@ -2113,6 +2644,9 @@ void RedisRaftCtxClear(RedisRaftCtx *rr)
         rr->sharding_info = NULL;
     }
 
+    TopologyCacheFree(&rr->topology_cache);
+    ResolverCacheFree(&rr->resolver_cache);
+
     if (rr->client_state) {
         RedisModule_FreeDict(rr->ctx, rr->client_state);
         rr->client_state = NULL;
@@ -2128,20 +2662,12 @@ void RedisRaftCtxClear(RedisRaftCtx *rr)
         rr->locked_keys = NULL;
     }
 
-    if (rr->blocked_command_dict) {
-        RedisModule_FreeDict(rr->ctx, rr->blocked_command_dict);
-        rr->blocked_command_dict = NULL;
-    }
+    blockedCommandsTerm();
+    SlotIndexFree(&rr->slot_index);
+    SlotMigrationReset(&rr->slot_migration);
 
-    struct sc_list *elem;
-    while ((elem = sc_list_pop_head(&rr->blocked_command_list)) != NULL) {
-        RedisModule_Free(sc_list_entry(elem, BlockedCommand, blocked_list));
-    }
-
-    if (rr->acl_dict) {
-        RedisModule_FreeDict(rr->ctx, rr->acl_dict);
-        rr->acl_dict = NULL;
-    }
+    ACLCacheFree(&rr->acl_cache);
+    ProxyPoolFree(&rr->proxy_pool);
 
     if (rr->client_session_dict) {
         RedisModule_FreeDict(rr->ctx, rr->client_session_dict);
@@ -2161,6 +2687,17 @@ void RedisRaftFreeGlobals()
         RedisModule_FreeThreadSafeContext(redisraft_log_ctx);
     }
     RedisRaftCtxClear(&redis_raft);
+
+    RaftRedisCommandArrayFree(&intercept.cmds);
+    intercept.spare = NULL;
+
+    if (intercept.raft) {
+        RedisModule_FreeString(NULL, intercept.raft);
+        RedisModule_FreeString(NULL, intercept.sort_reply);
+        RedisModule_FreeString(NULL, intercept.reject_random);
+        RedisModule_FreeString(NULL, intercept.reject_subscribe);
+        intercept.raft = NULL;
+    }
 }
 
 __attribute__((__unused__)) int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
@@ -2189,6 +2726,11 @@ __attribute__((__unused__)) int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisMod
     redisraft_log_ctx = RedisModule_GetDetachedThreadSafeContext(ctx);
 
     RedisModule_RegisterInfoFunc(ctx, handleInfo);
+
+    intercept.raft = RedisModule_CreateString(NULL, "RAFT", 4);
+    intercept.sort_reply = RedisModule_CreateString(NULL, "RAFT._SORT_REPLY", 16);
+    intercept.reject_random = RedisModule_CreateString(NULL, "RAFT._REJECT_RANDOM_COMMAND", 27);
+    intercept.reject_subscribe = RedisModule_CreateString(NULL, "RAFT._REJECT_SUBSCRIBE", 22);
     RedisModule_RegisterCommandFilter(ctx, interceptRedisCommands, 0);
 
     if (registerRaftCommands(ctx) == RR_ERROR) {
@@ -2223,6 +2765,30 @@ __attribute__((__unused__)) int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisMod
         goto error;
     }
 
+    /* Slot index maintenance */
+    if (RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_Loading, SlotIndexServerEvent) != REDISMODULE_OK ||
+        RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_FlushDB, SlotIndexServerEvent) != REDISMODULE_OK ||
+        RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_SwapDB, SlotIndexServerEvent) != REDISMODULE_OK) {
+        LOG_WARNING("Failed to subscribe to server events.");
+        goto error;
+    }
+
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_NEW | REDISMODULE_NOTIFY_GENERIC |
+                                                       REDISMODULE_NOTIFY_EXPIRED | REDISMODULE_NOTIFY_EVICTED,
+                                              SlotIndexKeyspaceEvent) != REDISMODULE_OK) {
+        LOG_WARNING("Failed to subscribe to keyspace events.");
+        goto error;
+    }
+
+    /* Blocked commands loaded from a snapshot, see blocked.c */
+    if (RedisModule_SubscribeToKeyspaceEvents(ctx, REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_LIST |
+                                                       REDISMODULE_NOTIFY_ZSET | REDISMODULE_NOTIFY_STREAM |
+                                                       REDISMODULE_NOTIFY_MODULE,
+                                              blockedCommandsKeyspaceEvent) != REDISMODULE_OK) {
+        LOG_WARNING("Failed to subscribe to keyspace events.");
+        goto error;
+    }
+
     RedisRaftCtx *rr = &redis_raft;
 
     if (RedisRaftCtxInit(rr, ctx) == RR_ERROR) {
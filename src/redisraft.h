@@ -63,7 +63,7 @@ struct CommandSpecTable;
 struct TestNetworkWrapper;
 
 #define REDIS_RAFT_DATATYPE_NAME   "redisraft"
-#define REDIS_RAFT_DATATYPE_ENCVER 1
+#define REDIS_RAFT_DATATYPE_ENCVER 4
 
 extern int redisraft_trace;
 extern int redisraft_loglevel;
@@ -186,11 +186,6 @@ typedef struct Connection {
     char *password;                    /* password to use if specified */
     void *privdata;                    /* User provided pointer */
 
-    struct AddrinfoResult {
-        int rc;
-        struct addrinfo *addr;
-    } addrinfo_result;
-
     /* Connect callback is guaranteed after ConnConnect(); Callback should check
      * connection state as it will also be called on error.
      */
@@ -213,6 +208,17 @@ typedef struct Connection {
     struct sc_list entries;
 } Connection;
 
+/* Resolved addresses of connection hosts, shared by all connections. Failed
+ * lookups are cached too, for a shorter time. */
+typedef struct ResolverCache {
+    RedisModuleDict *entries; /* Host -> ResolverEntry */
+
+    /* Stats */
+    unsigned long long hits;      /* Lookups served from cache, including failures */
+    unsigned long long misses;    /* Lookups that called getaddrinfo() */
+    unsigned long long coalesced; /* Lookups that waited for a running getaddrinfo() */
+} ResolverCache;
+
 /* -------------------- Global Raft Context -------------------- */
 
 /* General state of the module */
@@ -286,6 +292,256 @@ void threadPoolInit(ThreadPool *pool, int thread_count);
 void threadPoolAdd(ThreadPool *pool, void *arg, void (*run)(void *arg));
 void threadPoolShutdown(ThreadPool *pool);
 
+/* apply.c */
+typedef struct ApplyPipeline {
+    pthread_mutex_t mtx;
+    struct sc_list queue;       /* ApplyPrefetch objects, in log order */
+    struct sc_list dropped;     /* ApplyPrefetch objects dropped while in flight */
+    raft_index_t scheduled_idx; /* Last index handed to the thread pool */
+
+    /* Stats */
+    unsigned long long applied;          /* Number of applied RAFT_LOGTYPE_NORMAL entries */
+    unsigned long long prefetched;       /* Number of entries deserialized by the thread pool */
+    unsigned long long prefetch_hits;    /* Applied entries that were already deserialized */
+    unsigned long long prefetch_misses;  /* Applied entries deserialized on the main thread */
+    unsigned long long prefetch_dropped; /* Prefetches dropped before their worker was done */
+    uint64_t deserialize_time;           /* Total microseconds spent on deserialization by workers */
+    uint64_t exec_time;                  /* Total microseconds spent on executing entries */
+} ApplyPipeline;
+
+/* State shared by a batch of consecutive entries being applied */
+typedef struct ApplyBatch {
+    raft_index_t first_idx;      /* First entry of the current batch */
+    raft_index_t last_idx;       /* Last entry of the current batch */
+    int slot_start;              /* Last validated local stable slot range, -1 if none */
+    int slot_end;
+    unsigned long long batches;  /* Number of batches */
+} ApplyBatch;
+
+/* util.c */
+#define TIMER_WHEEL_SLOTS 512
+
+typedef struct TimerWheelEntry {
+    long long tick;       /* Tick the entry expires at */
+    struct sc_list list;  /* Slot linkage */
+} TimerWheelEntry;
+
+typedef void (*TimerWheelCallback)(TimerWheelEntry *e, void *privdata);
+
+typedef struct TimerWheel {
+    struct sc_list slots[TIMER_WHEEL_SLOTS];
+    long long resolution; /* Milliseconds per tick */
+    long long tick;       /* Last expired tick */
+    unsigned long count;  /* Number of entries */
+} TimerWheel;
+
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 8
+#define LATENCY_HISTOGRAM_BUCKETS     (LATENCY_HISTOGRAM_SUB_BUCKETS * 40)
+
+typedef struct LatencyHistogram {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long buckets[LATENCY_HISTOGRAM_BUCKETS];
+} LatencyHistogram;
+
+/* serialization.c */
+/* First byte of entries using the varint encoding, legacy entries start with
+ * '*' */
+#define RAFT_REDIS_ENCODING_V2 0x02
+
+/* Max length of a varint encoded 64-bit integer */
+#define VARINT_MAX_LEN 10
+
+/* Command buffers larger than this don't keep their memory once emptied */
+#define COMMAND_BUFFER_KEEP_SIZE (64 * 1024)
+
+/* Growable buffer command arrays are serialized into */
+typedef struct RaftRedisCommandBuffer {
+    char *data;
+    size_t len;
+    size_t size;
+    int num; /* Number of command arrays in the buffer */
+} RaftRedisCommandBuffer;
+
+/* batch.c */
+/* Writes received in the current event loop iteration, appended as a single
+ * entry before going to sleep */
+typedef struct WriteBatch {
+    struct RaftReq *req;         /* Pending RR_REDISCOMMAND_BATCH request, NULL if none */
+    RaftRedisCommandBuffer buf;  /* Pending commands, serialized */
+    unsigned long long entries;  /* Number of entries appended with multiple commands */
+    unsigned long long commands; /* Number of commands appended in those entries */
+} WriteBatch;
+
+/* trace.c */
+/* Stages of a write on the leader */
+typedef enum WriteStage {
+    WRITE_STAGE_VALIDATE, /* Intercepted -> validated, including the dry run */
+    WRITE_STAGE_APPEND,   /* Validated -> appended to the log, including batching and serialization */
+    WRITE_STAGE_WRITE,    /* Appended -> written to the log file */
+    WRITE_STAGE_FSYNC,    /* Written -> on disk */
+    WRITE_STAGE_COMMIT,   /* On disk -> committed */
+    WRITE_STAGE_APPLY,    /* Committed -> executed */
+    WRITE_STAGE_TOTAL,    /* Intercepted -> executed */
+    WRITE_STAGE_NUM
+} WriteStage;
+
+extern const char *WriteStageStr[];
+
+/* Times a write reached the stages tracked by its RaftReq, in microseconds */
+typedef struct WriteTimes {
+    uint64_t received;  /* Intercepted by the command filter */
+    uint64_t validated; /* Passed validation and the dry run */
+    uint64_t appended;  /* Appended to the log */
+} WriteTimes;
+
+#define WRITE_TRACE_MARKS 128
+
+/* The last indexes a stage reached and when, in a ring buffer */
+typedef struct WriteMarks {
+    raft_index_t idx[WRITE_TRACE_MARKS];
+    uint64_t time[WRITE_TRACE_MARKS];
+    int next; /* Slot of the next mark */
+    int len;  /* Number of marks */
+} WriteMarks;
+
+typedef struct WriteTrace {
+    WriteMarks written;                         /* Indexes written to the log file */
+    WriteMarks fsynced;                         /* Indexes on disk */
+    WriteMarks committed;                       /* Indexes committed */
+    LatencyHistogram stages[WRITE_STAGE_NUM];   /* Time spent in each stage, in microseconds */
+    unsigned long long slow;                    /* Writes slower than slow-write-threshold */
+} WriteTrace;
+
+/* proxy.c */
+/* A connection of the proxy pool */
+typedef struct ProxyConn {
+    Connection *conn;
+    struct ProxyPool *pool; /* NULL once removed from the pool */
+    long outstanding;       /* Requests waiting for a reply */
+} ProxyConn;
+
+/* Connections used to proxy commands to the leader, separate from the node
+ * connection used for Raft traffic */
+typedef struct ProxyPool {
+    raft_node_id_t leader_id; /* Leader the connections are made to */
+    NodeAddr addr;            /* Leader's address */
+    int num;                  /* Number of connections */
+    ProxyConn **conns;
+    TimerWheel deadlines;     /* Deadlines of requests waiting for a reply */
+    LatencyHistogram latency; /* Latency of proxied requests, in microseconds */
+} ProxyPool;
+
+/* Writes proxied to the leader in the current event loop iteration, sent as a
+ * single RAFT.ENTRIES command before going to sleep */
+typedef struct ProxyBatch {
+    struct RaftReq *req;        /* Pending RR_REDISCOMMAND_BATCH request, NULL if none */
+    RaftRedisCommandBuffer buf; /* Pending commands, serialized */
+} ProxyBatch;
+
+/* blocked.c */
+/* Commands blocked when applied, looked up by the index of their entry */
+typedef struct BlockedCommands {
+    struct sc_list list;                 /* In order of blocking, i.e. by index */
+    struct BlockedCommand **buckets;     /* Hash index by entry index */
+    unsigned long size;                  /* Number of buckets, a power of two */
+    unsigned long count;                 /* Number of blocked commands */
+    TimerWheel timeouts;                 /* Timeouts of blocked client requests */
+    RedisModuleTimerID timer;            /* Expires 'timeouts' while there are any */
+    unsigned long long timeout_entries;  /* Timeout entries appended for expired requests */
+    unsigned long long timeouts_expired; /* Requests that expired */
+    RedisModuleDict *dormant_keys;       /* Key -> number of dormant commands blocked on it */
+    unsigned long dormant;               /* Number of dormant commands */
+    bool arming;                         /* Arming dormant commands */
+    uint64_t rebuild_time;               /* Microseconds to rebuild from the last snapshot */
+} BlockedCommands;
+
+/* cluster.c */
+/* CLUSTER SLOTS, NODES and SHARDS replies, rendered once per topology epoch */
+typedef struct TopologyCache {
+    unsigned long long epoch;        /* Bumped when shardgroups or membership change */
+
+    /* State the cached replies were rendered with */
+    unsigned long long cached_epoch;
+    raft_node_id_t leader_id;
+    raft_term_t term;
+
+    RedisModuleString *nodes;        /* CLUSTER NODES, NULL until rendered */
+    struct TopologyReply *slots;     /* CLUSTER SLOTS, NULL until rendered */
+    struct TopologyReply *shards;    /* CLUSTER SHARDS, NULL until rendered */
+
+    unsigned long long hits;         /* Replies served from the cache */
+    unsigned long long renders;      /* Replies rendered */
+} TopologyCache;
+
+/* slotindex.c */
+/* Keys of db 0 by slot, for RAFT.SCAN */
+typedef struct SlotIndex {
+    bool valid;                /* Index matches the keyspace, built on demand */
+    RedisModuleDict *keys;     /* Key -> SlotIndexEntry */
+    RedisModuleDict *positions; /* Slot and sequence -> SlotIndexEntry */
+    unsigned int *counts;      /* Number of keys per slot */
+    unsigned long long num_keys; /* Number of indexed keys */
+    uint64_t seq;              /* Sequence of the last indexed key */
+    unsigned long long rebuilds; /* Number of times the index was built */
+} SlotIndex;
+
+/* migrate.c */
+/* Streaming migration of a slot, started by RAFT.MIGRATE */
+typedef struct SlotMigration {
+    struct RaftReq *req;         /* RAFT.MIGRATE request, while migrating */
+    int slot;                    /* Slot of the current or last migration, -1 if none */
+    Connection *conn;            /* Connection to the importing cluster */
+    RedisModuleString **keys;    /* Keys of the slot */
+    size_t num_keys;
+    size_t pos;                  /* Next key to send */
+    int inflight;                /* RAFT.IMPORT batches waiting for a reply */
+
+    /* Progress of the current or last migration */
+    unsigned long long keys_sent;  /* Keys sent with RAFT.IMPORT */
+    unsigned long long bytes_sent; /* Serialized bytes sent */
+    unsigned long long batches;    /* RAFT.IMPORT batches sent */
+    long long start_time;          /* Milliseconds, monotonic */
+    long long end_time;            /* Milliseconds, monotonic, 0 while migrating */
+} SlotMigration;
+
+/* acl.c */
+/* Cached ACL of script entries */
+typedef struct ACLEntry {
+    uint64_t id;                   /* Hash of the ACL string */
+    RedisModuleString *acl;        /* ACL string */
+    RedisModuleUser *user;         /* Module user with this ACL, created on demand */
+    int refcount;                  /* Number of commands using 'user' */
+    raft_term_t appended_term;     /* Term we appended a definition in, as leader */
+    unsigned long appended_epoch;  /* ACLCache->epoch we appended a definition in */
+    raft_term_t defined_term;      /* Term of the applied definition */
+    bool defined;                  /* Definition has been applied */
+    bool detached;                 /* Not in the cache, freed once released */
+    bool unrestricted;             /* ACL checks don't depend on command arguments */
+    RedisModuleDict *allowed;      /* CommandSpec pointers known to pass the ACL check */
+    unsigned long allowed_version; /* Command spec table version of 'allowed' */
+} ACLEntry;
+
+typedef struct ACLCache {
+    RedisModuleDict *entries;  /* ACL id -> ACLEntry */
+    unsigned long version;     /* Incremented when ACLs of clients may change */
+    bool stale;                /* An ACL command is running, ACLs of clients are not used */
+    bool collect;              /* Definitions were forgotten, free unused entries */
+    raft_term_t term;          /* Term of the last applied entry */
+    unsigned long defined_num; /* Applied definitions */
+
+    /* As leader, definitions appended since the last reset */
+    unsigned long epoch;         /* Incremented when a reset is appended */
+    raft_term_t epoch_term;      /* Term of 'epoch_defines' */
+    unsigned long epoch_defines; /* Definitions appended in this epoch */
+
+    /* Stats */
+    unsigned long long users_num;     /* Number of module users */
+    unsigned long long hits;          /* User name lookups served from cache */
+    unsigned long long misses;        /* User name lookups that built the ACL string */
+    unsigned long long invalidations; /* Number of invalidations due to ACL changes */
+} ACLCache;
+
 typedef struct FsyncThreadResult {
     raft_index_t fsync_index;
     uint64_t time;
@@ -327,6 +583,7 @@ typedef struct RedisRaftConfig {
     char *log_filename;     /* Raft log file name, derived from dbfilename */
     bool follower_proxy;    /* Do follower nodes proxy requests to leader? */
     bool quorum_reads;      /* Reads have to go through quorum */
+    bool slot_index;        /* Index keys by slot for raft.scan */
     char *ignored_commands; /* Comma delimited list of commands that should not be intercepted */
     char *cluster_user;     /* ACL user to use for internode communication */
     char *cluster_password; /* Password used for internode communication */
@@ -338,13 +595,19 @@ typedef struct RedisRaftConfig {
     int connection_timeout;           /* Milliseconds the node will continue to try connecting to another node */
     int join_timeout;                 /* Milliseconds the node will continue to try joining a cluster */
     int reconnect_interval;           /* Milliseconds to wait to reconnect to a node if connection drops */
+    int dns_cache_ttl;                /* Milliseconds to cache resolved node addresses, 0 to disable */
     int proxy_response_timeout;       /* Milliseconds to wait for a response to a proxy request */
+    int proxy_connections;            /* Number of connections to proxy commands to the leader */
     int response_timeout;             /* Milliseconds to wait for a response to a Raft message */
     long long append_req_max_count;   /* Max in-flight appendreq message count between two nodes. */
     long long append_req_max_size;    /* Max appendreq message size in bytes. Just an approximation. */
     long long snapshot_req_max_count; /* Max in-flight snapshotreq message count between two nodes. */
     long long snapshot_req_max_size;  /* Max snapshotreq message size in bytes. Just an approximation. */
     long long scan_size;              /* how many keys to fetch at a time internally for raft.scan */
+    long long apply_prefetch;         /* Max entries to deserialize ahead of apply, 0 to disable */
+    long long write_batch_max_count;  /* Max commands to append as a single entry, 1 to disable */
+    long long write_batch_max_size;   /* Max serialized size of commands appended as a single entry */
+    long long slow_write_threshold;   /* Log writes slower than this many microseconds, 0 to disable */
 
     /* Debug configs */
     long long log_delay_apply;  /* If not zero, sleep microseconds before the execution of a command.*/
@@ -388,7 +651,14 @@ typedef struct RedisRaftCtx {
                                                     commands we get from the leader. */
     RedisRaftState state;          /* Raft module state */
     ThreadPool thread_pool;        /* Thread pool for slow operations */
+    ResolverCache resolver_cache;  /* Resolved addresses of connections */
     FsyncThread fsyncThread;       /* Thread to call fsync on raft log file */
+    ApplyPipeline apply_pipeline;  /* Deserializes entries ahead of apply */
+    ApplyBatch apply_batch;        /* Per batch state of entries being applied */
+    WriteBatch write_batch;        /* Writes waiting to be appended to the log */
+    WriteTrace write_trace;        /* Latency of writes, by stage */
+    ProxyBatch proxy_batch;        /* Writes waiting to be proxied to the leader */
+    ProxyPool proxy_pool;          /* Connections to proxy commands to the leader */
     Log log;                       /* Raft persistent log */
     Metadata meta;                 /* Raft metadata for voted_for and term */
     struct EntryCache *logcache;   /* Log entry cache to keep entries in memory for faster access */
@@ -424,21 +694,25 @@ typedef struct RedisRaftCtx {
     unsigned long long proxy_failed_reqs;        /* Number of failed proxy requests, i.e. did not send */
     unsigned long long proxy_failed_responses;   /* Number of failed proxy responses, i.e. did not complete */
     unsigned long proxy_outstanding_reqs;        /* Number of proxied requests pending */
+    unsigned long long proxy_batches;            /* Number of RAFT.ENTRIES batches sent */
     unsigned long snapshots_received;            /* Number of received snapshots */
     unsigned long snapshots_created;             /* Number of snapshots created */
     unsigned long appendreq_received;            /* Number of received appendreq messages */
     unsigned long appendreq_with_entry_received; /* Number of received appendreq messages with at least one entry in them */
     unsigned long snapshotreq_received;          /* Number of received snapshotreq messages */
     unsigned long exec_throttled;                /* Number of command executions throttled due to slow execution */
+    unsigned long long dry_runs;                 /* Number of dry-run RedisModule_Call() executions */
+    unsigned long long dry_runs_skipped;         /* Number of dry-runs skipped as they could not fail */
 
     int entered_eval;                     /* handling a lua script */
     RedisModuleDict *locked_keys;         /* keys that have been locked for migration */
-    RedisModuleDict *acl_dict;            /* maps acl strings to RedisModuleUser * objects */
+    ACLCache acl_cache;                   /* ACLs of script entries */
     RedisModuleDict *client_session_dict; /* maps session IDs to Session Objects */
 
-    /* we use a dict and an intrusive list to reproduce java's LinkedHashMap, fast lookup with order maintenance */
-    struct sc_list blocked_command_list;   /* list of blocked commands in order of them blocking */
-    RedisModuleDict *blocked_command_dict; /* raft entry id -> blocked command mapping, for fast lookup */
+    BlockedCommands blocked_commands; /* Commands blocked by applied entries */
+    SlotIndex slot_index;             /* Keys by slot, if 'slot-index' is enabled */
+    SlotMigration slot_migration;     /* Streaming migration of a slot */
+    TopologyCache topology_cache;     /* Cached CLUSTER SLOTS/NODES/SHARDS replies */
 } RedisRaftCtx;
 
 extern RedisRaftCtx redis_raft;
@@ -465,12 +739,31 @@ static inline bool MigrationSessionKeyValid(long long key)
 }
 
 typedef struct PendingResponse {
-    bool proxy;
     int id;
     long long request_time;
+    long long send_time; /* Monotonic microseconds, for the round trip time */
+    long num_entries;    /* Entries of the RAFT.AE message */
+    size_t bytes;        /* Size of the RAFT.AE message */
     struct sc_list entries;
 } PendingResponse;
 
+/* Replication metrics of a peer, see RAFT.STATS */
+typedef struct NodeStats {
+    unsigned long long ae_sent;              /* RAFT.AE messages sent */
+    unsigned long long ae_bytes_sent;        /* Bytes of RAFT.AE messages sent */
+    unsigned long long ae_entries_sent;      /* Entries sent, including retransmissions */
+    unsigned long long ae_acked;             /* Successful RAFT.AE responses */
+    unsigned long long ae_bytes_acked;       /* Bytes of RAFT.AE messages acked */
+    unsigned long long ae_entries_acked;     /* Entries of RAFT.AE messages acked */
+    unsigned long long ae_rejected;          /* RAFT.AE responses with a log mismatch */
+    unsigned long long backpressure;         /* Times RAFT.AE was held back by append-req-max-count */
+    unsigned long long snapshot_chunks_sent; /* RAFT.SNAPSHOT messages sent */
+    unsigned long long snapshot_bytes_sent;  /* Bytes of snapshot chunks sent */
+    raft_index_t match_idx;                  /* Last index acked by the node */
+    LatencyHistogram ae_rtt;                 /* RAFT.AE round trip time in microseconds */
+    LatencyHistogram lag;                    /* Entries behind our last index, on RAFT.AE responses */
+} NodeStats;
+
 /* Maintains all state about peer nodes */
 typedef struct Node {
     raft_node_id_t id;                /* Raft unique node ID */
@@ -478,8 +771,8 @@ typedef struct Node {
     Connection *conn;                 /* Connection to node */
     NodeAddr addr;                    /* Node's address */
     long pending_raft_response_num;   /* Number of pending Raft responses */
-    long pending_proxy_response_num;  /* Number of pending proxy responses */
     struct sc_list pending_responses; /* List of PendingResponse objects */
+    NodeStats stats;                  /* Replication metrics */
     struct sc_list entries;           /* Next Node item in the list */
 } Node;
 
@@ -507,8 +800,10 @@ enum RaftReqType {
     RR_IMPORT_KEYS,
     RR_MIGRATE_KEYS,
     RR_DELETE_UNLOCK_KEYS,
+    RR_MIGRATE_SLOT,
     RR_END_SESSION,
     RR_CLIENT_UNBLOCK,
+    RR_REDISCOMMAND_BATCH,
     RR_RAFTREQ_MAX
 };
 
@@ -519,9 +814,13 @@ typedef struct {
     NodeAddr addr;
 } RaftCfgChange;
 
+struct CommandSpec;
+
 typedef struct {
     int argc;
     RedisModuleString **argv;
+    const struct CommandSpec *spec; /* Cached command spec, see CommandSpecTableGetCommandSpec() */
+    unsigned long spec_version;     /* Spec table version 'spec' was resolved with, 0 if none */
 } RaftRedisCommand;
 
 typedef struct {
@@ -534,8 +833,12 @@ typedef struct {
     RedisModuleString *acl;
 } RaftRedisCommandArray;
 
-/* Max length of a ShardGroupNode string, including newline and null terminator */
-#define SHARDGROUPNODE_MAXLEN (RAFT_SHARDGROUP_NODEID_LEN + 1 + NODEADDR_MAXLEN + 2)
+/* Command arrays of a RAFT_LOGTYPE_NORMAL entry. Entries created by write
+ * batching carry a command array per client, others carry a single one. */
+typedef struct {
+    int len;
+    RaftRedisCommandArray *arrays;
+} RaftRedisCommandBatch;
 
 /* Describes a node in a ShardGroup (foreign RedisRaft cluster). */
 typedef struct ShardGroupNode {
@@ -543,10 +846,6 @@ typedef struct ShardGroupNode {
     NodeAddr addr;                                /* Node address and port */
 } ShardGroupNode;
 
-/* Max length of a ShardGroup string, including newline and null terminator
- * but excluding nodes and shard groups */
-#define SHARDGROUP_MAXLEN (10 + 1 + 10 + 1 + 1)
-
 typedef enum SlotRangeType {
     SLOTRANGE_TYPE_UNDEF = 0,
     SLOTRANGE_TYPE_STABLE,
@@ -560,8 +859,6 @@ static inline bool SlotRangeTypeValid(enum SlotRangeType val)
     return (val > SLOTRANGE_TYPE_UNDEF && val < SLOTRANGE_TYPE_MAX);
 }
 
-#define SLOT_RANGE_MAXLEN (10 + 1 + 10 + 1 + 10 + 1 + 1)
-
 typedef struct ShardGroupSlotRange {
     unsigned int start_slot;                  /* First slot, inclusive */
     unsigned int end_slot;                    /* Last slot, inclusive */
@@ -584,13 +881,14 @@ typedef struct ShardGroup {
     unsigned int next_redir; /* Round-robin -MOVED index */
 
     /* Synchronization state */
-    unsigned int node_conn_idx; /* Next node to connect to, when looking for a live one */
-    NodeAddr conn_addr;         /* Address to use on next connect, if use_conn_addr is set */
-    bool use_conn_addr;         /* Should we use conn_addr? Otherwise iterate node_conn_idx? */
-    Connection *conn;           /* Connection we use */
-    long long last_updated;     /* Last time of successful update (mstime) */
-    bool update_in_progress;    /* Are we currently updating? */
-    bool local;                 /* ShardGroup struct that corresponds to local cluster */
+    unsigned int node_conn_idx;        /* Next node to connect to, when looking for a live one */
+    NodeAddr conn_addr;                /* Address to use on next connect, if use_conn_addr is set */
+    bool use_conn_addr;                /* Should we use conn_addr? Otherwise iterate node_conn_idx? */
+    Connection *conn;                  /* Connection we use */
+    long long last_updated;            /* Last time of successful update (mstime) */
+    bool update_in_progress;           /* Are we currently updating? */
+    unsigned long long config_version; /* Version of the last received configuration */
+    bool local;                        /* ShardGroup struct that corresponds to local cluster */
 } ShardGroup;
 
 #define RAFT_LOGTYPE_ADD_SHARDGROUP      (RAFT_LOGTYPE_NUM + 1)
@@ -601,9 +899,21 @@ typedef struct ShardGroup {
 #define RAFT_LOGTYPE_IMPORT_KEYS         (RAFT_LOGTYPE_NUM + 6)
 #define RAFT_LOGTYPE_END_SESSION         (RAFT_LOGTYPE_NUM + 7)
 #define RAFT_LOGTYPE_TIMEOUT_BLOCKED     (RAFT_LOGTYPE_NUM + 8)
+#define RAFT_LOGTYPE_ACL_DEFINE          (RAFT_LOGTYPE_NUM + 9)
+#define RAFT_LOGTYPE_LOCK_SLOT           (RAFT_LOGTYPE_NUM + 10)
+#define RAFT_LOGTYPE_DELETE_UNLOCK_SLOT  (RAFT_LOGTYPE_NUM + 11)
 
 #define MAX_AUTH_STRING_ARG_LENGTH 255
 
+/* Routing of a hash slot, resolved from the slot maps below */
+typedef struct SlotRoute {
+    ShardGroup *sg;           /* Owner of the slot */
+    ShardGroup *asking_sg;    /* Owner of the slot for ASKING commands */
+    ShardGroup *importing_sg; /* Target of ASK redirects */
+    uint8_t type;             /* SlotRangeType of the slot in 'sg' */
+    uint8_t asking_type;      /* SlotRangeType of the slot in 'asking_sg' */
+} SlotRoute;
+
 /* Sharding information, used when cluster_mode is enabled and multiple
  * RedisRaft clusters operate together to perform sharding.
  */
@@ -623,6 +933,15 @@ typedef struct ShardingInfo {
     ShardGroup *migrating_slots_map[REDIS_RAFT_HASH_SLOTS];
 
     raft_term_t max_importing_term[REDIS_RAFT_HASH_SLOTS];
+
+    /* Slots locked by RAFT.MIGRATE, their keys can't be modified */
+    bool locked_slots[REDIS_RAFT_HASH_SLOTS];
+    unsigned int locked_slots_num;
+
+    /* Routing table of the request path, rebuilt from the slot maps when the
+     * topology epoch changes. See ShardingInfoGetRoute(). */
+    SlotRoute routes[REDIS_RAFT_HASH_SLOTS];
+    unsigned long long routes_epoch;
 } ShardingInfo;
 
 typedef struct {
@@ -637,19 +956,27 @@ typedef struct RaftReq {
     int type;
     RedisModuleBlockedClient *client;
     RedisModuleCtx *ctx;
-    RedisModuleTimerID timeout_timer;
+    TimerWheelEntry timeout; /* Entry in BlockedCommands->timeouts, for blocking requests */
     raft_index_t raft_idx;
     raft_session_t client_id;
+    WriteTimes times; /* Set for RR_REDISCOMMAND requests on the leader */
 
     union {
         struct {
             Node *proxy_node;
             int hash_slot;
             RaftRedisCommandArray cmds;
+            RedisModuleString *error; /* Set if rejected before being appended */
         } redis;
 
         ImportKeys import_keys;
 
+        struct {
+            int len;
+            int size;
+            struct RaftReq **reqs; /* RR_REDISCOMMAND requests, in log order */
+        } batch;
+
         struct {
             char shard_group_id[RAFT_DBID_LEN + 1];
             char auth_username[MAX_AUTH_STRING_ARG_LENGTH + 1];
@@ -661,6 +988,15 @@ typedef struct RaftReq {
             raft_term_t migrate_term;
             unsigned long long migration_session_key;
         } migrate_keys;
+
+        struct {
+            unsigned int slot;
+            char shard_group_id[RAFT_DBID_LEN + 1];
+            char auth_username[MAX_AUTH_STRING_ARG_LENGTH + 1];
+            char auth_password[MAX_AUTH_STRING_ARG_LENGTH + 1];
+            raft_term_t migrate_term;
+            unsigned long long migration_session_key;
+        } migrate_slot;
     } r;
 } RaftReq;
 
@@ -672,7 +1008,12 @@ typedef struct BlockedCommand {
     size_t data_len;
     RaftReq *req;
     RedisModuleCallReply *reply;
+    ACLEntry *acl; /* Held while the command is blocked */
     struct sc_list blocked_list;
+    struct BlockedCommand *index_next; /* Next in the same BlockedCommands bucket */
+    RedisModuleString **keys;          /* Keys the command is blocked on */
+    int num_keys;
+    bool dormant; /* Loaded from a snapshot, not executed yet */
 } BlockedCommand;
 
 #define SNAPSHOT_RESULT_MAGIC 0x70616e73 /* "snap" */
@@ -688,9 +1029,14 @@ typedef struct SnapshotResult {
  * used to determine how different intercepted Redis commands are
  * handled.
  */
-typedef struct {
+typedef struct CommandSpec {
     char *name;         /* Command name */
     unsigned int flags; /* Command flags, see CMD_SPEC_* */
+    int arity;          /* Redis command arity, 0 if unknown or has subcommands */
+    int first_key;      /* Position of the first key, 0 if the command has no keys */
+    int last_key;       /* Position of the last key, negative if counted from the end */
+    int key_step;       /* Step between key positions */
+    bool fixed_keys;    /* Key positions above cover all keys of the command */
 } CommandSpec;
 
 #define CMD_SPEC_READONLY       (1 << 1)  /* Command is a read-only command */
@@ -787,6 +1133,8 @@ typedef struct ClientState {
      */
     bool watched;
     RaftReq *blocked_req;
+    ACLEntry *acl;             /* Cached ACL of the client's user */
+    unsigned long acl_version; /* ACLCache->version of 'acl' */
 } ClientState;
 
 typedef struct ClientSession {
@@ -826,13 +1174,19 @@ void NodeAddrListFree(NodeAddrListElement *head);
 /* node.c */
 Node *NodeCreate(RedisRaftCtx *rr, int id, const NodeAddr *addr);
 void HandleNodeStates(RedisRaftCtx *rr);
-void NodeAddPendingResponse(Node *node, bool proxy);
-void NodeDismissPendingResponse(Node *node);
+PendingResponse *NodeAddPendingResponse(Node *node);
+void NodeDismissPendingResponse(Node *node, PendingResponse *resp);
 
 /* serialization.c */
+void RaftRedisCommandBufferAppend(RaftRedisCommandBuffer *buf, const RaftRedisCommandArray *source);
+raft_entry_t *RaftRedisCommandBufferToEntry(RaftRedisCommandBuffer *buf);
+void RaftRedisCommandBufferClear(RaftRedisCommandBuffer *buf);
+void RaftRedisCommandBufferFree(RaftRedisCommandBuffer *buf);
 raft_entry_t *RaftRedisCommandArraySerialize(const RaftRedisCommandArray *source);
 size_t RaftRedisCommandDeserialize(RaftRedisCommand *target, const void *buf, size_t buf_size);
 RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const void *buf, size_t buf_size);
+RRStatus RaftRedisCommandBatchDeserialize(RaftRedisCommandBatch *target, const void *buf, size_t buf_size, raft_session_t session);
+void RaftRedisCommandBatchFree(RaftRedisCommandBatch *batch);
 void RaftRedisCommandArrayFree(RaftRedisCommandArray *array);
 void RaftRedisCommandFree(RaftRedisCommand *r);
 RaftRedisCommand *RaftRedisCommandArrayExtend(RaftRedisCommandArray *target);
@@ -841,8 +1195,14 @@ raft_entry_t *RaftRedisSerializeImport(const ImportKeys *import_keys);
 RRStatus RaftRedisDeserializeImport(ImportKeys *target, const void *buf, size_t buf_size);
 raft_entry_t *RaftRedisLockKeysSerialize(RedisModuleString **argv, size_t argc);
 RedisModuleString **RaftRedisLockKeysDeserialize(const void *buf, size_t buf_size, size_t *num_keys);
-raft_entry_t *RaftRedisSerializeTimeout(raft_index_t idx, bool error);
-RRStatus RaftRedisDeserializeTimeout(const void *buf, size_t buf_size, raft_index_t *idx, bool *error);
+raft_entry_t *RaftRedisSerializeTimeout(const raft_index_t *idxs, int count, bool error);
+RRStatus RaftRedisDeserializeTimeout(const void *buf, size_t buf_size, raft_index_t **idxs, int *count, bool *error);
+raft_entry_t *RaftRedisSerializeSlot(int type, unsigned int slot);
+RRStatus RaftRedisDeserializeSlot(const void *buf, size_t buf_size, unsigned int *slot);
+raft_entry_t *RaftRedisSerializeDeleteUnlockSlot(unsigned int slot, bool unlock,
+                                                 RedisModuleString **keys, size_t num_keys);
+RRStatus RaftRedisDeserializeDeleteUnlockSlot(const void *buf, size_t buf_size, unsigned int *slot,
+                                              bool *unlock, RedisModuleString ***keys, size_t *num_keys);
 
 /* redisraft.c */
 RRStatus RedisRaftCtxInit(RedisRaftCtx *rr, RedisModuleCtx *ctx);
@@ -865,7 +1225,6 @@ void callHandleNodeStates(RedisModuleCtx *ctx, void *arg);
 void handleBeforeSleep(RedisRaftCtx *rr);
 void handleFsyncCompleted(void *arg);
 void clearClientSessions(RedisRaftCtx *rr);
-void blockedTimedOut(RedisModuleCtx *ctx, void *data);
 void handleUnblock(RedisModuleCtx *ctx, RedisModuleCallReply *reply, void *private_data);
 
 /* util.c */
@@ -877,6 +1236,7 @@ void AddBasicLocalShardGroup(RedisRaftCtx *rr);
 void FreeImportKeys(ImportKeys *target);
 unsigned int keyHashSlot(const char *key, size_t keylen);
 unsigned int keyHashSlotRedisString(RedisModuleString *s);
+bool keyHashSlotArgv(RedisModuleString **argv, int first, int last, int step, int *slot);
 RRStatus parseHashSlots(char *slots, char *string);
 bool parseLongLong(const char *str, char **end, long long *val);
 bool parseLong(const char *str, char **end, long *val);
@@ -899,6 +1259,14 @@ int base64DecodeLen(const char *bufcoded);
 int base64Decode(char *bufplain, const char *bufcoded);
 int base64EncodeLen(int len);
 int base64Encode(char *encoded, const char *string, int len);
+long long monotonicMilliseconds(void);
+void TimerWheelInit(TimerWheel *tw, long long resolution, long long now);
+void TimerWheelEntryInit(TimerWheelEntry *e);
+void TimerWheelAdd(TimerWheel *tw, TimerWheelEntry *e, long long deadline);
+void TimerWheelDel(TimerWheel *tw, TimerWheelEntry *e);
+void TimerWheelExpire(TimerWheel *tw, long long now, TimerWheelCallback cb, void *privdata);
+void LatencyHistogramAdd(LatencyHistogram *h, uint64_t value);
+uint64_t LatencyHistogramPercentile(LatencyHistogram *h, double percentile);
 
 /* config.c */
 RRStatus ConfigInit(RedisModuleCtx *ctx, RedisRaftConfig *c);
@@ -924,6 +1292,11 @@ void SnapshotInit(RedisRaftCtx *rr);
 
 /* proxy.c */
 RRStatus ProxyCommand(RedisRaftCtx *rr, RedisModuleCtx *ctx, RaftRedisCommandArray *cmds, Node *leader);
+void ProxyBatchFlush(RedisRaftCtx *rr);
+void ProxyPoolInit(ProxyPool *pool);
+void ProxyPoolReset(ProxyPool *pool);
+void ProxyPoolFree(ProxyPool *pool);
+void ProxyHandleTimeouts(RedisRaftCtx *rr);
 
 /* connection.c */
 Connection *ConnCreate(RedisRaftCtx *rr, void *privdata, ConnectionCallbackFunc idle_cb, ConnectionFreeFunc free_cb, char *username, char *password);
@@ -937,10 +1310,13 @@ redisAsyncContext *ConnGetRedisCtx(Connection *conn);
 bool ConnIsIdle(Connection *conn);
 bool ConnIsConnected(Connection *conn);
 const char *ConnGetStateStr(Connection *conn);
+void ResolverCacheInit(ResolverCache *cache);
+void ResolverCacheFree(ResolverCache *cache);
 
 /* cluster.c */
-char *ShardGroupSerialize(ShardGroup *sg);
+char *ShardGroupSerialize(ShardGroup *sg, size_t *len);
 ShardGroup *ShardGroupDeserialize(const char *buf, size_t buf_len);
+ShardGroup **ShardGroupsDeserialize(const char *buf, size_t buf_len, int *num_sg);
 ShardGroup *ShardGroupCreate();
 void ShardGroupFree(ShardGroup *sg);
 void ShardGroupTerm(ShardGroup *sg);
@@ -957,13 +1333,18 @@ RRStatus ShardingInfoUpdateShardGroup(RedisRaftCtx *rr, ShardGroup *new_sg);
 void ShardingInfoRDBSave(RedisModuleIO *rdb);
 void ShardingInfoRDBLoad(RedisModuleIO *rdb);
 void ShardingPeriodicCall(RedisRaftCtx *rr);
+void ShardingInfoResetConfigVersions(RedisRaftCtx *rr);
 RRStatus ShardGroupAppendLogEntry(RedisRaftCtx *rr, ShardGroup *sg, int type, void *user_data);
 RRStatus ShardGroupsAppendLogEntry(RedisRaftCtx *rr, int num_sg, ShardGroup **sg, int type, void *user_data);
 void ShardGroupLink(RedisRaftCtx *rr, RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
-void ShardGroupGet(RedisRaftCtx *rr, RedisModuleCtx *ctx);
+void ShardGroupGet(RedisRaftCtx *rr, RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 void ShardGroupAdd(RedisRaftCtx *rr, RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 void ShardGroupReplace(RedisRaftCtx *rr, RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 ShardGroup *GetShardGroupById(RedisRaftCtx *rr, const char *id);
+void TopologyCacheInit(TopologyCache *tc);
+void TopologyCacheFree(TopologyCache *tc);
+void ShardingTopologyChanged(RedisRaftCtx *rr);
+const SlotRoute *ShardingInfoGetRoute(RedisRaftCtx *rr, unsigned int slot);
 
 /* join.c */
 void JoinCluster(RedisRaftCtx *rr, NodeAddrListElement *el, RaftReq *req, void (*complete_callback)(RaftReq *req));
@@ -972,10 +1353,21 @@ void JoinCluster(RedisRaftCtx *rr, NodeAddrListElement *el, RaftReq *req, void (
 void importKeys(RedisRaftCtx *rr, raft_entry_t *entry, RaftReq *req);
 int cmdRaftImport(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 void MigrateKeys(RedisRaftCtx *rr, RaftReq *req);
+void MigrateSlot(RedisRaftCtx *rr, RaftReq *req);
+void SlotMigrationInit(SlotMigration *m);
+void SlotMigrationReset(SlotMigration *m);
+int cmdRaftMigrate(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
 
 /* commands.c */
 typedef struct CommandSpecTable {
     RedisModuleDict *table;
+
+    /* Perfect hash index of 'table', built once the table is complete */
+    CommandSpec **index;     /* Collision free slots */
+    uint32_t index_mask;     /* Number of slots - 1 */
+    uint32_t *displacements; /* Hash seed of each bucket */
+    uint32_t buckets_mask;   /* Number of buckets - 1 */
+    unsigned long version;   /* Incremented whenever the table is rebuilt */
 } CommandSpecTable;
 
 void CommandSpecTableInit(RedisModuleCtx *ctx, struct CommandSpecTable **cmd_spec_table);
@@ -987,6 +1379,11 @@ CommandSpec *CommandSpecTableGetC(struct CommandSpecTable *cmd_spec_table, void
 int CommandSpecTableGetFlags(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, const RedisModuleString *cmd, const RedisModuleString *subcmd);
 RRStatus CommandSpecTableSetC(struct CommandSpecTable *cmd_spec_table, void *key, size_t keylen, CommandSpec *cs);
 void CommandSpecTableRebuild(RedisModuleCtx *ctx, struct CommandSpecTable *cmd_spec_table, const char *ignored_commands);
+const CommandSpec *CommandSpecTableLookup(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, const RedisModuleString *cmd, const RedisModuleString *subcmd);
+const CommandSpec *CommandSpecTableGetCommandSpec(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, RaftRedisCommand *cmd);
+int CommandSpecGetFlags(const CommandSpec *cs, bool has_subcmd);
+RedisModuleCallReply *CommandDryRunGetError(RedisRaftCtx *rr, RedisModuleCtx *ctx, ACLEntry *acl, RaftRedisCommand *cmd, bool check_oom);
+RRStatus CommandDryRun(RedisRaftCtx *rr, RedisModuleCtx *ctx, ACLEntry *acl, RaftRedisCommand *cmd, bool check_oom);
 unsigned int CommandSpecTableGetAggregateFlags(CommandSpecTable *cmd_spec_table, RedisModuleDict *sub_command_tables, RaftRedisCommandArray *array, unsigned int default_flags);
 
 /* sort.c */
@@ -1002,6 +1399,9 @@ int encodeInteger(char prefix, char *ptr, size_t sz, unsigned long val);
 size_t calcSerializeStringSize(RedisModuleString *str);
 int decodeString(const char *p, size_t sz, RedisModuleString **str);
 int encodeString(char *p, size_t sz, RedisModuleString *str);
+int encodeVarint(char *ptr, uint64_t val);
+int varintLen(uint64_t val);
+int decodeVarint(const char *ptr, size_t sz, uint64_t *val);
 
 /* clientstate.c */
 ClientState *ClientStateGetById(RedisRaftCtx *rr, unsigned long long client_id);
@@ -1019,12 +1419,71 @@ void addBlockedCommand(BlockedCommand *bc);
 void freeBlockedCommand(BlockedCommand *bc);
 void deleteBlockedCommand(raft_index_t idx);
 BlockedCommand *getBlockedCommand(raft_index_t idx);
+void blockedCommandsInit(void);
+void blockedCommandsTerm(void);
+void blockedCommandSetKeys(BlockedCommand *bc, RaftRedisCommand *cmd);
 void blockedCommandsSave(RedisModuleIO *rdb);
-void blockedCommandsLoad(RedisModuleIO *rdb);
+void blockedCommandsLoad(RedisModuleIO *rdb, int encver);
+void blockedCommandsArmReady(void);
+void blockedCommandsArmKeys(RedisModuleString **keys, size_t num_keys);
+void blockedCommandsArmForCommands(RaftRedisCommandArray *cmds);
+int blockedCommandsKeyspaceEvent(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key);
 void clearAllBlockCommands();
+void blockedTimeoutAdd(RaftReq *req, long long timeout);
+void blockedTimeoutDel(RaftReq *req);
 int extractBlockingTimeout(RedisModuleCtx *ctx, RaftRedisCommandArray *cmds, long long *timeout);
 void replaceBlockingTimeout(RaftRedisCommandArray *cmds);
 
+/* slotindex.c */
+void SlotIndexInit(SlotIndex *si);
+void SlotIndexFree(SlotIndex *si);
+int SlotIndexKeyspaceEvent(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key);
+void SlotIndexServerEvent(RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent, void *data);
+void SlotIndexScan(RedisRaftCtx *rr, RedisModuleCtx *ctx, unsigned long long cursor, const char *slots, long long count);
+size_t SlotIndexGetKeys(RedisRaftCtx *rr, RedisModuleCtx *ctx, unsigned int slot, RedisModuleString ***keys);
+
+/* apply.c */
+void ApplyPipelineInit(ApplyPipeline *p);
+void ApplyPipelineReset(ApplyPipeline *p);
+void ApplyPipelineSchedule(RedisRaftCtx *rr);
+RRStatus ApplyPipelineTake(ApplyPipeline *p, raft_index_t idx, raft_entry_t *entry, RaftRedisCommandBatch *target);
+void ApplyBatchBegin(ApplyBatch *b, raft_index_t first_idx, raft_index_t last_idx);
+void ApplyBatchInvalidate(ApplyBatch *b);
+bool ApplyBatchSlotValidated(ApplyBatch *b, int slot);
+void ApplyBatchSetValidatedSlot(RedisRaftCtx *rr, int slot);
+
+/* batch.c */
+bool WriteBatchAdd(RedisRaftCtx *rr, RaftReq *req);
+void WriteBatchFlush(RedisRaftCtx *rr);
+void WriteBatchReplyWithError(RaftReq *batch, const char *msg);
+bool WriteBatchCanProxy(RaftRedisCommandArray *cmds, unsigned int cmd_flags);
+void WriteBatchAppendProxied(RedisRaftCtx *rr, RedisModuleCtx *ctx, RaftRedisCommandBatch *cmds);
+
+/* trace.c */
+void WriteTraceReset(WriteTrace *t);
+void WriteTraceMark(WriteMarks *m, raft_index_t idx, uint64_t time);
+void WriteTraceCommitted(RedisRaftCtx *rr);
+uint64_t WriteTraceWrittenTime(WriteTrace *t, raft_index_t idx);
+void WriteTraceExecuted(RedisRaftCtx *rr, RaftReq *req, uint64_t now);
+
+/* acl.c */
+void ACLCacheInit(ACLCache *cache);
+void ACLCacheFree(ACLCache *cache);
+void ACLCacheSetStale(ACLCache *cache);
+void ACLCacheClientsChanged(ACLCache *cache);
+void ACLCacheInvalidate(ACLCache *cache);
+void ACLCacheCollect(ACLCache *cache);
+void ACLCacheApplied(ACLCache *cache, raft_term_t term);
+void ACLCacheDefine(ACLCache *cache, const char *acl, size_t len, raft_term_t term);
+ACLEntry *ACLCacheGetCurrentUser(RedisRaftCtx *rr, RedisModuleCtx *ctx);
+RRStatus ACLCacheSetCommandACL(RedisRaftCtx *rr, RedisModuleCtx *ctx, ACLEntry *e, RaftRedisCommandArray *cmds);
+bool ACLEntryCommandAllowed(ACLEntry *e, const CommandSpec *cs, unsigned long version);
+void ACLEntrySetCommandAllowed(ACLEntry *e, const CommandSpec *cs, unsigned long version);
+ACLEntry *ACLCacheAcquire(ACLCache *cache, RedisModuleString *acl);
+void ACLCacheRelease(ACLEntry *e);
+void ACLCacheRDBSave(RedisModuleIO *rdb, ACLCache *cache);
+void ACLCacheRDBLoad(RedisModuleIO *rdb, ACLCache *cache, raft_term_t term);
+
 /* test_network_wrapper.c */
 typedef struct TestNetworkWrapper {
     redis_test_client* client;
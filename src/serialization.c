@@ -6,13 +6,22 @@
 
 #include "redisraft.h"
 
+#include <stddef.h>
 #include <string.h>
 
 /* RaftRedisCommand represents a single Redis command to execute.  Every Raft log entry
- * contains a serialized list of commands in Redis multi-bulk compatible encoding (using \n
- * rather than \r\n termination).
- * For example:
- * *1\n*3\n$3\nSET\n$3\nkey\n$5\nvalue
+ * contains a serialized list of command arrays, prefixed with the encoding version
+ * byte (RAFT_REDIS_ENCODING_V2) and the number of arrays. Numbers are encoded as
+ * varints. Each array consists of:
+ *
+ * <client id> <cmd_flags << 1 | asking> <acl length> <acl> <command count>
+ *
+ * followed by the commands, each encoded as its argc and its length prefixed
+ * arguments.
+ *
+ * Older entries use a Redis multi-bulk compatible encoding (using \n rather than
+ * \r\n termination), which is still accepted when deserializing. For example:
+ * *0\n*0\n$0\n\n*1\n*3\n$3\nSET\n$3\nkey\n$5\nvalue\n
  */
 
 RaftRedisCommand *RaftRedisCommandArrayExtend(RaftRedisCommandArray *target)
@@ -67,6 +76,7 @@ void RaftRedisCommandFree(RaftRedisCommand *r)
             RedisModule_FreeString(NULL, r->argv[i]);
         }
         RedisModule_Free(r->argv);
+        r->argv = NULL;
     }
     r->argc = 0;
 }
@@ -94,94 +104,126 @@ void RaftRedisCommandArrayFree(RaftRedisCommandArray *array)
     array->size = array->len = 0;
     if (array->acl) {
         RedisModule_FreeString(NULL, array->acl);
+        array->acl = NULL;
     }
     array->asking = false;
 }
 
-static size_t calcSerializedSize(RaftRedisCommand *cmd)
+static void bufferReserve(RaftRedisCommandBuffer *buf, size_t len)
 {
-    size_t sz = calcIntSerializedLen(cmd->argc + 1);
-    int i;
+    if (buf->size - buf->len >= len) {
+        return;
+    }
 
-    for (i = 0; i < cmd->argc; i++) {
-        size_t len;
-        RedisModule_StringPtrLen(cmd->argv[i], &len);
-        sz += calcIntSerializedLen(len) + len + 1;
+    size_t size = buf->size ? buf->size : 256;
+    while (size - buf->len < len) {
+        size *= 2;
     }
 
-    return sz;
+    buf->data = RedisModule_Realloc(buf->data, size);
+    buf->size = size;
 }
 
-/* Serialize a number of RaftRedisCommand into a Raft entry */
-raft_entry_t *RaftRedisCommandArraySerialize(const RaftRedisCommandArray *source)
+static void bufferAddVarint(RaftRedisCommandBuffer *buf, uint64_t val)
+{
+    bufferReserve(buf, varintLen(val));
+    buf->len += encodeVarint(buf->data + buf->len, val);
+}
+
+static void bufferAddBytes(RaftRedisCommandBuffer *buf, const char *p, size_t len)
+{
+    bufferReserve(buf, varintLen(len) + len);
+    buf->len += encodeVarint(buf->data + buf->len, len);
+    memcpy(buf->data + buf->len, p, len);
+    buf->len += len;
+}
+
+/* Encode a command array at the end of the buffer, in a single pass. */
+void RaftRedisCommandBufferAppend(RaftRedisCommandBuffer *buf, const RaftRedisCommandArray *source)
 {
+    const char *p;
     size_t len;
-    int n, i, j;
-    char *p;
 
-    size_t sz = calcIntSerializedLen(source->asking);
-    sz += calcIntSerializedLen(source->cmd_flags);
-    sz += calcIntSerializedLen(source->len);
+    bufferAddVarint(buf, source->client_id);
+    bufferAddVarint(buf, (uint64_t) source->cmd_flags << 1 | source->asking);
 
-    /* Compute sizes */
-    for (i = 0; i < source->len; i++) {
-        sz += calcSerializedSize(source->commands[i]);
+    if (source->acl) {
+        p = RedisModule_StringPtrLen(source->acl, &len);
+        bufferAddBytes(buf, p, len);
+    } else {
+        bufferAddVarint(buf, 0);
     }
-    sz += calcSerializeStringSize(source->acl);
 
-    /* Prepare entry */
-    raft_entry_t *ety = raft_entry_new(sz);
-    p = ety->data;
+    bufferAddVarint(buf, source->len);
+    for (int i = 0; i < source->len; i++) {
+        RaftRedisCommand *c = source->commands[i];
 
-    /* Encode Asking */
-    n = encodeInteger('*', p, sz, source->asking);
-    RedisModule_Assert(n != -1);
-    p += n;
-    sz -= n;
+        bufferAddVarint(buf, c->argc);
+        for (int j = 0; j < c->argc; j++) {
+            p = RedisModule_StringPtrLen(c->argv[j], &len);
+            bufferAddBytes(buf, p, len);
+        }
+    }
 
-    /* Encode cmd_flags */
-    n = encodeInteger('*', p, sz, source->cmd_flags);
-    RedisModule_Assert(n != -1);
-    p += n;
-    sz -= n;
+    buf->num++;
+}
 
-    /* Encode ACL */
-    n = encodeString(p, sz, source->acl);
-    p += n;
-    sz -= n;
+/* Create a Raft entry of the command arrays encoded in the buffer. The
+ * buffer is emptied, see RaftRedisCommandBufferClear(). */
+raft_entry_t *RaftRedisCommandBufferToEntry(RaftRedisCommandBuffer *buf)
+{
+    char header[1 + VARINT_MAX_LEN];
 
-    /* Encode count */
-    n = encodeInteger('*', p, sz, source->len);
-    RedisModule_Assert(n != -1);
-    p += n;
-    sz -= n;
+    header[0] = RAFT_REDIS_ENCODING_V2;
+    size_t n = 1 + encodeVarint(header + 1, buf->num);
 
-    /* Encode entries */
-    for (i = 0; i < source->len; i++) {
-        RaftRedisCommand *src = source->commands[i];
+    raft_entry_t *ety = raft_entry_new(n + buf->len);
+    memcpy(ety->data, header, n);
+    memcpy(ety->data + n, buf->data, buf->len);
 
-        n = encodeInteger('*', p, sz, src->argc);
-        RedisModule_Assert(n != -1);
-        p += n;
-        sz -= n;
+    RaftRedisCommandBufferClear(buf);
 
-        for (j = 0; j < src->argc; j++) {
-            const char *e = RedisModule_StringPtrLen(src->argv[j], &len);
-            RedisModule_Assert(sz > len);
-
-            n = encodeInteger('$', p, sz, len);
-            RedisModule_Assert(n != -1);
-            p += n;
-            sz -= n;
+    return ety;
+}
 
-            memcpy(p, e, len);
-            p += len;
-            *p = '\n';
-            p++;
-            sz -= (len + 1);
-        }
+/* Empty the buffer. It keeps its memory for reuse, unless it grew beyond
+ * COMMAND_BUFFER_KEEP_SIZE for a large entry. */
+void RaftRedisCommandBufferClear(RaftRedisCommandBuffer *buf)
+{
+    if (buf->size > COMMAND_BUFFER_KEEP_SIZE) {
+        RaftRedisCommandBufferFree(buf);
     }
 
+    buf->len = 0;
+    buf->num = 0;
+}
+
+void RaftRedisCommandBufferFree(RaftRedisCommandBuffer *buf)
+{
+    RedisModule_Free(buf->data);
+    *buf = (RaftRedisCommandBuffer){0};
+}
+
+/* Serialize a number of RaftRedisCommand into a Raft entry. The array is
+ * encoded in a single pass into a buffer that starts with room for the entry
+ * header, and the buffer is handed over as the entry. */
+raft_entry_t *RaftRedisCommandArraySerialize(const RaftRedisCommandArray *source)
+{
+    const size_t hdr = offsetof(raft_entry_t, data);
+    RaftRedisCommandBuffer buf = {0};
+
+    bufferReserve(&buf, hdr + 1 + VARINT_MAX_LEN);
+    buf.len = hdr;
+    buf.data[buf.len++] = RAFT_REDIS_ENCODING_V2;
+    bufferAddVarint(&buf, 1);
+    RaftRedisCommandBufferAppend(&buf, source);
+
+    /* Raft allocates entries with the module allocator too */
+    raft_entry_t *ety = RedisModule_Realloc(buf.data, buf.len);
+    memset(ety, 0, hdr);
+    ety->data_len = buf.len - hdr;
+    ety->refs = 1;
+
     return ety;
 }
 
@@ -223,7 +265,123 @@ error:
     return 0;
 }
 
-RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const void *buf, size_t buf_size)
+static bool readVarint(const char **p, size_t *sz, uint64_t *val)
+{
+    int n = decodeVarint(*p, *sz, val);
+    if (n < 0) {
+        return false;
+    }
+
+    *p += n;
+    *sz -= n;
+    return true;
+}
+
+static bool readBytes(const char **p, size_t *sz, const char **bytes, size_t *len)
+{
+    uint64_t tmp;
+
+    if (!readVarint(p, sz, &tmp) || tmp > *sz) {
+        return false;
+    }
+
+    *bytes = *p;
+    *len = tmp;
+    *p += tmp;
+    *sz -= tmp;
+    return true;
+}
+
+/* Deserialize a RAFT_REDIS_ENCODING_V2 command array, returns the number of
+ * bytes consumed or -1 on error. Arguments are created straight from the
+ * entry data, as lengths are known upfront. */
+static long deserializeArrayV2(RaftRedisCommandArray *target, const char *buf, size_t buf_size)
+{
+    const char *p = buf;
+    size_t sz = buf_size;
+    uint64_t client_id, flags, num, argc;
+    const char *str;
+    size_t len;
+
+    if (target->len) {
+        RaftRedisCommandArrayFree(target);
+    }
+
+    if (!readVarint(&p, &sz, &client_id) ||
+        !readVarint(&p, &sz, &flags) ||
+        !readBytes(&p, &sz, &str, &len)) {
+        return -1;
+    }
+
+    target->client_id = client_id;
+    target->asking = flags & 1;
+    target->cmd_flags = flags >> 1;
+    if (len) {
+        target->acl = RedisModule_CreateString(NULL, str, len);
+    }
+
+    /* Every command takes at least a byte */
+    if (!readVarint(&p, &sz, &num) || !num || num > sz) {
+        goto error;
+    }
+
+    target->len = target->size = (int) num;
+    target->commands = RedisModule_Calloc(num, sizeof(RaftRedisCommand *));
+
+    for (uint64_t i = 0; i < num; i++) {
+        RaftRedisCommand *c = RedisModule_Calloc(1, sizeof(RaftRedisCommand));
+        target->commands[i] = c;
+
+        if (!readVarint(&p, &sz, &argc) || !argc || argc > sz) {
+            goto error;
+        }
+
+        c->argv = RedisModule_Alloc(argc * sizeof(RedisModuleString *));
+        for (uint64_t j = 0; j < argc; j++) {
+            if (!readBytes(&p, &sz, &str, &len)) {
+                goto error;
+            }
+            c->argv[c->argc++] = RedisModule_CreateString(NULL, str, len);
+        }
+    }
+
+    return p - buf;
+
+error:
+    RaftRedisCommandArrayFree(target);
+    return -1;
+}
+
+/* Deserialize the arrays of a RAFT_REDIS_ENCODING_V2 entry */
+static RRStatus deserializeBatchV2(RaftRedisCommandBatch *target, const char *buf, size_t buf_size)
+{
+    const char *p = buf + 1;
+    size_t sz = buf_size - 1;
+    uint64_t num;
+    long len;
+
+    /* Every array takes at least a byte */
+    if (!readVarint(&p, &sz, &num) || !num || num > sz) {
+        return RR_ERROR;
+    }
+
+    target->arrays = RedisModule_Calloc(num, sizeof(RaftRedisCommandArray));
+    target->len = (int) num;
+
+    for (uint64_t i = 0; i < num; i++) {
+        if ((len = deserializeArrayV2(&target->arrays[i], p, sz)) < 0) {
+            RaftRedisCommandBatchFree(target);
+            return RR_ERROR;
+        }
+        p += len;
+        sz -= len;
+    }
+
+    return RR_OK;
+}
+
+/* Deserialize a legacy command array, returns the number of bytes consumed or -1 on error. */
+static long deserializeArray(RaftRedisCommandArray *target, const void *buf, size_t buf_size)
 {
     const char *p = buf;
     size_t commands_num;
@@ -236,7 +394,7 @@ RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const v
     /* Read asking */
     size_t asking;
     if ((n = decodeInteger(p, buf_size, '*', &asking)) < 0) {
-        return RR_ERROR;
+        return -1;
     }
     p += n;
     buf_size -= n;
@@ -245,7 +403,7 @@ RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const v
     /* Read cmd_flags */
     size_t cmd_flags;
     if ((n = decodeInteger(p, buf_size, '*', &cmd_flags)) < 0) {
-        return RR_ERROR;
+        return -1;
     }
     p += n;
     buf_size -= n;
@@ -254,7 +412,7 @@ RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const v
     /* Read ACL */
     RedisModuleString *acl;
     if ((n = decodeString(p, buf_size, &acl)) < 0) {
-        return RR_ERROR;
+        return -1;
     }
     p += n;
     buf_size -= n;
@@ -270,7 +428,7 @@ RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const v
     /* Read command count */
     if ((n = decodeInteger(p, buf_size, '*', &commands_num)) < 0 ||
         !commands_num) {
-        return RR_ERROR;
+        return -1;
     }
     p += n;
     buf_size -= n;
@@ -284,16 +442,76 @@ RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const v
         if (!len) {
             /* Error */
             RaftRedisCommandArrayFree(target);
-            return RR_ERROR;
+            return -1;
         }
 
         p += len;
         buf_size -= len;
     }
 
+    return p - (char *) buf;
+}
+
+/* Deserialize an entry holding a single command array */
+RRStatus RaftRedisCommandArrayDeserialize(RaftRedisCommandArray *target, const void *buf, size_t buf_size)
+{
+    const char *p = buf;
+
+    if (buf_size == 0 || *p != RAFT_REDIS_ENCODING_V2) {
+        return deserializeArray(target, buf, buf_size) < 0 ? RR_ERROR : RR_OK;
+    }
+
+    uint64_t num;
+    size_t sz = buf_size - 1;
+    p++;
+
+    if (!readVarint(&p, &sz, &num) || num != 1) {
+        return RR_ERROR;
+    }
+
+    return deserializeArrayV2(target, p, sz) < 0 ? RR_ERROR : RR_OK;
+}
+
+/* Deserialize the command arrays of a RAFT_LOGTYPE_NORMAL entry. Legacy entries
+ * hold a single array, attributed to 'session'. */
+RRStatus RaftRedisCommandBatchDeserialize(RaftRedisCommandBatch *target, const void *buf,
+                                          size_t buf_size, raft_session_t session)
+{
+    const char *p = buf;
+
+    RaftRedisCommandBatchFree(target);
+
+    if (buf_size > 0 && *p == RAFT_REDIS_ENCODING_V2) {
+        return deserializeBatchV2(target, buf, buf_size);
+    }
+
+    target->arrays = RedisModule_Calloc(1, sizeof(RaftRedisCommandArray));
+    target->len = 1;
+
+    if (deserializeArray(&target->arrays[0], buf, buf_size) < 0) {
+        RaftRedisCommandBatchFree(target);
+        return RR_ERROR;
+    }
+    target->arrays[0].client_id = session;
+
     return RR_OK;
 }
 
+void RaftRedisCommandBatchFree(RaftRedisCommandBatch *batch)
+{
+    if (!batch->arrays) {
+        return;
+    }
+
+    for (int i = 0; i < batch->len; i++) {
+        RaftRedisCommandArrayFree(&batch->arrays[i]);
+    }
+    RedisModule_Free(batch->arrays);
+
+    batch->arrays = NULL;
+    batch->len = 0;
+}
+
 RRStatus RaftRedisDeserializeImport(ImportKeys *target, const void *buf, size_t buf_size)
 {
     const char *p = buf;
@@ -466,49 +684,47 @@ RedisModuleString **RaftRedisLockKeysDeserialize(const void *buf, size_t buf_siz
     return ret;
 }
 
-raft_entry_t *RaftRedisSerializeTimeout(raft_index_t idx, bool error)
+/* Serialize a RAFT_LOGTYPE_TIMEOUT_BLOCKED entry, which times out, or unblocks
+ * with an error, the commands blocked by the entries at 'idxs'. It's encoded
+ * as:
+ *
+ * <RAFT_REDIS_ENCODING_V2> <error> <count> <idx>...
+ *
+ * with varint numbers. Legacy entries encode a single index and the error flag
+ * as '*' prefixed numbers.
+ */
+raft_entry_t *RaftRedisSerializeTimeout(const raft_index_t *idxs, int count, bool error)
 {
-    int n;
-    int err_val = error ? 1 : 0;
-
-    size_t sz = calcIntSerializedLen(idx); /* idx we are timing out */
-    sz += calcIntSerializedLen(err_val);   /* encoding the error bool */
-    sz++;
+    RedisModule_Assert(count > 0);
 
+    size_t sz = 1 + (2 + (size_t) count) * VARINT_MAX_LEN;
     raft_entry_t *ety = raft_entry_new(sz);
     ety->type = RAFT_LOGTYPE_TIMEOUT_BLOCKED;
 
     char *p = ety->data;
 
-    /* Encode idx of entry we are timing out */
-    n = encodeInteger('*', p, sz, idx);
-    RedisModule_Assert(n != -1);
-    p += n;
-    sz -= n;
-
-    /* Encode if regular timeout or error */
-    n = encodeInteger('*', p, sz, err_val);
-    RedisModule_Assert(n != -1);
-    p += n;
-    sz -= n;
+    *p++ = RAFT_REDIS_ENCODING_V2;
+    p += encodeVarint(p, error ? 1 : 0);
+    p += encodeVarint(p, count);
+    for (int i = 0; i < count; i++) {
+        p += encodeVarint(p, idxs[i]);
+    }
 
+    ety->data_len = p - ety->data;
     return ety;
 }
 
-RRStatus RaftRedisDeserializeTimeout(const void *buf, size_t buf_size, raft_index_t *idx, bool *error)
+static RRStatus deserializeLegacyTimeout(const char *p, size_t buf_size, raft_index_t **idxs, int *count, bool *error)
 {
-    const char *p = buf;
     int n;
-
-    size_t tmp;
+    size_t idx, tmp;
 
     /* Read idx */
-    if ((n = decodeInteger(p, buf_size, '*', &tmp)) < 0 || !idx) {
+    if ((n = decodeInteger(p, buf_size, '*', &idx)) < 0) {
         return RR_ERROR;
     }
     p += n;
     buf_size -= n;
-    *idx = tmp;
 
     /* read error */
     if ((n = decodeInteger(p, buf_size, '*', &tmp)) < 0) {
@@ -516,9 +732,196 @@ RRStatus RaftRedisDeserializeTimeout(const void *buf, size_t buf_size, raft_inde
     }
     p += n;
     buf_size -= n;
+
+    /* should only have the final '\0' at the end of the data */
+    if (buf_size != 1) {
+        return RR_ERROR;
+    }
+
+    *idxs = RedisModule_Alloc(sizeof(raft_index_t));
+    (*idxs)[0] = (raft_index_t) idx;
+    *count = 1;
     *error = (tmp == 1);
 
-    RedisModule_Assert(buf_size == 1); /* should only have the final '\0' at the end of the data */
+    return RR_OK;
+}
+
+/* Deserialize a RAFT_LOGTYPE_TIMEOUT_BLOCKED entry. On success, the caller
+ * must free the array returned in 'idxs'. */
+RRStatus RaftRedisDeserializeTimeout(const void *buf, size_t buf_size, raft_index_t **idxs, int *count, bool *error)
+{
+    const char *p = buf;
+    size_t sz = buf_size;
+    uint64_t err_val, num;
+
+    if (sz > 0 && *p == '*') {
+        return deserializeLegacyTimeout(p, sz, idxs, count, error);
+    }
+
+    if (sz == 0 || *p != RAFT_REDIS_ENCODING_V2) {
+        return RR_ERROR;
+    }
+    p++;
+    sz--;
+
+    if (!readVarint(&p, &sz, &err_val) || err_val > 1 ||
+        !readVarint(&p, &sz, &num) || !num || num > sz) {
+        return RR_ERROR;
+    }
+
+    raft_index_t *ret = RedisModule_Alloc(num * sizeof(raft_index_t));
+    for (uint64_t i = 0; i < num; i++) {
+        uint64_t idx;
+
+        if (!readVarint(&p, &sz, &idx)) {
+            RedisModule_Free(ret);
+            return RR_ERROR;
+        }
+        ret[i] = (raft_index_t) idx;
+    }
+
+    if (sz != 0) {
+        RedisModule_Free(ret);
+        return RR_ERROR;
+    }
+
+    *idxs = ret;
+    *count = (int) num;
+    *error = err_val == 1;
 
     return RR_OK;
-}
\ No newline at end of file
+}
+
+/* Serialize a RAFT_LOGTYPE_LOCK_SLOT entry, encoded as:
+ *
+ * <RAFT_REDIS_ENCODING_V2> <slot>
+ */
+raft_entry_t *RaftRedisSerializeSlot(int type, unsigned int slot)
+{
+    raft_entry_t *ety = raft_entry_new(1 + VARINT_MAX_LEN);
+    ety->type = type;
+
+    char *p = ety->data;
+
+    *p++ = RAFT_REDIS_ENCODING_V2;
+    p += encodeVarint(p, slot);
+
+    ety->data_len = p - ety->data;
+    return ety;
+}
+
+RRStatus RaftRedisDeserializeSlot(const void *buf, size_t buf_size, unsigned int *slot)
+{
+    const char *p = buf;
+    size_t sz = buf_size;
+    uint64_t val;
+
+    if (sz == 0 || *p != RAFT_REDIS_ENCODING_V2) {
+        return RR_ERROR;
+    }
+    p++;
+    sz--;
+
+    if (!readVarint(&p, &sz, &val) || val > REDIS_RAFT_HASH_MAX_SLOT || sz != 0) {
+        return RR_ERROR;
+    }
+
+    *slot = (unsigned int) val;
+    return RR_OK;
+}
+
+/* Serialize a RAFT_LOGTYPE_DELETE_UNLOCK_SLOT entry with some of the keys the
+ * leader migrated, so the keys are not looked up again when the entry is
+ * applied. If 'unlock' is set, the slot is unlocked once the keys are deleted.
+ * It's encoded as:
+ *
+ * <RAFT_REDIS_ENCODING_V2> <slot> <unlock> <num_keys> <key>...
+ *
+ * with varint numbers and varint length prefixed keys.
+ */
+raft_entry_t *RaftRedisSerializeDeleteUnlockSlot(unsigned int slot, bool unlock,
+                                                 RedisModuleString **keys, size_t num_keys)
+{
+    size_t len = 1 + varintLen(slot) + varintLen(unlock) + varintLen(num_keys);
+
+    for (size_t i = 0; i < num_keys; i++) {
+        size_t key_len;
+        RedisModule_StringPtrLen(keys[i], &key_len);
+        len += varintLen(key_len) + key_len;
+    }
+
+    raft_entry_t *ety = raft_entry_new(len);
+    ety->type = RAFT_LOGTYPE_DELETE_UNLOCK_SLOT;
+
+    char *p = ety->data;
+
+    *p++ = RAFT_REDIS_ENCODING_V2;
+    p += encodeVarint(p, slot);
+    p += encodeVarint(p, unlock);
+    p += encodeVarint(p, num_keys);
+
+    for (size_t i = 0; i < num_keys; i++) {
+        size_t key_len;
+        const char *key = RedisModule_StringPtrLen(keys[i], &key_len);
+
+        p += encodeVarint(p, key_len);
+        memcpy(p, key, key_len);
+        p += key_len;
+    }
+
+    RedisModule_Assert((size_t) (p - ety->data) == len);
+    ety->data_len = len;
+    return ety;
+}
+
+/* Deserialize a RAFT_LOGTYPE_DELETE_UNLOCK_SLOT entry. The caller must free
+ * the keys and the array returned in 'keys', NULL if there are none. */
+RRStatus RaftRedisDeserializeDeleteUnlockSlot(const void *buf, size_t buf_size, unsigned int *slot,
+                                              bool *unlock, RedisModuleString ***keys, size_t *num_keys)
+{
+    const char *p = buf;
+    size_t sz = buf_size;
+    uint64_t val, flag, num;
+
+    if (sz == 0 || *p != RAFT_REDIS_ENCODING_V2) {
+        return RR_ERROR;
+    }
+    p++;
+    sz--;
+
+    if (!readVarint(&p, &sz, &val) || val > REDIS_RAFT_HASH_MAX_SLOT ||
+        !readVarint(&p, &sz, &flag) || flag > 1 ||
+        !readVarint(&p, &sz, &num) || num > sz) {
+        return RR_ERROR;
+    }
+
+    RedisModuleString **ret = num ? RedisModule_Alloc(num * sizeof(*ret)) : NULL;
+    uint64_t i;
+
+    for (i = 0; i < num; i++) {
+        const char *key;
+        size_t key_len;
+
+        if (!readBytes(&p, &sz, &key, &key_len)) {
+            goto error;
+        }
+        ret[i] = RedisModule_CreateString(NULL, key, key_len);
+    }
+
+    if (sz != 0) {
+        goto error;
+    }
+
+    *slot = (unsigned int) val;
+    *unlock = flag;
+    *keys = ret;
+    *num_keys = num;
+    return RR_OK;
+
+error:
+    while (i > 0) {
+        RedisModule_FreeString(NULL, ret[--i]);
+    }
+    RedisModule_Free(ret);
+    return RR_ERROR;
+}
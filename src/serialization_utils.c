@@ -160,3 +160,57 @@ int encodeString(char *p, size_t sz, RedisModuleString *str)
 
     return (int) (n + len + 1);
 }
+
+/* encodes val as an unsigned LEB128 varint into ptr, which must have room for
+ * VARINT_MAX_LEN bytes.
+ *
+ * returns the number of bytes written
+ */
+int encodeVarint(char *ptr, uint64_t val)
+{
+    unsigned char *p = (unsigned char *) ptr;
+    int n = 0;
+
+    while (val >= 0x80) {
+        p[n++] = (unsigned char) (val | 0x80);
+        val >>= 7;
+    }
+    p[n++] = (unsigned char) val;
+
+    return n;
+}
+
+/* returns the number of bytes encodeVarint() writes for val */
+int varintLen(uint64_t val)
+{
+    int n = 1;
+
+    while (val >= 0x80) {
+        val >>= 7;
+        n++;
+    }
+
+    return n;
+}
+
+/* decodes a varint stored at ptr
+ * sz = remaining buffer size in bytes
+ * val = pointer we return integer into
+ *
+ * returns the number of bytes consumed from the buffer or -1 upon error
+ */
+int decodeVarint(const char *ptr, size_t sz, uint64_t *val)
+{
+    const unsigned char *p = (const unsigned char *) ptr;
+    uint64_t tmp = 0;
+
+    for (int i = 0; i < VARINT_MAX_LEN && (size_t) i < sz; i++) {
+        tmp |= (uint64_t) (p[i] & 0x7f) << (7 * i);
+        if (!(p[i] & 0x80)) {
+            *val = tmp;
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,350 @@
+/*
+ * Copyright Redis Ltd. 2023 - present
+ * Licensed under your choice of the Redis Source Available License 2.0 (RSALv2) or
+ * the Server Side Public License v1 (SSPLv1).
+ */
+
+#include "redisraft.h"
+
+#include <string.h>
+
+/* Slot index
+ *
+ * RAFT.SCAN returns the keys of a set of slots, to migrate them. Without an
+ * index, it has to SCAN the whole keyspace and filter the keys by slot.
+ *
+ * When 'slot-index' is enabled, keys of db 0 are indexed by slot, so RAFT.SCAN
+ * only visits the keys of the requested slots. The index is built with a full
+ * scan on first use, then maintained from keyspace notifications: new keys are
+ * added, deleted, expired, evicted, renamed and moved keys are removed.
+ *
+ * Keys are ordered by slot, then by the sequence number they were indexed
+ * with. The RAFT.SCAN cursor is a position in this order, so keys deleted
+ * between calls (e.g. migrated keys) don't move the other keys, and keys that
+ * exist during the whole scan are returned once.
+ *
+ * Keys loaded from an RDB don't trigger notifications. The index is dropped
+ * when loading starts or when db 0 is swapped, and rebuilt on the next use.
+ */
+
+#define SEQ_BITS 48
+#define SEQ_MASK ((1ULL << SEQ_BITS) - 1)
+
+typedef struct SlotIndexEntry {
+    RedisModuleString *key;
+    unsigned int slot;
+    uint64_t seq;
+} SlotIndexEntry;
+
+/* Position of a key in the index, big endian so positions sort by slot */
+typedef struct SlotIndexPos {
+    unsigned char buf[10];
+} SlotIndexPos;
+
+static SlotIndexPos encodePos(unsigned int slot, uint64_t seq)
+{
+    SlotIndexPos pos;
+
+    pos.buf[0] = (unsigned char) (slot >> 8);
+    pos.buf[1] = (unsigned char) slot;
+    for (int i = 0; i < 8; i++) {
+        pos.buf[2 + i] = (unsigned char) (seq >> (56 - 8 * i));
+    }
+
+    return pos;
+}
+
+void SlotIndexInit(SlotIndex *si)
+{
+    *si = (SlotIndex){0};
+}
+
+static void freeEntries(SlotIndex *si)
+{
+    if (!si->keys) {
+        return;
+    }
+
+    RedisModuleDictIter *it = RedisModule_DictIteratorStartC(si->keys, "^", NULL, 0);
+    SlotIndexEntry *e;
+
+    while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL) {
+        RedisModule_FreeString(NULL, e->key);
+        RedisModule_Free(e);
+    }
+    RedisModule_DictIteratorStop(it);
+
+    RedisModule_FreeDict(NULL, si->keys);
+    RedisModule_FreeDict(NULL, si->positions);
+    RedisModule_Free(si->counts);
+
+    si->keys = NULL;
+    si->positions = NULL;
+    si->counts = NULL;
+    si->num_keys = 0;
+}
+
+/* Drop the index, it is rebuilt on the next use. The sequence is kept, so
+ * cursors of a previous index can't skip keys of the new one. */
+void SlotIndexFree(SlotIndex *si)
+{
+    freeEntries(si);
+    si->valid = false;
+}
+
+static void addKey(SlotIndex *si, RedisModuleString *key)
+{
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(key, &len);
+
+    if (RedisModule_DictGetC(si->keys, (void *) str, len, NULL)) {
+        return;
+    }
+
+    SlotIndexEntry *e = RedisModule_Alloc(sizeof(*e));
+    e->key = RedisModule_CreateStringFromString(NULL, key);
+    e->slot = keyHashSlot(str, len);
+    e->seq = ++si->seq;
+
+    SlotIndexPos pos = encodePos(e->slot, e->seq);
+    RedisModule_DictSetC(si->keys, (void *) str, len, e);
+    RedisModule_DictSetC(si->positions, pos.buf, sizeof(pos.buf), e);
+
+    si->counts[e->slot]++;
+    si->num_keys++;
+}
+
+static void removeKey(SlotIndex *si, RedisModuleString *key)
+{
+    size_t len;
+    const char *str = RedisModule_StringPtrLen(key, &len);
+    SlotIndexEntry *e;
+
+    if (RedisModule_DictDelC(si->keys, (void *) str, len, &e) != REDISMODULE_OK) {
+        return;
+    }
+
+    SlotIndexPos pos = encodePos(e->slot, e->seq);
+    RedisModule_DictDelC(si->positions, pos.buf, sizeof(pos.buf), NULL);
+
+    si->counts[e->slot]--;
+    si->num_keys--;
+
+    RedisModule_FreeString(NULL, e->key);
+    RedisModule_Free(e);
+}
+
+static void scanCallback(RedisModuleCtx *ctx, RedisModuleString *keyname,
+                         RedisModuleKey *key, void *privdata)
+{
+    addKey(privdata, keyname);
+}
+
+/* Build the index from the keyspace of db 0, 'ctx' must have it selected. */
+static void buildIndex(SlotIndex *si, RedisModuleCtx *ctx)
+{
+    uint64_t begin = RedisModule_MonotonicMicroseconds();
+
+    freeEntries(si);
+    si->keys = RedisModule_CreateDict(NULL);
+    si->positions = RedisModule_CreateDict(NULL);
+    si->counts = RedisModule_Calloc(REDIS_RAFT_HASH_SLOTS, sizeof(*si->counts));
+
+    RedisModuleScanCursor *cursor = RedisModule_ScanCursorCreate();
+    while (RedisModule_Scan(ctx, cursor, scanCallback, si)) {
+        ;
+    }
+    RedisModule_ScanCursorDestroy(cursor);
+
+    si->valid = true;
+    si->rebuilds++;
+
+    LOG_VERBOSE("Slot index built with %llu keys in %lu microseconds",
+                si->num_keys, RedisModule_MonotonicMicroseconds() - begin);
+}
+
+int SlotIndexKeyspaceEvent(RedisModuleCtx *ctx, int type, const char *event, RedisModuleString *key)
+{
+    RedisRaftCtx *rr = &redis_raft;
+    SlotIndex *si = &rr->slot_index;
+
+    if (!si->valid) {
+        return REDISMODULE_OK;
+    }
+
+    if (!rr->config.slot_index) {
+        SlotIndexFree(si);
+        return REDISMODULE_OK;
+    }
+
+    if (RedisModule_GetSelectedDb(ctx) != 0) {
+        return REDISMODULE_OK;
+    }
+
+    if (type & REDISMODULE_NOTIFY_NEW) {
+        addKey(si, key);
+    } else if (!strcmp(event, "del") ||
+               !strcmp(event, "expired") ||
+               !strcmp(event, "evicted") ||
+               !strcmp(event, "rename_from") ||
+               !strcmp(event, "move_from")) {
+        removeKey(si, key);
+    }
+
+    return REDISMODULE_OK;
+}
+
+void SlotIndexServerEvent(RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent, void *data)
+{
+    SlotIndex *si = &redis_raft.slot_index;
+
+    if (!si->valid) {
+        return;
+    }
+
+    if (eid.id == REDISMODULE_EVENT_LOADING) {
+        if (subevent != REDISMODULE_SUBEVENT_LOADING_ENDED &&
+            subevent != REDISMODULE_SUBEVENT_LOADING_FAILED) {
+            SlotIndexFree(si);
+        }
+    } else if (eid.id == REDISMODULE_EVENT_FLUSHDB) {
+        RedisModuleFlushInfoV1 *fi = data;
+
+        if (subevent == REDISMODULE_SUBEVENT_FLUSHDB_END && (fi->dbnum == -1 || fi->dbnum == 0)) {
+            SlotIndexFree(si);
+        }
+    } else if (eid.id == REDISMODULE_EVENT_SWAPDB) {
+        RedisModuleSwapDbInfoV1 *sd = data;
+
+        if (sd->dbnum_first == 0 || sd->dbnum_second == 0) {
+            SlotIndexFree(si);
+        }
+    }
+}
+
+typedef struct SlotKeys {
+    unsigned int slot;
+    RedisModuleString **keys;
+    size_t len;
+    size_t size;
+} SlotKeys;
+
+static void slotKeysAdd(SlotKeys *sk, RedisModuleString *key)
+{
+    if (sk->len == sk->size) {
+        sk->size = sk->size ? sk->size * 2 : 64;
+        sk->keys = RedisModule_Realloc(sk->keys, sk->size * sizeof(*sk->keys));
+    }
+    sk->keys[sk->len++] = RedisModule_CreateStringFromString(NULL, key);
+}
+
+static void slotKeysScanCallback(RedisModuleCtx *ctx, RedisModuleString *keyname,
+                                 RedisModuleKey *key, void *privdata)
+{
+    SlotKeys *sk = privdata;
+
+    if (keyHashSlotRedisString(keyname) == sk->slot) {
+        slotKeysAdd(sk, keyname);
+    }
+}
+
+/* Get the keys of a slot, from the index if it is enabled, or with a scan of
+ * the keyspace of db 0, selected in 'ctx'. The caller must free the keys and
+ * the array returned in 'keys'. */
+size_t SlotIndexGetKeys(RedisRaftCtx *rr, RedisModuleCtx *ctx, unsigned int slot, RedisModuleString ***keys)
+{
+    SlotIndex *si = &rr->slot_index;
+    SlotKeys sk = {.slot = slot};
+
+    if (rr->config.slot_index) {
+        if (!si->valid) {
+            buildIndex(si, ctx);
+        }
+
+        SlotIndexPos pos = encodePos(slot, 0);
+        RedisModuleDictIter *it = RedisModule_DictIteratorStartC(si->positions, ">=",
+                                                                 pos.buf, sizeof(pos.buf));
+        SlotIndexEntry *e;
+
+        while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL && e->slot == slot) {
+            slotKeysAdd(&sk, e->key);
+        }
+        RedisModule_DictIteratorStop(it);
+    } else {
+        RedisModuleScanCursor *cursor = RedisModule_ScanCursorCreate();
+        while (RedisModule_Scan(ctx, cursor, slotKeysScanCallback, &sk)) {
+            ;
+        }
+        RedisModule_ScanCursorDestroy(cursor);
+    }
+
+    *keys = sk.keys;
+    return sk.len;
+}
+
+/* Reply to RAFT.SCAN from the index, with up to 'count' keys of 'slots'
+ * after 'cursor'. The cursor holds a slot in its high bits and a sequence
+ * number in its low SEQ_BITS bits. */
+void SlotIndexScan(RedisRaftCtx *rr, RedisModuleCtx *ctx, unsigned long long cursor,
+                   const char *slots, long long count)
+{
+    SlotIndex *si = &rr->slot_index;
+    unsigned long long next = 0;
+    long long len = 0;
+
+    if ((cursor >> SEQ_BITS) >= REDIS_RAFT_HASH_SLOTS) {
+        RedisModule_ReplyWithError(ctx, "ERR invalid cursor");
+        return;
+    }
+
+    if (!si->valid) {
+        buildIndex(si, ctx);
+    }
+
+    /* The cursor is not known until the keys are iterated */
+    SlotIndexEntry **entries = NULL;
+    long long size = 0;
+
+    for (unsigned int slot = cursor >> SEQ_BITS; slot < REDIS_RAFT_HASH_SLOTS; slot++) {
+        if (!slots[slot] || !si->counts[slot]) {
+            continue;
+        }
+
+        uint64_t seq = (slot == (cursor >> SEQ_BITS)) ? (cursor & SEQ_MASK) : 0;
+        SlotIndexPos pos = encodePos(slot, seq);
+        RedisModuleDictIter *it = RedisModule_DictIteratorStartC(si->positions, ">=",
+                                                                 pos.buf, sizeof(pos.buf));
+        SlotIndexEntry *e;
+
+        while (RedisModule_DictNextC(it, NULL, (void **) &e) != NULL && e->slot == slot) {
+            if (len == count) {
+                next = ((unsigned long long) slot << SEQ_BITS) | e->seq;
+                break;
+            }
+            if (len == size) {
+                size = size ? size * 2 : 64;
+                entries = RedisModule_Realloc(entries, size * sizeof(*entries));
+            }
+            entries[len++] = e;
+        }
+        RedisModule_DictIteratorStop(it);
+
+        if (next) {
+            break;
+        }
+    }
+
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%llu", next);
+
+    RedisModule_ReplyWithArray(ctx, 2);
+    RedisModule_ReplyWithStringBuffer(ctx, buf, n);
+    RedisModule_ReplyWithArray(ctx, len);
+    for (long long i = 0; i < len; i++) {
+        RedisModule_ReplyWithArray(ctx, 2);
+        RedisModule_ReplyWithString(ctx, entries[i]->key);
+        RedisModule_ReplyWithLongLong(ctx, entries[i]->slot);
+    }
+
+    RedisModule_Free(entries);
+}
@@ -548,6 +548,7 @@ int raftLoadSnapshot(raft_server_t *raft, void *user_data, raft_term_t term,
     }
     RedisModule_RdbStreamFree(s);
 
+    blockedCommandsArmReady();
     configRaftFromSnapshotInfo(rr);
     raft_end_load_snapshot(rr->raft);
 
@@ -588,6 +589,27 @@ static void lockedKeysRDBLoad(RedisModuleIO *rdb)
     }
 }
 
+static void lockedSlotsRDBLoad(RedisModuleIO *rdb, int encver)
+{
+    ShardingInfo *si = redis_raft.sharding_info;
+
+    memset(si->locked_slots, 0, sizeof(si->locked_slots));
+    si->locked_slots_num = 0;
+
+    if (encver < 4) {
+        return;
+    }
+
+    size_t count = RedisModule_LoadUnsigned(rdb);
+    for (size_t i = 0; i < count; i++) {
+        unsigned int slot = (unsigned int) RedisModule_LoadUnsigned(rdb);
+        RedisModule_Assert(HashSlotValid(slot));
+
+        si->locked_slots[slot] = true;
+        si->locked_slots_num++;
+    }
+}
+
 static void clientSessionRDBLoad(RedisModuleIO *rdb)
 {
     RedisRaftCtx *rr = &redis_raft;
@@ -679,11 +701,19 @@ static int rdbLoadSnapshotInfo(RedisModuleIO *rdb, int encver, int when)
     /* Load locked_keys dict */
     lockedKeysRDBLoad(rdb);
 
+    /* Load slots locked by RAFT.MIGRATE */
+    lockedSlotsRDBLoad(rdb, encver);
+
     /* Load client_session dict */
     clientSessionRDBLoad(rdb);
 
+    /* Load ACL definitions, blocked commands may refer to them */
+    if (encver >= 2) {
+        ACLCacheRDBLoad(rdb, &redis_raft.acl_cache, info->last_applied_term);
+    }
+
     /* load blocked command state */
-    blockedCommandsLoad(rdb);
+    blockedCommandsLoad(rdb, encver);
 
     info->loaded = true;
     return REDISMODULE_OK;
@@ -708,6 +738,18 @@ static void lockedKeysRDBSave(RedisModuleIO *rdb)
     RedisModule_DictIteratorStop(iter);
 }
 
+static void lockedSlotsRDBSave(RedisModuleIO *rdb)
+{
+    ShardingInfo *si = redis_raft.sharding_info;
+
+    RedisModule_SaveUnsigned(rdb, si->locked_slots_num);
+    for (unsigned int i = 0; i < REDIS_RAFT_HASH_SLOTS; i++) {
+        if (si->locked_slots[i]) {
+            RedisModule_SaveUnsigned(rdb, i);
+        }
+    }
+}
+
 static void clientSessionRDBSave(RedisModuleIO *rdb)
 {
     RedisRaftCtx *rr = &redis_raft;
@@ -765,9 +807,15 @@ static void rdbSaveSnapshotInfo(RedisModuleIO *rdb, int when)
     /* Save LockedKeys dict */
     lockedKeysRDBSave(rdb);
 
+    /* Save slots locked by RAFT.MIGRATE */
+    lockedSlotsRDBSave(rdb);
+
     /* Save client_session dict */
     clientSessionRDBSave(rdb);
 
+    /* Save ACL definitions */
+    ACLCacheRDBSave(rdb, &redis_raft.acl_cache);
+
     /* save blocked command state */
     blockedCommandsSave(rdb);
 }
@@ -796,7 +844,7 @@ static void handleSnapshotResponse(redisAsyncContext *c, void *r, void *privdata
 
     redisReply *reply = r;
 
-    NodeDismissPendingResponse(node);
+    NodeDismissPendingResponse(node, NULL);
     if (!reply) {
         ConnMarkDisconnected(node->conn);
         return;
@@ -885,7 +933,9 @@ int raftSendSnapshot(raft_server_t *raft,
         return -1;
     }
 
-    NodeAddPendingResponse(node, false);
+    NodeAddPendingResponse(node);
+    node->stats.snapshot_chunks_sent++;
+    node->stats.snapshot_bytes_sent += msg->chunk.len;
 
     return 0;
 }
@@ -0,0 +1,168 @@
+/*
+ * Copyright Redis Ltd. 2023 - present
+ * Licensed under your choice of the Redis Source Available License 2.0 (RSALv2) or
+ * the Server Side Public License v1 (SSPLv1).
+ */
+
+#include "redisraft.h"
+
+/* Write latency tracing
+ *
+ * A write goes through these stages on the leader (see WriteStage):
+ *
+ *   validate: From the command filter to the end of validation, including the
+ *             dry run.
+ *   append:   Until it is appended to the log, including the wait for the
+ *             write batch and serialization.
+ *   write:    Until its entry is written to the log file, before going to
+ *             sleep (see handleBeforeSleep()).
+ *   fsync:    Until the fsync thread reports the entry is on disk.
+ *   commit:   Until the entry is committed, which takes RAFT.AE round trips
+ *             with a majority of the nodes.
+ *   apply:    Until the command is executed, including apply throttling.
+ *
+ * The first stages are timestamped on the RaftReq. The others progress by
+ * index, for many requests at once, so instead of visiting the pending
+ * requests, each stage keeps the last indexes it reached and when. When a
+ * request is executed, the time it reached these stages is found from its
+ * entry index. If the mark of a stage was overwritten by later ones, its time
+ * is attributed to the next stage.
+ *
+ * Durations are added to a histogram per stage, reported by INFO raft and
+ * RAFT.STATS. Writes slower than 'slow-write-threshold' are logged with their
+ * breakdown.
+ */
+
+const char *WriteStageStr[] = {
+    "validate",
+    "append",
+    "write",
+    "fsync",
+    "commit",
+    "apply",
+    "total",
+};
+
+static void resetMarks(WriteMarks *m)
+{
+    m->next = 0;
+    m->len = 0;
+}
+
+/* Forget the marks, indexes may go back after a leader change. */
+void WriteTraceReset(WriteTrace *t)
+{
+    resetMarks(&t->written);
+    resetMarks(&t->fsynced);
+    resetMarks(&t->committed);
+}
+
+static int slotBefore(int slot, int n)
+{
+    return (slot + WRITE_TRACE_MARKS - n) % WRITE_TRACE_MARKS;
+}
+
+/* Record that a stage reached 'idx' at 'time'. */
+void WriteTraceMark(WriteMarks *m, raft_index_t idx, uint64_t time)
+{
+    if (m->len && m->idx[slotBefore(m->next, 1)] >= idx) {
+        return;
+    }
+
+    m->idx[m->next] = idx;
+    m->time[m->next] = time;
+    m->next = (m->next + 1) % WRITE_TRACE_MARKS;
+
+    if (m->len < WRITE_TRACE_MARKS) {
+        m->len++;
+    }
+}
+
+/* Returns the time a stage reached 'idx', or 0 if unknown. */
+static uint64_t findMark(WriteMarks *m, raft_index_t idx)
+{
+    uint64_t time = 0;
+
+    for (int i = 1; i <= m->len; i++) {
+        int slot = slotBefore(m->next, i);
+
+        if (m->idx[slot] < idx) {
+            return time;
+        }
+        time = m->time[slot];
+    }
+
+    /* All marks are past 'idx', the one it reached may be overwritten */
+    return m->len < WRITE_TRACE_MARKS ? time : 0;
+}
+
+/* Returns when 'idx' was written to the log file, in microseconds, or 0 if it
+ * is not written yet or nothing was written since the marks were reset. If
+ * its mark was overwritten, the oldest mark is used instead, which makes the
+ * entry look younger than it is. */
+uint64_t WriteTraceWrittenTime(WriteTrace *t, raft_index_t idx)
+{
+    WriteMarks *m = &t->written;
+
+    if (!m->len || m->idx[slotBefore(m->next, 1)] < idx) {
+        return 0;
+    }
+
+    uint64_t time = findMark(m, idx);
+    return time ? time : m->time[slotBefore(m->next, m->len)];
+}
+
+/* Mark the commit index, if it moved. */
+void WriteTraceCommitted(RedisRaftCtx *rr)
+{
+    WriteMarks *m = &rr->write_trace.committed;
+    raft_index_t idx = raft_get_commit_idx(rr->raft);
+
+    if (m->len && m->idx[slotBefore(m->next, 1)] >= idx) {
+        return;
+    }
+
+    WriteTraceMark(m, idx, RedisModule_MonotonicMicroseconds());
+}
+
+/* Record the stages of a write executed at 'now'. */
+void WriteTraceExecuted(RedisRaftCtx *rr, RaftReq *req, uint64_t now)
+{
+    WriteTrace *t = &rr->write_trace;
+
+    if (!req->times.received || !req->times.appended) {
+        return;
+    }
+
+    /* Time each stage ends, a stage ends no earlier than the previous one */
+    uint64_t ends[WRITE_STAGE_TOTAL + 1] = {
+        req->times.received,
+        req->times.validated,
+        req->times.appended,
+        findMark(&t->written, req->raft_idx),
+        findMark(&t->fsynced, req->raft_idx),
+        findMark(&t->committed, req->raft_idx),
+        now,
+    };
+    uint64_t took[WRITE_STAGE_NUM];
+
+    for (int i = 0; i < WRITE_STAGE_TOTAL; i++) {
+        ends[i + 1] = MAX(ends[i + 1], ends[i]);
+        took[i] = ends[i + 1] - ends[i];
+        LatencyHistogramAdd(&t->stages[i], took[i]);
+    }
+
+    took[WRITE_STAGE_TOTAL] = ends[WRITE_STAGE_TOTAL] - ends[0];
+    LatencyHistogramAdd(&t->stages[WRITE_STAGE_TOTAL], took[WRITE_STAGE_TOTAL]);
+
+    long long threshold = rr->config.slow_write_threshold;
+    if (threshold && took[WRITE_STAGE_TOTAL] >= (uint64_t) threshold) {
+        t->slow++;
+        LOG_NOTICE("Slow write at index %ld: total=%lu us, validate=%lu append=%lu "
+                   "write=%lu fsync=%lu commit=%lu apply=%lu",
+                   req->raft_idx, took[WRITE_STAGE_TOTAL],
+                   took[WRITE_STAGE_VALIDATE], took[WRITE_STAGE_APPEND],
+                   took[WRITE_STAGE_WRITE], took[WRITE_STAGE_FSYNC],
+                   took[WRITE_STAGE_COMMIT], took[WRITE_STAGE_APPLY]);
+    }
+}
@@ -12,11 +12,10 @@
 #include "log.h"
 #include "redisraft.h"
 
-#include "common/crc16.h"
-
 #include <fcntl.h>
 #include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -177,45 +176,90 @@ void FreeImportKeys(ImportKeys *target)
 }
 
 /* -----------------------------------------------------------------------------
- * Hashing code - copied directly from Redis.
+ * Hashing code - derived from Redis.
  * -------------------------------------------------------------------------- */
 
-/* We have 16384 hash slots. The hash slot of a given key is obtained
- * as the least significant 14 bits of the crc16 of the key.
- *
- * However if the key contains the {...} pattern, only the part between
- * { and } is hashed. This may be useful in the future to force certain
- * keys to be in the same node (assuming no resharding is in progress). */
-unsigned int keyHashSlot(const char *key, size_t keylen)
+/* CRC16 tables for slicing-by-8: crc16_tables[k][b] is the CRC16 of byte 'b'
+ * followed by 'k' zero bytes. crc16_tables[0] is the table of crc16_ccitt().
+ */
+static uint16_t crc16_tables[8][256];
+static pthread_once_t crc16_tables_once = PTHREAD_ONCE_INIT;
+
+static void initCrc16Tables(void)
 {
-    size_t s, e; /* start-end indexes of { and } */
+    for (int b = 0; b < 256; b++) {
+        uint16_t crc = (uint16_t) (b << 8);
 
-    for (s = 0; s < keylen; s++) {
-        if (key[s] == '{') {
-            break;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
         }
+        crc16_tables[0][b] = crc;
     }
 
-    /* No '{' ? Hash the whole key. This is the base case. */
-    if (s == keylen) {
-        return crc16_ccitt(key, keylen) & 0x3FFF;
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            uint16_t prev = crc16_tables[k - 1][b];
+            crc16_tables[k][b] = (uint16_t) ((prev << 8) ^ crc16_tables[0][prev >> 8]);
+        }
     }
+}
 
-    /* '{' found? Check if we have the corresponding '}'. */
-    for (e = s + 1; e < keylen; e++) {
-        if (key[e] == '}') {
-            break;
-        }
+/* Same as crc16_ccitt(), 8 bytes at a time. The CRC state is only two bytes
+ * wide, so the other six bytes of a block don't depend on it and their table
+ * lookups are independent. */
+static uint16_t crc16(const char *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    uint16_t (*t)[256] = crc16_tables;
+    uint16_t crc = 0;
+
+    while (len >= 8) {
+        uint16_t x = crc ^ (uint16_t) ((p[0] << 8) | p[1]);
+
+        crc = t[7][x >> 8] ^ t[6][x & 0xFF] ^
+              t[5][p[2]] ^ t[4][p[3]] ^ t[3][p[4]] ^
+              t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = (uint16_t) (crc << 8) ^ t[0][((crc >> 8) ^ *p++) & 0xFF];
     }
 
-    /* No '}' or nothing between {} ? Hash the whole key. */
-    if (e == keylen || e == s + 1) {
-        return crc16_ccitt(key, keylen) & 0x3FFF;
+    return crc;
+}
+
+/* Returns the part of the key that is hashed: the {...} hashtag if there is
+ * a non-empty one, or the whole key. memchr() scans many bytes at a time. */
+static const char *keyHashTag(const char *key, size_t keylen, size_t *taglen)
+{
+    const char *s = memchr(key, '{', keylen);
+    if (s) {
+        const char *e = memchr(s + 1, '}', keylen - (s + 1 - key));
+        if (e && e != s + 1) {
+            *taglen = e - s - 1;
+            return s + 1;
+        }
     }
 
-    /* If we are here there is both a { and a } on its right. Hash
-     * what is in the middle between { and }. */
-    return crc16_ccitt(key + s + 1, e - s - 1) & 0x3FFF;
+    *taglen = keylen;
+    return key;
+}
+
+/* We have 16384 hash slots. The hash slot of a given key is obtained
+ * as the least significant 14 bits of the crc16 of the key.
+ *
+ * However if the key contains the {...} pattern, only the part between
+ * { and } is hashed. This may be useful in the future to force certain
+ * keys to be in the same node (assuming no resharding is in progress). */
+unsigned int keyHashSlot(const char *key, size_t keylen)
+{
+    size_t taglen;
+    const char *tag = keyHashTag(key, keylen, &taglen);
+
+    pthread_once(&crc16_tables_once, initCrc16Tables);
+    return crc16(tag, taglen) & 0x3FFF;
 }
 
 unsigned int keyHashSlotRedisString(RedisModuleString *str)
@@ -226,6 +270,42 @@ unsigned int keyHashSlotRedisString(RedisModuleString *str)
     return keyHashSlot(key, keylen);
 }
 
+/* Hashes the keys of argv at positions first, first + step, ... up to last,
+ * included. Returns false if they don't all map to the same slot.
+ *
+ * '*slot' is the slot the keys must map to, or -1 for any slot. It is set
+ * to the slot of the keys. Consecutive keys usually share a hashtag, so the
+ * hash of the previous tag is reused when it matches. */
+bool keyHashSlotArgv(RedisModuleString **argv, int first, int last, int step, int *slot)
+{
+    const char *prev = NULL;
+    size_t prevlen = 0;
+
+    pthread_once(&crc16_tables_once, initCrc16Tables);
+
+    for (int i = first; i <= last; i += step) {
+        size_t keylen, taglen;
+        const char *key = RedisModule_StringPtrLen(argv[i], &keylen);
+        const char *tag = keyHashTag(key, keylen, &taglen);
+
+        if (prev && taglen == prevlen && !memcmp(tag, prev, taglen)) {
+            continue;
+        }
+
+        int thisslot = crc16(tag, taglen) & 0x3FFF;
+        if (*slot == -1) {
+            *slot = thisslot;
+        } else if (*slot != thisslot) {
+            return false;
+        }
+
+        prev = tag;
+        prevlen = taglen;
+    }
+
+    return true;
+}
+
 RRStatus parseHashSlots(char *slots, char *string)
 {
     string = RedisModule_Strdup(string);
@@ -643,4 +723,163 @@ int base64Encode(char *encoded, const char *string, int len)
 
     *p++ = '\0';
     return p - encoded;
-}
\ No newline at end of file
+}
+long long monotonicMilliseconds(void)
+{
+    return (long long) (RedisModule_MonotonicMicroseconds() / 1000);
+}
+
+/* Timer wheel
+ *
+ * Tracks the deadlines of many pending operations. Entries are hashed into
+ * slots by their deadline, rounded up to the wheel resolution, so adding and
+ * removing an entry is O(1) and expiring only looks at the slots of the ticks
+ * that elapsed. Deadlines further than a full turn stay in their slot until
+ * their turn comes.
+ */
+void TimerWheelInit(TimerWheel *tw, long long resolution, long long now)
+{
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        sc_list_init(&tw->slots[i]);
+    }
+
+    tw->resolution = resolution;
+    tw->tick = now / resolution;
+    tw->count = 0;
+}
+
+void TimerWheelEntryInit(TimerWheelEntry *e)
+{
+    sc_list_init(&e->list);
+    e->tick = 0;
+}
+
+void TimerWheelAdd(TimerWheel *tw, TimerWheelEntry *e, long long deadline)
+{
+    TimerWheelDel(tw, e);
+
+    e->tick = (deadline + tw->resolution - 1) / tw->resolution;
+    if (e->tick <= tw->tick) {
+        e->tick = tw->tick + 1;
+    }
+
+    sc_list_add_tail(&tw->slots[e->tick % TIMER_WHEEL_SLOTS], &e->list);
+    tw->count++;
+}
+
+void TimerWheelDel(TimerWheel *tw, TimerWheelEntry *e)
+{
+    if (sc_list_is_empty(&e->list)) {
+        return;
+    }
+
+    sc_list_del(NULL, &e->list);
+    tw->count--;
+}
+
+/* Remove all entries with a deadline up to 'now' and call 'cb' for each.
+ * The callback may add or remove other entries. */
+void TimerWheelExpire(TimerWheel *tw, long long now, TimerWheelCallback cb, void *privdata)
+{
+    long long tick = now / tw->resolution;
+    long long from = tw->tick + 1;
+    struct sc_list expired;
+
+    if (tick <= tw->tick) {
+        return;
+    }
+
+    if (tick - from >= TIMER_WHEEL_SLOTS) {
+        from = tick - TIMER_WHEEL_SLOTS + 1;
+    }
+
+    sc_list_init(&expired);
+
+    for (long long t = from; t <= tick; t++) {
+        struct sc_list *slot = &tw->slots[t % TIMER_WHEEL_SLOTS];
+        struct sc_list *tmp, *it;
+
+        sc_list_foreach_safe (slot, tmp, it) {
+            TimerWheelEntry *e = sc_list_entry(it, TimerWheelEntry, list);
+            if (e->tick <= tick) {
+                sc_list_add_tail(&expired, it);
+            }
+        }
+    }
+
+    tw->tick = tick;
+
+    /* Entries are collected first, as callbacks may remove any entry */
+    struct sc_list *it;
+    while ((it = sc_list_pop_head(&expired)) != NULL) {
+        tw->count--;
+        cb(sc_list_entry(it, TimerWheelEntry, list), privdata);
+    }
+}
+
+/* Latency histogram
+ *
+ * Values are counted in log-linear buckets: each power of two is split into
+ * LATENCY_HISTOGRAM_SUB_BUCKETS buckets, so percentiles are reported within
+ * ~12% of the actual value, with a fixed amount of memory.
+ */
+#define LATENCY_SUB_BITS 3
+
+static int latencyBucket(uint64_t value)
+{
+    if (value < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+        return (int) value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - LATENCY_SUB_BITS;
+    int bucket = (msb - LATENCY_SUB_BITS + 1) * LATENCY_HISTOGRAM_SUB_BUCKETS +
+                 (int) ((value >> shift) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1));
+
+    return bucket < LATENCY_HISTOGRAM_BUCKETS ? bucket : LATENCY_HISTOGRAM_BUCKETS - 1;
+}
+
+/* Returns the highest value counted in a bucket */
+static uint64_t latencyBucketMax(int bucket)
+{
+    if (bucket < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % LATENCY_HISTOGRAM_SUB_BUCKETS;
+
+    return ((LATENCY_HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogramAdd(LatencyHistogram *h, uint64_t value)
+{
+    h->buckets[latencyBucket(value)]++;
+    h->count++;
+    h->sum += value;
+}
+
+/* Returns the value below which 'percentile' percent of the values fall, or 0
+ * if the histogram is empty. */
+uint64_t LatencyHistogramPercentile(LatencyHistogram *h, double percentile)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) ((percentile / 100.0) * (double) h->count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            return latencyBucketMax(i);
+        }
+    }
+
+    return latencyBucketMax(LATENCY_HISTOGRAM_BUCKETS - 1);
+}
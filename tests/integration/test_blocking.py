@@ -235,6 +235,74 @@ def test_blocking_with_snapshot(cluster):
         assert val == [b'3']
 
 
+def test_blocking_with_snapshot_dormant(cluster):
+    """
+    Commands loaded from a snapshot stay dormant until their keys are written.
+    """
+    cluster.create(3)
+
+    c1 = cluster.leader_node().client.connection_pool.get_connection('c1')
+    c1.send_command("brpop", "x", 0)
+    c2 = cluster.leader_node().client.connection_pool.get_connection('c2')
+    c2.send_command("brpop", "y", 0)
+    cluster.wait_for_unanimity()
+
+    cluster.node(2).client.execute_command('raft.debug', 'compact')
+    cluster.node(2).restart()
+    cluster.node(2).wait_for_info_param('raft_state', 'up')
+
+    assert cluster.node(2).info()['raft_blocked_commands'] == 2
+    assert cluster.node(2).info()['raft_blocked_commands_dormant'] == 2
+
+    cluster.leader_node().execute("lpush", "x", 1)
+    cluster.wait_for_unanimity()
+
+    assert c1.read_response() == [b'x', b'1']
+    assert cluster.node(2).info()['raft_blocked_commands'] == 1
+    assert cluster.node(2).info()['raft_blocked_commands_dormant'] == 1
+    assert cluster.node(2).raft_debug_exec("llen", "x") == 0
+
+    cluster.leader_node().execute("lpush", "y", 2)
+    cluster.wait_for_unanimity()
+
+    assert c2.read_response() == [b'y', b'2']
+    assert cluster.node(2).info()['raft_blocked_commands'] == 0
+    assert cluster.node(2).info()['raft_blocked_commands_dormant'] == 0
+
+
+def test_blocking_with_snapshot_dormant_unblock_push(cluster):
+    """
+    A dormant command is armed when its key is written by another blocked
+    command being served, not by an applied entry. No entry applied after
+    the snapshot refers to 'y', only the keyspace notification of the push
+    arms BRPOP.
+    """
+    cluster.create(3)
+
+    c1 = cluster.leader_node().client.connection_pool.get_connection('c1')
+    c1.send_command("brpop", "y", 0)
+    c2 = cluster.leader_node().client.connection_pool.get_connection('c2')
+    c2.send_command("blmove", "x", "y", "right", "left", 0)
+    cluster.wait_for_unanimity()
+
+    cluster.node(2).client.execute_command('raft.debug', 'compact')
+    cluster.node(2).restart()
+    cluster.node(2).wait_for_info_param('raft_state', 'up')
+    assert cluster.node(2).info()['raft_blocked_commands_dormant'] == 2
+
+    # LPUSH arms BLMOVE, which is served and pushes to 'y'
+    cluster.leader_node().execute("lpush", "x", 1)
+    cluster.wait_for_unanimity()
+    cluster.node(2).wait_for_log_applied()
+
+    assert c2.read_response() == b'1'
+    assert c1.read_response() == [b'y', b'1']
+    assert cluster.node(2).info()['raft_blocked_commands'] == 0
+    assert cluster.node(2).info()['raft_blocked_commands_dormant'] == 0
+    assert cluster.node(2).raft_debug_exec("llen", "x") == 0
+    assert cluster.node(2).raft_debug_exec("llen", "y") == 0
+
+
 def test_blocking_with_timeout(cluster):
     cluster.create(3)
 
@@ -258,6 +326,32 @@ def test_blocking_with_timeout(cluster):
         assert val == [b'3', b'2']
 
 
+def test_blocking_timeouts_batched(cluster):
+    """
+    Blocked commands that time out together are timed out by a single entry.
+    """
+    cluster.create(3)
+    leader = cluster.leader_node()
+
+    conns = []
+    for i in range(10):
+        conn = leader.client.connection_pool.get_connection('c%d' % i)
+        conn.send_command("brpop", "x", 1)
+        conns.append(conn)
+
+    for conn in conns:
+        assert conn.read_response() is None
+
+    cluster.wait_for_unanimity()
+
+    info = leader.info()
+    assert info['raft_blocked_timeouts_expired'] == 10
+    assert 1 <= info['raft_blocked_timeout_entries'] < 10
+
+    for i in range(1, 4):
+        assert cluster.node(i).info()['raft_blocked_commands'] == 0
+
+
 def test_blocking_with_term_change(cluster):
     cluster.create(3)
 
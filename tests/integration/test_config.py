@@ -27,7 +27,9 @@ def test_config_sanity(cluster):
     verify('raft.join-timeout', 999)
     verify('raft.response-timeout', 999)
     verify('raft.proxy-response-timeout', 999)
+    verify('raft.proxy-connections', 9)
     verify('raft.reconnect-interval', 999)
+    verify('raft.dns-cache-ttl', 999)
     verify('raft.shardgroup-update-interval', 999)
     verify('raft.append-req-max-count', 999)
     verify('raft.append-req-max-size', 999)
@@ -36,6 +38,10 @@ def test_config_sanity(cluster):
     verify('raft.log-max-cache-size', 999)
     verify('raft.log-max-file-size', 999)
     verify('raft.scan-size', 999)
+    verify('raft.apply-prefetch', 999)
+    verify('raft.write-batch-max-count', 999)
+    verify('raft.write-batch-max-size', 999)
+    verify('raft.slow-write-threshold', 999)
     verify('raft.log-delay-apply', 999)
     verify('raft.snapshot-delay', 999)
 
@@ -45,6 +51,8 @@ def test_config_sanity(cluster):
     verify('raft.follower-proxy', 'no')
     verify('raft.quorum-reads', 'yes')
     verify('raft.quorum-reads', 'no')
+    verify('raft.slot-index', 'yes')
+    verify('raft.slot-index', 'no')
     verify('raft.sharding', 'yes')
     verify('raft.sharding', 'no')
     verify('raft.tls-enabled', 'no')
@@ -153,7 +161,9 @@ def test_config_args(cluster):
                  'join-timeout':               8005,
                  'response-timeout':           8006,
                  'proxy-response-timeout':     8007,
+                 'proxy-connections':          7,
                  'reconnect-interval':         8008,
+                 'dns-cache-ttl':              8019,
                  'shardgroup-update-interval': 8009,
                  'append-req-max-count':       8010,
                  'append-req-max-size':        8099,
@@ -162,11 +172,16 @@ def test_config_args(cluster):
                  'log-max-cache-size':         8011,
                  'log-max-file-size':          8012,
                  'scan-size':                  8013,
+                 'apply-prefetch':             8016,
+                 'write-batch-max-count':      8017,
+                 'write-batch-max-size':       8018,
+                 'slow-write-threshold':       8020,
                  'log-delay-apply':            8014,
                  'snapshot-delay':             8015,
                  'log-fsync':                  'no',
                  'follower-proxy':             'yes',
                  'quorum-reads':               'no',
+                 'slot-index':                 'yes',
                  'sharding':                   'yes',
                  'external-sharding':          'yes',
                  'tls-enabled':                'no',
@@ -216,8 +231,11 @@ def test_invalid_configs(cluster):
     verify_failure('raft.response-timeout', -1)
     verify_failure('raft.proxy-response-timeout', 0)
     verify_failure('raft.proxy-response-timeout', -1)
+    verify_failure('raft.proxy-connections', 0)
+    verify_failure('raft.proxy-connections', 65)
     verify_failure('raft.reconnect-interval', 0)
     verify_failure('raft.reconnect-interval', -1)
+    verify_failure('raft.dns-cache-ttl', -1)
     verify_failure('raft.shardgroup-update-interval', 0)
     verify_failure('raft.shardgroup-update-interval', -1)
     verify_failure('raft.append-req-max-count', 0)
@@ -231,12 +249,17 @@ def test_invalid_configs(cluster):
     verify_failure('raft.log-max-cache-size', -1)
     verify_failure('raft.log-max-file-size', -1)
     verify_failure('raft.scan-size', -1)
+    verify_failure('raft.apply-prefetch', -1)
+    verify_failure('raft.write-batch-max-count', 0)
+    verify_failure('raft.write-batch-max-size', 0)
+    verify_failure('raft.slow-write-threshold', -1)
     verify_failure('raft.log-delay-apply', -1)
     verify_failure('raft.snapshot-delay', -1)
 
     verify_failure('raft.log-fsync', 'someinvalidvalue')
     verify_failure('raft.follower-proxy', 'someinvalidvalue')
     verify_failure('raft.quorum-reads', 'someinvalidvalue')
+    verify_failure('raft.slot-index', 'someinvalidvalue')
     verify_failure('raft.sharding', 'someinvalidvalue')
     verify_failure('raft.tls-enabled', 'someinvalidvalue')
     verify_failure('raft.log-disable-apply', 'someinvalidvalue')
@@ -285,6 +308,13 @@ def test_ignored_commands(cluster):
     with raises(ResponseError, match='NOCLUSTER No Raft Cluster'):
         node.client.execute_command("cmd2", "a", "b")
 
+    # command names are case-insensitive
+    node.config_set('raft.ignored-commands', 'CMD5')
+    with raises(ResponseError, match="unknown command"):
+        node.client.execute_command("cmd5", "test", "command")
+    with raises(ResponseError, match="unknown command"):
+        node.client.execute_command("Cmd5", "test", "command")
+
 
 def test_module_command_flags(cluster):
     """
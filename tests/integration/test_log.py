@@ -625,3 +625,46 @@ def test_startup_with_more_advanced_snapshot(cluster):
     cluster.execute('incr', 'x')
     assert cluster.execute('get', 'x') == b'4'
     assert n3.info()['raft_current_index'] == 12
+
+
+def test_log_range(cluster):
+    """
+    RAFT.LOG RANGE returns entry metadata page by page.
+    """
+    r1 = cluster.add_node()
+    for i in range(10):
+        r1.execute('SET', 'key%d' % i, 'x' * i)
+
+    def to_dict(reply):
+        return {reply[i].decode(): reply[i + 1]
+                for i in range(0, len(reply), 2)}
+
+    def read_all(node, count):
+        entries = []
+        idx = 1
+        while True:
+            idx, page = node.execute('RAFT.LOG', 'RANGE', idx, count)
+            assert len(page) <= count
+            entries += [to_dict(e) for e in page]
+            if idx == 0:
+                return entries
+
+    current_idx = r1.info()['raft_current_index']
+    entries = read_all(r1, 3)
+    assert [e['index'] for e in entries] == list(range(1, current_idx + 1))
+    assert all(e['term'] >= 1 and e['data_len'] >= 0 for e in entries)
+    assert read_all(r1, 100) == entries
+
+    # Entries are read from the log file after a restart
+    r1.restart()
+    r1.wait_for_election()
+    assert read_all(r1, 4)[:current_idx] == entries
+
+    assert r1.execute('RAFT.LOG', 'RANGE', current_idx + 100, 10) == [0, []]
+
+    with raises(ResponseError, match='invalid count'):
+        r1.execute('RAFT.LOG', 'RANGE', 1, 0)
+    with raises(ResponseError, match='invalid index'):
+        r1.execute('RAFT.LOG', 'RANGE', 'x', 1)
+    with raises(ResponseError, match='wrong number of arguments'):
+        r1.execute('RAFT.LOG', 'RANGE', 1)
@@ -291,6 +291,45 @@ def test_migration_basic_on_oom(cluster_factory):
             cluster2.leader_node().execute('get', '{key2}' + str(i))
 
 
+def test_raft_scan_slot_index(cluster):
+    """
+    RAFT.SCAN with the slot index returns the keys of the requested slots,
+    once, even if keys are deleted during the scan.
+    """
+    cluster.create(1, raft_args={'slot-index': 'yes', 'scan-size': 10})
+    node = cluster.leader_node()
+
+    for i in range(100):
+        node.execute('set', '{key}' + str(i), 'value')   # slot 12539
+        node.execute('set', '{key2}' + str(i), 'value')  # slot 4998
+
+    cursor = 0
+    keys = []
+    while True:
+        reply = node.execute('raft.scan', str(cursor), '12539')
+        cursor = int(reply[0])
+        for key, slot in reply[1]:
+            assert slot == 12539
+            keys.append(key)
+            node.execute('del', key)
+        if cursor == 0:
+            break
+
+    assert len(keys) == 100
+    assert len(set(keys)) == 100
+    assert node.info()['raft_slot_index_keys'] == 100
+    assert node.info()['raft_slot_index_rebuilds'] == 1
+
+    # Index is rebuilt after a snapshot is loaded
+    node.execute('raft.debug', 'compact')
+    node.restart()
+    node.wait_for_node_voting()
+
+    reply = node.execute('raft.scan', '0', '4998')
+    assert len(reply[1]) == 10
+    assert node.info()['raft_slot_index_keys'] == 100
+
+
 def test_raft_import(cluster):
     cluster.create(3, raft_args={
         'sharding': 'yes',
@@ -557,6 +596,59 @@ def test_sad_path_migrate(cluster_factory):
                            "Unable to unlock/delete migrated keys, try again")
 
 
+def test_migrate_slot(cluster_factory):
+    cluster1 = cluster_factory().create(1, raft_args={
+        'sharding': 'yes',
+        'external-sharding': 'yes'})
+    cluster2 = cluster_factory().create(1, raft_args={
+        'sharding': 'yes',
+        'external-sharding': 'yes'})
+
+    cluster1_dbid = cluster1.leader_node().info()["raft_dbid"]
+    cluster2_dbid = cluster2.leader_node().info()["raft_dbid"]
+
+    # Slot 12539, more keys than a single import batch
+    for i in range(2500):
+        assert cluster1.execute('set', '{key}%d' % i, 'value%d' % i)
+    assert cluster1.execute('set', 'key1', 'value1')
+
+    replace_args = [
+        'RAFT.SHARDGROUP', 'REPLACE',
+        '2',
+        cluster2_dbid,
+        '1', '1',
+        '0', '16383', SlotRangeType.IMPORTING, '123',
+        '%s00000001' % cluster2_dbid, 'localhost:%s' % cluster2.node(1).port,
+        cluster1_dbid,
+        '1', '1',
+        '0', '16383', SlotRangeType.MIGRATING, '123',
+        '%s00000001' % cluster1_dbid, 'localhost:%s' % cluster1.node(1).port,
+    ]
+    assert cluster1.execute(*replace_args) == b'OK'
+    assert cluster2.execute(*replace_args) == b'OK'
+
+    assert cluster1.execute('raft.migrate', '12539') == b'OK'
+
+    info = cluster1.leader_node().info()
+    assert info['raft_migration_keys_total'] == 2500
+    assert info['raft_migration_keys_sent'] == 2500
+    assert info['raft_migration_batches'] >= 3
+
+    with raises(ResponseError, match="ASK 12539 localhost"):
+        cluster1.execute('get', '{key}0')
+
+    # Keys of other slots are not migrated
+    assert cluster1.execute('get', 'key1') == b'value1'
+
+    conn = RawConnection(cluster2.leader_node().client)
+    for i in (0, 1234, 2499):
+        assert conn.execute('asking') == b'OK'
+        assert conn.execute('get', '{key}%d' % i) == b'value%d' % i
+
+    with raises(ResponseError, match="invalid slot"):
+        cluster1.execute('raft.migrate', '16384')
+
+
 def test_redirect_asking_to_leader(cluster):
     """
     Followers redirect asking mode requests to the leader with an ASK reply.
@@ -13,7 +13,7 @@ from redis import ResponseError, ConnectionError
 from pytest import raises
 from retry import retry
 
-from .sandbox import RedisRaft, RedisRaftFailedToStart, RawConnection
+from .sandbox import RedisRaft, RedisRaftFailedToStart, RawConnection, assert_after
 from retry import retry
 
 
@@ -534,6 +534,59 @@ def test_throttle_applying_entries(cluster):
     assert cluster.node(2).info()['raft_exec_throttled'] > 0
 
 
+def test_apply_prefetch(cluster):
+    """
+    Test followers apply entries deserialized ahead of time by the thread pool.
+    """
+    cluster.create(3)
+
+    for i in range(500):
+        cluster.execute('incr', 'counter')
+    cluster.wait_for_unanimity()
+
+    for node_id in (2, 3):
+        node = cluster.node(node_id)
+        node.wait_for_log_applied()
+        info = node.info()
+        assert node.raft_debug_exec('get', 'counter') == b'500'
+        assert info['raft_apply_lag'] == 0
+        assert info['raft_apply_prefetch_hits'] > 0
+        assert (info['raft_apply_prefetch_hits'] +
+                info['raft_apply_prefetch_misses'] == info['raft_apply_entries'])
+
+    # Disabling prefetch, followers should decode entries themselves.
+    cluster.config_set('raft.apply-prefetch', 0)
+    hits = cluster.node(2).info()['raft_apply_prefetch_hits']
+
+    for i in range(100):
+        cluster.execute('incr', 'counter')
+    cluster.wait_for_unanimity()
+    cluster.node(2).wait_for_log_applied()
+
+    assert cluster.node(2).raft_debug_exec('get', 'counter') == b'600'
+    assert cluster.node(2).info()['raft_apply_prefetch_hits'] == hits
+
+
+def test_apply_batches(cluster):
+    """
+    Test followers apply consecutive committed entries in batches.
+    """
+    cluster.create(3)
+
+    pipe = cluster.leader_node().client.pipeline(transaction=False)
+    for i in range(1000):
+        pipe.incr('counter')
+    pipe.execute()
+    cluster.wait_for_unanimity()
+
+    node = cluster.node(2)
+    node.wait_for_log_applied()
+    info = node.info()
+
+    assert node.raft_debug_exec('get', 'counter') == b'1000'
+    assert 0 < info['raft_apply_batches'] < info['raft_apply_entries']
+
+
 def test_maxmemory(cluster):
     cluster.create(3)
 
@@ -642,6 +695,231 @@ def test_acl(cluster):
         return 1234;""", '0')
 
 
+def test_acl_cache(cluster):
+    """
+    Test script entries refer to cached ACLs, and nodes that receive them
+    through a snapshot can execute them.
+    """
+    cluster.create(2)
+
+    script = "redis.call('INCR', KEYS[1]); return 1;"
+    for _ in range(10):
+        assert cluster.execute('EVAL', script, '1', 'key') == 1
+
+    leader = cluster.leader_node()
+    info = leader.info()
+    assert info['raft_acl_cache_misses'] == 1
+    assert info['raft_acl_cache_hits'] == 9
+
+    # ACL changes are applied to the following scripts
+    cluster.execute('acl', 'setuser', 'default', 'resetkeys', '~key*')
+    msg = "ACL failure in script: No permissions to access a key"
+    with raises(ResponseError, match=msg):
+        cluster.execute('EVAL', script, '1', 'abc')
+    assert cluster.execute('EVAL', script, '1', 'key') == 1
+
+    info = leader.info()
+    assert info['raft_acl_cache_invalidations'] == 1
+    assert info['raft_acl_cache_misses'] == 2
+
+    # A new node receives ACL definitions through the snapshot
+    leader.execute('raft.debug', 'compact')
+    n3 = cluster.add_node()
+    assert cluster.execute('EVAL', script, '1', 'key') == 1
+    cluster.wait_for_unanimity()
+    n3.wait_for_log_applied()
+    assert n3.info()['raft_snapshots_received'] == 1
+    assert n3.raft_debug_exec('get', 'key') == b'12'
+
+    # Entries are still executed after restart
+    n3.restart()
+    n3.wait_for_node_voting()
+    n3.wait_for_log_applied()
+    assert n3.raft_debug_exec('get', 'key') == b'12'
+
+
+def test_acl_cache_bounded(cluster):
+    """
+    Test ACL definitions don't accumulate as ACLs change, followers forget
+    them on reset entries and keep executing scripts.
+    """
+    cluster.create(2)
+
+    script = "redis.call('INCR', KEYS[1]); return 1;"
+    for i in range(1100):
+        cluster.execute('acl', 'setuser', 'default', 'resetchannels',
+                        '&ch%d' % i)
+        assert cluster.execute('EVAL', script, '1', 'key') == 1
+
+    cluster.wait_for_unanimity()
+    cluster.node(2).wait_for_log_applied()
+
+    for node in cluster.nodes.values():
+        info = node.info()
+        assert info['raft_acl_cache_definitions'] <= 1024
+        assert info['raft_acl_cache_users'] <= 1024
+    assert cluster.node(2).raft_debug_exec('get', 'key') == b'1100'
+
+    # A new term forgets earlier definitions
+    cluster.node(2).timeout_now()
+    cluster.wait_for_unanimity()
+    assert cluster.execute('EVAL', script, '1', 'key') == 1
+    cluster.wait_for_unanimity()
+    cluster.node(1).wait_for_log_applied()
+    assert cluster.node(1).info()['raft_acl_cache_definitions'] == 1
+
+
+def test_dry_run_skipped(cluster):
+    """
+    Test dry-runs are skipped for commands that already passed them, unless
+    the ACL restricts keys or memory usage is close to maxmemory.
+    """
+    cluster.create(1)
+    node = cluster.node(1)
+
+    for i in range(10):
+        cluster.execute('set', 'key', i)
+
+    info = node.info()
+    assert info['raft_dry_runs'] == 1
+    assert info['raft_dry_runs_skipped'] == 9
+
+    # Arity errors are still reported
+    with raises(ResponseError, match='wrong number of arguments'):
+        cluster.execute('set', 'key')
+
+    # Inside MULTI too
+    assert node.client.execute_command('multi') == b'OK'
+    assert node.client.execute_command('set', 'key', 1) == b'QUEUED'
+    with raises(ResponseError, match='wrong number of arguments'):
+        node.client.execute_command('set', 'key')
+    with raises(ResponseError, match='EXECABORT'):
+        node.client.execute_command('exec')
+
+    # ACL checks depend on keys
+    cluster.execute('acl', 'setuser', 'default', 'resetkeys', '~key*')
+    dry_runs = node.info()['raft_dry_runs']
+    cluster.execute('set', 'key', 1)
+    with raises(ResponseError, match='No permissions to access a key'):
+        cluster.execute('set', 'abc', 1)
+    assert node.info()['raft_dry_runs'] == dry_runs + 2
+
+    # OOM is checked close to maxmemory
+    cluster.execute('acl', 'setuser', 'default', 'allkeys')
+    cluster.execute('set', 'key', 1)
+    cluster.config_set('maxmemory', 1)
+    dry_runs = node.info()['raft_dry_runs']
+    msg = "OOM command not allowed when used memory > 'maxmemory'"
+    with raises(ResponseError, match=msg):
+        cluster.execute('set', 'key', 2)
+    assert node.info()['raft_dry_runs'] == dry_runs + 1
+
+
+def test_write_batching(cluster):
+    """
+    Test writes of concurrent clients are appended as a single entry and
+    each client receives its own reply.
+    """
+    cluster.create(3)
+    node = cluster.node(1)
+
+    pool = node.client.connection_pool
+    conns = [pool.get_connection('batch') for _ in range(10)]
+
+    def incr_all():
+        for conn in conns:
+            conn.send_command('incr', 'counter')
+        return [conn.read_response() for conn in conns]
+
+    replies = []
+    for _ in range(20):
+        replies += incr_all()
+
+    assert sorted(replies) == list(range(1, 201))
+    assert node.info()['raft_write_batch_entries'] > 0
+    assert node.info()['raft_write_batch_commands'] > 0
+
+    # Followers apply batched entries too
+    cluster.wait_for_unanimity()
+    for n in cluster.nodes.values():
+        assert n.raft_debug_exec('get', 'counter') == b'200'
+
+    # Disabled
+    node.config_set('raft.write-batch-max-count', 1)
+    entries = node.info()['raft_write_batch_entries']
+    for _ in range(5):
+        incr_all()
+    assert node.info()['raft_write_batch_entries'] == entries
+    assert cluster.execute('get', 'counter') == b'250'
+
+    for conn in conns:
+        pool.release(conn)
+
+
+def test_proxy_batching(cluster):
+    """
+    Test writes proxied by a follower are sent to the leader in batches and
+    each client receives its own reply.
+    """
+    cluster.create(3)
+    assert cluster.leader == 1
+    cluster.config_set('raft.follower-proxy', 'yes')
+    cluster.execute('set', 'str', 'x')
+
+    node = cluster.node(2)
+    pool = node.client.connection_pool
+    conns = [pool.get_connection('batch') for _ in range(10)]
+
+    for _ in range(20):
+        for conn in conns[:8]:
+            conn.send_command('incr', 'counter')
+        # Rejected by the leader before being appended
+        conns[8].send_command('incr')
+        # Fails when applied
+        conns[9].send_command('incr', 'str')
+
+        for conn in conns[:8]:
+            conn.read_response()
+        with raises(ResponseError, match='wrong number of arguments'):
+            conns[8].read_response()
+        with raises(ResponseError, match='not an integer'):
+            conns[9].read_response()
+
+    assert node.info()['raft_proxy_batches'] > 0
+    assert node.info()['raft_proxy_reqs'] == 200
+    assert cluster.node(1).info()['raft_write_batch_entries'] > 0
+    assert cluster.execute('get', 'counter') == b'160'
+
+    for conn in conns:
+        pool.release(conn)
+
+
+def test_proxy_connection_pool(cluster):
+    """
+    Test proxied commands are sent over a separate pool of connections and
+    their latency is reported.
+    """
+    cluster.create(3)
+    assert cluster.leader == 1
+    cluster.config_set('raft.follower-proxy', 'yes')
+
+    node = cluster.node(2)
+    for i in range(100):
+        assert node.client.set('key', i)
+
+    info = node.info()
+    assert info['raft_proxy_connections'] == 2
+    assert info['raft_proxy_latency_p50_microseconds'] > 0
+    assert info['raft_proxy_latency_p99_microseconds'] >= \
+        info['raft_proxy_latency_p50_microseconds']
+    assert info['raft_proxy_outstanding_reqs'] == 0
+
+    node.config_set('raft.proxy-connections', 1)
+    assert node.client.set('key', 'value')
+    assert node.info()['raft_proxy_connections'] == 1
+    assert cluster.node(1).client.get('key') == b'value'
+
+
 def test_ro_permutations(cluster):
     cluster.create(3)
 
@@ -902,3 +1180,96 @@ def test_session_same_id_clients_persisting(cluster):
     with raises(ConnectionError, match="Connection (closed|reset)"):
         conn1.execute("get", "X")
     conn2.execute("get", "X")
+
+
+def test_dns_cache(cluster):
+    """
+    Reconnects resolve node addresses from the DNS cache.
+    """
+    cluster.create(3)
+
+    # All nodes are on localhost
+    info = cluster.node(1).info()
+    assert info['raft_dns_cache_entries'] == 1
+    misses = info['raft_dns_cache_misses']
+    hits = info['raft_dns_cache_hits']
+    assert misses >= 1
+
+    cluster.node(2).terminate()
+    cluster.node(2).start()
+    cluster.wait_for_unanimity()
+
+    def check_hits():
+        info = cluster.node(1).info()
+        assert info['raft_dns_cache_hits'] > hits
+        assert info['raft_dns_cache_misses'] == misses
+
+    assert_after(check_hits, 10)
+
+
+def test_raft_stats(cluster):
+    """
+    RAFT.STATS reports replication metrics of each peer.
+    """
+    cluster.create(3)
+    for i in range(10):
+        cluster.execute('SET', 'key%d' % i, 'value')
+    cluster.wait_for_unanimity()
+
+    def to_dict(reply):
+        return {reply[i].decode(): reply[i + 1]
+                for i in range(0, len(reply), 2)}
+
+    stats = to_dict(cluster.leader_node().execute('RAFT.STATS'))
+    assert stats['role'] == b'leader'
+    assert stats['commit_idx'] == stats['current_idx']
+
+    peers = [to_dict(peer) for peer in stats['peers']]
+    assert sorted(peer['id'] for peer in peers) == [2, 3]
+    for peer in peers:
+        assert peer['state'] == b'connected'
+        assert peer['ae_sent'] > 0
+        assert peer['ae_acked'] > 0
+        assert peer['ae_entries_acked'] > 0
+        assert peer['ae_rtt_count'] > 0
+        assert peer['match_idx'] == stats['current_idx']
+        assert peer['lag_entries'] == 0
+        assert peer['lag_msec'] == 0
+
+    with raises(ResponseError, match='wrong number of arguments'):
+        cluster.leader_node().execute('RAFT.STATS', 'x')
+
+
+def test_write_latency(cluster):
+    """
+    Write latency is recorded by stage, slow writes are counted.
+    """
+    cluster.create(3)
+    leader = cluster.leader_node()
+
+    for i in range(10):
+        cluster.execute('SET', 'key%d' % i, 'value')
+
+    info = leader.info()
+    assert info['raft_slow_writes'] == 0
+    total = info['raft_write_total']
+    assert total['count'] == 10
+    assert total['p99_usec'] >= total['p50_usec'] > 0
+    assert info['raft_write_commit']['count'] == 10
+
+    # Every write is slower than 1 microsecond
+    leader.config_set('raft.slow-write-threshold', 1)
+    cluster.execute('SET', 'key', 'value')
+    assert leader.info()['raft_slow_writes'] == 1
+
+    def to_dict(reply):
+        return {reply[i].decode(): reply[i + 1]
+                for i in range(0, len(reply), 2)}
+
+    stats = to_dict(leader.execute('RAFT.STATS'))
+    assert stats['slow_writes'] == 1
+
+    latency = to_dict(stats['write_latency'])
+    assert list(latency.keys()) == ['validate', 'append', 'write', 'fsync',
+                                    'commit', 'apply', 'total']
+    assert to_dict(latency['total'])['count'] == 11
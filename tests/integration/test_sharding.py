@@ -66,6 +66,18 @@ def test_cross_slot_violation(cluster):
     # With tags, it should succeed
     assert c.mset({'{tag1}key1': 'val1', '{tag1}key2': 'val2'})
 
+    # Keys at fixed positions, with a step and counted from the end
+    with raises(ResponseError, match='CROSSSLOT'):
+        c.execute_command('del', '{tag1}key1', '{tag1}key2', 'key3')
+    with raises(ResponseError, match='CROSSSLOT'):
+        c.execute_command('blpop', '{tag1}key1', 'key3', '0')
+
+    # Keys at variable positions
+    with raises(ResponseError, match='CROSSSLOT'):
+        c.execute_command('zunionstore', '{tag1}dst', '2', '{tag1}z1', 'z2')
+    assert c.execute_command('zunionstore', '{tag1}dst', '2',
+                             '{tag1}z1', '{tag1}z2') == 0
+
     # MULTI/EXEC with cross slot between commands
     txn = cluster.node(1).client.pipeline(transaction=True)
     txn.set('key1', 'val1')
@@ -485,6 +497,42 @@ def test_shard_group_refresh(cluster_factory):
     assert_after(check_slots, 10)
 
 
+def test_shard_group_get_if_newer(cluster):
+    cluster.create(3, raft_args={
+        'sharding': 'yes',
+        'slot-config': '0:1000'})
+
+    c = cluster.node(1).client
+
+    # Plain GET is unchanged, IF-NEWER appends the version
+    sg = c.execute_command('RAFT.SHARDGROUP', 'GET')
+    assert len(sg) == 3
+
+    reply = c.execute_command('RAFT.SHARDGROUP', 'GET', 'IF-NEWER', '0')
+    assert reply[0:3] == sg
+    version = reply[3]
+    assert version > 0
+
+    # Unchanged configuration returns nil
+    assert c.execute_command(
+        'RAFT.SHARDGROUP', 'GET', 'IF-NEWER', version) is None
+
+    # A membership change makes the version newer
+    cluster.add_node(use_cluster_args=True)
+    cluster.wait_for_unanimity()
+
+    reply = c.execute_command('RAFT.SHARDGROUP', 'GET', 'IF-NEWER', version)
+    assert len(reply[2]) == 4
+    assert reply[3] > version
+
+    with raises(ResponseError, match='syntax error'):
+        c.execute_command('RAFT.SHARDGROUP', 'GET', 'IF-OLDER', '0')
+    with raises(ResponseError, match='invalid version'):
+        c.execute_command('RAFT.SHARDGROUP', 'GET', 'IF-NEWER', 'x')
+    with raises(ResponseError, match='wrong number of arguments'):
+        c.execute_command('RAFT.SHARDGROUP', 'GET', 'IF-NEWER')
+
+
 def test_shard_group_no_slots(cluster):
     cluster.create(3, raft_args={
         'sharding': 'yes',
@@ -1281,3 +1329,47 @@ def test_cluster_shards_for_multiple_slots_range_sg(cluster):
                 assert False, "didn't match %s" % shard
 
     validate_shards(cluster.node(1).execute('CLUSTER', 'SHARDS'))
+
+
+def test_cluster_topology_cache(cluster):
+    cluster.create(3, raft_args={
+        'sharding': 'yes',
+        'slot-config': '0:1000'})
+
+    c = cluster.node(1).client
+
+    slots = c.execute_command('CLUSTER', 'SLOTS')
+    nodes = c.execute_command('CLUSTER', 'NODES')
+    shards = c.execute_command('CLUSTER', 'SHARDS')
+    info = cluster.node(1).info()
+    renders = info['raft_topology_cache_renders']
+    hits = info['raft_topology_cache_hits']
+    epoch = info['raft_topology_epoch']
+
+    # Unchanged topology is served from the cache
+    assert c.execute_command('CLUSTER', 'SLOTS') == slots
+    assert c.execute_command('CLUSTER', 'NODES') == nodes
+    assert c.execute_command('CLUSTER', 'SHARDS') == shards
+    info = cluster.node(1).info()
+    assert info['raft_topology_cache_renders'] == renders
+    assert info['raft_topology_cache_hits'] == hits + 3
+
+    # A shardgroup change bumps the epoch and renders again
+    assert c.execute_command(
+        'RAFT.SHARDGROUP', 'ADD',
+        '12345678901234567890123456789012',
+        '1', '1',
+        '1001', '16383', SlotRangeType.STABLE, '0',
+        '1234567890123456789012345678901234567890', '1.1.1.1:1111') == b'OK'
+    assert cluster.node(1).info()['raft_topology_epoch'] > epoch
+
+    slots = c.execute_command('CLUSTER', 'SLOTS')
+    assert len(slots) == 2
+    assert cluster.node(1).info()['raft_topology_cache_renders'] == renders + 1
+
+    # So does a membership change
+    cluster.add_node(use_cluster_args=True)
+    cluster.wait_for_unanimity()
+    slots = c.execute_command('CLUSTER', 'SLOTS')
+    local = [s for s in slots if s[0] == 0][0]
+    assert len(local) == 2 + 4
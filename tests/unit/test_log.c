@@ -104,6 +104,56 @@ static void test_log_random_access_with_snapshot()
     LogTerm(&log);
 }
 
+static void test_log_entry_info()
+{
+    Log log;
+    LogEntryInfo info;
+
+    LogInit(&log);
+    LogCreate(&log, LOGNAME, DBID, 1, 1, 0);
+    LogReset(&log, 100, 1);
+
+    raft_entry_t *e = make_entry(3, "value");
+    e->term = 2;
+    e->session = 99;
+    e->type = RAFT_LOGTYPE_NO_OP;
+    assert(LogAppend(&log, e) == RR_OK);
+    raft_entry_release(e);
+
+    append_entry(&log, 30, NULL);
+
+    /* Invalid out of bound reads */
+    assert(LogGetEntryInfo(&log, 100, &info) == RR_ERROR);
+    assert(LogGetEntryInfo(&log, 103, &info) == RR_ERROR);
+
+    assert(LogGetEntryInfo(&log, 101, &info) == RR_OK);
+    assert(info.term == 2);
+    assert(info.id == 3);
+    assert(info.session == 99);
+    assert(info.type == RAFT_LOGTYPE_NO_OP);
+    assert(info.data_len == strlen("value") + 1);
+
+    /* Header only reads don't affect full reads */
+    e = LogGet(&log, 102);
+    assert(e->id == 30);
+    raft_entry_release(e);
+
+    assert(LogGetEntryInfo(&log, 102, &info) == RR_OK);
+    assert(info.id == 30);
+
+    /* Entries on the second page */
+    assert(LogCompactionBegin(&log) == RR_OK);
+    append_entry(&log, 40, NULL);
+
+    assert(LogGetEntryInfo(&log, 103, &info) == RR_OK);
+    assert(info.id == 40);
+    assert(LogGetEntryInfo(&log, 101, &info) == RR_OK);
+    assert(info.id == 3);
+
+    LogCompactionEnd(&log);
+    LogTerm(&log);
+}
+
 static void test_log_load_entries()
 {
     raft_entry_t *ety;
@@ -837,6 +887,7 @@ void test_log()
     test_run(test_log_load_entries);
     test_run(test_log_random_access);
     test_run(test_log_random_access_with_snapshot);
+    test_run(test_log_entry_info);
     test_run(test_log_write_after_read);
     test_run(test_log_index_rebuild);
     test_run(test_log_delete);
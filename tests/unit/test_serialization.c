@@ -36,18 +36,55 @@ static void test_serialize_redis_command()
     setupRedisCommand(RaftRedisCommandArrayExtend(&cmd_array), cmd2_argv, 2);
     setupRedisCommand(RaftRedisCommandArrayExtend(&cmd_array), cmd3_argv, 1);
     cmd_array.acl = RedisModule_CreateString(NULL, "hello", 5);
+    cmd_array.cmd_flags = 3;
 
-    const char *expected = "*0\n*0\n$5\nhello\n*3\n*3\n$3\nSET\n$3\nkey\n$5\nvalue\n*2\n$3\nGET\n$5\nmykey\n*1\n$4\nPING\n";
+    const char expected[] = "\x02\x01"
+                            "\x00\x06\x05hello\x03"
+                            "\x03\x03SET\x03key\x05value"
+                            "\x02\x03GET\x05mykey"
+                            "\x01\x04PING";
 
     raft_entry_t *e = RaftRedisCommandArraySerialize(&cmd_array);
     assert(e != NULL);
-    assert(e->data_len == strlen(expected));
-    assert(memcmp(e->data, expected, strlen(expected)) == 0);
+    assert(e->data_len == sizeof(expected) - 1);
+    assert(memcmp(e->data, expected, sizeof(expected) - 1) == 0);
+
+    RaftRedisCommandArray target = {0};
+    assert(RaftRedisCommandArrayDeserialize(&target, e->data, e->data_len) == RR_OK);
+    assert(target.len == 3);
+    assert(target.cmd_flags == 3);
+    assert(!target.asking);
+    assert(strcmp((char *) target.acl, "hello") == 0);
+    assert(target.commands[0]->argc == 3);
+    assert(strcmp((char *) target.commands[0]->argv[2], "value") == 0);
+    assert(target.commands[2]->argc == 1);
+    assert(strcmp((char *) target.commands[2]->argv[0], "PING") == 0);
+    RaftRedisCommandArrayFree(&target);
     raft_entry_release(e);
 
     RaftRedisCommandArrayFree(&cmd_array);
 }
 
+static void test_varint()
+{
+    uint64_t values[] = {0, 1, 127, 128, 300, 16383, 16384, UINT32_MAX, UINT64_MAX};
+    char buf[VARINT_MAX_LEN];
+    uint64_t val;
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        int n = encodeVarint(buf, values[i]);
+        assert(n > 0 && n <= VARINT_MAX_LEN);
+        assert(decodeVarint(buf, n, &val) == n);
+        assert(val == values[i]);
+
+        /* truncated */
+        assert(decodeVarint(buf, n - 1, &val) == -1);
+    }
+
+    assert(encodeVarint(buf, 300) == 2);
+    assert(memcmp(buf, "\xac\x02", 2) == 0);
+}
+
 static void test_deserialize_redis_command()
 {
     const char *serialized = "*3\n$3\nSET\n$3\nkey\n$5\nvalue\n";
@@ -87,6 +124,194 @@ static void test_deserialize_redis_command_array_with_acl()
     RaftRedisCommandArrayFree(&cmd_array);
 }
 
+static void test_serialize_redis_command_batch()
+{
+    const char *cmd1_argv[] = {"SET", "key", "value"};
+    const char *cmd2_argv[] = {"INCR", "counter"};
+
+    RaftRedisCommandArray a1 = {.client_id = 5};
+    RaftRedisCommandArray a2 = {.client_id = 12};
+    setupRedisCommand(RaftRedisCommandArrayExtend(&a1), cmd1_argv, 3);
+    setupRedisCommand(RaftRedisCommandArrayExtend(&a2), cmd2_argv, 2);
+
+    const char expected[] = "\x02\x02"
+                            "\x05\x00\x00\x01\x03\x03SET\x03key\x05value"
+                            "\x0c\x00\x00\x01\x02\x04INCR\x07"
+                            "counter";
+
+    RaftRedisCommandBuffer buf = {0};
+    RaftRedisCommandBufferAppend(&buf, &a1);
+    RaftRedisCommandBufferAppend(&buf, &a2);
+    raft_entry_t *e = RaftRedisCommandBufferToEntry(&buf);
+    assert(e != NULL);
+    assert(e->data_len == sizeof(expected) - 1);
+    assert(memcmp(e->data, expected, sizeof(expected) - 1) == 0);
+    assert(buf.len == 0 && buf.num == 0);
+    RaftRedisCommandBufferFree(&buf);
+
+    RaftRedisCommandBatch batch = {0};
+    assert(RaftRedisCommandBatchDeserialize(&batch, e->data, e->data_len, 0) == RR_OK);
+    assert(batch.len == 2);
+    assert(batch.arrays[0].client_id == 5);
+    assert(batch.arrays[0].len == 1);
+    assert(batch.arrays[0].commands[0]->argc == 3);
+    assert(batch.arrays[1].client_id == 12);
+    assert(batch.arrays[1].len == 1);
+    assert(batch.arrays[1].commands[0]->argc == 2);
+    RaftRedisCommandBatchFree(&batch);
+
+    /* A batch can't be deserialized as a single array */
+    RaftRedisCommandArray target = {0};
+    assert(RaftRedisCommandArrayDeserialize(&target, e->data, e->data_len) == RR_ERROR);
+    raft_entry_release(e);
+
+    /* A single array is encoded straight into the entry */
+    const char expected_single[] = "\x02\x01"
+                                   "\x05\x00\x00\x01\x03\x03SET\x03key\x05value";
+
+    e = RaftRedisCommandArraySerialize(&a1);
+    assert(e->data_len == sizeof(expected_single) - 1);
+    assert(memcmp(e->data, expected_single, sizeof(expected_single) - 1) == 0);
+
+    /* Truncated */
+    for (unsigned int i = 0; i < e->data_len; i++) {
+        assert(RaftRedisCommandBatchDeserialize(&batch, e->data, i, 0) == RR_ERROR);
+        assert(batch.arrays == NULL);
+    }
+    raft_entry_release(e);
+
+    /* Large buffers don't keep their memory */
+    char *large = malloc(COMMAND_BUFFER_KEEP_SIZE);
+    memset(large, 'x', COMMAND_BUFFER_KEEP_SIZE);
+    RedisModule_FreeString(NULL, a1.commands[0]->argv[2]);
+    a1.commands[0]->argv[2] = RedisModule_CreateString(NULL, large, COMMAND_BUFFER_KEEP_SIZE);
+    free(large);
+
+    RaftRedisCommandBufferAppend(&buf, &a1);
+    assert(buf.size > COMMAND_BUFFER_KEEP_SIZE);
+    raft_entry_release(RaftRedisCommandBufferToEntry(&buf));
+    assert(buf.data == NULL && buf.size == 0);
+
+    RaftRedisCommandArrayFree(&a1);
+    RaftRedisCommandArrayFree(&a2);
+}
+
+static void test_deserialize_legacy_redis_command_batch()
+{
+    RaftRedisCommandBatch batch = {0};
+
+    /* Legacy single array entries are attributed to the entry session */
+    const char *single = "*0\n*0\n$0\n\n*1\n*1\n$4\nPING\n";
+    assert(RaftRedisCommandBatchDeserialize(&batch, single, strlen(single), 7) == RR_OK);
+    assert(batch.len == 1);
+    assert(batch.arrays[0].client_id == 7);
+    RaftRedisCommandBatchFree(&batch);
+
+    /* Corrupted */
+    const char *d_truncated = "*0\n*0\n$0\n\n*1\n*1\n$4\nPI";
+    assert(RaftRedisCommandBatchDeserialize(&batch, d_truncated, strlen(d_truncated), 0) == RR_ERROR);
+    assert(batch.arrays == NULL);
+}
+
+static void test_serialize_slot()
+{
+    unsigned int slot;
+
+    raft_entry_t *e = RaftRedisSerializeSlot(RAFT_LOGTYPE_LOCK_SLOT, 16383);
+    assert(e->type == RAFT_LOGTYPE_LOCK_SLOT);
+    assert(RaftRedisDeserializeSlot(e->data, e->data_len, &slot) == RR_OK);
+    assert(slot == 16383);
+
+    /* Truncated */
+    assert(RaftRedisDeserializeSlot(e->data, e->data_len - 1, &slot) == RR_ERROR);
+    raft_entry_release(e);
+
+    /* Out of range */
+    e = RaftRedisSerializeSlot(RAFT_LOGTYPE_LOCK_SLOT, 16384);
+    assert(RaftRedisDeserializeSlot(e->data, e->data_len, &slot) == RR_ERROR);
+    raft_entry_release(e);
+}
+
+static void test_serialize_delete_unlock_slot()
+{
+    RedisModuleString *keys[] = {
+        RedisModule_CreateString(NULL, "key1", 4),
+        RedisModule_CreateString(NULL, "{key1}2", 7),
+    };
+    RedisModuleString **out;
+    unsigned int slot;
+    size_t num_keys;
+    bool unlock;
+
+    raft_entry_t *e = RaftRedisSerializeDeleteUnlockSlot(9189, false, keys, 2);
+    assert(e->type == RAFT_LOGTYPE_DELETE_UNLOCK_SLOT);
+    assert(RaftRedisDeserializeDeleteUnlockSlot(e->data, e->data_len, &slot, &unlock, &out, &num_keys) == RR_OK);
+    assert(slot == 9189);
+    assert(!unlock);
+    assert(num_keys == 2);
+    assert(strcmp((char *) out[0], "key1") == 0);
+    assert(strcmp((char *) out[1], "{key1}2") == 0);
+    for (size_t i = 0; i < num_keys; i++) {
+        RedisModule_FreeString(NULL, out[i]);
+    }
+    RedisModule_Free(out);
+
+    /* Truncated */
+    assert(RaftRedisDeserializeDeleteUnlockSlot(e->data, e->data_len - 1, &slot, &unlock, &out, &num_keys) == RR_ERROR);
+    raft_entry_release(e);
+
+    /* No keys */
+    e = RaftRedisSerializeDeleteUnlockSlot(0, true, NULL, 0);
+    assert(RaftRedisDeserializeDeleteUnlockSlot(e->data, e->data_len, &slot, &unlock, &out, &num_keys) == RR_OK);
+    assert(slot == 0);
+    assert(unlock);
+    assert(num_keys == 0);
+    assert(out == NULL);
+    raft_entry_release(e);
+
+    RedisModule_FreeString(NULL, keys[0]);
+    RedisModule_FreeString(NULL, keys[1]);
+}
+
+static void test_serialize_timeout()
+{
+    raft_index_t idxs[] = {3, 200, 100000};
+    raft_index_t *out;
+    int count;
+    bool error;
+
+    raft_entry_t *e = RaftRedisSerializeTimeout(idxs, 3, false);
+    assert(e->type == RAFT_LOGTYPE_TIMEOUT_BLOCKED);
+    assert(RaftRedisDeserializeTimeout(e->data, e->data_len, &out, &count, &error) == RR_OK);
+    assert(count == 3);
+    assert(out[0] == 3 && out[1] == 200 && out[2] == 100000);
+    assert(error == false);
+    free(out);
+
+    /* Truncated */
+    assert(RaftRedisDeserializeTimeout(e->data, e->data_len - 1, &out, &count, &error) == RR_ERROR);
+    raft_entry_release(e);
+
+    e = RaftRedisSerializeTimeout(idxs, 1, true);
+    assert(RaftRedisDeserializeTimeout(e->data, e->data_len, &out, &count, &error) == RR_OK);
+    assert(count == 1);
+    assert(out[0] == 3);
+    assert(error == true);
+    free(out);
+    raft_entry_release(e);
+
+    /* Legacy entries carry a single index */
+    const char legacy[] = "*25\n*1\n";
+    assert(RaftRedisDeserializeTimeout(legacy, sizeof(legacy), &out, &count, &error) == RR_OK);
+    assert(count == 1);
+    assert(out[0] == 25);
+    assert(error == true);
+    free(out);
+
+    const char zero_count[] = "\x02\x00\x00";
+    assert(RaftRedisDeserializeTimeout(zero_count, sizeof(zero_count) - 1, &out, &count, &error) == RR_ERROR);
+}
+
 static void test_deserialize_corrupted_data()
 {
     size_t ret;
@@ -184,14 +409,70 @@ static void test_serialize_shardgroup()
         .nodes = nodes,
     };
 
-    char *str = ShardGroupSerialize(&sg);
-    assert(strcmp(str,
-                  "12345678901234567890123456789012\n"
-                  "1\n3\n"
-                  "1\n1000\n1\n123\n"
-                  "12345678901234567890123456789012aabbccdd\n1.1.1.1:1111\n"
-                  "12345678901234567890123456789012aabbccee\n2.2.2.2:2222\n"
-                  "12345678901234567890123456789012aabbccff\n3.3.3.3:3333\n") == 0);
+    const char *legacy = "12345678901234567890123456789012\n"
+                         "1\n3\n"
+                         "1\n1000\n1\n123\n"
+                         "12345678901234567890123456789012aabbccdd\n1.1.1.1:1111\n"
+                         "12345678901234567890123456789012aabbccee\n2.2.2.2:2222\n"
+                         "12345678901234567890123456789012aabbccff\n3.3.3.3:3333\n";
+
+    size_t len;
+    char *str = ShardGroupSerialize(&sg, &len);
+    assert(str[0] == RAFT_REDIS_ENCODING_V2);
+    assert(len < strlen(legacy));
+
+    ShardGroup *d = ShardGroupDeserialize(str, len);
+    assert(d != NULL);
+    assert(strcmp(d->id, sg.id) == 0);
+    assert(d->slot_ranges_num == 1);
+    assert(d->slot_ranges[0].start_slot == 1);
+    assert(d->slot_ranges[0].end_slot == 1000);
+    assert(d->slot_ranges[0].type == SLOTRANGE_TYPE_STABLE);
+    assert(d->slot_ranges[0].migration_session_key == 123);
+    assert(d->nodes_num == 3);
+    for (int i = 0; i < 3; i++) {
+        assert(strcmp(d->nodes[i].node_id, nodes[i].node_id) == 0);
+        assert(strcmp(d->nodes[i].addr.host, nodes[i].addr.host) == 0);
+        assert(d->nodes[i].addr.port == nodes[i].addr.port);
+    }
+    ShardGroupFree(d);
+
+    /* Truncated payloads and trailing bytes are rejected */
+    for (size_t i = 0; i < len; i++) {
+        assert(ShardGroupDeserialize(str, i) == NULL);
+    }
+
+    char *extra = RedisModule_Alloc(len + 1);
+    memcpy(extra, str, len);
+    extra[len] = 0;
+    assert(ShardGroupDeserialize(extra, len + 1) == NULL);
+    RedisModule_Free(extra);
+
+    /* REPLACE payload: encoding, number of shardgroups, then each
+     * shardgroup prefixed by its length */
+    char buf[512];
+    char *p = buf;
+
+    *p++ = RAFT_REDIS_ENCODING_V2;
+    p += encodeVarint(p, 2);
+    for (int i = 0; i < 2; i++) {
+        p += encodeVarint(p, len);
+        memcpy(p, str, len);
+        p += len;
+    }
+
+    int num_sg;
+    ShardGroup **sgs = ShardGroupsDeserialize(buf, p - buf, &num_sg);
+    assert(sgs != NULL);
+    assert(num_sg == 2);
+    for (int i = 0; i < num_sg; i++) {
+        assert(sgs[i]->nodes_num == 3);
+        assert(sgs[i]->slot_ranges[0].end_slot == 1000);
+        ShardGroupFree(sgs[i]);
+    }
+    RedisModule_Free(sgs);
+
+    assert(ShardGroupsDeserialize(buf, p - buf - 1, &num_sg) == NULL);
 
     RedisModule_Free(str);
 }
@@ -256,6 +537,12 @@ void test_serialization()
     test_run(test_deserialize_redis_command);
     test_run(test_deserialize_redis_command_array);
     test_run(test_deserialize_redis_command_array_with_acl);
+    test_run(test_serialize_redis_command_batch);
+    test_run(test_deserialize_legacy_redis_command_batch);
+    test_run(test_varint);
+    test_run(test_serialize_slot);
+    test_run(test_serialize_delete_unlock_slot);
+    test_run(test_serialize_timeout);
     test_run(test_deserialize_corrupted_data);
     test_run(test_serialize_shardgroup);
     test_run(test_deserialize_shardgroup);
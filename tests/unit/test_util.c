@@ -7,6 +7,7 @@
 #include "test.h"
 
 #include "../src/redisraft.h"
+#include "common/crc16.h"
 
 #include <assert.h>
 #include <stddef.h>
@@ -85,9 +86,294 @@ static void test_base64_encode()
 
 }
 
+static int expired_count;
+static TimerWheelEntry *del_on_expire;
+
+static void countExpired(TimerWheelEntry *e, void *privdata)
+{
+    TimerWheel *tw = privdata;
+
+    expired_count++;
+
+    /* Removing another entry from the callback is allowed */
+    if (del_on_expire) {
+        TimerWheelDel(tw, del_on_expire);
+        del_on_expire = NULL;
+    }
+}
+
+static void test_timer_wheel()
+{
+    TimerWheel tw;
+    TimerWheelEntry entries[10];
+
+    TimerWheelInit(&tw, 10, 0);
+
+    for (int i = 0; i < 10; i++) {
+        TimerWheelEntryInit(&entries[i]);
+        TimerWheelAdd(&tw, &entries[i], (i + 1) * 10);
+        assert(entries[i].tick == i + 1);
+    }
+    assert(tw.count == 10);
+
+    /* Deleting twice is a no-op */
+    TimerWheelDel(&tw, &entries[4]);
+    TimerWheelDel(&tw, &entries[4]);
+    assert(tw.count == 9);
+
+    expired_count = 0;
+    TimerWheelExpire(&tw, 9, countExpired, &tw);
+    assert(expired_count == 0);
+
+    del_on_expire = &entries[9];
+    TimerWheelExpire(&tw, 30, countExpired, &tw);
+    assert(expired_count == 3);
+    assert(tw.count == 5);
+
+    /* Expiring a tick twice is a no-op */
+    TimerWheelExpire(&tw, 30, countExpired, &tw);
+    assert(expired_count == 3);
+
+    /* entries[9] was removed by the callback */
+    TimerWheelExpire(&tw, 1000, countExpired, &tw);
+    assert(expired_count == 8);
+    assert(tw.count == 0);
+
+    /* A deadline more than a full turn away */
+    TimerWheelEntryInit(&entries[0]);
+    TimerWheelAdd(&tw, &entries[0], 1000 + TIMER_WHEEL_SLOTS * 10 + 10);
+    TimerWheelExpire(&tw, 1010, countExpired, &tw);
+    assert(expired_count == 8);
+    TimerWheelExpire(&tw, 1000 + TIMER_WHEEL_SLOTS * 10 + 10, countExpired, &tw);
+    assert(expired_count == 9);
+}
+
+static void test_latency_histogram()
+{
+    LatencyHistogram h = {0};
+
+    assert(LatencyHistogramPercentile(&h, 50) == 0);
+
+    for (uint64_t i = 1; i <= 1000; i++) {
+        LatencyHistogramAdd(&h, i);
+    }
+    assert(h.count == 1000);
+
+    /* Percentiles are within 12.5% of the exact value, never below */
+    uint64_t p50 = LatencyHistogramPercentile(&h, 50);
+    assert(p50 >= 500 && p50 <= 563);
+    uint64_t p99 = LatencyHistogramPercentile(&h, 99);
+    assert(p99 >= 990 && p99 <= 1114);
+    assert(LatencyHistogramPercentile(&h, 0) == 1);
+
+    /* Small values are exact */
+    LatencyHistogram s = {0};
+    LatencyHistogramAdd(&s, 3);
+    assert(LatencyHistogramPercentile(&s, 100) == 3);
+
+    /* Huge values land in the last bucket */
+    LatencyHistogramAdd(&s, UINT64_MAX);
+    assert(LatencyHistogramPercentile(&s, 100) > 0);
+}
+
+static void test_write_trace()
+{
+    static RedisRaftCtx rr;
+    WriteTrace *t = &rr.write_trace;
+    LatencyHistogram *s = t->stages;
+
+    RaftReq req = {
+        .raft_idx = 10,
+        .times = {.received = 100, .validated = 110, .appended = 130},
+    };
+
+    WriteTraceMark(&t->written, 9, 140);
+    WriteTraceMark(&t->written, 10, 150);
+    WriteTraceMark(&t->written, 10, 999); /* Index did not move, ignored */
+    WriteTraceMark(&t->fsynced, 12, 200);
+
+    assert(WriteTraceWrittenTime(t, 9) == 140);
+    assert(WriteTraceWrittenTime(t, 10) == 150);
+    assert(WriteTraceWrittenTime(t, 11) == 0); /* Not written yet */
+
+    /* Without a commit mark, the commit time goes to the apply stage */
+    WriteTraceExecuted(&rr, &req, 300);
+    assert(s[WRITE_STAGE_VALIDATE].sum == 10);
+    assert(s[WRITE_STAGE_APPEND].sum == 20);
+    assert(s[WRITE_STAGE_WRITE].sum == 20);
+    assert(s[WRITE_STAGE_FSYNC].sum == 50);
+    assert(s[WRITE_STAGE_COMMIT].sum == 0);
+    assert(s[WRITE_STAGE_APPLY].sum == 100);
+    assert(s[WRITE_STAGE_TOTAL].sum == 200);
+
+    /* Requests that were not appended are not recorded */
+    RaftReq rejected = {.times = {.received = 100, .validated = 110}};
+    WriteTraceExecuted(&rr, &rejected, 300);
+    assert(s[WRITE_STAGE_TOTAL].count == 1);
+
+    /* Marks overwritten by later ones are unknown */
+    WriteTraceReset(t);
+    for (int i = 1; i <= WRITE_TRACE_MARKS + 1; i++) {
+        WriteTraceMark(&t->written, 100 + i, 1000 + i);
+    }
+
+    RaftReq old = {
+        .raft_idx = 101,
+        .times = {.received = 500, .validated = 500, .appended = 500},
+    };
+    WriteTraceExecuted(&rr, &old, 2000);
+    assert(s[WRITE_STAGE_WRITE].sum == 20);
+    assert(s[WRITE_STAGE_APPLY].sum == 100 + 1500);
+
+    RaftReq recent = {
+        .raft_idx = 200,
+        .times = {.received = 1000, .validated = 1000, .appended = 1000},
+    };
+    WriteTraceExecuted(&rr, &recent, 2000);
+    assert(s[WRITE_STAGE_WRITE].sum == 20 + 100);
+    assert(s[WRITE_STAGE_TOTAL].count == 3);
+
+    /* An overwritten mark is approximated by the oldest one */
+    assert(WriteTraceWrittenTime(t, 101) == 1002);
+    assert(WriteTraceWrittenTime(t, 150) == 1050);
+}
+
+/* keyHashSlot() as implemented by Redis, with the byte at a time CRC16 */
+static unsigned int referenceKeyHashSlot(const char *key, size_t keylen)
+{
+    size_t s, e;
+
+    for (s = 0; s < keylen; s++) {
+        if (key[s] == '{') {
+            break;
+        }
+    }
+    if (s == keylen) {
+        return crc16_ccitt(key, (int) keylen) & 0x3FFF;
+    }
+
+    for (e = s + 1; e < keylen; e++) {
+        if (key[e] == '}') {
+            break;
+        }
+    }
+    if (e == keylen || e == s + 1) {
+        return crc16_ccitt(key, (int) keylen) & 0x3FFF;
+    }
+
+    return crc16_ccitt(key + s + 1, (int) (e - s - 1)) & 0x3FFF;
+}
+
+#define HASH_SLOT_KEYS 10000
+
+static unsigned long long nanoseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void test_key_hash_slot()
+{
+    static const char *fixed[] = {
+        "", "{", "}", "{}", "{}key", "key{}", "{key}", "{key", "key}",
+        "}key{", "foo{bar}{zap}", "foo{}{bar}", "{{bar}}", "123456789",
+        "user:1000", "{user1000}.following", "{user1000}.followers",
+    };
+    char *keys[HASH_SLOT_KEYS];
+    unsigned long long begin, reference_ns, ns;
+    unsigned int sum = 0;
+
+    /* Known values from the Redis Cluster specification */
+    assert(keyHashSlot("123456789", 9) == (0x31C3 & 0x3FFF));
+    assert(keyHashSlot("{user1000}.following", 20) == keyHashSlot("user1000", 8));
+
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        assert(keyHashSlot(fixed[i], strlen(fixed[i])) ==
+               referenceKeyHashSlot(fixed[i], strlen(fixed[i])));
+    }
+
+    /* Random keys of all lengths, a quarter of them with a hashtag */
+    srand(1);
+    for (int i = 0; i < HASH_SLOT_KEYS; i++) {
+        size_t len = 1 + rand() % 64;
+
+        keys[i] = malloc(len + 1);
+        for (size_t j = 0; j < len; j++) {
+            keys[i][j] = (char) (1 + rand() % 255);
+        }
+        keys[i][len] = '\0';
+
+        if (i % 4 == 0 && len > 4) {
+            keys[i][rand() % (len / 2)] = '{';
+            keys[i][len / 2 + rand() % (len / 2)] = '}';
+        }
+    }
+
+    for (int i = 0; i < HASH_SLOT_KEYS; i++) {
+        assert(keyHashSlot(keys[i], strlen(keys[i])) ==
+               referenceKeyHashSlot(keys[i], strlen(keys[i])));
+    }
+
+    /* Benchmark */
+    begin = nanoseconds();
+    for (int i = 0; i < HASH_SLOT_KEYS; i++) {
+        sum += referenceKeyHashSlot(keys[i], strlen(keys[i]));
+    }
+    reference_ns = nanoseconds() - begin;
+
+    begin = nanoseconds();
+    for (int i = 0; i < HASH_SLOT_KEYS; i++) {
+        sum -= keyHashSlot(keys[i], strlen(keys[i]));
+    }
+    ns = nanoseconds() - begin;
+
+    assert(sum == 0);
+    printf("    keyHashSlot: %llu ns for %d keys, reference: %llu ns\n",
+           ns, HASH_SLOT_KEYS, reference_ns);
+
+    for (int i = 0; i < HASH_SLOT_KEYS; i++) {
+        free(keys[i]);
+    }
+}
+
+static void test_key_hash_slot_argv()
+{
+    const char *same[] = {"cmd", "{tag}a", "value", "{tag}b", "value", "tag", "value"};
+    const char *cross[] = {"cmd", "{tag}a", "{tag}b", "{tag}c", "other"};
+    RedisModuleString **argv;
+    int slot;
+
+    argv = (RedisModuleString **) same;
+    slot = -1;
+    assert(keyHashSlotArgv(argv, 1, 5, 2, &slot));
+    assert(slot == (int) keyHashSlot("tag", 3));
+
+    /* Keys must map to the given slot */
+    slot = (int) keyHashSlot("tag", 3) + 1;
+    assert(!keyHashSlotArgv(argv, 1, 5, 2, &slot));
+
+    /* No keys, slot is unchanged */
+    slot = -1;
+    assert(keyHashSlotArgv(argv, 1, 0, 1, &slot));
+    assert(slot == -1);
+
+    argv = (RedisModuleString **) cross;
+    slot = -1;
+    assert(keyHashSlotArgv(argv, 1, 3, 1, &slot));
+    slot = -1;
+    assert(!keyHashSlotArgv(argv, 1, 4, 1, &slot));
+}
+
 void test_util()
 {
     test_run(test_raftreq_str);
     test_run(test_parse_slots);
     test_run(test_base64_encode);
+    test_run(test_key_hash_slot);
+    test_run(test_key_hash_slot_argv);
+    test_run(test_timer_wheel);
+    test_run(test_latency_histogram);
+    test_run(test_write_trace);
 }